@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Offset/drift estimator for the four-timestamp sync exchange. Keeps the
+// last CLOCK_EST_WINDOW exchanges, uses the fastest quarter of them (their
+// offsets have the least USB queueing asymmetry in them, same idea as the
+// NTP clock filter) and fits offset = a + drift * t by least squares. All
+// integer, register-free so it runs in the host simulation.
+//
+// Times are node ns, offsets are host - node in ns, drift is the rate the
+// offset grows at in ppb (positive: the host clock runs fast of the node).
+
+#define CLOCK_EST_WINDOW 256     // 5.1 s at one exchange per 20 ms
+#define CLOCK_EST_MIN_SAMPLES 8  // before the first estimate
+#define CLOCK_EST_KEEP_DIV 4     // fit the fastest 1/KEEP_DIV of the window
+#define CLOCK_EST_MAX_DELAY_NS 500000 // exchanges slower than this are dropped
+
+typedef struct {
+  int64_t t_ns;      // node time of the exchange, midpoint of t0 and t3
+  int64_t offset_ns; // host - node
+  int32_t delay_ns;  // one way, half the round trip minus host turnaround
+} clock_est_sample_t;
+
+typedef struct {
+  clock_est_sample_t s[CLOCK_EST_WINDOW];
+  uint32_t head;  // next slot
+  uint32_t count; // valid samples
+
+  // results of the last fit, valid once count >= CLOCK_EST_MIN_SAMPLES
+  bool valid;
+  int64_t t_ns;         // time of the newest sample
+  int64_t offset_ns;    // fitted offset at t_ns
+  int32_t drift_ppb;    // fitted slope
+  int32_t jitter_ns;    // rms residual of the samples in the fit
+  int32_t min_delay_ns; // lowest delay in the window
+  uint32_t used;        // samples in the fit
+  uint32_t rejected;    // exchanges dropped for delay
+} clock_est_t;
+
+void clock_est_init(clock_est_t *e);
+
+// Adds one exchange and refits. Returns e->valid.
+bool clock_est_add(clock_est_t *e, int64_t t_ns, int64_t offset_ns,
+                   int64_t delay_ns);
+
+// The node clock rate was changed by delta_ppb (positive: slower) at the
+// newest sample. Rewrites the history as if the new rate had always applied,
+// so the next fit measures the drift under the new rate without waiting for
+// the window to refill.
+void clock_est_rate_step(clock_est_t *e, int32_t delta_ppb);
+
+// Offset extrapolated along the fitted drift
+int64_t clock_est_offset_at(const clock_est_t *e, int64_t t_ns);
@@ -0,0 +1,43 @@
+#pragma once
+#include "jitter_buf.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decoder for the Cmd frames the server sends on the vendor channel: the
+// SYNC_MSG_TYPE_CMD byte, a varint length and a Cmd of messages.proto. It is
+// written for that one schema instead of walking nanopb's field tables, and
+// streams: each MoveCmd is parsed field by field straight into a reserved
+// jitter buffer slot and committed once it is whole. No Cmd struct (three
+// MoveCmds of 24 floats) is built and nothing is copied after the parse.
+
+#define CMD_GLOBAL_AXES 4 // X, Y, Z, E of MoveCmd
+
+typedef struct {
+  uint32_t frames;
+  uint32_t moves;     // committed to the jitter buffer
+  uint32_t rejected;  // moves the jitter buffer refused, full or misordered
+  uint32_t malformed; // frames that didn't parse, what followed was dropped
+  uint32_t config;    // ConfigSystem, SetPID and SetParams payloads
+} cmd_stats_t;
+
+typedef struct {
+  // From ConfigSystem: the motor each of X, Y, Z, E drives, -1 for an axis
+  // on another node. Until one arrives axis i drives motor i.
+  int8_t motor[CMD_GLOBAL_AXES];
+  float timestep; // s
+  // SetPID and SetParams go here, NULL to drop them. Only called with
+  // finite values, SetParams ones all positive: anything else fails the
+  // frame and the old settings stay.
+  void (*set_pid)(int axis, float p, float i, float d, float tf);
+  void (*set_params)(int axis, float phase_r, float phase_l,
+                     float encoder_cpr, float counts_per_mm);
+  cmd_stats_t stats;
+} cmd_decoder_t;
+
+void cmd_decoder_init(cmd_decoder_t *d);
+
+// One frame of len bytes, type byte included, received at scheduler time
+// now_ns: moves go into jb. False if it didn't parse; moves before the bad
+// field are queued all the same.
+bool cmd_decode_frame(cmd_decoder_t *d, jitter_buf_t *jb, const uint8_t *buf,
+                      uint32_t len, uint64_t now_ns);
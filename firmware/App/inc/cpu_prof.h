@@ -0,0 +1,35 @@
+#pragma once
+#include "cycle_counter.h"
+#include "sync_protocol.h"
+#include <stdint.h>
+
+// Where the core's cycles go. Each interrupt handler and main loop task of
+// interest is one SYNC_CPU_* slot; it reads the DWT cycle counter on entry
+// and hands the difference to cpu_prof_end() on the way out, which keeps
+// count, min, max and total and counts runs over the slot's budget (the
+// scheduler tick period for TIM24, a PWM period for the current loop). The
+// host reads the block over a vendor control request, see
+// SYNC_VREQ_CPU_PROF, and host_clock_sync/cpu_prof.c shows it.
+//
+// Every slot has exactly one writer, the handler it times, and is guarded by
+// a sequence count so the reader, which any interrupt can preempt, never
+// sees a half written slot. A reset only bumps an epoch; each slot starts
+// over the next time it runs, so nothing else ever writes into it.
+
+// Starts the cycle counter and the first window
+void cpu_prof_init(uint64_t now_ns);
+
+// Cycles a run of `slot` may take, 0 for no limit. Kept over resets.
+void cpu_prof_set_budget(uint32_t slot, uint32_t cycles);
+
+// One run of `slot` that took `cycles`, from the slot's own context
+void cpu_prof_record(uint32_t slot, uint32_t cycles);
+
+// Thread context only
+void cpu_prof_read(sync_cpu_prof_t *out, uint64_t now_ns);
+void cpu_prof_reset(uint64_t now_ns);
+
+// uint32_t t0 = cycle_count(); ... cpu_prof_end(SYNC_CPU_X, t0);
+static inline void cpu_prof_end(uint32_t slot, uint32_t t0) {
+  cpu_prof_record(slot, cycle_count() - t0);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// TIM1/TIM8 run center-aligned off the 275 MHz APB2 timer clock
+#define PWM_TIM_CLK_HZ 275000000UL
+#define PWM_FREQ_HZ 20000UL
+#define PWM_ARR (PWM_TIM_CLK_HZ / (2 * PWM_FREQ_HZ)) // 6875 counts
+
+#define CURRENT_SENSE_NUM_MOTORS 2
+#define CURRENT_SENSE_CAL_SAMPLES 1024
+
+// One injected sequence, sampled simultaneously by ADC1 (phase A) and ADC2
+// (phase B) at the center of the PWM period. Raw 16 bit counts with the zero
+// current offset already removed.
+typedef struct {
+  int32_t ia[CURRENT_SENSE_NUM_MOTORS];
+  int32_t ib[CURRENT_SENSE_NUM_MOTORS];
+  uint32_t seq; // increments once per PWM period
+} current_sample_t;
+
+typedef void (*current_sense_cb_t)(const current_sample_t *s);
+
+void current_sense_init(void);
+void current_sense_start(void);
+void current_sense_set_callback(current_sense_cb_t cb);
+bool current_sense_calibrated(void);
+uint32_t current_sense_overruns(void);
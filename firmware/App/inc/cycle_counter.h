@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+// Core clock cycle counter. On the target this is DWT CYCCNT, on the host
+// build it is CLOCK_MONOTONIC scaled to the 550 MHz core clock, so host
+// benchmarks come out in roughly comparable units.
+
+#define CYCLE_COUNTER_HZ 550000000UL
+
+#if defined(HOST_BUILD)
+#include <time.h>
+
+static inline void cycle_counter_init(void) {}
+
+static inline uint32_t cycle_count(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  return (uint32_t)(ns * (CYCLE_COUNTER_HZ / 1000000UL) / 1000ULL);
+}
+#else
+#include "stm32h7xx.h"
+
+static inline void cycle_counter_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->LAR = 0xC5ACCE55; // unlock, the M7 DWT ignores writes otherwise
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cycle_count(void) { return DWT->CYCCNT; }
+#endif
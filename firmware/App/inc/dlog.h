@@ -0,0 +1,118 @@
+#pragma once
+#include <stdint.h>
+
+// Deferred binary logging. DLOG() stores the format string in the dlog_fmt
+// section (not loaded on the target) and writes only a small record to RTT
+// up-buffer DLOG_RTT_CHANNEL:
+//
+//   u16 fmt    offset of the format string in dlog_fmt
+//   u8  len    bytes of arguments that follow the header
+//   u8  seq    increments per record, gaps mean dropped records
+//   u32 cycles cycle counter at the time of the call
+//   args       4 bytes per integer/pointer sized argument, 8 bytes for
+//              64 bit integers and for floating point (stored as double)
+//
+// Only the values go into the record, so there is no %s: a char * argument
+// is a compile error. %p logs the address.
+//
+// tools/dlog_decode.py turns a dump of that channel plus the ELF back into
+// text. Safe from any interrupt, a full buffer drops the record.
+//
+//   DLOG("offset: %lld delay: %lld\n", offset_ns, delay_ns);
+
+#define DLOG_RTT_CHANNEL 1
+#define DLOG_BUFFER_SIZE 4096
+#define DLOG_MAX_ARG_BYTES 64
+
+typedef struct {
+  uint16_t fmt;
+  uint8_t len;
+  uint8_t seq;
+  uint32_t cycles;
+  uint8_t args[DLOG_MAX_ARG_BYTES];
+} dlog_rec_t;
+
+extern const char __start_dlog_fmt[];
+
+void dlog_init(void);
+void dlog_begin(dlog_rec_t *r, const char *fmt);
+void dlog_commit(dlog_rec_t *r);
+uint32_t dlog_dropped(void);
+
+static inline void dlog_put_u32(dlog_rec_t *r, uint32_t v) {
+  if (r->len + 4 <= DLOG_MAX_ARG_BYTES) {
+    __builtin_memcpy(&r->args[r->len], &v, 4);
+    r->len += 4;
+  }
+}
+
+static inline void dlog_put_u64(dlog_rec_t *r, uint64_t v) {
+  if (r->len + 8 <= DLOG_MAX_ARG_BYTES) {
+    __builtin_memcpy(&r->args[r->len], &v, 8);
+    r->len += 8;
+  }
+}
+
+static inline void dlog_put_f64(dlog_rec_t *r, double v) {
+  uint64_t u;
+  __builtin_memcpy(&u, &v, 8);
+  dlog_put_u64(r, u);
+}
+
+// long is 32 bit on the target and 64 bit in the host build
+static inline void dlog_put_long(dlog_rec_t *r, unsigned long v) {
+  if (sizeof(long) == 8)
+    dlog_put_u64(r, v);
+  else
+    dlog_put_u32(r, (uint32_t)v);
+}
+
+static inline void dlog_put_ptr(dlog_rec_t *r, const void *v) {
+  dlog_put_u32(r, (uint32_t)(uintptr_t)v);
+}
+
+// Never defined: the record would only hold the address and the text isn't
+// anywhere the decoder reads
+void dlog_put_str(dlog_rec_t *r, const char *s) __attribute__((
+    error("DLOG can't log a string, only its address: put the text in the "
+          "format or cast to void * for %p")));
+
+#define DLOG_PUT(r, x)                                                         \
+  _Generic((x),                                                                \
+      float: dlog_put_f64,                                                     \
+      double: dlog_put_f64,                                                    \
+      long long: dlog_put_u64,                                                 \
+      unsigned long long: dlog_put_u64,                                        \
+      long: dlog_put_long,                                                     \
+      unsigned long: dlog_put_long,                                            \
+      void *: dlog_put_ptr,                                                    \
+      const void *: dlog_put_ptr,                                              \
+      char *: dlog_put_str,                                                    \
+      const char *: dlog_put_str,                                              \
+      default: dlog_put_u32)(r, x)
+
+// Argument counting/dispatch for up to 8 arguments
+#define DLOG_NARG_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define DLOG_NARG(...)                                                         \
+  DLOG_NARG_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_ARGS_0(r, ...)
+#define DLOG_ARGS_1(r, a) DLOG_PUT(r, a);
+#define DLOG_ARGS_2(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_1(r, __VA_ARGS__)
+#define DLOG_ARGS_3(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_2(r, __VA_ARGS__)
+#define DLOG_ARGS_4(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_3(r, __VA_ARGS__)
+#define DLOG_ARGS_5(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_4(r, __VA_ARGS__)
+#define DLOG_ARGS_6(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_5(r, __VA_ARGS__)
+#define DLOG_ARGS_7(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_6(r, __VA_ARGS__)
+#define DLOG_ARGS_8(r, a, ...) DLOG_PUT(r, a); DLOG_ARGS_7(r, __VA_ARGS__)
+
+#define DLOG(fmt, ...)                                                         \
+  do {                                                                         \
+    static const char dlog_fmt_[]                                              \
+        __attribute__((section("dlog_fmt"), used)) = fmt;                      \
+    dlog_rec_t dlog_r_;                                                        \
+    dlog_begin(&dlog_r_, dlog_fmt_);                                           \
+    DLOG_CAT(DLOG_ARGS_, DLOG_NARG(__VA_ARGS__))(&dlog_r_, ##__VA_ARGS__)      \
+    dlog_commit(&dlog_r_);                                                     \
+  } while (0)
@@ -0,0 +1,26 @@
+#pragma once
+
+// Buffers a DMA master reads or writes behind the core's back: the USB OTG
+// HS internal DMA, and any peripheral DMA added later. They live in D2 SRAM
+// (RAM_D2, 32K at 0x30000000), which MPU_Config() maps as normal
+// non-cacheable memory, so neither side ever sees a stale cache line and the
+// drivers skip clean/invalidate for them. TinyUSB puts its endpoint buffers
+// there through CFG_TUSB_MEM_SECTION and knows the region is uncached from
+// CFG_DWC2_MEM_UNCACHED_REGIONS, both in tusb_config.h.
+//
+// DTCM, where everything else lives, isn't cached either, but the USB DMA
+// can't reach it. Core accesses to the region are uncached and slower than
+// DTCM; keep CPU-side work on copies elsewhere.
+//
+// The section is cleared by the startup code like .bss. 32 byte alignment
+// keeps buffers on their own cache lines should the region ever be made
+// cacheable again.
+
+#define DMA_BUF_BASE 0x30000000UL
+#define DMA_BUF_SIZE (32UL * 1024)
+
+#if defined(HOST_BUILD)
+#define DMA_BUF
+#else
+#define DMA_BUF __attribute__((section(".dma_buf"), aligned(32)))
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Quadrature position and velocity for one axis, updated from the current
+// loop; motor.c takes the snapshot.
+//
+// Position: the 16 bit timer count extended by its signed change every
+// update, never wraps as long as the count moves less than 32767 per update
+// (that's 650 M counts/s at the 20 kHz loop).
+//
+// Velocity, mixed M/T: the encoder timer captures its count on every
+// ENCx_A rising edge and a free running timer stamps the same edge, so each
+// update has the count and time of the last edge. The rate is the counts
+// between the last two edges seen over the time between them, exact to one
+// timestamp tick whether that's 4 counts over 100 ms or 50 counts over
+// one loop period. While no new edge comes in the estimate is held down to
+// what one more edge would have needed, and after ENCODER_STALE_DIV of a
+// second it reads zero. Integer only: one 32 bit divide per new edge.
+
+#define ENCODER_VEL_FRAC 8     // velocity is counts/s in Q8
+#define ENCODER_EDGE_COUNTS 4  // counts per A period at x4 decoding
+#define ENCODER_STALE_DIV 10   // no edge for 1/10 s reads as standing still
+
+// One snapshot of the hardware, edge_cnt/edge_t from the same edge
+typedef struct {
+  uint16_t cnt;      // counter now
+  uint16_t edge_cnt; // counter captured at the last edge
+  uint32_t edge_t;   // timestamp of the last edge
+  uint32_t now_t;    // timestamp now
+} encoder_sample_t;
+
+typedef struct {
+  int64_t pos;       // counts since encoder_init
+  int32_t vel;       // counts/s, Q ENCODER_VEL_FRAC
+  uint16_t cnt;      // counter at the last update
+  uint32_t edge_t;   // reference edge, the start of the next window
+  int64_t edge_pos;
+  bool edge_valid;   // false until an edge came in since init or a stop
+  uint32_t ts_num;   // timestamp Hz << ts_shift, just below 2^32
+  int ts_shift;
+  uint32_t stale_ticks;
+  uint32_t edges;    // windows measured
+} encoder_t;
+
+// ts_hz is the timestamp clock; s the hardware as it is now, its latched
+// edge is taken as old
+void encoder_init(encoder_t *e, uint32_t ts_hz, const encoder_sample_t *s);
+void encoder_update(encoder_t *e, const encoder_sample_t *s);
+// counts/s
+float encoder_velocity(const encoder_t *e);
@@ -1,14 +1,17 @@
-/* fifo.h — interrupt-safe ring buffer for embedded systems
+/* fifo.h — ring buffer for passing data between an ISR and the foreground
  *
- * Usage:
- *   #define FIFO_USE_BASEPRI  // (optional) on Cortex-M; otherwise PRIMASK is
- * used #include "fifo.h"
+ * Single producer / single consumer and lock-free by default: only the
+ * producer moves head, only the consumer moves tail, so neither side ever
+ * masks interrupts. Define FIFO_MULTI before including to wrap every
+ * operation in a PRIMASK (or FIFO_USE_BASEPRI) critical section instead,
+ * for rings with more than one producer or consumer.
  *
+ * Usage:
  *   #define CAP 128
  *   static uint8_t rx_storage[CAP];
  *   static fifo_t rx;
  *   void init(void) {
- *     fifo_init(&rx, rx_storage, CAP);   // CAP may be any >= 2
+ *     fifo_init(&rx, rx_storage, CAP, NULL);   // CAP may be any >= 2
  *   }
  *
  *   // ISR (producer)
@@ -22,6 +25,15 @@
  *     uint8_t b;
  *     return fifo_pop(&rx, &b) ? b : -1; // -1 if empty
  *   }
+ *
+ * Typed rings hold fixed size elements, counts are then in elements:
+ *   static setpoint_t sp_storage[DEPTH + 1];
+ *   fifo_init_elem(&sp_ring, sp_storage, DEPTH + 1, sizeof(setpoint_t), NULL);
+ *   fifo_write(&sp_ring, &sp, 1);
+ *
+ * Zero-copy: fifo_reserve()/fifo_commit() hand the producer the contiguous
+ * free span at head, fifo_peek()/fifo_consume() the consumer the contiguous
+ * filled span at tail. A wrapped ring needs two rounds to reach everything.
  */
 
 #ifndef FIFO_H_
@@ -31,16 +43,29 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-/* --------- Memory barrier (visibility between IRQ contexts) ---------- */
-#if defined(__GNUC__) || defined(__clang__)
+/* --------- Memory barriers (visibility between IRQ contexts) ---------
+ * FIFO_DMB orders the data before an index is published. FIFO_ACQUIRE
+ * orders the read of the other side's index before touching the data; on a
+ * single Cortex-M core an interrupt sees program order, so only the compiler
+ * needs holding back.
+ */
+#if defined(__arm__) && (defined(__GNUC__) || defined(__clang__))
 #define FIFO_DMB() __asm__ __volatile__("dmb ish" ::: "memory")
+#define FIFO_ACQUIRE() __asm__ __volatile__("" ::: "memory")
+#elif defined(__GNUC__) || defined(__clang__)
+/* Host build: the producer and consumer are threads, not IRQ contexts */
+#define FIFO_DMB() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define FIFO_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
 #else
 #define FIFO_DMB()                                                             \
   do { /* platform-specific barrier */                                         \
   } while (0)
+#define FIFO_ACQUIRE() FIFO_DMB()
 #endif
 
+#if defined(FIFO_MULTI)
 /* --------- Critical section primitives (configurable) -----------------
  * Choose one:
  *   - FIFO_USE_BASEPRI: mask only <= BASEPRI interrupts (Cortex-M3+)
@@ -49,7 +74,26 @@
  */
 #if !defined(FIFO_CS_ENTER) || !defined(FIFO_CS_EXIT)
 
-#if defined(FIFO_USE_BASEPRI)
+#if !defined(__arm__)
+/* Host build: no interrupt masking, a spinlock stands in for PRIMASK. One
+ * lock per translation unit, which is enough for the host tests. Yield while
+ * spinning so a preempted holder can finish on a single core. */
+#include <sched.h>
+static volatile uint8_t fifo_host_lock_;
+static inline uint32_t fifo_cs_enter_(void) {
+  while (__atomic_test_and_set(&fifo_host_lock_, __ATOMIC_ACQUIRE))
+    sched_yield();
+  return 0;
+}
+static inline void fifo_cs_exit_(uint32_t token) {
+  (void)token;
+  __atomic_clear(&fifo_host_lock_, __ATOMIC_RELEASE);
+}
+#define FIFO_CS_STATE uint32_t __fifo_cs_token
+#define FIFO_CS_ENTER() (__fifo_cs_token = fifo_cs_enter_())
+#define FIFO_CS_EXIT() (fifo_cs_exit_(__fifo_cs_token))
+
+#elif defined(FIFO_USE_BASEPRI)
 /* BASEPRI critical section (keeps higher-priority IRQs running).
  * Define FIFO_BASEPRI_LEVEL to your system's desired mask level (0-255, shifted
  * by 3 in HW). Example: 0x40 masks priorities numerically >= 0x40 (lower
@@ -98,12 +142,27 @@ static inline void fifo_cs_exit_(uint32_t primask) {
 
 #endif /* !defined(FIFO_CS_ENTER) || !defined(FIFO_CS_EXIT) */
 
+#define FIFO_LOCK()                                                            \
+  FIFO_CS_STATE;                                                               \
+  FIFO_CS_ENTER()
+#define FIFO_UNLOCK() FIFO_CS_EXIT()
+
+#else
+#define FIFO_LOCK()                                                            \
+  do {                                                                         \
+  } while (0)
+#define FIFO_UNLOCK()                                                          \
+  do {                                                                         \
+  } while (0)
+#endif /* FIFO_MULTI */
+
 /* ----------------------- FIFO structure ------------------------------ */
 typedef struct {
-  uint8_t *buf;         /* external storage */
-  size_t cap;           /* capacity (number of bytes) */
-  volatile size_t head; /* next write index */
-  volatile size_t tail; /* next read index  */
+  uint8_t *buf;         /* external storage, cap * elem bytes */
+  size_t cap;           /* capacity in elements, one slot is kept free */
+  size_t elem;          /* element size in bytes, 1 for byte fifos */
+  volatile size_t head; /* next write index, only moved by the producer */
+  volatile size_t tail; /* next read index, only moved by the consumer */
   /* Optional: set mask = cap-1 for power-of-two fast wrap; else 0 */
   size_t mask;
   void (*error_callback)();
@@ -114,162 +173,206 @@ static inline bool is_pow2_(size_t x) { return (x & (x - 1u)) == 0u; }
 static inline size_t wrap_(size_t idx, size_t cap, size_t mask) {
   return mask ? (idx & mask) : (idx >= cap ? idx - cap : idx);
 }
+static inline size_t fifo_used_(size_t head, size_t tail, size_t cap) {
+  return (head >= tail) ? (head - tail) : (cap - (tail - head));
+}
+static inline size_t fifo_min_(size_t a, size_t b) { return a < b ? a : b; }
+
+/* Short copies go word by word in line. A variable length memcpy is a call
+ * into newlib on the target and a rep movs on the host, either of which
+ * costs more to start than an 8 byte copy takes; a fixed size memcpy is a
+ * plain (unaligned) load and store. */
+#ifndef FIFO_SMALL_COPY
+#define FIFO_SMALL_COPY 32u
+#endif
+static inline void fifo_copy_(void *dst, const void *src, size_t n) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (n > FIFO_SMALL_COPY) {
+#if defined(__GNUC__) || defined(__clang__)
+    /* elem isn't known where this is inlined: without the bound gcc would
+     * take this branch for one element read into a small local */
+    __asm__("" : "+r"(n));
+#endif
+    memcpy(d, s, n);
+    return;
+  }
+  for (; n >= 4u; n -= 4u, d += 4, s += 4)
+    memcpy(d, s, 4u);
+  if (n & 2u) {
+    memcpy(d, s, 2u);
+    d += 2;
+    s += 2;
+  }
+  if (n & 1u)
+    *d = *s;
+}
 
 /* ----------------------- API ----------------------------------------- */
-static inline void fifo_init(fifo_t *f, uint8_t *storage, size_t capacity,
-                             void (*error_callback)()) {
-  f->buf = storage;
+static inline void fifo_init_elem(fifo_t *f, void *storage, size_t capacity,
+                                  size_t elem_size,
+                                  void (*error_callback)()) {
+  f->buf = (uint8_t *)storage;
   f->cap = capacity;
+  f->elem = elem_size;
   f->head = 0u;
   f->tail = 0u;
   f->mask = is_pow2_(capacity) ? (capacity - 1u) : 0u;
   f->error_callback = error_callback;
 }
 
+static inline void fifo_init(fifo_t *f, uint8_t *storage, size_t capacity,
+                             void (*error_callback)()) {
+  fifo_init_elem(f, storage, capacity, 1u, error_callback);
+}
+
+/* Only safe while neither side is running */
 static inline void fifo_reset(fifo_t *f) {
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
+  FIFO_LOCK();
   f->head = f->tail = 0u;
-  FIFO_CS_EXIT();
+  FIFO_UNLOCK();
 }
 
 static inline size_t fifo_capacity(const fifo_t *f) { return f->cap; }
 
-/* Size must be computed atomically w.r.t. concurrent head/tail updates. */
+/* A snapshot: from the producer it can only shrink behind its back, from
+ * the consumer it can only grow, so either side may act on it. */
 static inline size_t fifo_size(const fifo_t *f) {
-  size_t h, t;
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
-  h = f->head;
-  t = f->tail;
-  FIFO_CS_EXIT();
-  return (h >= t) ? (h - t) : (f->cap - (t - h));
+  size_t n;
+  FIFO_LOCK();
+  n = fifo_used_(f->head, f->tail, f->cap);
+  FIFO_UNLOCK();
+  return n;
+}
+
+static inline size_t fifo_free(const fifo_t *f) {
+  return f->cap - 1u - fifo_size(f);
 }
 
 static inline bool fifo_is_empty(const fifo_t *f) {
-  bool empty;
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
-  empty = (f->head == f->tail);
-  FIFO_CS_EXIT();
-  return empty;
+  return f->head == f->tail;
 }
 
 static inline bool fifo_is_full(const fifo_t *f) {
-  bool full;
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
-  size_t next = wrap_(f->head + 1u, f->cap, f->mask);
-  full = (next == f->tail);
-  FIFO_CS_EXIT();
-  return full;
+  return wrap_(f->head + 1u, f->cap, f->mask) == f->tail;
 }
 
-/* Push a single byte. Returns false if full (byte not written). */
+/* Push a single byte. Returns false if full (byte not written), or if f
+ * is a typed ring: one byte would be a fraction of an element. */
 static inline bool fifo_push(fifo_t *f, uint8_t byte) {
-#if defined(FIFO_SPSC)
-  size_t next = wrap_(f->head + 1u, f->cap, f->mask);
-  if (next == f->tail)
-    return false; /* full */
-  f->buf[f->head] = byte;
-  FIFO_DMB(); /* ensure data visible before head move */
-  f->head = next;
-  return true;
-#else
   bool ok = false;
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
-  size_t next = wrap_(f->head + 1u, f->cap, f->mask);
+  if (f->elem != 1u)
+    return false;
+  FIFO_LOCK();
+  size_t head = f->head;
+  size_t next = wrap_(head + 1u, f->cap, f->mask);
   if (next != f->tail) {
-    f->buf[f->head] = byte;
-    FIFO_DMB();
+    FIFO_ACQUIRE(); /* tail read before the slot is reused */
+    f->buf[head] = byte;
+    FIFO_DMB(); /* data visible before head moves */
     f->head = next;
     ok = true;
-  } else {
+  } else if (f->error_callback) {
     f->error_callback();
   }
-  FIFO_CS_EXIT();
+  FIFO_UNLOCK();
   return ok;
-#endif
 }
 
-/* Pop a single byte. Returns false if empty. */
+/* Pop a single byte. Returns false if empty, or if f is a typed ring. */
 static inline bool fifo_pop(fifo_t *f, uint8_t *out) {
-#if defined(FIFO_SPSC)
-  if (f->head == f->tail)
-    return false; /* empty */
-  *out = f->buf[f->tail];
-  FIFO_DMB(); /* ensure data read before tail move */
-  f->tail = wrap_(f->tail + 1u, f->cap, f->mask);
-  return true;
-#else
   bool ok = false;
-  FIFO_CS_STATE;
-  FIFO_CS_ENTER();
-  if (f->head != f->tail) {
-    *out = f->buf[f->tail];
-    FIFO_DMB();
-    f->tail = wrap_(f->tail + 1u, f->cap, f->mask);
+  if (f->elem != 1u)
+    return false;
+  FIFO_LOCK();
+  size_t tail = f->tail;
+  if (f->head != tail) {
+    FIFO_ACQUIRE(); /* head read before the data */
+    *out = f->buf[tail];
+    FIFO_DMB(); /* data read before tail moves */
+    f->tail = wrap_(tail + 1u, f->cap, f->mask);
     ok = true;
   }
-  FIFO_CS_EXIT();
+  FIFO_UNLOCK();
   return ok;
-#endif
 }
 
-/* Write up to len bytes; returns number actually written. */
-static inline size_t fifo_write(fifo_t *f, const uint8_t *src, size_t len) {
-  size_t n = 0;
-  while (n < len) {
-    /* Optionally batch inside one CS for better throughput. */
-    FIFO_CS_STATE;
-    FIFO_CS_ENTER();
-    size_t head = f->head, tail = f->tail, cap = f->cap, mask = f->mask;
-    size_t space =
-        (tail > head) ? (tail - head - 1u) : (cap - (head - tail) - 1u);
-    size_t chunk = (len - n < space) ? (len - n) : space;
-    /* First contiguous segment to end of buffer */
-    size_t to_end = mask ? ((cap - (head & mask)) & mask) + 1u : (cap - head);
-    if (chunk > to_end)
-      chunk = to_end;
-    for (size_t i = 0; i < chunk; ++i)
-      f->buf[wrap_(head + i, cap, mask)] = src[n + i];
-    FIFO_DMB();
-    f->head = wrap_(head + chunk, cap, mask);
-    FIFO_CS_EXIT();
-
-    if (chunk == 0) {
-      f->error_callback();
-      break; /* full */
-    }
-    n += chunk;
-  }
+/* Write up to n elements; returns the number actually written. At most two
+ * memcpy, one up to the end of storage and one from the start. */
+static inline size_t fifo_write(fifo_t *f, const void *src, size_t n) {
+  FIFO_LOCK();
+  size_t head = f->head, cap = f->cap, elem = f->elem;
+  size_t count = fifo_min_(n, cap - 1u - fifo_used_(head, f->tail, cap));
+  FIFO_ACQUIRE();
+  size_t first = fifo_min_(count, cap - head);
+  fifo_copy_(f->buf + head * elem, src, first * elem);
+  if (count > first)
+    fifo_copy_(f->buf, (const uint8_t *)src + first * elem,
+               (count - first) * elem);
+  FIFO_DMB();
+  f->head = wrap_(head + count, cap, f->mask);
+  FIFO_UNLOCK();
+
+  if (count < n && f->error_callback)
+    f->error_callback(); /* full */
+  return count;
+}
+
+/* Read up to n elements; returns the number actually read. */
+static inline size_t fifo_read(fifo_t *f, void *dst, size_t n) {
+  FIFO_LOCK();
+  size_t tail = f->tail, cap = f->cap, elem = f->elem;
+  size_t count = fifo_min_(n, fifo_used_(f->head, tail, cap));
+  FIFO_ACQUIRE();
+  size_t first = fifo_min_(count, cap - tail);
+  fifo_copy_(dst, f->buf + tail * elem, first * elem);
+  if (count > first)
+    fifo_copy_((uint8_t *)dst + first * elem, f->buf, (count - first) * elem);
+  FIFO_DMB();
+  f->tail = wrap_(tail + count, cap, f->mask);
+  FIFO_UNLOCK();
+  return count;
+}
+
+/* Contiguous free span at head; returns its length in elements and points
+ * *span at it. Nothing is visible to the consumer until fifo_commit(). With
+ * FIFO_MULTI one producer still has to own the span until it commits. */
+static inline size_t fifo_reserve(fifo_t *f, void **span) {
+  FIFO_LOCK();
+  size_t head = f->head, cap = f->cap;
+  size_t n = fifo_min_(cap - 1u - fifo_used_(head, f->tail, cap), cap - head);
+  FIFO_UNLOCK();
+  FIFO_ACQUIRE();
+  *span = f->buf + head * f->elem;
   return n;
 }
 
-/* Read up to len bytes; returns number actually read. */
-static inline size_t fifo_read(fifo_t *f, uint8_t *dst, size_t len) {
-  size_t n = 0;
-  while (n < len) {
-    FIFO_CS_STATE;
-    FIFO_CS_ENTER();
-    size_t head = f->head, tail = f->tail, cap = f->cap, mask = f->mask;
-    size_t avail = (head >= tail) ? (head - tail) : (cap - (tail - head));
-    size_t chunk = (len - n < avail) ? (len - n) : avail;
-    size_t to_end = mask ? ((cap - (tail & mask)) & mask) + 1u : (cap - tail);
-    if (chunk > to_end)
-      chunk = to_end;
-    for (size_t i = 0; i < chunk; ++i)
-      dst[n + i] = f->buf[wrap_(tail + i, cap, mask)];
-    FIFO_DMB();
-    f->tail = wrap_(tail + chunk, cap, mask);
-    FIFO_CS_EXIT();
-
-    if (chunk == 0)
-      break; /* empty */
-    n += chunk;
-  }
+/* Publish n elements written into the span from fifo_reserve() */
+static inline void fifo_commit(fifo_t *f, size_t n) {
+  FIFO_DMB();
+  FIFO_LOCK();
+  f->head = wrap_(f->head + n, f->cap, f->mask);
+  FIFO_UNLOCK();
+}
+
+/* Contiguous filled span at tail; returns its length in elements. The data
+ * stays in the ring until fifo_consume(). */
+static inline size_t fifo_peek(fifo_t *f, const void **span) {
+  FIFO_LOCK();
+  size_t tail = f->tail;
+  size_t n = fifo_min_(fifo_used_(f->head, tail, f->cap), f->cap - tail);
+  FIFO_UNLOCK();
+  FIFO_ACQUIRE();
+  *span = f->buf + tail * f->elem;
   return n;
 }
 
+/* Release n elements from the span returned by fifo_peek() */
+static inline void fifo_consume(fifo_t *f, size_t n) {
+  FIFO_DMB();
+  FIFO_LOCK();
+  f->tail = wrap_(f->tail + n, f->cap, f->mask);
+  FIFO_UNLOCK();
+}
+
 #endif /* FIFO_H_ */
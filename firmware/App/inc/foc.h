@@ -0,0 +1,61 @@
+#pragma once
+#include "arm_math.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Field oriented current loop. Pure math on top of CMSIS-DSP, no register
+// access, so the same code runs in the ADC interrupt and in the host tests.
+
+typedef struct {
+  float phase_r;     // ohm, phase to neutral
+  float phase_l;     // henry, phase to neutral
+  float pole_pairs;  //
+  float encoder_cpr; // counts per mechanical revolution (x4 decoded)
+  float vbus;        // volts
+  float ts;          // current loop period in seconds
+} foc_params_t;
+
+typedef struct {
+  foc_params_t p;
+  arm_pid_instance_f32 pid_d;
+  arm_pid_instance_f32 pid_q;
+  float v_max; // largest vd/vq magnitude SVPWM can produce without clipping
+
+  float id_ref, iq_ref; // amps
+  float id, iq;         // last measurement, amps
+  float vd, vq;         // last output, volts
+  float theta_e;        // electrical angle used for the last step, rad
+
+  int32_t enc_offset; // encoder count at electrical angle zero, mod cpr
+  int64_t enc_pos;    // position at the last step
+  int32_t enc_mod;    // enc_pos mod cpr, 0..cpr-1
+  bool enc_valid;     // enc_mod follows enc_pos, false until the first step
+  int32_t align_left; // periods left in the alignment sequence
+  float align_current;
+
+  float duty[3]; // phase duty cycles, 0..1
+  bool enabled;
+} foc_t;
+
+void foc_init(foc_t *f, const foc_params_t *p);
+// PI gains in V/A and V/(A*s), continuous time
+void foc_set_gains(foc_t *f, float kp, float ki);
+// Pole-zero cancellation from phase R/L, bandwidth in rad/s
+void foc_tune_bandwidth(foc_t *f, float bw_rad_s);
+void foc_set_current(foc_t *f, float id_ref, float iq_ref);
+void foc_enable(foc_t *f, bool en);
+// Lock the rotor onto electrical zero with a d-axis current, then take the
+// encoder count at the end of it as the offset
+void foc_align(foc_t *f, float current, int32_t periods);
+bool foc_aligning(const foc_t *f);
+// A whole count of at least 1, small enough that a float holds every count
+// up to it exactly; foc_step divides by it
+#define FOC_MAX_ENCODER_CPR 16777216.0f
+bool foc_encoder_cpr_valid(float encoder_cpr);
+// Takes the offset modulo the new count, the next step reduces the position
+// from scratch
+void foc_set_encoder_cpr(foc_t *f, float encoder_cpr);
+
+// One control period: phase currents in amps, encoder position in counts
+// since init, any value. Result is left in f->duty.
+void foc_step(foc_t *f, float ia, float ib, int64_t enc_pos);
@@ -0,0 +1,75 @@
+#pragma once
+#include "fifo.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Jitter buffer for timestamped setpoints. The host stamps every sample with
+// the scheduler time it has to run at (the clock sched_servo keeps locked to
+// the host), USB pushes them in whenever they arrive and the scheduler tick
+// releases each one on the tick nearest its time. USB timing then only shows
+// up as slack, not in the motion, and the buffer only has to cover the worst
+// arrival jitter instead of a guessed number of samples.
+//
+// Elements are fixed size and must start with their uint64_t target time in
+// ns. Single producer, single consumer on a lock-free fifo: push from the USB
+// side, release from the tick.
+
+typedef struct {
+  uint32_t released;   // samples handed to the tick
+  uint32_t late;       // samples whose tick had already passed
+  uint32_t skipped;    // late samples overtaken by a newer due one
+  uint32_t overflows;  // pushes rejected, buffer full
+  uint32_t misordered; // pushes rejected, time not after the last one
+  uint32_t waits;      // ticks with samples buffered but none due yet
+  uint32_t empty;      // ticks with nothing buffered
+} jitter_buf_stats_t;
+
+typedef struct {
+  fifo_t ring;
+  uint32_t tick_ns;
+
+  // producer side
+  uint64_t last_t_ns;   // newest target time pushed
+  int64_t slack_min_ns; // least lead over the clock since the last take
+  void *reserved;       // slot from jitter_buf_reserve, not committed yet
+
+  // overflows and misordered count on the producer side, the rest on the
+  // consumer side
+  jitter_buf_stats_t stats;
+} jitter_buf_t;
+
+typedef enum {
+  JITTER_RELEASED, // *out holds the sample for this tick
+  JITTER_WAIT,     // next sample is for a later tick
+  JITTER_EMPTY,
+} jitter_buf_result_t;
+
+// storage holds depth + 1 elements of elem_size
+void jitter_buf_init(jitter_buf_t *jb, void *storage, uint32_t depth,
+                     uint32_t elem_size, uint32_t tick_ns);
+
+// Drops everything buffered, e.g. when the host restarts the clock
+void jitter_buf_flush(jitter_buf_t *jb);
+
+// Producer: queue a sample at clock time now_ns. False if it was rejected.
+bool jitter_buf_push(jitter_buf_t *jb, const void *elem, uint64_t now_ns);
+
+// Producer, zero-copy: the slot at the head to fill in place, NULL if the
+// buffer is full (counted as an overflow). Nothing is queued until
+// jitter_buf_commit(); reserving again without committing hands out the
+// same slot.
+void *jitter_buf_reserve(jitter_buf_t *jb);
+
+// Producer: queue the reserved slot as push would at clock time now_ns.
+// False if it was rejected, the slot is then reused by the next reserve.
+bool jitter_buf_commit(jitter_buf_t *jb, uint64_t now_ns);
+
+// Producer: least slack since the last call (INT64_MAX if nothing was
+// pushed), negative when a sample came in after its time
+int64_t jitter_buf_take_slack(jitter_buf_t *jb);
+
+// Consumer, once per scheduler tick at clock time now_ns. Samples within half
+// a tick of now_ns are due; of several due ones the newest wins, the rest
+// count as skipped.
+jitter_buf_result_t jitter_buf_release(jitter_buf_t *jb, uint64_t now_ns,
+                                       void *out);
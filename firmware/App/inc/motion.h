@@ -0,0 +1,56 @@
+#pragma once
+#include "cmd_decode.h"
+#include "jitter_buf.h"
+#include "motor.h"
+#include "pos_ctrl.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MOTION_NUM_AXES MOTOR_COUNT
+#define MOTION_RING_DEPTH 64 // setpoints in the jitter buffer
+#define MOTION_TICK_NS 1000000
+
+// One scheduler tick worth of setpoints, axis i drives motor i
+typedef struct {
+  uint64_t t_ns; // scheduler time to run at, first for jitter_buf
+  uint32_t seq;  // host sample number, acked back in the sync stats
+  axis_setpoint_t axis[MOTION_NUM_AXES];
+} motion_setpoint_t;
+
+typedef struct {
+  uint32_t underruns; // ticks with no setpoint due, position held
+  jitter_buf_stats_t jb;
+  float max_err[MOTION_NUM_AXES]; // largest following error seen, mm
+  uint32_t ack; // seq + 1 of the last setpoint released, 0 for none
+  cmd_stats_t cmd;
+} motion_stats_t;
+
+void motion_init(void);
+// Producer side of the jitter buffer (USB), now_ns is scheduler time at
+// arrival. False if the setpoint was rejected.
+bool motion_push(const motion_setpoint_t *sp, uint64_t now_ns);
+// A Cmd frame off the vendor channel, type byte included: moves go into the
+// jitter buffer in place, SetPID/SetParams/ConfigSystem are applied. False
+// if it didn't parse.
+bool motion_rx_cmd(const uint8_t *buf, uint32_t len, uint64_t now_ns);
+uint32_t motion_ring_free(void);
+// Least slack of the setpoints pushed since the last call, INT64_MAX if none
+int64_t motion_take_slack_ns(void);
+// Drop everything buffered, the host restarted the clock
+void motion_flush(void);
+// Scheduler tick at scheduler time now_ns: release the setpoint due on this
+// tick and run the position/velocity loops
+void motion_tick(uint64_t now_ns);
+// Starts or stops the loops. Starting switches the gates on, aligns each
+// motor the first time, then holds the position the axes settled at until a
+// setpoint comes due. Stopping switches the gates off. No-op if already in
+// that state.
+void motion_enable(bool en);
+// SetPID / SetParams
+void motion_set_pid(int axis, float p, float i, float d, float tf);
+void motion_set_params(int axis, float phase_r, float phase_l,
+                       float encoder_cpr, float counts_per_mm);
+void motion_set_feedforward(bool vel, bool acc, bool jerk);
+// Moving mass and current loop lag, A/(mm/s^2) and A/(mm/s^3)
+void motion_set_ff_gains(int axis, float ka, float kj);
+void motion_stats(motion_stats_t *out);
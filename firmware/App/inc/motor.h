@@ -0,0 +1,37 @@
+#pragma once
+#include "current_sense.h"
+#include "foc.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MOTOR_COUNT CURRENT_SENSE_NUM_MOTORS
+
+// Phase current scale: 16 bit ADC on 3.3 V, shunt amplifier at 10 A/V
+#define MOTOR_AMPS_PER_COUNT (3.3f / 65536.0f * 10.0f)
+#define MOTOR_VBUS 24.0f
+#define MOTOR_CURRENT_BW_RAD_S (2.0f * PI * 1000.0f)
+
+typedef struct {
+  uint32_t last; // CPU cycles spent in the last current loop update
+  uint32_t min;
+  uint32_t max;
+  uint32_t count;
+} motor_cycle_stats_t;
+
+// Registers the current loop on the current sense interrupt and starts the
+// encoder timers. Gate drivers stay disabled until motor_enable.
+void motor_init(void);
+// Values from SetParams; re-tunes the current loop from R/L. Ignored when
+// encoder_cpr isn't foc_encoder_cpr_valid.
+void motor_set_params(int m, float phase_r, float phase_l, float encoder_cpr);
+void motor_set_current(int m, float id, float iq);
+// Needs the axis enabled, the alignment current goes through the bridge
+void motor_align(int m, float current);
+bool motor_aligning(int m);
+void motor_enable(int m, bool en);
+// Encoder counts since motor_init, 64 bit so it never wraps
+int64_t motor_position(int m);
+// counts/s, M/T estimate from the edge timestamps (encoder.h)
+float motor_velocity(int m);
+foc_t *motor_foc(int m);
+void motor_cycle_stats(motor_cycle_stats_t *out);
@@ -3,4 +3,6 @@
 
 void tim5_init(void);
 uint64_t node_time_now_ns(void);
+// TIM5 since boot, never zeroed
+uint64_t node_time_raw_ns(void);
 void zero_clock();
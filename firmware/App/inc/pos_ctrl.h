@@ -0,0 +1,50 @@
+#pragma once
+#include "arm_math.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cascaded position -> velocity -> current controller for one axis. Runs at
+// the scheduler tick and hands a q-axis current to the FOC loop. Like foc.c
+// it is register-free so it can be simulated on the host.
+
+// One tick of an AxisMoveCmd, in mm and seconds
+typedef struct {
+  float pos;
+  float vel;
+  float acc;
+  float jerk;
+} axis_setpoint_t;
+
+typedef struct {
+  float kp_pos; // 1/s, position error to velocity command
+  float kp_vel; // A/(mm/s)
+  float ki_vel; // A/mm, integral of velocity error
+  float tf_vel; // s, velocity estimate low pass time constant
+  float ka;     // A/(mm/s^2), acceleration feedforward (moving mass)
+  float kj;     // A/(mm/s^3), jerk feedforward (current loop lag)
+  float i_max;  // A
+  float ts;     // tick period, s
+} pos_ctrl_params_t;
+
+typedef struct {
+  pos_ctrl_params_t p;
+  arm_pid_instance_f32 pid_vel;
+  float vel_ff_scale; // 0 or 1, feedforward terms can be disabled for tuning
+  float acc_ff_scale;
+  float jerk_ff_scale;
+
+  float last_pos;
+  float vel;     // filtered velocity estimate, mm/s
+  float err;     // last following error, mm
+  float i_cmd;   // last current command, A
+  bool primed;   // last_pos valid
+} pos_ctrl_t;
+
+void pos_ctrl_init(pos_ctrl_t *c, const pos_ctrl_params_t *p);
+// SetPID mapping: p is the position gain, d/i the velocity loop P/I and tf
+// the velocity filter time constant
+void pos_ctrl_set_pid(pos_ctrl_t *c, float p, float i, float d, float tf);
+void pos_ctrl_set_feedforward(pos_ctrl_t *c, bool vel, bool acc, bool jerk);
+void pos_ctrl_reset(pos_ctrl_t *c);
+// Returns the q-axis current command
+float pos_ctrl_step(pos_ctrl_t *c, const axis_setpoint_t *sp, float pos_mm);
@@ -1,23 +1,47 @@
 #pragma once
+#include "clock_est.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define SERVO_FP_SHIFT 16
 #define SERVO_FP_ONE (1L << SERVO_FP_SHIFT)
 #define SERVO_TIMER_TICK_NS 100LL // 10 MHz timer => 100 ns
+#define SERVO_MAX_PPB 2000000     // rate correction limit, 2000 ppm
+#define SERVO_LOCK_GAIN_DIV 16    // frequency lock follows the fit by 1/16
+#define SERVO_LOCKED_NS 10000     // |offset| to count as converged
+#define SERVO_LOCKED_SYNCS 25     // for this many syncs in a row
+#define SERVO_HOST_BUS_DIV 256    // host to USB bus rate average, ~5 s
+
+// Phase loop gains on the estimator output, tuned in test_clock_sync_sim
+#define SERVO_DEFAULT_KP_FP 16384 // 0.25 ppb per ns of offset, 4 s time constant
+#define SERVO_DEFAULT_KI_FP 64    // trims what the frequency lock lags by
 
 typedef struct {
   uint32_t base_counts; // nominal counts per scheduler tick (e.g. 10000)
   uint32_t min_counts;  // safety lower bound (e.g. 9500)
   uint32_t max_counts;  // safety upper bound (e.g. 10500)
 
-  int32_t Kp_fp; // Q16.16 proportional gain
-  int32_t Ki_fp; // Q16.16 integral gain
+  int32_t Kp_fp; // Q16.16 ppb of rate correction per ns of estimated offset
+  int32_t Ki_fp; // Q16.16 ppb per ns, added to the frequency lock each sync
+
+  int32_t freq_corr_ppb; // applied rate correction, positive lengthens ticks
+  int32_t freq_lock_ppb; // the part of it that cancels oscillator drift
 
-  int32_t freq_corr_fp; // Q16.16 fractional frequency correction
-  int32_t integrator;   // integrated error in timer ticks
+  // With a USB SOF fit the lock targets the bus drift plus the host to bus
+  // rate; that second part only moves with the two host crystals, so it can
+  // be averaged far longer than the exchange drift could be
+  bool bus_valid;
+  int32_t bus_drift_ppb; // USB bus against the raw node crystal
+  uint32_t host_bus_n;   // exchanges averaged so far, up to HOST_BUS_DIV
+  int64_t host_bus_acc;  // host clock against the USB bus, ppb * HOST_BUS_DIV
+  int64_t arr_frac;      // sub-count remainder carried to the next tick, 1e-9
 
-  int64_t last_offset_ns;
+  clock_est_t est;
+  int64_t last_offset_ns; // raw offset and delay of the last exchange
   int64_t last_delay_ns;
+  int64_t est_offset_ns;  // estimated offset when the last exchange finished
+  uint32_t locked_syncs;  // consecutive syncs inside SERVO_LOCKED_NS
+  int64_t locked_at_ns;   // node time convergence was reached, -1 before
 } sched_servo_fixed_t;
 
 void sched_servo_fixed_init(sched_servo_fixed_t *s, uint32_t base_counts,
@@ -28,6 +52,16 @@ void sched_servo_fixed_on_sync(sched_servo_fixed_t *s, uint64_t t0_node_ns,
                                uint64_t t1_host_ns, uint64_t t2_host_ns,
                                uint64_t t3_node_ns);
 
-uint32_t sched_servo_fixed_next_arr(const sched_servo_fixed_t *s);
+// Latest USB SOF fit (usb_sof_poll), applied from the next exchange on
+void sched_servo_fixed_set_bus_drift(sched_servo_fixed_t *s, bool valid,
+                                     int32_t drift_ppb);
+
+// Counts for the next tick minus one, for TIM24->ARR. Dithers between
+// neighbouring counts so the average period has ppb resolution.
+uint32_t sched_servo_fixed_next_arr(sched_servo_fixed_t *s);
 
 int32_t sched_servo_fixed_freq_ppm(const sched_servo_fixed_t *s);
+
+static inline bool sched_servo_fixed_locked(const sched_servo_fixed_t *s) {
+  return s->locked_at_ns >= 0;
+}
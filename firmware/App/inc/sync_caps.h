@@ -0,0 +1,14 @@
+#pragma once
+#include "sync_protocol.h"
+#include <stdint.h>
+
+// HELLO capability negotiation. The node answers a version 2 HELLO with its
+// own capabilities and the configuration it picked from both: the most
+// preferred encoding the two have in common, the larger batch both can do,
+// the features both have. A version 1 HELLO gets the version 1 behaviour,
+// one protobuf setpoint per frame and no reply.
+
+// hello is bufsize bytes off the wire, version 1 or 2. caps holds the node's
+// side, the picked fields are filled in.
+void sync_caps_negotiate(const void *hello, uint32_t bufsize,
+                         sync_caps_t *caps);
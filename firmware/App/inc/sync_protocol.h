@@ -5,6 +5,61 @@
 #define SYNC_MSG_TYPE_RESP 2  // host   -> device
 #define SYNC_MSG_TYPE_STATS 3 // device -> host
 #define SYNC_MSG_TYPE_HELLO 4 // host -> device
+#define SYNC_MSG_TYPE_CMD 5   // host -> device, length delimited Cmd follows
+#define SYNC_MSG_TYPE_CAPS 6  // device -> host, answer to a version 2 HELLO
+#define SYNC_MSG_TYPE_TELEMETRY 7 // device -> host, one full bulk packet
+#define SYNC_MSG_TYPE_TLM_CFG 8   // host -> device, telemetry channels
+#define SYNC_MSG_TYPE_BULK_TEST 9 // either way, bulk throughput filler
+
+#define SYNC_PROTOCOL_VERSION 2
+
+// Setpoint encodings, a higher bit is cheaper to take apart on the node and
+// preferred when both sides have it
+#define SYNC_ENC_PB (1u << 0) // length delimited nanopb Cmd
+
+// Features either side can do without
+#define SYNC_FEAT_TIMESTAMPED_SP (1u << 0) // MoveCmd.t_ns, the jitter buffer
+#define SYNC_FEAT_ACK (1u << 1)            // MoveCmd.seq, sync_stats_t.sp_ack
+#define SYNC_FEAT_SOF_DRIFT (1u << 2)      // bus_drift_ppb, host_bus_ppb
+#define SYNC_FEAT_TELEMETRY (1u << 3)      // sync_tlm_cfg_t, sync_tlm_hdr_t
+// The host drives the motors: the node switches the bridges on for this
+// session and off when it ends. A host only after the clock leaves it out.
+#define SYNC_FEAT_MOTION (1u << 4)
+
+// Telemetry channels, sampled on the servo tick. Per axis channels carry one
+// value (or pair) for each of sync_tlm_hdr_t.axes, in axis order, and a
+// sample has the enabled channels in bit order after its u32 tick.
+#define SYNC_TLM_CH_FOLLOW_ERR (1u << 0) // f32 following error, mm
+#define SYNC_TLM_CH_CURRENT (1u << 1)    // f32 id, f32 iq measured, A
+#define SYNC_TLM_CH_IQ_REF (1u << 2)     // f32 iq command, A
+#define SYNC_TLM_CH_ENCODER (1u << 3)    // i32 encoder count
+#define SYNC_TLM_CH_SETPOINT (1u << 4)   // f32 pos mm, f32 vel mm/s
+#define SYNC_TLM_CH_BUFFER (1u << 5) // u16 jitter buffer depth, u16 underruns
+                                     // (once per sample, not per axis)
+#define SYNC_TLM_CH_DRIVER (1u << 6) // u32 TMC2240 DRV_STATUS, SG4_RESULT,
+                                     // MSCURACT, ADC_TEMP as read, 100 Hz
+#define SYNC_TLM_CH_ALL 0x7fu
+
+// Telemetry always goes out in full high speed bulk packets, the samples
+// zero padded at the end
+#define SYNC_TLM_PACKET_SIZE 512
+
+// Vendor control requests on EP0, answered outside the bulk channel so they
+// work with or without a session
+#define SYNC_VREQ_CPU_PROF 0x50 // IN, sync_cpu_prof_t
+#define SYNC_CPU_PROF_RESET 1u  // wValue: start a new window after the read
+#define SYNC_VREQ_BULK_TEST 0x51 // IN, sync_bulk_test_t, starts a new test
+
+// CPU profile slots, interrupts first, then the main loop tasks
+#define SYNC_CPU_TICK 0        // TIM24_IRQHandler, the whole scheduler tick
+#define SYNC_CPU_SYNC_TICK 1   // sync_tick() within it
+#define SYNC_CPU_MOTION_TICK 2 // motion_tick() within it
+#define SYNC_CPU_USB_ISR 3     // OTG_HS_IRQHandler
+#define SYNC_CPU_ADC_ISR 4     // ADC_IRQHandler, the current loop
+#define SYNC_CPU_TUD_TASK 5    // tud_task() in the main loop
+#define SYNC_CPU_TLM_TASK 6    // telemetry_task() in the main loop
+#define SYNC_CPU_SLOTS 7
+
 #pragma pack(push, 1)
 
 // Device -> Host: sync request
@@ -24,13 +79,42 @@ typedef struct {
   uint64_t t2_ns; // host TX timestamp (ns, host clock)
 } sync_resp_t;
 
+// Host -> Device: start a session. Version 1 ends after protocol_version.
 typedef struct {
   uint8_t msg_type; // SYNC_MSG_TYPE_HELLO
   uint8_t reserved;
   uint16_t reserved2;
   uint32_t protocol_version; // e.g. 1
+  // version 2: what the host can send
+  uint32_t encodings; // SYNC_ENC_*
+  uint32_t features;  // SYNC_FEAT_*
+  uint16_t max_batch; // setpoints per CMD frame
+  uint16_t reserved3;
 } sync_hello_t;
 
+#define SYNC_HELLO_V1_SIZE 8
+
+// Device -> Host: what the node takes, and the configuration picked from both
+// sides. The host sends with encoding and batch from here on.
+typedef struct {
+  uint8_t msg_type; // SYNC_MSG_TYPE_CAPS
+  uint8_t reserved;
+  uint16_t reserved2;
+  uint32_t protocol_version;
+  uint32_t encodings;   // SYNC_ENC_* the node decodes
+  uint32_t features;    // SYNC_FEAT_* the node has
+  uint16_t max_batch;   // setpoints per CMD frame
+  uint16_t sp_buffer;   // setpoints the jitter buffer holds
+  uint32_t max_rate_hz; // setpoint rate, one per scheduler tick
+  uint16_t ep_out_size; // bulk packet sizes at the current bus speed
+  uint16_t ep_in_size;
+  // picked
+  uint32_t encoding; // one SYNC_ENC_* bit, 0 if there is none in common
+  uint32_t features_on;
+  uint16_t batch;
+  uint16_t reserved3;
+} sync_caps_t;
+
 // Device -> Host: status / stats after each sync
 typedef struct {
   uint8_t msg_type; // SYNC_MSG_TYPE_STATS
@@ -39,6 +123,65 @@ typedef struct {
   int64_t offset_ns;     // node - host offset estimate
   int64_t delay_ns;      // path delay estimate
   int32_t freq_corr_ppm; // current frequency correction in ppm
+  int32_t bus_drift_ppb; // USB bus clock against the node crystal, from SOF
+  int32_t host_bus_ppb;  // host clock against the USB bus, 0 without SOF
+  int32_t sp_slack_ns;   // least setpoint slack since the last stats
+  uint32_t sp_late;      // setpoints that missed their tick, total
+  uint32_t sp_ack;       // seq + 1 of the last setpoint released, 0 for none
 } sync_stats_t;
 
+// Host -> Device: pick the telemetry channels. A HELLO turns telemetry off.
+typedef struct {
+  uint8_t msg_type; // SYNC_MSG_TYPE_TLM_CFG
+  uint8_t reserved;
+  uint16_t decimation; // servo ticks per sample, 0 taken as 1
+  uint32_t channels;   // SYNC_TLM_CH_*, 0 stops the stream
+} sync_tlm_cfg_t;
+
+// Device -> Host: head of a SYNC_TLM_PACKET_SIZE telemetry packet, count
+// samples of sample_size bytes follow. Each sample starts with the u32
+// scheduler tick (ms since the HELLO) it was taken on.
+typedef struct {
+  uint8_t msg_type; // SYNC_MSG_TYPE_TELEMETRY
+  uint8_t count;
+  uint16_t seq;        // packet number, a gap is a lost packet
+  uint32_t channels;   // SYNC_TLM_CH_* in every sample of this packet
+  uint16_t decimation; // servo ticks between samples
+  uint8_t axes;
+  uint8_t sample_size; // bytes, tick included
+  uint32_t dropped;    // samples the servo tick found no room for, total
+} sync_tlm_hdr_t;
+
+// Device -> Host, SYNC_VREQ_CPU_PROF: cycle counts of each SYNC_CPU_* slot
+// since the last reset
+typedef struct {
+  uint32_t count;    // runs
+  uint32_t min;      // cycles, all 0 if it hasn't run
+  uint32_t avg;
+  uint32_t max;
+  uint32_t budget;   // cycles a run may take, 0 for no limit
+  uint32_t overruns; // runs over budget
+  uint64_t total;    // cycles, the load against window_ns
+} sync_cpu_slot_t;
+
+typedef struct {
+  uint32_t core_hz;   // cycle counter rate
+  uint16_t slots;     // SYNC_CPU_SLOTS
+  uint16_t reserved;
+  uint64_t window_ns; // node time since the last reset
+  sync_cpu_slot_t slot[SYNC_CPU_SLOTS];
+} sync_cpu_prof_t;
+
+// Device -> Host, SYNC_VREQ_BULK_TEST: the counters of the last test. The
+// request then queues wIndex << 16 | wValue SYNC_TLM_PACKET_SIZE IN packets of
+// SYNC_MSG_TYPE_BULK_TEST, the u32 packet number at byte 4, and
+// starts counting OUT packets of that type again. The node's USB throughput
+// without the rest of the protocol; keep the server off while it runs.
+typedef struct {
+  uint32_t in_left;     // IN packets still to go
+  uint32_t in_sent;     // IN packets queued
+  uint32_t out_packets; // SYNC_MSG_TYPE_BULK_TEST OUT transfers received
+  uint32_t out_bytes;
+} sync_bulk_test_t;
+
 #pragma pack(pop)
@@ -0,0 +1,26 @@
+#pragma once
+
+// Placement in the M7's tightly coupled memories. ITCM (64K at 0) and DTCM
+// (128K at 0x20000000) run at core speed with no wait states and sit beside
+// the caches, so code and data there take the same cycles every time no
+// matter what ran in between. Flash goes through the ART accelerator and the
+// I-cache, and a miss after the USB stack or the main loop has evicted an
+// ISR costs tens of cycles more.
+//
+// TCM_CODE is for the interrupt handlers and what they call on every run,
+// TCM_BSS for the zero initialised state they touch. The linker scripts
+// collect both, the startup code copies the code over from flash and clears
+// the state, and tools/check_tcm.py checks the map after every link.
+// Calls between flash and ITCM are out of BL range, the linker puts in
+// veneers. The host build ignores all of it.
+
+#if defined(HOST_BUILD)
+#define TCM_CODE
+#define TCM_BSS
+#else
+#define TCM_CODE __attribute__((section(".itcm_text")))
+#define TCM_BSS __attribute__((section(".dtcm_bss")))
+#endif
+
+// Flash against ITCM timing of a current loop sized kernel, see tcm_bench.c
+void tcm_bench_run(void);
@@ -0,0 +1,69 @@
+#pragma once
+#include "sync_protocol.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Device -> host telemetry on the vendor IN endpoint. The servo tick fills a
+// whole sample into a lock-free ring on every decimation-th tick and never
+// waits: with the ring full the sample is dropped and counted. Everything
+// else, picking the channels, packing and sending, runs in telemetry_task()
+// from the main loop next to tud_task, below every interrupt.
+//
+// The TX FIFO is one packet deep, so a packet only goes out when it is
+// empty: that keeps every SYNC_TLM_PACKET_SIZE packet on its own transfer.
+// The sync request sent from the tick checks telemetry_tx_busy() and waits
+// a tick rather than land in the middle of one.
+
+#define TELEMETRY_AXES 2        // MOTION_NUM_AXES
+#define TELEMETRY_TICK_NS 1000000 // MOTION_TICK_NS
+#define TELEMETRY_DRV_REGS 4    // TMC_SPI_REGS
+#define TELEMETRY_RING_DEPTH 64 // samples, 64 ms at full rate
+// A part filled packet goes out once its first sample is this old
+#define TELEMETRY_MAX_AGE_NS 20000000ULL
+
+// Everything the tick has, the channels are picked out of it when packing
+typedef struct {
+  uint64_t t_ns; // scheduler time of the tick
+  float err[TELEMETRY_AXES];
+  float id[TELEMETRY_AXES];
+  float iq[TELEMETRY_AXES];
+  float iq_ref[TELEMETRY_AXES];
+  int32_t enc[TELEMETRY_AXES];
+  float sp_pos[TELEMETRY_AXES];
+  float sp_vel[TELEMETRY_AXES];
+  uint16_t jb_depth;
+  uint16_t underruns;
+  uint32_t drv[TELEMETRY_AXES][TELEMETRY_DRV_REGS];
+} telemetry_sample_t;
+
+typedef struct {
+  uint32_t samples; // packed into packets
+  uint32_t packets;
+  uint32_t dropped;   // ring full on the tick
+  uint32_t discarded; // thrown away by a config change
+  uint32_t tx_waits;  // task passes with a packet ready but the FIFO busy
+} telemetry_stats_t;
+
+void telemetry_init(void);
+
+// Thread context (vendor RX callback). Part filled packets and queued samples
+// of the old configuration are dropped; channels 0 stops the stream.
+void telemetry_config(uint32_t channels, uint16_t decimation);
+uint32_t telemetry_channels(void);
+
+// Servo tick: a slot to fill on a sample tick, NULL if there is none (off,
+// not a sample tick, or the ring is full). Commit once it is filled.
+telemetry_sample_t *telemetry_begin(uint64_t now_ns);
+void telemetry_commit(void);
+
+// Main loop: packs queued samples and sends a packet when it is full or its
+// first sample is TELEMETRY_MAX_AGE_NS older than now_ns
+void telemetry_task(uint64_t now_ns);
+
+// A packet is being written to the TX FIFO, other writers must not start
+bool telemetry_tx_busy(void);
+
+// Bytes of one sample with these channels, the tick included
+uint32_t telemetry_sample_size(uint32_t channels);
+
+void telemetry_stats(telemetry_stats_t *out);
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// TMC2240 SPI datagrams and the registers the node reads; tmc_spi.c moves
+// the bytes.
+//
+// A datagram is 40 bits, MSB first: the address with TMC2240_WRITE for a
+// write, then 32 bits of data. The chip latches it on the rising chip select
+// and answers in the next datagram: SPI_STATUS, then the register the
+// previous read asked for. Field layouts follow the datasheet, the same bits
+// as the Prunt.TMC_Types.TMC2240 records and zig_impl/src/tmc2240.zig, so the
+// words go over the wire as read.
+
+#define TMC2240_DATAGRAM 5 // bytes
+#define TMC2240_WRITE 0x80u
+
+#define TMC2240_GCONF 0x00
+#define TMC2240_GSTAT 0x01
+#define TMC2240_IFCNT 0x02
+#define TMC2240_IOIN 0x04
+#define TMC2240_DRV_CONF 0x0a
+#define TMC2240_IHOLD_IRUN 0x10
+#define TMC2240_ADC_VSUPPLY_AIN 0x50
+#define TMC2240_ADC_TEMP 0x51
+#define TMC2240_MSCURACT 0x6b
+#define TMC2240_CHOPCONF 0x6c
+#define TMC2240_DRV_STATUS 0x6f
+#define TMC2240_SG4_RESULT 0x75
+
+// SPI_STATUS, the first byte of every reply
+#define TMC2240_ST_RESET (1u << 0)        // GSTAT.reset
+#define TMC2240_ST_DRIVER_ERROR (1u << 1) // GSTAT.drv_err
+#define TMC2240_ST_SG2 (1u << 2)          // DRV_STATUS.stallguard
+#define TMC2240_ST_STANDSTILL (1u << 3)   // DRV_STATUS.stst
+
+// DRV_STATUS
+#define TMC2240_DRV_SG_RESULT(v) ((v) & 0x3ffu)
+#define TMC2240_DRV_CS_ACTUAL(v) (((v) >> 16) & 0x1fu)
+#define TMC2240_DRV_S2VSA (1u << 12)
+#define TMC2240_DRV_S2VSB (1u << 13)
+#define TMC2240_DRV_STEALTH (1u << 14)
+#define TMC2240_DRV_FSACTIVE (1u << 15)
+#define TMC2240_DRV_STALLGUARD (1u << 24)
+#define TMC2240_DRV_OT (1u << 25)
+#define TMC2240_DRV_OTPW (1u << 26)
+#define TMC2240_DRV_S2GA (1u << 27)
+#define TMC2240_DRV_S2GB (1u << 28)
+#define TMC2240_DRV_OLA (1u << 29)
+#define TMC2240_DRV_OLB (1u << 30)
+#define TMC2240_DRV_STST (1u << 31)
+// the bridge is off until GSTAT is cleared
+#define TMC2240_DRV_FAULTS                                                     \
+  (TMC2240_DRV_S2VSA | TMC2240_DRV_S2VSB | TMC2240_DRV_OT |                   \
+   TMC2240_DRV_S2GA | TMC2240_DRV_S2GB)
+
+// SG4_RESULT, MSCURACT (signed 9 bit coil currents), ADC_TEMP
+#define TMC2240_SG4_RESULT_VALUE(v) ((v) & 0x3ffu)
+#define TMC2240_MSCURACT_A(v) ((int16_t)((v) << 7) >> 7)
+#define TMC2240_MSCURACT_B(v) ((int16_t)((v) >> 9) >> 7)
+#define TMC2240_ADC_TEMP_VALUE(v) ((v) & 0x1fffu)
+// degrees C from ADC_TEMP
+#define TMC2240_TEMP_C(adc) (((float)(adc) - 2038.0f) / 7.7f)
+
+void tmc2240_encode(uint8_t dg[TMC2240_DATAGRAM], uint8_t reg, bool write,
+                    uint32_t value);
+// Data of a reply, its SPI_STATUS to *status if not NULL
+uint32_t tmc2240_decode(const uint8_t dg[TMC2240_DATAGRAM], uint8_t *status);
+
+// A batch reads nregs registers from each of `drivers` chips, every chip on
+// its own chip select. Datagram i goes to chip i % drivers, so the chips
+// take turns and each gets the rest of the round to latch. Round r asks
+// for regs[r]; the reply comes a round later, and an extra round at the end
+// picks up the last one.
+#define TMC2240_BATCH_LEN(drivers, nregs) ((drivers) * ((nregs) + 1))
+
+void tmc2240_batch_build(uint8_t (*tx)[TMC2240_DATAGRAM], int drivers,
+                         const uint8_t *regs, int nregs);
+// values[d * nregs + r] is regs[r] of chip d; status[d] the chip's last
+// SPI_STATUS
+void tmc2240_batch_parse(const uint8_t (*rx)[TMC2240_DATAGRAM], int drivers,
+                         int nregs, uint32_t *values, uint8_t *status);
@@ -0,0 +1,38 @@
+#pragma once
+#include "tmc2240.h"
+#include <stdint.h>
+
+// TMC2240 register telemetry on SPI3 (the MDRV_* pins), one chip select per
+// driver. Every TMC_SPI_PERIOD_TICKS servo ticks the tick starts a batch
+// (tmc2240_batch_build) and DMA moves it one datagram at a time: the RX
+// stream's transfer complete interrupt raises the chip select, points both
+// streams at the next datagram and restarts the SPI. No blocking HAL calls,
+// no polling; the CPU only sees one short interrupt per 5 bytes.
+//
+// The last complete batch is double buffered, the servo tick reads it for
+// telemetry while the SPI interrupt, which it can preempt, fills the other.
+// Only reads: configuring the chips is left to whoever enables them.
+
+#define TMC_SPI_DRIVERS 2 // TELEMETRY_AXES, one per motor
+#define TMC_SPI_REGS 4    // per driver and batch, in tmc_spi_regs[] order
+#define TMC_SPI_PERIOD_TICKS 10 // 100 Hz
+#define TMC_SPI_LEN TMC2240_BATCH_LEN(TMC_SPI_DRIVERS, TMC_SPI_REGS)
+
+// DRV_STATUS, SG4_RESULT, MSCURACT, ADC_TEMP; SYNC_TLM_CH_DRIVER order
+extern const uint8_t tmc_spi_regs[TMC_SPI_REGS];
+
+typedef struct {
+  uint32_t batches;  // completed since tmc_spi_init
+  uint32_t overruns; // periods skipped with the last batch still running
+  uint32_t errors;   // DMA transfer errors, the batch is dropped
+  uint8_t status[TMC_SPI_DRIVERS]; // SPI_STATUS of the last batch
+} tmc_spi_stats_t;
+
+// Takes SPI3 over from MX_SPI3_Init: 8 bit frames, mode 3, 3.9 MHz off the
+// 62.5 MHz PLL2P kernel clock
+void tmc_spi_init(void);
+// Servo tick
+void tmc_spi_tick(void);
+// Registers of driver d from the last complete batch, zero before the first
+void tmc_spi_latest(int d, uint32_t out[TMC_SPI_REGS]);
+void tmc_spi_stats(tmc_spi_stats_t *out);
@@ -74,13 +74,25 @@ extern "C" {
  * that they can be put into those specific section. e.g
  * - CFG_TUSB_MEM SECTION : __attribute__ (( section(".usb_ram") ))
  * - CFG_TUSB_MEM_ALIGN   : __attribute__ ((aligned(4)))
+ *
+ * The OTG HS internal DMA moves the endpoint data, which can't reach DTCM.
+ * Endpoint buffers go to the non-cacheable D2 SRAM region, see dma_buf.h.
+ * Cache maintenance stays on for any buffer handed over from elsewhere, the
+ * driver skips it inside the uncached regions.
  */
+#include "dma_buf.h"
+
+#define CFG_TUD_DWC2_DMA_ENABLE 1
+#define CFG_TUD_MEM_DCACHE_ENABLE 1
+#define CFG_DWC2_MEM_UNCACHED_REGIONS                                          \
+  {.start = DMA_BUF_BASE, .end = DMA_BUF_BASE + DMA_BUF_SIZE - 1},
+
 #ifndef CFG_TUSB_MEM_SECTION
-#define CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION __attribute__((section(".dma_buf")))
 #endif
 
 #ifndef CFG_TUSB_MEM_ALIGN
-#define CFG_TUSB_MEM_ALIGN __attribute__((aligned(4)))
+#define CFG_TUSB_MEM_ALIGN __attribute__((aligned(32)))
 #endif
 
 //--------------------------------------------------------------------
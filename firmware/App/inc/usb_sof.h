@@ -0,0 +1,66 @@
+#pragma once
+#include "clock_est.h"
+#include "fifo.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Node crystal against the USB bus clock. A high speed host controller sends
+// a start of frame every 125 us microframe off its own crystal, so the SOF
+// interrupt is a free 8 kHz reference that only jitters by our interrupt
+// latency. The OTG interrupt hands each SOF to usb_sof_isr() with the
+// microframe number and the raw TIM5 time; one per USB_SOF_SAMPLE_UFRAMES
+// goes through a ring to the foreground, where usb_sof_poll() fits bus time
+// against node time with clock_est.
+//
+// The fitted drift is far cleaner than what the bulk sync exchange can see,
+// but the bus clock has no fixed phase to host time and runs off a different
+// crystal than CLOCK_MONOTONIC_RAW, so the exchange still supplies the offset
+// and the (slowly varying) host to bus rate. See sched_servo.h.
+
+#define USB_SOF_UFRAME_NS 125000   // high speed microframe
+#define USB_SOF_FN_MASK 0x3fffu    // DSTS.FNSOF: frame << 3 | microframe
+#define USB_SOF_SAMPLE_UFRAMES 32  // one fit sample per 4 ms, 1 s window
+#define USB_SOF_RING 16            // 64 ms between two polls
+// A silence longer than this can hide a wrap of the microframe number
+// (2.048 s), the fit starts over
+#define USB_SOF_GAP_NS                                                         \
+  ((int64_t)(USB_SOF_FN_MASK + 1) * USB_SOF_UFRAME_NS / 2)
+
+typedef struct {
+  int64_t bus_ns;  // microframes since the fit started, in ns
+  int64_t node_ns; // raw node time of that SOF, same origin
+  uint32_t epoch;  // bumped on every restart
+} usb_sof_sample_t;
+
+typedef struct {
+  // interrupt side
+  bool running;
+  uint32_t fn;          // last microframe number
+  uint64_t node0_ns;    // raw node time of the first SOF of the epoch
+  uint64_t last_ns;     // raw node time of the last SOF
+  int64_t uframes;      // unwrapped microframes since node0_ns
+  int64_t batch_start;  // first microframe of the current batch
+  int64_t batch_min;    // least delayed SOF of the batch so far
+  usb_sof_sample_t cand;
+  uint32_t epoch;
+  uint32_t frames;      // SOFs seen
+  uint32_t missed;      // microframes skipped in the numbering
+  uint32_t restarts;
+  uint32_t overflows;   // samples dropped on a full ring
+  volatile int32_t drift_ppb; // last fit, for the batch selection
+
+  // foreground side
+  usb_sof_sample_t storage[USB_SOF_RING + 1];
+  fifo_t ring;
+  uint32_t est_epoch;
+  clock_est_t est; // bus - node
+} usb_sof_t;
+
+void usb_sof_init(usb_sof_t *s);
+
+// OTG interrupt, before the SOF flag is cleared. fnsof is DSTS.FNSOF.
+void usb_sof_isr(usb_sof_t *s, uint32_t fnsof, uint64_t node_raw_ns);
+
+// Foreground: feed pending samples to the fit. Returns s->est.valid, the
+// bus drift is then s->est.drift_ppb (positive: the bus runs fast).
+bool usb_sof_poll(usb_sof_t *s);
@@ -0,0 +1,148 @@
+#include "clock_est.h"
+#include <string.h>
+
+static uint32_t isqrt64(uint64_t v) {
+  uint64_t r = 0, bit = 1ULL << 62;
+  while (bit > v)
+    bit >>= 2;
+  while (bit) {
+    if (v >= r + bit) {
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    } else {
+      r >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)r;
+}
+
+void clock_est_init(clock_est_t *e) { memset(e, 0, sizeof(*e)); }
+
+static const clock_est_sample_t *newest(const clock_est_t *e) {
+  return &e->s[(e->head + CLOCK_EST_WINDOW - 1) % CLOCK_EST_WINDOW];
+}
+
+// Delay of the n-th fastest exchange in the window, the selection threshold.
+// Quickselect on a copy, linear on average where a sort of the window would
+// cost a few thousand compares per exchange.
+static int32_t nth_delay(const clock_est_t *e, uint32_t n) {
+  int32_t d[CLOCK_EST_WINDOW];
+  for (uint32_t i = 0; i < e->count; i++)
+    d[i] = e->s[i].delay_ns;
+  uint32_t lo = 0, hi = e->count - 1;
+  while (lo < hi) {
+    int32_t pivot = d[(lo + hi) / 2];
+    uint32_t i = lo, j = hi;
+    while (i <= j) {
+      while (d[i] < pivot)
+        i++;
+      while (d[j] > pivot)
+        j--;
+      if (i <= j) {
+        int32_t t = d[i];
+        d[i] = d[j];
+        d[j] = t;
+        i++;
+        if (j == 0)
+          break;
+        j--;
+      }
+    }
+    if (n <= j)
+      hi = j;
+    else if (n >= i)
+      lo = i;
+    else
+      break;
+  }
+  return d[n];
+}
+
+static void fit(clock_est_t *e) {
+  const clock_est_sample_t *ref = newest(e);
+  uint32_t keep = e->count / CLOCK_EST_KEEP_DIV;
+  if (keep < 2)
+    keep = 2;
+  int32_t thresh = nth_delay(e, keep - 1);
+  int32_t min_delay = thresh;
+  for (uint32_t i = 0; i < e->count; i++)
+    if (e->s[i].delay_ns < min_delay)
+      min_delay = e->s[i].delay_ns;
+  e->min_delay_ns = min_delay;
+
+  // x in us relative to the newest sample, y in ns relative to its offset,
+  // keeps every sum well inside int64 over the window
+  int64_t sx = 0, sy = 0;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < e->count; i++) {
+    if (e->s[i].delay_ns > thresh)
+      continue;
+    sx += (e->s[i].t_ns - ref->t_ns) / 1000;
+    sy += e->s[i].offset_ns - ref->offset_ns;
+    n++;
+  }
+  int64_t xm = sx / n, ym = sy / n;
+
+  int64_t sxx = 0, sxy = 0;
+  for (uint32_t i = 0; i < e->count; i++) {
+    if (e->s[i].delay_ns > thresh)
+      continue;
+    int64_t dx = (e->s[i].t_ns - ref->t_ns) / 1000 - xm;
+    int64_t dy = e->s[i].offset_ns - ref->offset_ns - ym;
+    sxx += dx * dx;
+    sxy += dx * dy;
+  }
+  // ns/us scaled to ppb, split so neither side overflows nor loses precision
+  int64_t drift = (sxx >= 1000) ? (sxy * 1000) / (sxx / 1000) : 0;
+
+  uint64_t srr = 0;
+  for (uint32_t i = 0; i < e->count; i++) {
+    if (e->s[i].delay_ns > thresh)
+      continue;
+    int64_t dx = (e->s[i].t_ns - ref->t_ns) / 1000 - xm;
+    int64_t dy = e->s[i].offset_ns - ref->offset_ns - ym;
+    int64_t r = dy - drift * dx / 1000000;
+    srr += (uint64_t)(r * r);
+  }
+
+  e->t_ns = ref->t_ns;
+  e->offset_ns = ref->offset_ns + ym - drift * xm / 1000000;
+  e->drift_ppb = (int32_t)drift;
+  e->jitter_ns = (int32_t)isqrt64(srr / n);
+  e->used = n;
+  e->valid = true;
+}
+
+bool clock_est_add(clock_est_t *e, int64_t t_ns, int64_t offset_ns,
+                   int64_t delay_ns) {
+  if (delay_ns < 0 || delay_ns > CLOCK_EST_MAX_DELAY_NS) {
+    e->rejected++;
+    return e->valid;
+  }
+  clock_est_sample_t *s = &e->s[e->head];
+  s->t_ns = t_ns;
+  s->offset_ns = offset_ns;
+  s->delay_ns = (int32_t)delay_ns;
+  e->head = (e->head + 1) % CLOCK_EST_WINDOW;
+  if (e->count < CLOCK_EST_WINDOW)
+    e->count++;
+
+  if (e->count >= CLOCK_EST_MIN_SAMPLES)
+    fit(e);
+  return e->valid;
+}
+
+void clock_est_rate_step(clock_est_t *e, int32_t delta_ppb) {
+  if (e->count == 0 || delta_ppb == 0)
+    return;
+  int64_t t_ref = newest(e)->t_ns;
+  for (uint32_t i = 0; i < e->count; i++)
+    e->s[i].offset_ns += (e->s[i].t_ns - t_ref) * delta_ppb / 1000000000LL;
+  if (e->valid)
+    e->drift_ppb += delta_ppb;
+}
+
+int64_t clock_est_offset_at(const clock_est_t *e, int64_t t_ns) {
+  return e->offset_ns + (t_ns - e->t_ns) / 1000 * e->drift_ppb / 1000000;
+}
@@ -0,0 +1,309 @@
+#include "cmd_decode.h"
+#include "foc.h"
+#include "motion.h"
+#include "sync_protocol.h"
+#include <math.h>
+#include <string.h>
+
+// Wire types, and the tags of messages.proto as they appear on the wire:
+// field << 3 | wire type. Every field number is below 16, so every tag is a
+// single byte.
+#define WT_VARINT 0
+#define WT_I64 1
+#define WT_LEN 2
+#define WT_I32 5
+#define TAG(field, wt) ((uint32_t)(field) << 3 | (wt))
+
+_Static_assert(MOTION_NUM_AXES <= CMD_GLOBAL_AXES, "axis map");
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+} rd_t;
+
+static bool rd_varint(rd_t *r, uint64_t *v) {
+  uint64_t x = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (r->p == r->end)
+      return false;
+    uint8_t b = *r->p++;
+    x |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *v = x;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool rd_tag(rd_t *r, uint32_t *tag) {
+  if (r->p < r->end && *r->p < 0x80) {
+    *tag = *r->p++;
+    return true;
+  }
+  uint64_t v;
+  if (!rd_varint(r, &v) || v > UINT32_MAX)
+    return false;
+  *tag = (uint32_t)v;
+  return true;
+}
+
+// fixed32, fixed64 and float are little endian on the wire and on both
+// the M7 and the host, they go straight into place
+static inline bool rd_fixed(rd_t *r, void *out, uint32_t n) {
+  if ((uint32_t)(r->end - r->p) < n)
+    return false;
+  memcpy(out, r->p, n);
+  r->p += n;
+  return true;
+}
+
+static bool rd_int32(rd_t *r, int32_t *out) {
+  uint64_t v;
+  if (!rd_varint(r, &v))
+    return false;
+  // negative int32 comes sign extended to ten bytes
+  *out = (int32_t)(int64_t)v;
+  return true;
+}
+
+static bool rd_sub(rd_t *r, rd_t *sub) {
+  uint64_t n;
+  if (!rd_varint(r, &n) || n > (uint64_t)(r->end - r->p))
+    return false;
+  sub->p = r->p;
+  sub->end = r->p + n;
+  r->p = sub->end;
+  return true;
+}
+
+static bool rd_skip(rd_t *r, uint32_t tag) {
+  uint64_t v;
+  rd_t sub;
+  switch (tag & 7) {
+  case WT_VARINT:
+    return rd_varint(r, &v);
+  case WT_I64:
+    return rd_fixed(r, &v, 8);
+  case WT_LEN:
+    return rd_sub(r, &sub);
+  case WT_I32:
+    return rd_fixed(r, &v, 4);
+  default:
+    return false;
+  }
+}
+
+// AxisMoveCmd; snap and crackle have no place in the setpoint
+static bool decode_axis(rd_t *r, axis_setpoint_t *a) {
+  while (r->p < r->end) {
+    uint32_t tag;
+    if (!rd_tag(r, &tag))
+      return false;
+    bool ok;
+    switch (tag) {
+    case TAG(1, WT_I32):
+      ok = rd_fixed(r, &a->pos, 4);
+      break;
+    case TAG(2, WT_I32):
+      ok = rd_fixed(r, &a->vel, 4);
+      break;
+    case TAG(3, WT_I32):
+      ok = rd_fixed(r, &a->acc, 4);
+      break;
+    case TAG(4, WT_I32):
+      ok = rd_fixed(r, &a->jerk, 4);
+      break;
+    default:
+      ok = rd_skip(r, tag);
+      break;
+    }
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+// MoveCmd, into the jitter buffer slot it ends up in
+static bool decode_move(cmd_decoder_t *d, jitter_buf_t *jb, rd_t *r,
+                        uint64_t now_ns) {
+  motion_setpoint_t *sp = jitter_buf_reserve(jb);
+  if (!sp) {
+    d->stats.rejected++;
+    return true; // the frame is fine, there is just no room
+  }
+  // proto3 leaves zeros and the other node's axes out
+  memset(sp, 0, sizeof(*sp));
+  while (r->p < r->end) {
+    uint32_t tag;
+    if (!rd_tag(r, &tag))
+      return false;
+    bool ok;
+    switch (tag) {
+    case TAG(1, WT_LEN):
+    case TAG(2, WT_LEN):
+    case TAG(3, WT_LEN):
+    case TAG(4, WT_LEN): {
+      rd_t sub;
+      ok = rd_sub(r, &sub);
+      int m = d->motor[(tag >> 3) - 1];
+      if (ok && m >= 0)
+        ok = decode_axis(&sub, &sp->axis[m]);
+      break;
+    }
+    case TAG(5, WT_I64):
+      ok = rd_fixed(r, &sp->t_ns, 8);
+      break;
+    case TAG(6, WT_I32):
+      ok = rd_fixed(r, &sp->seq, 4);
+      break;
+    default:
+      ok = rd_skip(r, tag);
+      break;
+    }
+    if (!ok)
+      return false; // the slot stays reserved, the next move reuses it
+  }
+  if (jitter_buf_commit(jb, now_ns))
+    d->stats.moves++;
+  else
+    d->stats.rejected++;
+  return true;
+}
+
+static bool decode_moves(cmd_decoder_t *d, jitter_buf_t *jb, rd_t *r,
+                         uint64_t now_ns) {
+  while (r->p < r->end) {
+    uint32_t tag;
+    rd_t sub;
+    if (!rd_tag(r, &tag))
+      return false;
+    if (tag != TAG(1, WT_LEN)) {
+      if (!rd_skip(r, tag))
+        return false;
+      continue;
+    }
+    if (!rd_sub(r, &sub) || !decode_move(d, jb, &sub, now_ns))
+      return false;
+  }
+  return true;
+}
+
+// ConfigSystem: float timestep = 1, the int32 axis indices 2..5. Parsed
+// into locals, it doesn't come per sample.
+static bool decode_config(cmd_decoder_t *d, rd_t *r) {
+  float ts = 0.0f;
+  int32_t idx[CMD_GLOBAL_AXES] = {0};
+  while (r->p < r->end) {
+    uint32_t tag;
+    if (!rd_tag(r, &tag))
+      return false;
+    uint32_t field = tag >> 3;
+    bool ok;
+    if (tag == TAG(1, WT_I32))
+      ok = rd_fixed(r, &ts, 4);
+    else if (field >= 2 && field <= 5 && (tag & 7) == WT_VARINT)
+      ok = rd_int32(r, &idx[field - 2]);
+    else
+      ok = rd_skip(r, tag);
+    if (!ok)
+      return false;
+  }
+  d->timestep = ts;
+  for (int g = 0; g < CMD_GLOBAL_AXES; g++)
+    d->motor[g] = idx[g] >= 0 && idx[g] < MOTION_NUM_AXES ? (int8_t)idx[g] : -1;
+  return true;
+}
+
+// SetPID and SetParams: int32 axis = 1, then four floats
+static bool decode_axis_floats(rd_t *r, int32_t *axis, float v[4]) {
+  *axis = 0;
+  memset(v, 0, 4 * sizeof(float));
+  while (r->p < r->end) {
+    uint32_t tag;
+    if (!rd_tag(r, &tag))
+      return false;
+    uint32_t field = tag >> 3;
+    bool ok;
+    if (tag == TAG(1, WT_VARINT))
+      ok = rd_int32(r, axis);
+    else if (field >= 2 && field <= 5 && (tag & 7) == WT_I32)
+      ok = rd_fixed(r, &v[field - 2], 4);
+    else
+      ok = rd_skip(r, tag);
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+// An omitted field decodes as 0. The motor model and counts/mm get divided
+// by, so SetParams needs all four; gains may be 0 but not negative.
+static bool axis_floats_valid(const float v[4], bool zero_ok) {
+  for (int k = 0; k < 4; k++)
+    if (!isfinite(v[k]) || v[k] < 0.0f || (v[k] == 0.0f && !zero_ok))
+      return false;
+  return true;
+}
+
+void cmd_decoder_init(cmd_decoder_t *d) {
+  memset(d, 0, sizeof(*d));
+  for (int g = 0; g < CMD_GLOBAL_AXES; g++)
+    d->motor[g] = g < MOTION_NUM_AXES ? (int8_t)g : -1;
+}
+
+bool cmd_decode_frame(cmd_decoder_t *d, jitter_buf_t *jb, const uint8_t *buf,
+                      uint32_t len, uint64_t now_ns) {
+  d->stats.frames++;
+  rd_t r = {buf + 1, buf + len};
+  rd_t cmd;
+  if (len < 2 || buf[0] != SYNC_MSG_TYPE_CMD || !rd_sub(&r, &cmd))
+    goto bad;
+  while (cmd.p < cmd.end) {
+    uint32_t tag;
+    rd_t sub;
+    int32_t axis;
+    float v[4];
+    if (!rd_tag(&cmd, &tag))
+      goto bad;
+    if ((tag & 7) != WT_LEN) {
+      if (!rd_skip(&cmd, tag))
+        goto bad;
+      continue;
+    }
+    if (!rd_sub(&cmd, &sub))
+      goto bad;
+    switch (tag >> 3) {
+    case 1: // Moves
+      if (!decode_moves(d, jb, &sub, now_ns))
+        goto bad;
+      break;
+    case 2: // SetParams
+      if (!decode_axis_floats(&sub, &axis, v) ||
+          !axis_floats_valid(v, false) || !foc_encoder_cpr_valid(v[2]))
+        goto bad;
+      d->stats.config++;
+      if (d->set_params)
+        d->set_params(axis, v[0], v[1], v[2], v[3]);
+      break;
+    case 3: // SetPID
+      if (!decode_axis_floats(&sub, &axis, v) || !axis_floats_valid(v, true))
+        goto bad;
+      d->stats.config++;
+      if (d->set_pid)
+        d->set_pid(axis, v[0], v[1], v[2], v[3]);
+      break;
+    case 4: // ConfigSystem
+      if (!decode_config(d, &sub))
+        goto bad;
+      d->stats.config++;
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
+bad:
+  d->stats.malformed++;
+  return false;
+}
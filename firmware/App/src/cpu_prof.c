@@ -0,0 +1,95 @@
+#include "cpu_prof.h"
+#include "tcm.h"
+#include <string.h>
+
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+typedef struct {
+  volatile uint32_t seq; // odd while the owner writes
+  uint32_t epoch;        // g_epoch the counts below belong to
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t overruns;
+  uint64_t total;
+} prof_slot_t;
+
+TCM_BSS static prof_slot_t g_slot[SYNC_CPU_SLOTS];
+TCM_BSS static uint32_t g_budget[SYNC_CPU_SLOTS];
+TCM_BSS static volatile uint32_t g_epoch;
+static uint64_t g_window_start_ns;
+
+void cpu_prof_init(uint64_t now_ns) {
+  memset(g_slot, 0, sizeof(g_slot));
+  cycle_counter_init();
+  cpu_prof_reset(now_ns);
+}
+
+void cpu_prof_set_budget(uint32_t slot, uint32_t cycles) {
+  if (slot < SYNC_CPU_SLOTS)
+    g_budget[slot] = cycles;
+}
+
+TCM_CODE void cpu_prof_record(uint32_t slot, uint32_t cycles) {
+  if (slot >= SYNC_CPU_SLOTS)
+    return;
+  prof_slot_t *s = &g_slot[slot];
+  s->seq++;
+  COMPILER_BARRIER();
+  uint32_t epoch = g_epoch;
+  if (s->epoch != epoch) {
+    s->epoch = epoch;
+    s->count = 0;
+    s->min = UINT32_MAX;
+    s->max = 0;
+    s->overruns = 0;
+    s->total = 0;
+  }
+  s->count++;
+  s->total += cycles;
+  if (cycles < s->min)
+    s->min = cycles;
+  if (cycles > s->max)
+    s->max = cycles;
+  uint32_t budget = g_budget[slot];
+  if (budget && cycles > budget)
+    s->overruns++;
+  COMPILER_BARRIER();
+  s->seq++;
+}
+
+void cpu_prof_read(sync_cpu_prof_t *out, uint64_t now_ns) {
+  memset(out, 0, sizeof(*out));
+  out->core_hz = CYCLE_COUNTER_HZ;
+  out->slots = SYNC_CPU_SLOTS;
+  out->window_ns = now_ns - g_window_start_ns;
+  uint32_t epoch = g_epoch;
+  for (int i = 0; i < SYNC_CPU_SLOTS; i++) {
+    prof_slot_t *s = &g_slot[i];
+    prof_slot_t copy;
+    uint32_t seq;
+    do {
+      seq = s->seq;
+      COMPILER_BARRIER();
+      copy = *s;
+      COMPILER_BARRIER();
+    } while ((seq & 1) || seq != s->seq);
+
+    sync_cpu_slot_t *o = &out->slot[i];
+    o->budget = g_budget[i];
+    if (copy.epoch != epoch || copy.count == 0)
+      continue; // not run since the reset
+    o->count = copy.count;
+    o->min = copy.min;
+    o->max = copy.max;
+    o->avg = (uint32_t)(copy.total / copy.count);
+    o->overruns = copy.overruns;
+    o->total = copy.total;
+  }
+}
+
+void cpu_prof_reset(uint64_t now_ns) {
+  g_window_start_ns = now_ns;
+  COMPILER_BARRIER();
+  g_epoch++;
+}
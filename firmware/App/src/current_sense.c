@@ -0,0 +1,204 @@
+#include "current_sense.h"
+#include "adc.h"
+#include "cpu_prof.h"
+#include "stm32h7xx.h"
+#include "tcm.h"
+#include "tim.h"
+
+// Phase current sampling for the two TIM1/TIM8 bridges.
+//
+// TIM1 is the master: TRGO (CEN) starts TIM8 in lock-step, TRGO2 (OC4REF with
+// CCR4 = ARR - 1) fires right after the counter peak, which is the middle of
+// the low-side on-time for every phase. That edge starts an injected sequence
+// on ADC1 with ADC2 slaved in dual injected simultaneous mode, so phase A and
+// phase B of each motor are sampled at the same instant:
+//
+//   rank 1: M1_CS_A (ADC1_INP2) / M1_CS_B (ADC2_INP2)
+//   rank 2: M2_CS_A (ADC1_INP3) / M2_CS_B (ADC2_INP4)
+//
+// Injected results land in JDRx, so there is no DMA involved; the JEOS
+// interrupt hands one complete sample set to the current loop callback.
+
+static current_sense_cb_t g_cb = 0;
+TCM_BSS static current_sample_t g_sample;
+TCM_BSS static int32_t g_offset_a[CURRENT_SENSE_NUM_MOTORS];
+TCM_BSS static int32_t g_offset_b[CURRENT_SENSE_NUM_MOTORS];
+static int32_t g_acc_a[CURRENT_SENSE_NUM_MOTORS];
+static int32_t g_acc_b[CURRENT_SENSE_NUM_MOTORS];
+static volatile uint32_t g_cal_count = 0;
+static volatile uint32_t g_overruns = 0;
+
+static void pwm_tim_init(TIM_HandleTypeDef *htim, bool master) {
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_SlaveConfigTypeDef sSlaveConfig = {0};
+  TIM_OC_InitTypeDef sConfigOC = {0};
+
+  htim->Init.Prescaler = 0;
+  htim->Init.CounterMode = TIM_COUNTERMODE_CENTERALIGNED1;
+  htim->Init.Period = PWM_ARR;
+  htim->Init.RepetitionCounter = 0;
+  htim->Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+  if (HAL_TIM_PWM_Init(htim) != HAL_OK)
+    Error_Handler();
+
+  // CH4 has no pin, its OC4REF only exists to time the ADC trigger
+  sConfigOC.OCMode = TIM_OCMODE_PWM1;
+  sConfigOC.Pulse = PWM_ARR - 1;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  if (HAL_TIM_PWM_ConfigChannel(htim, &sConfigOC, TIM_CHANNEL_4) != HAL_OK)
+    Error_Handler();
+
+  if (master) {
+    sMasterConfig.MasterOutputTrigger = TIM_TRGO_ENABLE;
+    sMasterConfig.MasterOutputTrigger2 = TIM_TRGO2_OC4REF;
+    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_ENABLE;
+    if (HAL_TIMEx_MasterConfigSynchronization(htim, &sMasterConfig) != HAL_OK)
+      Error_Handler();
+  } else {
+    // ITR0 on TIM8 is TIM1 TRGO
+    sSlaveConfig.SlaveMode = TIM_SLAVEMODE_TRIGGER;
+    sSlaveConfig.InputTrigger = TIM_TS_ITR0;
+    if (HAL_TIM_SlaveConfigSynchro(htim, &sSlaveConfig) != HAL_OK)
+      Error_Handler();
+  }
+}
+
+static void adc_injected_init(ADC_HandleTypeDef *hadc, uint32_t ch_m1,
+                              uint32_t ch_m2, uint32_t trigger) {
+  ADC_InjectionConfTypeDef sConfigInjected = {0};
+
+  sConfigInjected.InjectedSamplingTime = ADC_SAMPLETIME_8CYCLES_5;
+  sConfigInjected.InjectedSingleDiff = ADC_SINGLE_ENDED;
+  sConfigInjected.InjectedOffsetNumber = ADC_OFFSET_NONE;
+  sConfigInjected.InjectedOffset = 0;
+  sConfigInjected.InjectedOffsetSignedSaturation = DISABLE;
+  sConfigInjected.InjectedNbrOfConversion = CURRENT_SENSE_NUM_MOTORS;
+  sConfigInjected.InjectedDiscontinuousConvMode = DISABLE;
+  sConfigInjected.AutoInjectedConv = DISABLE;
+  sConfigInjected.QueueInjectedContext = DISABLE;
+  sConfigInjected.ExternalTrigInjecConv = trigger;
+  sConfigInjected.ExternalTrigInjecConvEdge =
+      ADC_EXTERNALTRIGINJECCONV_EDGE_RISING;
+  sConfigInjected.InjecOversamplingMode = DISABLE;
+
+  sConfigInjected.InjectedChannel = ch_m1;
+  sConfigInjected.InjectedRank = ADC_INJECTED_RANK_1;
+  if (HAL_ADCEx_InjectedConfigChannel(hadc, &sConfigInjected) != HAL_OK)
+    Error_Handler();
+
+  sConfigInjected.InjectedChannel = ch_m2;
+  sConfigInjected.InjectedRank = ADC_INJECTED_RANK_2;
+  if (HAL_ADCEx_InjectedConfigChannel(hadc, &sConfigInjected) != HAL_OK)
+    Error_Handler();
+}
+
+// Must run after MX_ADCx_Init/MX_TIMx_Init, reconfigures what CubeMX set up
+void current_sense_init(void) {
+  ADC_MultiModeTypeDef multimode = {0};
+
+  pwm_tim_init(&htim8, false);
+  pwm_tim_init(&htim1, true);
+
+  multimode.Mode = ADC_DUALMODE_INJECSIMULT;
+  multimode.DualModeData = ADC_DUALMODEDATAFORMAT_DISABLED;
+  multimode.TwoSamplingDelay = ADC_TWOSAMPLINGDELAY_1CYCLE;
+  if (HAL_ADCEx_MultiModeConfigChannel(&hadc1, &multimode) != HAL_OK)
+    Error_Handler();
+
+  // the slave trigger is ignored in dual mode, ADC1 JEXTSEL starts both
+  adc_injected_init(&hadc1, ADC_CHANNEL_2, ADC_CHANNEL_3,
+                    ADC_EXTERNALTRIGINJEC_T1_TRGO2);
+  adc_injected_init(&hadc2, ADC_CHANNEL_2, ADC_CHANNEL_4,
+                    ADC_INJECTED_SOFTWARE_START);
+
+  if (HAL_ADCEx_Calibration_Start(&hadc1, ADC_CALIB_OFFSET,
+                                  ADC_SINGLE_ENDED) != HAL_OK)
+    Error_Handler();
+  if (HAL_ADCEx_Calibration_Start(&hadc2, ADC_CALIB_OFFSET,
+                                  ADC_SINGLE_ENDED) != HAL_OK)
+    Error_Handler();
+
+  for (int m = 0; m < CURRENT_SENSE_NUM_MOTORS; m++) {
+    g_offset_a[m] = g_offset_b[m] = 0;
+    g_acc_a[m] = g_acc_b[m] = 0;
+  }
+  g_cal_count = 0;
+  g_overruns = 0;
+  g_sample.seq = 0;
+}
+
+// Duty is still 0 from CubeMX init, so the first CURRENT_SENSE_CAL_SAMPLES
+// periods see zero phase current and are used to find the amplifier offsets.
+void current_sense_start(void) {
+  // ADC2 only gets enabled here, the JADSTART on ADC1 arms both
+  if (HAL_ADCEx_InjectedStart(&hadc2) != HAL_OK)
+    Error_Handler();
+  if (HAL_ADCEx_InjectedStart_IT(&hadc1) != HAL_OK)
+    Error_Handler();
+  // EOCSelection is per conversion, but only the end of sequence matters
+  __HAL_ADC_DISABLE_IT(&hadc1, ADC_IT_JEOC);
+  __HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_JEOS);
+
+  // the current loop has to finish inside its PWM period
+  cpu_prof_set_budget(SYNC_CPU_ADC_ISR, CYCLE_COUNTER_HZ / PWM_FREQ_HZ);
+  HAL_NVIC_SetPriority(ADC_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(ADC_IRQn);
+
+  // TIM8 waits for the TIM1 CEN trigger so both bridges share one time base
+  HAL_TIM_PWM_Start(&htim8, TIM_CHANNEL_1);
+  HAL_TIM_PWM_Start(&htim8, TIM_CHANNEL_2);
+  HAL_TIM_PWM_Start(&htim8, TIM_CHANNEL_3);
+  HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_1);
+  HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_2);
+  HAL_TIM_PWM_Start(&htim1, TIM_CHANNEL_3);
+}
+
+void current_sense_set_callback(current_sense_cb_t cb) { g_cb = cb; }
+
+bool current_sense_calibrated(void) {
+  return g_cal_count >= CURRENT_SENSE_CAL_SAMPLES;
+}
+
+uint32_t current_sense_overruns(void) { return g_overruns; }
+
+TCM_CODE void ADC_IRQHandler(void) {
+  if (!(ADC1->ISR & ADC_ISR_JEOS))
+    return;
+  uint32_t t0 = cycle_count();
+  ADC1->ISR = ADC_ISR_JEOS | ADC_ISR_JEOC;
+
+  int32_t raw_a[CURRENT_SENSE_NUM_MOTORS] = {(int32_t)ADC1->JDR1,
+                                             (int32_t)ADC1->JDR2};
+  int32_t raw_b[CURRENT_SENSE_NUM_MOTORS] = {(int32_t)ADC2->JDR1,
+                                             (int32_t)ADC2->JDR2};
+
+  if (g_cal_count < CURRENT_SENSE_CAL_SAMPLES) {
+    for (int m = 0; m < CURRENT_SENSE_NUM_MOTORS; m++) {
+      g_acc_a[m] += raw_a[m];
+      g_acc_b[m] += raw_b[m];
+    }
+    if (++g_cal_count == CURRENT_SENSE_CAL_SAMPLES) {
+      for (int m = 0; m < CURRENT_SENSE_NUM_MOTORS; m++) {
+        g_offset_a[m] = g_acc_a[m] / CURRENT_SENSE_CAL_SAMPLES;
+        g_offset_b[m] = g_acc_b[m] / CURRENT_SENSE_CAL_SAMPLES;
+      }
+    }
+    return;
+  }
+
+  for (int m = 0; m < CURRENT_SENSE_NUM_MOTORS; m++) {
+    g_sample.ia[m] = raw_a[m] - g_offset_a[m];
+    g_sample.ib[m] = raw_b[m] - g_offset_b[m];
+  }
+  g_sample.seq++;
+
+  if (g_cb)
+    g_cb(&g_sample);
+
+  // next sequence finished while the callback was still running
+  if (ADC1->ISR & ADC_ISR_JEOS)
+    g_overruns++;
+  // calibration periods are left out, they don't run the loop
+  cpu_prof_end(SYNC_CPU_ADC_ISR, t0);
+}
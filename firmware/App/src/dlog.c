@@ -0,0 +1,39 @@
+#include "dlog.h"
+#include "SEGGER_RTT.h"
+#include "cycle_counter.h"
+#include <stdbool.h>
+
+static uint8_t g_dlog_buf[DLOG_BUFFER_SIZE];
+static uint8_t g_seq = 0;
+static volatile uint32_t g_dropped = 0;
+static volatile bool g_ready = false;
+
+void dlog_init(void) {
+  cycle_counter_init();
+  SEGGER_RTT_ConfigUpBuffer(DLOG_RTT_CHANNEL, "dlog", g_dlog_buf,
+                            sizeof(g_dlog_buf), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+  g_ready = true;
+}
+
+void dlog_begin(dlog_rec_t *r, const char *fmt) {
+  r->fmt = (uint16_t)(fmt - __start_dlog_fmt);
+  r->len = 0;
+  r->cycles = cycle_count();
+}
+
+void dlog_commit(dlog_rec_t *r) {
+  unsigned n = 8u + r->len;
+  if (!g_ready) { // interrupts that fire before dlog_init
+    g_dropped++;
+    return;
+  }
+  // the sequence number and the write have to be atomic against other
+  // interrupts or the host would see records out of order
+  SEGGER_RTT_LOCK();
+  r->seq = g_seq++;
+  if (SEGGER_RTT_WriteSkipNoLock(DLOG_RTT_CHANNEL, r, n) == 0)
+    g_dropped++;
+  SEGGER_RTT_UNLOCK();
+}
+
+uint32_t dlog_dropped(void) { return g_dropped; }
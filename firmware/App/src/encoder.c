@@ -0,0 +1,76 @@
+#include "encoder.h"
+#include "tcm.h"
+
+void encoder_init(encoder_t *e, uint32_t ts_hz, const encoder_sample_t *s) {
+  e->pos = 0;
+  e->vel = 0;
+  e->cnt = s->cnt;
+  e->edge_t = s->edge_t;
+  e->edge_pos = 0;
+  e->edge_valid = false;
+  e->ts_shift = 0;
+  while (((uint64_t)ts_hz << (e->ts_shift + 1)) <= UINT32_MAX)
+    e->ts_shift++;
+  e->ts_num = ts_hz << e->ts_shift;
+  e->stale_ticks = ts_hz / ENCODER_STALE_DIV;
+  e->edges = 0;
+}
+
+// dp counts over dt ticks in counts/s Q8. dt is cut down to 16 bits first so
+// a 32 bit divide keeps 15 bits or more of quotient, then one multiply and a
+// shift put the timestamp clock and the Q back.
+TCM_CODE static int32_t mt_rate(const encoder_t *e, int32_t dp, uint32_t dt) {
+  int sh = (dt >> 16) ? 16 - __builtin_clz(dt) : 0;
+  uint32_t q = e->ts_num / (dt >> sh); // ts_hz / dt << (ts_shift - sh)
+  int64_t v = (int64_t)dp * q;
+  int n = e->ts_shift + sh - ENCODER_VEL_FRAC;
+  if (n > 0)
+    v = (v + ((int64_t)1 << (n - 1))) >> n;
+  else
+    v <<= -n;
+  if (v > INT32_MAX)
+    return INT32_MAX;
+  if (v < -INT32_MAX)
+    return -INT32_MAX;
+  return (int32_t)v;
+}
+
+TCM_CODE void encoder_update(encoder_t *e, const encoder_sample_t *s) {
+  e->pos += (int16_t)(s->cnt - e->cnt);
+  e->cnt = s->cnt;
+
+  if (s->edge_t != e->edge_t) {
+    // the edge is from this period, its count a short way back from now
+    int64_t edge_pos = e->pos + (int16_t)(s->edge_cnt - s->cnt);
+    if (e->edge_valid) {
+      e->vel = mt_rate(e, (int32_t)(edge_pos - e->edge_pos),
+                       s->edge_t - e->edge_t);
+      e->edges++;
+    }
+    e->edge_t = s->edge_t;
+    e->edge_pos = edge_pos;
+    e->edge_valid = true;
+    return;
+  }
+  if (!e->edge_valid)
+    return;
+
+  uint32_t since = s->now_t - e->edge_t;
+  if (since == 0)
+    return;
+  if (since > e->stale_ticks) {
+    // and the next edge starts a new window instead of ending a stale one
+    e->vel = 0;
+    e->edge_valid = false;
+    return;
+  }
+  int32_t bound = mt_rate(e, ENCODER_EDGE_COUNTS, since);
+  if (e->vel > bound)
+    e->vel = bound;
+  else if (e->vel < -bound)
+    e->vel = -bound;
+}
+
+float encoder_velocity(const encoder_t *e) {
+  return (float)e->vel * (1.0f / (float)(1 << ENCODER_VEL_FRAC));
+}
@@ -0,0 +1,169 @@
+#include "foc.h"
+#include "tcm.h"
+
+#define FOC_SQRT3_2 0.86602540378f
+#define FOC_INV_SQRT3 0.57735026919f
+
+TCM_CODE static float clampf(float v, float lo, float hi) {
+  if (v < lo)
+    return lo;
+  if (v > hi)
+    return hi;
+  return v;
+}
+
+void foc_init(foc_t *f, const foc_params_t *p) {
+  f->p = *p;
+  // min/max injection reaches the inscribed circle of the hexagon
+  f->v_max = p->vbus * FOC_INV_SQRT3;
+  f->id_ref = f->iq_ref = 0.0f;
+  f->id = f->iq = 0.0f;
+  f->vd = f->vq = 0.0f;
+  f->theta_e = 0.0f;
+  f->enc_offset = 0;
+  f->enc_pos = 0;
+  f->enc_mod = 0;
+  f->enc_valid = false;
+  f->align_left = 0;
+  f->align_current = 0.0f;
+  f->duty[0] = f->duty[1] = f->duty[2] = 0.0f;
+  f->enabled = false;
+  foc_set_gains(f, 0.0f, 0.0f);
+}
+
+void foc_set_gains(foc_t *f, float kp, float ki) {
+  // arm_pid works on per-sample gains
+  f->pid_d.Kp = f->pid_q.Kp = kp;
+  f->pid_d.Ki = f->pid_q.Ki = ki * f->p.ts;
+  f->pid_d.Kd = f->pid_q.Kd = 0.0f;
+  arm_pid_init_f32(&f->pid_d, 1);
+  arm_pid_init_f32(&f->pid_q, 1);
+}
+
+void foc_tune_bandwidth(foc_t *f, float bw_rad_s) {
+  foc_set_gains(f, f->p.phase_l * bw_rad_s, f->p.phase_r * bw_rad_s);
+}
+
+void foc_set_current(foc_t *f, float id_ref, float iq_ref) {
+  f->id_ref = id_ref;
+  f->iq_ref = iq_ref;
+}
+
+void foc_enable(foc_t *f, bool en) {
+  if (en && !f->enabled) {
+    arm_pid_reset_f32(&f->pid_d);
+    arm_pid_reset_f32(&f->pid_q);
+  }
+  f->enabled = en;
+}
+
+void foc_align(foc_t *f, float current, int32_t periods) {
+  f->align_current = current;
+  f->align_left = periods;
+}
+
+TCM_CODE bool foc_aligning(const foc_t *f) { return f->align_left > 0; }
+
+bool foc_encoder_cpr_valid(float encoder_cpr) {
+  return encoder_cpr >= 1.0f && encoder_cpr <= FOC_MAX_ENCODER_CPR &&
+         encoder_cpr == floorf(encoder_cpr);
+}
+
+void foc_set_encoder_cpr(foc_t *f, float encoder_cpr) {
+  f->p.encoder_cpr = encoder_cpr;
+  f->enc_offset %= (int32_t)encoder_cpr;
+  f->enc_valid = false;
+}
+
+// Runs the PI and clamps its stored output, which is the integrator in the
+// velocity form arm_pid uses, so it cannot wind up past the limit
+TCM_CODE static float pi_step(arm_pid_instance_f32 *pid, float err, float lim) {
+  float out = clampf(arm_pid_f32(pid, err), -lim, lim);
+  pid->state[2] = out;
+  return out;
+}
+
+// Position modulo cpr. The change since the last step is far below a
+// revolution, so one add and wrap carries it along; the 64 bit divide, a
+// libgcc call in flash, only runs on the first step and after a cpr change.
+TCM_CODE static int32_t enc_reduce(foc_t *f, int64_t pos) {
+  int32_t cpr = (int32_t)f->p.encoder_cpr;
+  int64_t d = pos - f->enc_pos;
+  int32_t c;
+  if (f->enc_valid && d > -cpr && d < cpr) {
+    c = f->enc_mod + (int32_t)d;
+    if (c < 0)
+      c += cpr;
+    else if (c >= cpr)
+      c -= cpr;
+  } else {
+    c = (int32_t)(pos % cpr);
+    if (c < 0)
+      c += cpr;
+    f->enc_valid = true;
+  }
+  f->enc_pos = pos;
+  f->enc_mod = c;
+  return c;
+}
+
+TCM_CODE static float enc_to_theta_e(const foc_t *f, int32_t enc_mod) {
+  int32_t c = enc_mod - f->enc_offset;
+  if (c < 0)
+    c += (int32_t)f->p.encoder_cpr;
+  return (float)c * (2.0f * PI * f->p.pole_pairs / f->p.encoder_cpr);
+}
+
+TCM_CODE void foc_step(foc_t *f, float ia, float ib, int64_t enc_pos) {
+  float id_ref = f->id_ref, iq_ref = f->iq_ref;
+  int32_t enc_count = enc_reduce(f, enc_pos);
+  float theta;
+
+  if (f->align_left > 0) {
+    theta = 0.0f;
+    id_ref = f->align_current;
+    iq_ref = 0.0f;
+    if (--f->align_left == 0)
+      f->enc_offset = enc_count;
+  } else {
+    theta = enc_to_theta_e(f, enc_count);
+  }
+  f->theta_e = theta;
+
+  float s = arm_sin_f32(theta);
+  float c = arm_cos_f32(theta);
+
+  float i_alpha, i_beta;
+  arm_clarke_f32(ia, ib, &i_alpha, &i_beta);
+  arm_park_f32(i_alpha, i_beta, &f->id, &f->iq, s, c);
+
+  if (!f->enabled) {
+    f->vd = f->vq = 0.0f;
+    f->duty[0] = f->duty[1] = f->duty[2] = 0.0f;
+    return;
+  }
+
+  // d has priority, q gets whatever voltage is left
+  float vd = pi_step(&f->pid_d, id_ref - f->id, f->v_max);
+  float vq_lim;
+  arm_sqrt_f32(f->v_max * f->v_max - vd * vd, &vq_lim);
+  float vq = pi_step(&f->pid_q, iq_ref - f->iq, vq_lim);
+  f->vd = vd;
+  f->vq = vq;
+
+  float v_alpha, v_beta;
+  arm_inv_park_f32(vd, vq, &v_alpha, &v_beta, s, c);
+
+  // inverse Clarke with min/max zero sequence injection
+  float va = v_alpha;
+  float vb = -0.5f * v_alpha + FOC_SQRT3_2 * v_beta;
+  float vc = -0.5f * v_alpha - FOC_SQRT3_2 * v_beta;
+  float vmax = va > vb ? (va > vc ? va : vc) : (vb > vc ? vb : vc);
+  float vmin = va < vb ? (va < vc ? va : vc) : (vb < vc ? vb : vc);
+  float voff = 0.5f * (vmax + vmin);
+  float inv_vbus = 1.0f / f->p.vbus;
+
+  f->duty[0] = clampf(0.5f + (va - voff) * inv_vbus, 0.0f, 1.0f);
+  f->duty[1] = clampf(0.5f + (vb - voff) * inv_vbus, 0.0f, 1.0f);
+  f->duty[2] = clampf(0.5f + (vc - voff) * inv_vbus, 0.0f, 1.0f);
+}
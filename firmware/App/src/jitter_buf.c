@@ -0,0 +1,109 @@
+#include "jitter_buf.h"
+#include "tcm.h"
+#include <string.h>
+
+void jitter_buf_init(jitter_buf_t *jb, void *storage, uint32_t depth,
+                     uint32_t elem_size, uint32_t tick_ns) {
+  memset(jb, 0, sizeof(*jb));
+  fifo_init_elem(&jb->ring, storage, depth + 1, elem_size, NULL);
+  jb->tick_ns = tick_ns;
+  jb->slack_min_ns = INT64_MAX;
+}
+
+void jitter_buf_flush(jitter_buf_t *jb) {
+  fifo_reset(&jb->ring);
+  jb->last_t_ns = 0;
+  jb->reserved = NULL;
+}
+
+TCM_CODE static uint64_t elem_time(const void *elem) {
+  uint64_t t;
+  memcpy(&t, elem, sizeof(t));
+  return t;
+}
+
+static bool in_order(jitter_buf_t *jb, uint64_t t) {
+  if (t <= jb->last_t_ns && jb->last_t_ns != 0) {
+    jb->stats.misordered++;
+    return false;
+  }
+  return true;
+}
+
+static void accepted(jitter_buf_t *jb, uint64_t t, uint64_t now_ns) {
+  jb->last_t_ns = t;
+  int64_t slack = (int64_t)(t - now_ns);
+  if (slack < jb->slack_min_ns)
+    jb->slack_min_ns = slack;
+}
+
+bool jitter_buf_push(jitter_buf_t *jb, const void *elem, uint64_t now_ns) {
+  uint64_t t = elem_time(elem);
+  if (!in_order(jb, t))
+    return false;
+  if (fifo_write(&jb->ring, elem, 1) != 1) {
+    jb->stats.overflows++;
+    return false;
+  }
+  accepted(jb, t, now_ns);
+  return true;
+}
+
+void *jitter_buf_reserve(jitter_buf_t *jb) {
+  void *span;
+  if (fifo_reserve(&jb->ring, &span) == 0) {
+    jb->stats.overflows++;
+    jb->reserved = NULL;
+    return NULL;
+  }
+  jb->reserved = span;
+  return span;
+}
+
+bool jitter_buf_commit(jitter_buf_t *jb, uint64_t now_ns) {
+  if (!jb->reserved)
+    return false;
+  uint64_t t = elem_time(jb->reserved);
+  jb->reserved = NULL;
+  if (!in_order(jb, t))
+    return false;
+  fifo_commit(&jb->ring, 1);
+  accepted(jb, t, now_ns);
+  return true;
+}
+
+int64_t jitter_buf_take_slack(jitter_buf_t *jb) {
+  int64_t s = jb->slack_min_ns;
+  jb->slack_min_ns = INT64_MAX;
+  return s;
+}
+
+TCM_CODE jitter_buf_result_t jitter_buf_release(jitter_buf_t *jb,
+                                                uint64_t now_ns, void *out) {
+  uint64_t half = jb->tick_ns / 2;
+  bool released = false;
+  const void *span;
+  // peek the head in place, a sample for a later tick stays where it is
+  while (fifo_peek(&jb->ring, &span) > 0) {
+    uint64_t t = elem_time(span);
+    if ((int64_t)(t - now_ns) > (int64_t)half)
+      break;
+    if ((int64_t)(now_ns - t) >= (int64_t)half)
+      jb->stats.late++;
+    if (released)
+      jb->stats.skipped++;
+    memcpy(out, span, jb->ring.elem);
+    fifo_consume(&jb->ring, 1);
+    released = true;
+  }
+  if (released) {
+    jb->stats.released++;
+    return JITTER_RELEASED;
+  }
+  if (fifo_is_empty(&jb->ring)) {
+    jb->stats.empty++;
+    return JITTER_EMPTY;
+  }
+  jb->stats.waits++;
+  return JITTER_WAIT;
+}
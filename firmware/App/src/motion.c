@@ -0,0 +1,216 @@
+#include "motion.h"
+#include "fifo.h"
+#include "stm32h7xx.h"
+#include "tcm.h"
+#include "telemetry.h"
+#include "tmc_spi.h"
+#include <string.h>
+
+// Position/velocity loops for the FOC axes. Setpoints carry the scheduler
+// time they run at and wait in a jitter buffer, filled from USB and released
+// on their tick, so ConfigSystem.timestep has to match the tick.
+
+#define MOTION_TICK_S 0.001f
+#define MOTION_ALIGN_CURRENT 2.0f // A on d while finding the encoder offset
+
+typedef enum {
+  MOTION_OFF,
+  MOTION_ALIGNING, // gates on, waiting for the encoder offsets
+  MOTION_RUNNING,
+} motion_state_t;
+
+_Static_assert(TELEMETRY_AXES == MOTION_NUM_AXES, "telemetry axis count");
+_Static_assert(TELEMETRY_TICK_NS == MOTION_TICK_NS, "telemetry tick");
+_Static_assert(TMC_SPI_DRIVERS == MOTION_NUM_AXES, "one TMC2240 per axis");
+_Static_assert(TELEMETRY_DRV_REGS == TMC_SPI_REGS, "telemetry driver regs");
+
+TCM_BSS static pos_ctrl_t g_ctrl[MOTION_NUM_AXES];
+TCM_BSS static float g_counts_per_mm[MOTION_NUM_AXES];
+// the trajectory ring, filled from USB and drained by the tick
+TCM_BSS static motion_setpoint_t g_ring_storage[MOTION_RING_DEPTH + 1];
+TCM_BSS static jitter_buf_t g_jb;
+static cmd_decoder_t g_cmd; // USB side, the jitter buffer's producer
+TCM_BSS static motion_setpoint_t g_last; // held when nothing is due
+TCM_BSS static motion_stats_t g_stats;
+static volatile motion_state_t g_state = MOTION_OFF;
+static bool g_aligned[MOTION_NUM_AXES]; // once per boot, the offset stays
+
+void motion_init(void) {
+  pos_ctrl_params_t p = {
+      .kp_pos = 150.0f,
+      .kp_vel = 0.05f,
+      .ki_vel = 2.0f,
+      .tf_vel = 0.0005f,
+      .ka = 2.1e-4f,
+      .kj = 3.3e-8f,
+      .i_max = 10.0f,
+      .ts = MOTION_TICK_S,
+  };
+
+  jitter_buf_init(&g_jb, g_ring_storage, MOTION_RING_DEPTH,
+                  sizeof(motion_setpoint_t), MOTION_TICK_NS);
+  cmd_decoder_init(&g_cmd);
+  g_cmd.set_pid = motion_set_pid;
+  g_cmd.set_params = motion_set_params;
+  memset(&g_last, 0, sizeof(g_last));
+  memset(&g_stats, 0, sizeof(g_stats));
+  for (int a = 0; a < MOTION_NUM_AXES; a++) {
+    pos_ctrl_init(&g_ctrl[a], &p);
+    g_counts_per_mm[a] = 4096.0f / 40.0f;
+  }
+}
+
+uint32_t motion_ring_free(void) { return (uint32_t)fifo_free(&g_jb.ring); }
+
+bool motion_push(const motion_setpoint_t *sp, uint64_t now_ns) {
+  return jitter_buf_push(&g_jb, sp, now_ns);
+}
+
+bool motion_rx_cmd(const uint8_t *buf, uint32_t len, uint64_t now_ns) {
+  return cmd_decode_frame(&g_cmd, &g_jb, buf, len, now_ns);
+}
+
+int64_t motion_take_slack_ns(void) { return jitter_buf_take_slack(&g_jb); }
+
+void motion_flush(void) {
+  NVIC_DisableIRQ(TIM24_IRQn);
+  jitter_buf_flush(&g_jb);
+  NVIC_EnableIRQ(TIM24_IRQn);
+}
+
+// int64_t to float is a libgcc call (__aeabi_l2f) out of flash. The two
+// 32 bit halves each convert in the FPU, the low one signed so the usual
+// case of a high half of zero is exact to float precision.
+TCM_CODE static inline float counts_to_mm(int a, int64_t counts) {
+  int32_t lo = (int32_t)counts;
+  int32_t hi = (int32_t)((counts - lo) >> 32);
+  return ((float)hi * 4294967296.0f + (float)lo) / g_counts_per_mm[a];
+}
+
+TCM_CODE void motion_tick(uint64_t now_ns) {
+  if (g_state == MOTION_OFF)
+    return;
+  if (g_state == MOTION_ALIGNING) {
+    for (int a = 0; a < MOTION_NUM_AXES; a++)
+      if (motor_aligning(a))
+        return;
+    // hold where the rotors settled until a setpoint comes due
+    for (int a = 0; a < MOTION_NUM_AXES; a++) {
+      pos_ctrl_reset(&g_ctrl[a]);
+      g_last.axis[a].pos = counts_to_mm(a, motor_position(a));
+    }
+    g_state = MOTION_RUNNING;
+  }
+
+  motion_setpoint_t sp;
+  if (jitter_buf_release(&g_jb, now_ns, &sp) == JITTER_RELEASED) {
+    g_last = sp;
+    // survives HELLO, a host reattaching resumes after this one
+    g_stats.ack = sp.seq + 1;
+  } else {
+    // hold position with no feedforward until the host catches up
+    g_stats.underruns++;
+    sp = g_last;
+    for (int a = 0; a < MOTION_NUM_AXES; a++)
+      sp.axis[a].vel = sp.axis[a].acc = sp.axis[a].jerk = 0.0f;
+  }
+
+  // NULL on all but the sample ticks, a slot copy when it isn't
+  telemetry_sample_t *tlm = telemetry_begin(now_ns);
+
+  for (int a = 0; a < MOTION_NUM_AXES; a++) {
+    int64_t enc = motor_position(a);
+    float pos = counts_to_mm(a, enc);
+    float iq = pos_ctrl_step(&g_ctrl[a], &sp.axis[a], pos);
+    motor_set_current(a, 0.0f, iq);
+
+    float err = fabsf(g_ctrl[a].err);
+    if (err > g_stats.max_err[a])
+      g_stats.max_err[a] = err;
+
+    if (tlm) {
+      const foc_t *f = motor_foc(a);
+      tlm->err[a] = g_ctrl[a].err;
+      tlm->id[a] = f->id;
+      tlm->iq[a] = f->iq;
+      tlm->iq_ref[a] = iq;
+      tlm->enc[a] = (int32_t)enc;
+      tlm->sp_pos[a] = sp.axis[a].pos;
+      tlm->sp_vel[a] = sp.axis[a].vel;
+      tmc_spi_latest(a, tlm->drv[a]);
+    }
+  }
+  if (tlm) {
+    tlm->jb_depth = (uint16_t)fifo_size(&g_jb.ring);
+    tlm->underruns = (uint16_t)g_stats.underruns;
+    telemetry_commit();
+  }
+}
+
+void motion_enable(bool en) {
+  // a host reattaching sends HELLO again, the loops just keep running
+  if (en == (g_state != MOTION_OFF))
+    return;
+  NVIC_DisableIRQ(TIM24_IRQn);
+  for (int a = 0; a < MOTION_NUM_AXES; a++) {
+    if (en) {
+      // the bridge first: the current loop counts the alignment down
+      // whether it drives the current or not
+      motor_set_current(a, 0.0f, 0.0f);
+      motor_enable(a, true);
+      if (!g_aligned[a]) {
+        motor_align(a, MOTION_ALIGN_CURRENT);
+        g_aligned[a] = true;
+      }
+    } else {
+      motor_set_current(a, 0.0f, 0.0f);
+      motor_enable(a, false);
+    }
+  }
+  // the tick primes the position loops once the alignment is done
+  g_state = en ? MOTION_ALIGNING : MOTION_OFF;
+  NVIC_EnableIRQ(TIM24_IRQn);
+}
+
+void motion_set_pid(int axis, float p, float i, float d, float tf) {
+  if (axis < 0 || axis >= MOTION_NUM_AXES)
+    return;
+  NVIC_DisableIRQ(TIM24_IRQn);
+  pos_ctrl_set_pid(&g_ctrl[axis], p, i, d, tf);
+  NVIC_EnableIRQ(TIM24_IRQn);
+}
+
+void motion_set_params(int axis, float phase_r, float phase_l,
+                       float encoder_cpr, float counts_per_mm) {
+  if (axis < 0 || axis >= MOTION_NUM_AXES)
+    return;
+  NVIC_DisableIRQ(TIM24_IRQn);
+  g_counts_per_mm[axis] = counts_per_mm;
+  pos_ctrl_reset(&g_ctrl[axis]);
+  NVIC_EnableIRQ(TIM24_IRQn);
+  motor_set_params(axis, phase_r, phase_l, encoder_cpr);
+}
+
+void motion_set_feedforward(bool vel, bool acc, bool jerk) {
+  NVIC_DisableIRQ(TIM24_IRQn);
+  for (int a = 0; a < MOTION_NUM_AXES; a++)
+    pos_ctrl_set_feedforward(&g_ctrl[a], vel, acc, jerk);
+  NVIC_EnableIRQ(TIM24_IRQn);
+}
+
+void motion_set_ff_gains(int axis, float ka, float kj) {
+  if (axis < 0 || axis >= MOTION_NUM_AXES)
+    return;
+  NVIC_DisableIRQ(TIM24_IRQn);
+  g_ctrl[axis].p.ka = ka;
+  g_ctrl[axis].p.kj = kj;
+  NVIC_EnableIRQ(TIM24_IRQn);
+}
+
+void motion_stats(motion_stats_t *out) {
+  NVIC_DisableIRQ(TIM24_IRQn);
+  *out = g_stats;
+  out->jb = g_jb.stats;
+  NVIC_EnableIRQ(TIM24_IRQn);
+  out->cmd = g_cmd.stats;
+}
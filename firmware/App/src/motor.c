@@ -0,0 +1,185 @@
+#include "motor.h"
+#include "cycle_counter.h"
+#include "encoder.h"
+#include "main.h"
+#include "stm32h7xx.h"
+#include "tcm.h"
+#include "tim.h"
+
+// Hardware side of the current loop: M1 is TIM1 + ENC1 (TIM3), M2 is TIM8 +
+// ENC2 (TIM4). foc_step runs straight from the ADC JEOS interrupt, which is
+// already locked to the PWM period, and the new duties are picked up by the
+// CCR preload at the next update event.
+//
+// Edge timestamps for the velocity estimate: the encoder timers' CC1
+// captures the count on every ENCx_A rising edge and pulses TRGO, and TIM2
+// (ENC1) / TIM23 (ENC2), free running at the timer clock, capture their
+// counter on that trigger in CC4. Both only have the M3/M4 PWM on CH1-3,
+// which nothing drives yet.
+
+#define MOTOR_POLE_PAIRS 7.0f
+#define MOTOR_ALIGN_PERIODS ((int32_t)(PWM_FREQ_HZ / 2)) // 0.5 s
+// APB1 timer kernel clock, 2x PCLK1 as in scheduler_timer.c: 275 MHz
+#define MOTOR_EDGE_TS_HZ (SystemCoreClock / 2)
+
+typedef struct {
+  TIM_TypeDef *pwm;
+  TIM_TypeDef *enc;
+  TIM_TypeDef *ts;  // edge timestamps
+  uint32_t ts_itr;  // SMCR.TS selecting enc's TRGO, RM0468 ITR table
+  GPIO_TypeDef *en_port;
+  uint16_t en_pin;
+} motor_hw_t;
+
+static const motor_hw_t g_hw[MOTOR_COUNT] = {
+    {TIM1, TIM3, TIM2, TIM_TS_ITR2, EN_GATE_GPIO_Port, EN_GATE_Pin},
+    {TIM8, TIM4, TIM23, TIM_TS_ITR3, EN_GATE_2_GPIO_Port, EN_GATE_2_Pin},
+};
+
+TCM_BSS static foc_t g_foc[MOTOR_COUNT];
+TCM_BSS static encoder_t g_enc[MOTOR_COUNT];
+static motor_cycle_stats_t g_cycles;
+
+// An edge between the reads moves CCR4, which lands a few timer clocks
+// after CCR1; the second read of it is well past that
+TCM_CODE static void encoder_read(const motor_hw_t *hw, encoder_sample_t *s) {
+  uint32_t t;
+  do {
+    t = hw->ts->CCR4;
+    s->edge_cnt = (uint16_t)hw->enc->CCR1;
+    s->cnt = (uint16_t)hw->enc->CNT;
+    s->now_t = hw->ts->CNT;
+  } while (hw->ts->CCR4 != t);
+  s->edge_t = t;
+}
+
+static void edge_timestamps_init(const motor_hw_t *hw) {
+  // compare pulse: TRGO on every CC1 capture
+  hw->enc->CR2 = (hw->enc->CR2 & ~TIM_CR2_MMS) | TIM_TRGO_OC1;
+
+  hw->ts->CR1 = 0;
+  hw->ts->PSC = 0;
+  hw->ts->ARR = 0xFFFFFFFF;
+  hw->ts->SMCR = (hw->ts->SMCR & ~(TIM_SMCR_TS | TIM_SMCR_SMS)) | hw->ts_itr;
+  // IC4 on TRC, no filter or prescaler, rising edge
+  hw->ts->CCMR2 = (hw->ts->CCMR2 & ~TIM_CCMR2_CC4S_Msk & ~TIM_CCMR2_IC4F &
+                   ~TIM_CCMR2_IC4PSC) |
+                  (3u << TIM_CCMR2_CC4S_Pos);
+  hw->ts->CCER = (hw->ts->CCER & ~(TIM_CCER_CC4P | TIM_CCER_CC4NP)) |
+                 TIM_CCER_CC4E;
+  hw->ts->EGR = TIM_EGR_UG;
+  hw->ts->CR1 = TIM_CR1_CEN;
+}
+
+TCM_CODE static void motor_current_loop(const current_sample_t *s) {
+  uint32_t t0 = cycle_count();
+
+  for (int m = 0; m < MOTOR_COUNT; m++) {
+    const motor_hw_t *hw = &g_hw[m];
+    foc_t *f = &g_foc[m];
+
+    encoder_sample_t es;
+    encoder_read(hw, &es);
+    encoder_update(&g_enc[m], &es);
+
+    foc_step(f, (float)s->ia[m] * MOTOR_AMPS_PER_COUNT,
+             (float)s->ib[m] * MOTOR_AMPS_PER_COUNT, g_enc[m].pos);
+
+    hw->pwm->CCR1 = (uint32_t)(f->duty[0] * (float)PWM_ARR);
+    hw->pwm->CCR2 = (uint32_t)(f->duty[1] * (float)PWM_ARR);
+    hw->pwm->CCR3 = (uint32_t)(f->duty[2] * (float)PWM_ARR);
+  }
+
+  uint32_t dt = cycle_count() - t0;
+  g_cycles.last = dt;
+  if (dt < g_cycles.min)
+    g_cycles.min = dt;
+  if (dt > g_cycles.max)
+    g_cycles.max = dt;
+  g_cycles.count++;
+}
+
+void motor_init(void) {
+  foc_params_t p = {
+      .phase_r = 0.5f,
+      .phase_l = 200e-6f,
+      .pole_pairs = MOTOR_POLE_PAIRS,
+      .encoder_cpr = 4096.0f,
+      .vbus = MOTOR_VBUS,
+      .ts = 1.0f / (float)PWM_FREQ_HZ,
+  };
+
+  cycle_counter_init();
+  g_cycles.min = UINT32_MAX;
+  g_cycles.max = 0;
+  g_cycles.count = 0;
+
+  // CC1E on as well, the edge capture
+  HAL_TIM_Encoder_Start(&htim3, TIM_CHANNEL_ALL);
+  HAL_TIM_Encoder_Start(&htim4, TIM_CHANNEL_ALL);
+
+  for (int m = 0; m < MOTOR_COUNT; m++) {
+    foc_init(&g_foc[m], &p);
+    foc_tune_bandwidth(&g_foc[m], MOTOR_CURRENT_BW_RAD_S);
+    edge_timestamps_init(&g_hw[m]);
+    encoder_sample_t es;
+    encoder_read(&g_hw[m], &es);
+    encoder_init(&g_enc[m], MOTOR_EDGE_TS_HZ, &es);
+  }
+
+  current_sense_set_callback(motor_current_loop);
+}
+
+void motor_set_params(int m, float phase_r, float phase_l, float encoder_cpr) {
+  if (m < 0 || m >= MOTOR_COUNT || !foc_encoder_cpr_valid(encoder_cpr))
+    return;
+  // the loop must not run on a half updated state. The enable stays and the
+  // encoder offset carries over modulo the new count, a running axis keeps
+  // running on the new model.
+  NVIC_DisableIRQ(ADC_IRQn);
+  g_foc[m].p.phase_r = phase_r;
+  g_foc[m].p.phase_l = phase_l;
+  foc_set_encoder_cpr(&g_foc[m], encoder_cpr);
+  foc_tune_bandwidth(&g_foc[m], MOTOR_CURRENT_BW_RAD_S);
+  NVIC_EnableIRQ(ADC_IRQn);
+}
+
+TCM_CODE void motor_set_current(int m, float id, float iq) {
+  if (m < 0 || m >= MOTOR_COUNT)
+    return;
+  NVIC_DisableIRQ(ADC_IRQn);
+  foc_set_current(&g_foc[m], id, iq);
+  NVIC_EnableIRQ(ADC_IRQn);
+}
+
+void motor_align(int m, float current) {
+  if (m < 0 || m >= MOTOR_COUNT)
+    return;
+  NVIC_DisableIRQ(ADC_IRQn);
+  foc_align(&g_foc[m], current, MOTOR_ALIGN_PERIODS);
+  NVIC_EnableIRQ(ADC_IRQn);
+}
+
+TCM_CODE bool motor_aligning(int m) { return foc_aligning(&g_foc[m]); }
+
+void motor_enable(int m, bool en) {
+  if (m < 0 || m >= MOTOR_COUNT)
+    return;
+  NVIC_DisableIRQ(ADC_IRQn);
+  foc_enable(&g_foc[m], en);
+  NVIC_EnableIRQ(ADC_IRQn);
+  HAL_GPIO_WritePin(g_hw[m].en_port, g_hw[m].en_pin,
+                    en ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+TCM_CODE int64_t motor_position(int m) { return g_enc[m].pos; }
+
+float motor_velocity(int m) { return encoder_velocity(&g_enc[m]); }
+
+foc_t *motor_foc(int m) { return &g_foc[m]; }
+
+void motor_cycle_stats(motor_cycle_stats_t *out) {
+  NVIC_DisableIRQ(ADC_IRQn);
+  *out = g_cycles;
+  NVIC_EnableIRQ(ADC_IRQn);
+}
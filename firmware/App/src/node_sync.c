@@ -1,38 +1,96 @@
+#include "cpu_prof.h"
+#include "device/dcd.h"
+#include "dlog.h"
+#include "motion.h"
 #include "node_time.h"
 #include "sched_servo.h"
+#include "sync_caps.h"
 #include "sync_protocol.h"
+#include "tcm.h"
+#include "telemetry.h"
 #include "tusb.h"
+#include "usb_sof.h"
 #include "vendor/vendor_device.h"
 #include <stdio.h>
 #include <string.h>
 
 extern sched_servo_fixed_t g_sched_servo;
 
+// Fed from OTG_HS_IRQHandler, usb_sof_init() once before the USB interrupt
+// is enabled
+TCM_BSS usb_sof_t g_usb_sof;
+#define SYNC_RHPORT 1 // USB_OTG_HS, as passed to tusb_rhport_init
+
 // Only one outstanding request at a time
-static sync_req_t g_last_req;
-static int g_req_pending = 0;
-static uint16_t g_seq = 0;
-static uint8_t g_host_ready = 0;
+TCM_BSS static sync_req_t g_last_req;
+TCM_BSS static int g_req_pending = 0;
+TCM_BSS static uint16_t g_seq = 0;
+TCM_BSS static uint8_t g_host_ready = 0;
+// set by sync_tick when the host stopped answering, sync_task turns the
+// motors off from the main loop
+TCM_BSS static volatile uint8_t g_session_lost = 0;
+TCM_BSS static uint32_t g_since_resp = 0;
+// this session's configuration, from the last HELLO
+static sync_caps_t g_caps;
+// SYNC_VREQ_BULK_TEST, main loop and USB task only
+static sync_bulk_test_t g_bulk;
+
+#define SYNC_MAX_BATCH 3 // Moves.move max_count in messages.proto
 
 // Sync interval (e.g. every 20 ms)
 #define SYNC_INTERVAL_TICKS 20 // if scheduler tick is 1 ms
+// no response for this long and the host is taken to be gone
+#define SYNC_LOST_TICKS 500
 
-static uint32_t g_sync_tick_counter = 0;
+TCM_BSS static uint32_t g_sync_tick_counter = 0;
 extern uint64_t scheduler_time_ns;
+uint64_t scheduler_now_ns(void);
 
 void sync_init(void) {
   memset(&g_last_req, 0, sizeof(g_last_req));
   g_req_pending = 0;
   g_seq = 0;
   g_sync_tick_counter = 0;
+  g_since_resp = 0;
   g_host_ready = 0;
 }
 
+// Unmount, suspend or a host that went quiet: no one is left to stop the
+// motors, so they stop here
+static void sync_session_end(void) {
+  g_host_ready = 0;
+  g_req_pending = 0;
+  motion_enable(false);
+}
+
+void tud_umount_cb(void) { sync_session_end(); }
+
+void tud_suspend_cb(bool remote_wakeup_en) {
+  (void)remote_wakeup_en;
+  sync_session_end();
+}
+
+// Main loop
+void sync_task(void) {
+  if (g_session_lost) {
+    g_session_lost = 0;
+    motion_enable(false);
+  }
+}
+
 // Called from scheduler_tick_handler() once per 1 ms tick
-void sync_tick(void) {
+TCM_CODE void sync_tick(void) {
   g_sync_tick_counter++;
+  if (g_host_ready && ++g_since_resp >= SYNC_LOST_TICKS) {
+    g_host_ready = 0;
+    g_req_pending = 0;
+    g_session_lost = 1;
+    return;
+  }
 
-  if (!g_req_pending && g_sync_tick_counter >= SYNC_INTERVAL_TICKS) {
+  // a telemetry packet going into the TX FIFO: send on a later tick
+  if (!g_req_pending && g_sync_tick_counter >= SYNC_INTERVAL_TICKS &&
+      !telemetry_tx_busy()) {
     g_sync_tick_counter = 0;
     if (!g_host_ready)
       return;
@@ -54,12 +112,8 @@ void sync_tick(void) {
     tud_vendor_write_flush();
 
     // uint32_t bytes_sent = tud_vendor_flush();
-    printf("Sent sync request\n");
+    DLOG("Sent sync request %u\n", req.seq);
     // printf("sent %u bytes\n", bytes_sent);
-  } else if (g_req_pending && g_sync_tick_counter >= SYNC_INTERVAL_TICKS) {
-    // g_host_ready = 0;
-    // g_sync_tick_counter = 0;
-    // printf("Host timed out\n");
   }
 }
 
@@ -74,29 +128,96 @@ static void handle_sync_resp(const sync_resp_t *resp) {
     return;
   }
 
-  uint64_t t3_node_ns =
-      g_last_req.t0_ns +
-      ((int32_t)(g_sched_servo.freq_corr_fp * node_time_now_ns()) >>
-       SERVO_FP_SHIFT);
+  // t0 is scheduler time and the clock was zeroed when the request went
+  // out, scheduler time runs slower than TIM5 by the rate correction
+  int64_t elapsed = (int64_t)node_time_now_ns();
+  uint64_t t3_node_ns = g_last_req.t0_ns + elapsed -
+                        elapsed * g_sched_servo.freq_corr_ppb / 1000000000LL;
 
+  // the servo takes the oscillator drift from the SOF fit when it has one
+  sched_servo_fixed_set_bus_drift(&g_sched_servo, usb_sof_poll(&g_usb_sof),
+                                  g_usb_sof.est.drift_ppb);
   sched_servo_fixed_on_sync(&g_sched_servo, g_last_req.t0_ns, resp->t1_ns,
                             resp->t2_ns, t3_node_ns);
 
   g_req_pending = 0;
+  g_since_resp = 0;
 
   // After updating servo, send stats to host
   sync_stats_t stats;
   stats.msg_type = SYNC_MSG_TYPE_STATS;
   stats.reserved = 0;
   stats.seq = resp->seq;
-  stats.offset_ns = g_sched_servo.last_offset_ns;
+  stats.offset_ns = g_sched_servo.est.valid ? g_sched_servo.est_offset_ns
+                                             : g_sched_servo.last_offset_ns;
   stats.delay_ns = g_sched_servo.last_delay_ns;
   stats.freq_corr_ppm = sched_servo_fixed_freq_ppm(&g_sched_servo);
+  stats.bus_drift_ppb =
+      g_sched_servo.bus_valid ? g_sched_servo.bus_drift_ppb : 0;
+  stats.host_bus_ppb =
+      g_sched_servo.host_bus_n
+          ? (int32_t)(g_sched_servo.host_bus_acc / SERVO_HOST_BUS_DIV)
+          : 0;
+  // jitter buffer slack since the last stats, INT32_MAX if nothing arrived
+  int64_t slack = motion_take_slack_ns();
+  stats.sp_slack_ns = slack > INT32_MAX   ? INT32_MAX
+                      : slack < INT32_MIN ? INT32_MIN
+                                          : (int32_t)slack;
+  motion_stats_t ms;
+  motion_stats(&ms);
+  stats.sp_late = ms.jb.late;
+  stats.sp_ack = ms.ack;
 
   tud_vendor_write(&stats, sizeof(stats));
   tud_vendor_write_flush();
 }
 
+static void node_caps(sync_caps_t *c) {
+  memset(c, 0, sizeof(*c));
+  c->encodings = SYNC_ENC_PB;
+  c->features = SYNC_FEAT_TIMESTAMPED_SP | SYNC_FEAT_ACK |
+                SYNC_FEAT_SOF_DRIFT | SYNC_FEAT_TELEMETRY | SYNC_FEAT_MOTION;
+  c->max_batch = SYNC_MAX_BATCH;
+  c->sp_buffer = MOTION_RING_DEPTH;
+  c->max_rate_hz = 1000000000u / MOTION_TICK_NS;
+  c->ep_out_size = c->ep_in_size =
+      tud_speed_get() == TUSB_SPEED_HIGH ? 512 : 64;
+}
+
+// Vendor requests on EP0. The reply has to stay put until the data stage is
+// done, so it is static.
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage,
+                                tusb_control_request_t const *request) {
+  static sync_cpu_prof_t prof;
+  if (stage != CONTROL_STAGE_SETUP)
+    return true;
+  if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR ||
+      request->bmRequestType_bit.direction != TUSB_DIR_IN)
+    return false; // stalls
+  switch (request->bRequest) {
+  case SYNC_VREQ_CPU_PROF: {
+    uint64_t now = node_time_raw_ns();
+    cpu_prof_read(&prof, now);
+    if (request->wValue & SYNC_CPU_PROF_RESET)
+      cpu_prof_reset(now);
+    uint16_t len = request->wLength < sizeof(prof) ? request->wLength
+                                                    : (uint16_t)sizeof(prof);
+    return tud_control_xfer(rhport, request, &prof, len);
+  }
+  case SYNC_VREQ_BULK_TEST: {
+    static sync_bulk_test_t last;
+    last = g_bulk;
+    memset(&g_bulk, 0, sizeof(g_bulk));
+    g_bulk.in_left = (uint32_t)request->wIndex << 16 | request->wValue;
+    uint16_t len = request->wLength < sizeof(last) ? request->wLength
+                                                    : (uint16_t)sizeof(last);
+    return tud_control_xfer(rhport, request, &last, len);
+  }
+  default:
+    return false;
+  }
+}
+
 // TinyUSB vendor RX callback
 void tud_vendor_rx_cb(uint8_t idx, const uint8_t *buffer, uint32_t bufsize) {
   // printf("Got vendor usb msg, buffer: %p, size: %ld\n", buffer, bufsize);
@@ -105,24 +226,71 @@ void tud_vendor_rx_cb(uint8_t idx, const uint8_t *buffer, uint32_t bufsize) {
   if (bufsize == 0)
     return;
   uint8_t msg_type = buffer[0];
-  printf("msg_type: %" PRIu8 ", bufsize: %u\n", buffer[0], bufsize);
+  DLOG("msg_type: %u, bufsize: %u\n", msg_type, bufsize);
   if (msg_type == SYNC_MSG_TYPE_RESP && bufsize == sizeof(sync_resp_t)) {
-    printf("Sync resp\n");
+    DLOG("Sync resp\n");
     sync_resp_t resp;
     memcpy(&resp, buffer, sizeof(resp));
     handle_sync_resp(&resp);
   } else if (msg_type == SYNC_MSG_TYPE_HELLO &&
-             bufsize == sizeof(sync_hello_t)) {
-    printf("Host says Hello\n");
+             (bufsize == SYNC_HELLO_V1_SIZE ||
+              bufsize == sizeof(sync_hello_t))) {
+    DLOG("Host says Hello\n");
     zero_clock();
     scheduler_time_ns = 0;
     sync_init();
-    // can check stuff here if we want
-    // sync_hello_t hello;
-    // memcpy(&hello, buf, sizeof(resp));
+    // setpoints stamped against the old clock would never come due
+    motion_flush();
+    // the host asks for telemetry again once it is listening
+    telemetry_config(0, 1);
+    // TinyUSB only keeps the SOF interrupt on for its own consumers, and a
+    // SET_CONFIGURATION turns it off again. Enabling it in the controller
+    // directly doesn't queue an event per microframe to tud_task.
+    dcd_sof_enable(SYNC_RHPORT, true);
+    node_caps(&g_caps);
+    sync_caps_negotiate(buffer, bufsize, &g_caps);
+    // a version 1 host wouldn't know the reply
+    if (bufsize == sizeof(sync_hello_t) &&
+        ((const sync_hello_t *)buffer)->protocol_version >= 2) {
+      tud_vendor_write(&g_caps, sizeof(g_caps));
+      tud_vendor_write_flush();
+    }
     g_host_ready = 1;
+    // only a host that drives the motors gets the bridges, a HELLO from
+    // one that only syncs its clock ends whatever session ran before
+    motion_enable((g_caps.features_on & SYNC_FEAT_MOTION) != 0);
+  } else if (msg_type == SYNC_MSG_TYPE_CMD) {
+    // motion frames from the server share the endpoint, the moves are
+    // parsed straight into the jitter buffer
+    if (!motion_rx_cmd(buffer, bufsize, scheduler_now_ns()))
+      DLOG("Bad cmd frame, %u bytes\n", bufsize);
+  } else if (msg_type == SYNC_MSG_TYPE_BULK_TEST) {
+    g_bulk.out_packets++;
+    g_bulk.out_bytes += bufsize;
+  } else if (msg_type == SYNC_MSG_TYPE_TLM_CFG &&
+             bufsize == sizeof(sync_tlm_cfg_t)) {
+    sync_tlm_cfg_t cfg;
+    memcpy(&cfg, buffer, sizeof(cfg));
+    telemetry_config(cfg.channels, cfg.decimation);
+    DLOG("Telemetry channels %x every %u ticks\n", cfg.channels,
+         cfg.decimation);
   }
-  printf("Done with rx cb\n");
+  DLOG("Done with rx cb\n");
     HAL_GPIO_TogglePin(GPIOE, GPIO_PIN_0);
 
 }
+
+// Main loop: keeps the IN FIFO full of SYNC_VREQ_BULK_TEST packets while a
+// test has some left
+void sync_bulk_test_task(void) {
+  static uint8_t pkt[SYNC_TLM_PACKET_SIZE] = {SYNC_MSG_TYPE_BULK_TEST};
+  if (!g_bulk.in_left)
+    return;
+  while (g_bulk.in_left && tud_vendor_write_available() >= sizeof(pkt)) {
+    memcpy(pkt + 4, &g_bulk.in_sent, sizeof(g_bulk.in_sent));
+    tud_vendor_write(pkt, sizeof(pkt));
+    g_bulk.in_sent++;
+    g_bulk.in_left--;
+  }
+  tud_vendor_write_flush();
+}
@@ -1,10 +1,11 @@
 #include "node_time.h"
 #include "stm32h7xx.h"
+#include "tcm.h"
 
 #define TIM5_CLK_HZ 10000000UL // 10 MHz
 #define TICK_NS 100LL          // 1 / 10MHz = 100 ns
 
-static volatile uint32_t tim5_overflows = 0;
+TCM_BSS static volatile uint32_t tim5_overflows = 0;
 
 static uint64_t clock_offset = 0;
 
@@ -28,7 +29,8 @@ void TIM5_IRQHandler(void) {
   }
 }
 
-uint64_t node_time_now_ns(void) {
+// the SOF interrupt stamps every microframe with this
+TCM_CODE uint64_t node_time_raw_ns(void) {
   uint32_t hi1 = tim5_overflows;
   uint32_t lo = TIM5->CNT;
   uint32_t hi2 = tim5_overflows;
@@ -39,12 +41,13 @@ uint64_t node_time_now_ns(void) {
   }
 
   uint64_t ticks = ((uint64_t)hi1 << 32) | lo;
-  return ticks * TICK_NS - clock_offset;
+  return ticks * TICK_NS;
 }
 
+uint64_t node_time_now_ns(void) { return node_time_raw_ns() - clock_offset; }
+
 void zero_clock() {
   // __disable_irq();
-  clock_offset = 0;
-  clock_offset = node_time_now_ns();
+  clock_offset = node_time_raw_ns();
   // __enable_irq();
 }
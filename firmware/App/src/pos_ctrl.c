@@ -0,0 +1,67 @@
+#include "pos_ctrl.h"
+#include "tcm.h"
+
+TCM_CODE static float clampf(float v, float lo, float hi) {
+  if (v < lo)
+    return lo;
+  if (v > hi)
+    return hi;
+  return v;
+}
+
+void pos_ctrl_init(pos_ctrl_t *c, const pos_ctrl_params_t *p) {
+  c->p = *p;
+  c->vel_ff_scale = c->acc_ff_scale = c->jerk_ff_scale = 1.0f;
+  pos_ctrl_set_pid(c, p->kp_pos, p->ki_vel, p->kp_vel, p->tf_vel);
+}
+
+void pos_ctrl_set_pid(pos_ctrl_t *c, float p, float i, float d, float tf) {
+  c->p.kp_pos = p;
+  c->p.ki_vel = i;
+  c->p.kp_vel = d;
+  c->p.tf_vel = tf;
+  c->pid_vel.Kp = d;
+  c->pid_vel.Ki = i * c->p.ts;
+  c->pid_vel.Kd = 0.0f;
+  arm_pid_init_f32(&c->pid_vel, 1);
+  pos_ctrl_reset(c);
+}
+
+void pos_ctrl_set_feedforward(pos_ctrl_t *c, bool vel, bool acc, bool jerk) {
+  c->vel_ff_scale = vel ? 1.0f : 0.0f;
+  c->acc_ff_scale = acc ? 1.0f : 0.0f;
+  c->jerk_ff_scale = jerk ? 1.0f : 0.0f;
+}
+
+void pos_ctrl_reset(pos_ctrl_t *c) {
+  arm_pid_reset_f32(&c->pid_vel);
+  c->vel = 0.0f;
+  c->err = 0.0f;
+  c->i_cmd = 0.0f;
+  c->primed = false;
+}
+
+TCM_CODE float pos_ctrl_step(pos_ctrl_t *c, const axis_setpoint_t *sp, float pos_mm) {
+  if (!c->primed) {
+    c->last_pos = pos_mm;
+    c->primed = true;
+  }
+  float raw_vel = (pos_mm - c->last_pos) / c->p.ts;
+  c->last_pos = pos_mm;
+  float alpha = c->p.ts / (c->p.tf_vel + c->p.ts);
+  c->vel += alpha * (raw_vel - c->vel);
+
+  c->err = sp->pos - pos_mm;
+  float vel_cmd = c->p.kp_pos * c->err + c->vel_ff_scale * sp->vel;
+  float ff = c->acc_ff_scale * c->p.ka * sp->acc +
+             c->jerk_ff_scale * c->p.kj * sp->jerk;
+
+  // the integrator only gets the headroom the feedforward leaves over, same
+  // clamp-the-stored-output trick as the current loop
+  float pi = clampf(arm_pid_f32(&c->pid_vel, vel_cmd - c->vel),
+                    -c->p.i_max - ff, c->p.i_max - ff);
+  c->pid_vel.state[2] = pi;
+
+  c->i_cmd = clampf(pi + ff, -c->p.i_max, c->p.i_max);
+  return c->i_cmd;
+}
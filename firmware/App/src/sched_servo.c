@@ -1,14 +1,10 @@
-
 #include "sched_servo.h"
+#include "dlog.h"
 #include "stm32h7xx.h"
-#include <limits.h>
+#include "tcm.h"
 #include <stdint.h>
-#include <stdio.h>
-
-#define LOWPASS(output, input, c_lowpass)                                      \
-  (output += (c_lowpass) * ((input) - (output)))
 
-static int32_t clamp_int32(int32_t v, int32_t lo, int32_t hi) {
+TCM_CODE static int64_t clamp_int64(int64_t v, int64_t lo, int64_t hi) {
   if (v < lo)
     return lo;
   if (v > hi)
@@ -24,13 +20,23 @@ void sched_servo_fixed_init(sched_servo_fixed_t *s, uint32_t base_counts,
   s->max_counts = max_counts;
   s->Kp_fp = Kp_fp;
   s->Ki_fp = Ki_fp;
-  s->freq_corr_fp = 0;
-  s->integrator = 0;
+  s->freq_corr_ppb = 0;
+  s->freq_lock_ppb = 0;
+  s->bus_valid = false;
+  s->bus_drift_ppb = 0;
+  s->host_bus_n = 0;
+  s->host_bus_acc = 0;
+  s->arr_frac = 0;
+  clock_est_init(&s->est);
   s->last_offset_ns = 0;
   s->last_delay_ns = 0;
+  s->est_offset_ns = 0;
+  s->locked_syncs = 0;
+  s->locked_at_ns = -1;
 }
 
-// 4-timestamp PI servo
+// 4-timestamp exchange into the estimator, then a frequency lock on the
+// fitted drift plus a proportional phase term on the fitted offset
 void sched_servo_fixed_on_sync(sched_servo_fixed_t *s, uint64_t t0_node_ns,
                                uint64_t t1_host_ns, uint64_t t2_host_ns,
                                uint64_t t3_node_ns) {
@@ -45,68 +51,80 @@ void sched_servo_fixed_on_sync(sched_servo_fixed_t *s, uint64_t t0_node_ns,
   int64_t offset_ns = (t1_minus_t0 + t2_minus_t3) /
                       2; // absolute differencce between node and host clock
 
-  printf("delay: %lld\n", delay_ns);
-  printf("offset: %lld\n", offset_ns);
-  printf("apparent offset drift: %lld\n", offset_ns - s->last_offset_ns);
-  printf("freq_corr_fp: %d\n", s->freq_corr_fp);
-  printf("scheduler arr: %d\n", TIM24->ARR);
+  DLOG("delay: %lld offset: %lld apparent offset drift: %lld\n", delay_ns,
+       offset_ns, offset_ns - s->last_offset_ns);
   s->last_delay_ns = delay_ns;
   s->last_offset_ns = offset_ns;
-  int64_t abs_delay = (delay_ns >= 0) ? delay_ns : -delay_ns;
-  const int64_t MAX_DELAY_NS = 500000; // 500 us
-  if (abs_delay > MAX_DELAY_NS) {
-    printf("warning: big delay!\n");
+
+  uint32_t rejected = s->est.rejected;
+  int64_t t_mid = (int64_t)t0_node_ns + t3_minus_t0 / 2;
+  bool valid = clock_est_add(&s->est, t_mid, offset_ns, delay_ns);
+  if (s->est.rejected != rejected) {
+    DLOG("warning: big delay!\n");
     return; // ignore outlier
   }
-
-  // Error in timer ticks
-  int32_t err_ticks =
-      (int32_t)(offset_ns - (2 * delay_ns) / SERVO_TIMER_TICK_NS);
-
-  printf("err_ticks: %d\n", err_ticks);
-  // Integrate (with clamp)
-  const int32_t MAX_FREQ_FP = (int32_t)((200 * SERVO_FP_ONE) / 1000); // ~0.002
-  int32_t integ = s->integrator + err_ticks;
-  // s->integrator = clamp_int32(integ, -INT32_MAX / ((2 * s->Ki_fp) / 3),
-  //                             INT32_MAX / ((2 * s->Ki_fp) / 3));
-  s->integrator = clamp_int32(integ, -INT32_MAX, INT32_MAX);
-  printf("integrator: %d\n", s->integrator);
-  // P term: Q16.16 * int32 -> Q16.16
-  int64_t p_tmp = (int64_t)s->Kp_fp * (int64_t)err_ticks;
-  int32_t p_term_fp = (int32_t)(p_tmp >> SERVO_FP_SHIFT);
-
-  // I term: Q16.16 * int32 -> Q16.16
-  int64_t i_tmp = (int64_t)s->Ki_fp * (int64_t)s->integrator;
-  int32_t i_term_fp = (int32_t)(i_tmp >> SERVO_FP_SHIFT);
-
-  int32_t delta_fp = p_term_fp + i_term_fp;
-  // int32_t new_freq = s->freq_corr_fp - delta_fp;
-  int32_t new_freq = -delta_fp;
-
-  // Clamp freq correction to ~±2000 ppm (0.002)
-  static float freq_corr = 1200;
-  LOWPASS(freq_corr, (float)clamp_int32(new_freq, -MAX_FREQ_FP, MAX_FREQ_FP),
-          0.05f);
-  s->freq_corr_fp = freq_corr;
+  if (!valid)
+    return; // still filling the window
+  int64_t off = clock_est_offset_at(&s->est, (int64_t)t3_node_ns);
+  s->est_offset_ns = off;
+
+  // With the current correction applied the fit sees natural drift plus
+  // freq_corr, so the correction that cancels the drift alone is this
+  int64_t natural = (int64_t)s->est.drift_ppb - s->freq_corr_ppb;
+  if (s->bus_valid) {
+    // running mean until HOST_BUS_DIV exchanges are in, then exponential
+    int64_t host_bus = natural - s->bus_drift_ppb;
+    if (s->host_bus_n < SERVO_HOST_BUS_DIV)
+      s->host_bus_n++;
+    s->host_bus_acc +=
+        (host_bus * SERVO_HOST_BUS_DIV - s->host_bus_acc) / s->host_bus_n;
+    natural = s->bus_drift_ppb + s->host_bus_acc / SERVO_HOST_BUS_DIV;
+  }
+  int64_t target = -natural;
+  int64_t lock = s->freq_lock_ppb + (target - s->freq_lock_ppb) /
+                                        SERVO_LOCK_GAIN_DIV;
+  // host ahead (offset > 0) needs shorter ticks, so both terms subtract
+  lock -= ((int64_t)s->Ki_fp * off) >> SERVO_FP_SHIFT;
+  lock = clamp_int64(lock, -SERVO_MAX_PPB, SERVO_MAX_PPB);
+  s->freq_lock_ppb = (int32_t)lock;
+
+  int64_t corr = lock - (((int64_t)s->Kp_fp * off) >> SERVO_FP_SHIFT);
+  corr = clamp_int64(corr, -SERVO_MAX_PPB, SERVO_MAX_PPB);
+  clock_est_rate_step(&s->est, (int32_t)corr - s->freq_corr_ppb);
+  s->freq_corr_ppb = (int32_t)corr;
+
+  int64_t abs_off = off >= 0 ? off : -off;
+  s->locked_syncs = abs_off < SERVO_LOCKED_NS ? s->locked_syncs + 1 : 0;
+  if (s->locked_at_ns < 0 && s->locked_syncs >= SERVO_LOCKED_SYNCS)
+    s->locked_at_ns = (int64_t)t3_node_ns;
+
+  DLOG("est offset: %lld drift: %d ppb jitter: %d ns used: %u\n", off,
+       s->est.drift_ppb, s->est.jitter_ns, s->est.used);
+  DLOG("freq_corr: %d ppb lock: %d ppb scheduler arr: %u\n", s->freq_corr_ppb,
+       s->freq_lock_ppb, TIM24->ARR);
 }
 
-uint32_t sched_servo_fixed_next_arr(const sched_servo_fixed_t *s) {
-  int64_t mul = (int64_t)s->base_counts * (int64_t)s->freq_corr_fp;
-  int32_t delta_counts = (int32_t)(mul >> SERVO_FP_SHIFT);
-  int32_t counts = (int32_t)s->base_counts + delta_counts;
+void sched_servo_fixed_set_bus_drift(sched_servo_fixed_t *s, bool valid,
+                                     int32_t drift_ppb) {
+  s->bus_valid = valid;
+  s->bus_drift_ppb = drift_ppb;
+}
 
-  if (counts < (int32_t)s->min_counts)
-    counts = (int32_t)s->min_counts;
-  if (counts > (int32_t)s->max_counts)
-    counts = (int32_t)s->max_counts;
+TCM_CODE uint32_t sched_servo_fixed_next_arr(sched_servo_fixed_t *s) {
+  const int64_t one = 1000000000LL;
+  int64_t scaled = (int64_t)s->base_counts * (one + s->freq_corr_ppb) +
+                   s->arr_frac;
+  int64_t counts = scaled / one;
+  s->arr_frac = scaled - counts * one;
 
+  if (counts < (int64_t)s->min_counts || counts > (int64_t)s->max_counts) {
+    counts = clamp_int64(counts, s->min_counts, s->max_counts);
+    s->arr_frac = 0;
+  }
   return (uint32_t)(counts - 1);
 }
 
-// For logging: convert freq_corr_fp (Q16.16) to ppm
+// For logging and the stats message
 int32_t sched_servo_fixed_freq_ppm(const sched_servo_fixed_t *s) {
-  // freq_corr_real = freq_corr_fp / 2^16
-  // ppm = freq_corr_real * 1e6
-  int64_t tmp = (int64_t)s->freq_corr_fp * 1000000LL;
-  return (int32_t)(tmp >> SERVO_FP_SHIFT);
+  return s->freq_corr_ppb / 1000;
 }
@@ -1,9 +1,13 @@
 #include "node_sync.c"
+#include "cpu_prof.h"
+#include "motion.h"
 #include "sched_servo.h"
 #include "stm32h723xx.h"
 #include "stm32h7xx.h"
+#include "tcm.h"
+#include "tmc_spi.h"
 
-sched_servo_fixed_t g_sched_servo;
+TCM_BSS sched_servo_fixed_t g_sched_servo;
 
 void scheduler_tick_handler(void); // your RT “tick” callback
 
@@ -22,9 +26,8 @@ void tim_init_for_scheduler(void) {
   HAL_NVIC_SetPriority(TIM24_IRQn, 0, 0);
   NVIC_EnableIRQ(TIM24_IRQn);
 
-  // Need to tune gains better
-  int32_t Kp_fp = 50; // ~6.1e-5
-  int32_t Ki_fp = 1;  // tiny
+  int32_t Kp_fp = SERVO_DEFAULT_KP_FP;
+  int32_t Ki_fp = SERVO_DEFAULT_KI_FP;
 
   uint32_t min_counts = base_counts - 500; // 0.95 ms
   uint32_t max_counts = base_counts + 500; // 1.05 ms
@@ -32,23 +35,42 @@ void tim_init_for_scheduler(void) {
   sched_servo_fixed_init(&g_sched_servo, base_counts, min_counts, max_counts,
                          Kp_fp, Ki_fp);
 
+  // the tick has to be done well before the next one, hold it to one period
+  cpu_prof_set_budget(SYNC_CPU_TICK, CYCLE_COUNTER_HZ / 1000);
+
   TIM24->CR1 |= TIM_CR1_CEN;
 }
 
-void TIM24_IRQHandler(void) {
+TCM_CODE void TIM24_IRQHandler(void) {
   if (TIM24->SR & TIM_SR_UIF) {
+    uint32_t t0 = cycle_count();
     TIM24->SR &= ~TIM_SR_UIF;
 
     scheduler_tick_handler();
 
     uint32_t next_arr = sched_servo_fixed_next_arr(&g_sched_servo);
     TIM24->ARR = next_arr;
+    cpu_prof_end(SYNC_CPU_TICK, t0);
   }
 }
 
-uint64_t scheduler_time_ns = 0;
+TCM_BSS uint64_t scheduler_time_ns = 0;
+
+// Scheduler time between ticks, TIM24 counts 100 ns from the last update.
+// For stamping USB arrivals, the tick itself uses scheduler_time_ns.
+uint64_t scheduler_now_ns(void) {
+  volatile uint64_t *tick_ns = &scheduler_time_ns;
+  uint64_t t;
+  uint32_t cnt;
+  do {
+    t = *tick_ns;
+    cnt = TIM24->CNT;
+  } while (t != *tick_ns);
+  return t + (uint64_t)cnt * 100;
+}
+
 // Stub: you plug in your scheduler or just toggle a pin, etc.
-void scheduler_tick_handler(void) {
+TCM_CODE void scheduler_tick_handler(void) {
   // Do whatever periodic work you want here
   scheduler_time_ns += 1e6;
   static uint32_t cnt = 0;
@@ -57,5 +79,11 @@ void scheduler_tick_handler(void) {
     // HAL_GPIO_TogglePin(GPIOE, GPIO_PIN_0);
   }
   cnt += 1;
+  uint32_t t0 = cycle_count();
   sync_tick();
+  uint32_t t1 = cycle_count();
+  cpu_prof_record(SYNC_CPU_SYNC_TICK, t1 - t0);
+  motion_tick(scheduler_time_ns);
+  cpu_prof_end(SYNC_CPU_MOTION_TICK, t1);
+  tmc_spi_tick();
 }
@@ -0,0 +1,31 @@
+#include "sync_caps.h"
+#include <string.h>
+
+static uint32_t highest_bit(uint32_t v) {
+  return v ? 1u << (31 - __builtin_clz(v)) : 0;
+}
+
+void sync_caps_negotiate(const void *hello, uint32_t bufsize,
+                         sync_caps_t *caps) {
+  // what a version 1 host does
+  sync_hello_t h = {.protocol_version = 1,
+                    .encodings = SYNC_ENC_PB,
+                    .features = 0,
+                    .max_batch = 1};
+  if (bufsize >= sizeof(sync_hello_t)) {
+    memcpy(&h, hello, sizeof(h));
+    if (h.protocol_version < 2) {
+      h.encodings = SYNC_ENC_PB;
+      h.features = 0;
+      h.max_batch = 1;
+    }
+  }
+
+  caps->msg_type = SYNC_MSG_TYPE_CAPS;
+  caps->protocol_version = SYNC_PROTOCOL_VERSION;
+  caps->encoding = highest_bit(h.encodings & caps->encodings);
+  caps->features_on = h.features & caps->features;
+  uint16_t batch = h.max_batch < caps->max_batch ? h.max_batch
+                                                 : caps->max_batch;
+  caps->batch = batch ? batch : 1;
+}
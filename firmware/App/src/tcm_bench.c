@@ -0,0 +1,91 @@
+#include "cycle_counter.h"
+#include "stm32h7xx.h"
+#include "tcm.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// The same control loop kernel built twice, once into flash and once into
+// ITCM, timed with the I-cache warm and with it invalidated before every run.
+// The invalidated case is what an ISR sees after the USB stack or the main
+// loop pushed it out of the 16K cache. Built with `make TCM_BENCH=1`, the
+// results go to stdout (RTT) once at boot.
+
+#define BENCH_RUNS 1000
+
+typedef struct {
+  float ia, ib, theta;
+  float id, iq, ui_d, ui_q;
+  float duty[3];
+} bench_state_t;
+
+// Clarke, Park with a polynomial sine, two PI loops, inverse Park and a
+// min/max centred modulation: about what foc_step does, without calls out
+static inline __attribute__((always_inline)) void kernel(bench_state_t *b) {
+  float x = b->theta;
+  float x2 = x * x;
+  float s = x * (1.0f - x2 * (0.16666667f - x2 * 0.0083333f));
+  float c = 1.0f - x2 * (0.5f - x2 * 0.041666667f);
+  float alpha = b->ia;
+  float beta = (b->ia + 2.0f * b->ib) * 0.57735026919f;
+  b->id = alpha * c + beta * s;
+  b->iq = beta * c - alpha * s;
+  float ed = -b->id, eq = 1.0f - b->iq;
+  b->ui_d += 0.01f * ed;
+  b->ui_q += 0.01f * eq;
+  float vd = 0.5f * ed + b->ui_d;
+  float vq = 0.5f * eq + b->ui_q;
+  vd = vd > 12.0f ? 12.0f : vd < -12.0f ? -12.0f : vd;
+  vq = vq > 12.0f ? 12.0f : vq < -12.0f ? -12.0f : vq;
+  float va = vd * c - vq * s;
+  float vb = vd * s + vq * c;
+  float v[3] = {va, -0.5f * va + 0.86602540378f * vb,
+                -0.5f * va - 0.86602540378f * vb};
+  float lo = v[0], hi = v[0];
+  for (int i = 1; i < 3; i++) {
+    lo = v[i] < lo ? v[i] : lo;
+    hi = v[i] > hi ? v[i] : hi;
+  }
+  float mid = 0.5f * (lo + hi);
+  for (int i = 0; i < 3; i++)
+    b->duty[i] = 0.5f + (v[i] - mid) * (1.0f / 24.0f);
+  b->theta = x > 3.0f ? -3.0f : x + 0.01f;
+}
+
+// noipa keeps the two copies apart, identical code folding would merge them
+__attribute__((noipa)) static void kernel_flash(bench_state_t *b) {
+  kernel(b);
+}
+
+TCM_CODE __attribute__((noipa)) static void kernel_itcm(bench_state_t *b) {
+  kernel(b);
+}
+
+static void bench(const char *name, void (*fn)(bench_state_t *), bool cold) {
+  bench_state_t b = {.ia = 0.3f, .ib = -0.1f};
+  uint32_t min = UINT32_MAX, max = 0;
+  uint64_t sum = 0;
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    __disable_irq();
+    if (cold)
+      SCB_InvalidateICache();
+    uint32_t t0 = cycle_count();
+    fn(&b);
+    uint32_t dt = cycle_count() - t0;
+    __enable_irq();
+    sum += dt;
+    min = dt < min ? dt : min;
+    max = dt > max ? dt : max;
+  }
+  printf("tcm bench %-6s %-4s min %4" PRIu32 " avg %4" PRIu32 " max %4" PRIu32
+         " jitter %4" PRIu32 " cycles\n",
+         name, cold ? "cold" : "warm", min, (uint32_t)(sum / BENCH_RUNS), max,
+         max - min);
+}
+
+void tcm_bench_run(void) {
+  bench("flash", kernel_flash, false);
+  bench("itcm", kernel_itcm, false);
+  bench("flash", kernel_flash, true);
+  bench("itcm", kernel_itcm, true);
+}
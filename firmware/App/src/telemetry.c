@@ -0,0 +1,209 @@
+#include "telemetry.h"
+#include "fifo.h"
+#include "tusb.h"
+#include <string.h>
+
+static telemetry_sample_t g_storage[TELEMETRY_RING_DEPTH + 1];
+static fifo_t g_ring;
+
+// written by the RX callback, read by the tick
+static volatile uint32_t g_channels;
+static volatile uint16_t g_decimation = 1;
+// tick only
+static uint16_t g_div;
+static volatile uint32_t g_dropped;
+// set by the task around the write, read by the tick
+static volatile bool g_tx_busy;
+
+// the packet being filled, task only
+static uint8_t g_pkt[SYNC_TLM_PACKET_SIZE];
+static uint32_t g_pkt_len; // header included
+static uint8_t g_pkt_count;
+static uint16_t g_pkt_seq;
+static uint64_t g_pkt_t0_ns;
+static uint32_t g_pkt_channels;
+static uint16_t g_pkt_decimation;
+static telemetry_stats_t g_stats;
+
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+void telemetry_init(void) {
+  fifo_init_elem(&g_ring, g_storage, TELEMETRY_RING_DEPTH + 1,
+                 sizeof(telemetry_sample_t), NULL);
+  g_channels = 0;
+  g_decimation = 1;
+  g_div = 0;
+  g_dropped = 0;
+  g_tx_busy = false;
+  g_pkt_len = 0;
+  g_pkt_count = 0;
+  g_pkt_seq = 0;
+  memset(&g_stats, 0, sizeof(g_stats));
+}
+
+// Consumer side, so the RX callback can do it too: it runs on the same
+// thread as the task
+static void discard(void) {
+  const void *span;
+  size_t n;
+  while ((n = fifo_peek(&g_ring, &span)) > 0) {
+    fifo_consume(&g_ring, n);
+    g_stats.discarded += (uint32_t)n;
+  }
+  g_stats.discarded += g_pkt_count;
+  g_pkt_count = 0;
+  g_pkt_len = 0;
+}
+
+void telemetry_config(uint32_t channels, uint16_t decimation) {
+  g_channels = 0;
+  COMPILER_BARRIER();
+  discard();
+  g_decimation = decimation ? decimation : 1;
+  g_div = 0;
+  COMPILER_BARRIER();
+  g_channels = channels & SYNC_TLM_CH_ALL;
+}
+
+uint32_t telemetry_channels(void) { return g_channels; }
+
+uint32_t telemetry_sample_size(uint32_t channels) {
+  uint32_t n = 4; // tick
+  if (channels & SYNC_TLM_CH_FOLLOW_ERR)
+    n += 4 * TELEMETRY_AXES;
+  if (channels & SYNC_TLM_CH_CURRENT)
+    n += 8 * TELEMETRY_AXES;
+  if (channels & SYNC_TLM_CH_IQ_REF)
+    n += 4 * TELEMETRY_AXES;
+  if (channels & SYNC_TLM_CH_ENCODER)
+    n += 4 * TELEMETRY_AXES;
+  if (channels & SYNC_TLM_CH_SETPOINT)
+    n += 8 * TELEMETRY_AXES;
+  if (channels & SYNC_TLM_CH_BUFFER)
+    n += 4;
+  if (channels & SYNC_TLM_CH_DRIVER)
+    n += 4 * TELEMETRY_DRV_REGS * TELEMETRY_AXES;
+  return n;
+}
+
+telemetry_sample_t *telemetry_begin(uint64_t now_ns) {
+  if (!g_channels)
+    return NULL;
+  if (++g_div < g_decimation)
+    return NULL;
+  g_div = 0;
+  void *span;
+  if (fifo_reserve(&g_ring, &span) == 0) {
+    g_dropped++;
+    return NULL;
+  }
+  telemetry_sample_t *s = span;
+  s->t_ns = now_ns;
+  return s;
+}
+
+void telemetry_commit(void) { fifo_commit(&g_ring, 1); }
+
+bool telemetry_tx_busy(void) { return g_tx_busy; }
+
+static void put(const void *v, uint32_t n) {
+  memcpy(g_pkt + g_pkt_len, v, n);
+  g_pkt_len += n;
+}
+
+static void pack(const telemetry_sample_t *s, uint32_t ch) {
+  uint32_t tick =
+      (uint32_t)((s->t_ns + TELEMETRY_TICK_NS / 2) / TELEMETRY_TICK_NS);
+  put(&tick, 4);
+  if (ch & SYNC_TLM_CH_FOLLOW_ERR)
+    put(s->err, sizeof(s->err));
+  if (ch & SYNC_TLM_CH_CURRENT)
+    for (int a = 0; a < TELEMETRY_AXES; a++) {
+      put(&s->id[a], 4);
+      put(&s->iq[a], 4);
+    }
+  if (ch & SYNC_TLM_CH_IQ_REF)
+    put(s->iq_ref, sizeof(s->iq_ref));
+  if (ch & SYNC_TLM_CH_ENCODER)
+    put(s->enc, sizeof(s->enc));
+  if (ch & SYNC_TLM_CH_SETPOINT)
+    for (int a = 0; a < TELEMETRY_AXES; a++) {
+      put(&s->sp_pos[a], 4);
+      put(&s->sp_vel[a], 4);
+    }
+  if (ch & SYNC_TLM_CH_BUFFER) {
+    put(&s->jb_depth, 2);
+    put(&s->underruns, 2);
+  }
+  if (ch & SYNC_TLM_CH_DRIVER)
+    put(s->drv, sizeof(s->drv));
+  g_pkt_count++;
+}
+
+static bool send_packet(void) {
+  // busy first: a sync request written between the check and the write
+  // would push the packet over the FIFO
+  g_tx_busy = true;
+  COMPILER_BARRIER();
+  if (tud_vendor_write_available() < SYNC_TLM_PACKET_SIZE) {
+    COMPILER_BARRIER();
+    g_tx_busy = false;
+    g_stats.tx_waits++;
+    return false;
+  }
+  sync_tlm_hdr_t h = {
+      .msg_type = SYNC_MSG_TYPE_TELEMETRY,
+      .count = g_pkt_count,
+      .seq = g_pkt_seq++,
+      .channels = g_pkt_channels,
+      .decimation = g_pkt_decimation,
+      .axes = TELEMETRY_AXES,
+      .sample_size = (uint8_t)telemetry_sample_size(g_pkt_channels),
+      .dropped = g_dropped,
+  };
+  memcpy(g_pkt, &h, sizeof(h));
+  memset(g_pkt + g_pkt_len, 0, SYNC_TLM_PACKET_SIZE - g_pkt_len);
+  tud_vendor_write(g_pkt, SYNC_TLM_PACKET_SIZE);
+  tud_vendor_write_flush();
+  COMPILER_BARRIER();
+  g_tx_busy = false;
+
+  g_stats.packets++;
+  g_stats.samples += g_pkt_count;
+  g_pkt_count = 0;
+  g_pkt_len = 0;
+  return true;
+}
+
+void telemetry_task(uint64_t now_ns) {
+  uint32_t ch = g_channels;
+  if (!ch) {
+    // stopped, or a config change in progress
+    discard();
+    return;
+  }
+  uint32_t size = telemetry_sample_size(ch);
+  for (;;) {
+    if (g_pkt_count && g_pkt_len + size > SYNC_TLM_PACKET_SIZE &&
+        !send_packet())
+      return; // the ring holds the rest until the FIFO drains
+    const void *span;
+    if (fifo_peek(&g_ring, &span) == 0)
+      break;
+    if (!g_pkt_count) {
+      g_pkt_len = sizeof(sync_tlm_hdr_t);
+      g_pkt_t0_ns = ((const telemetry_sample_t *)span)->t_ns;
+      g_pkt_channels = ch;
+      g_pkt_decimation = g_decimation;
+    }
+    pack(span, ch);
+    fifo_consume(&g_ring, 1);
+  }
+  if (g_pkt_count && now_ns - g_pkt_t0_ns >= TELEMETRY_MAX_AGE_NS)
+    send_packet();
+}
+
+void telemetry_stats(telemetry_stats_t *out) {
+  *out = g_stats;
+  out->dropped = g_dropped;
+}
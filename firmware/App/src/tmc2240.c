@@ -0,0 +1,33 @@
+#include "tmc2240.h"
+
+void tmc2240_encode(uint8_t dg[TMC2240_DATAGRAM], uint8_t reg, bool write,
+                    uint32_t value) {
+  dg[0] = (uint8_t)((reg & 0x7fu) | (write ? TMC2240_WRITE : 0));
+  dg[1] = (uint8_t)(value >> 24);
+  dg[2] = (uint8_t)(value >> 16);
+  dg[3] = (uint8_t)(value >> 8);
+  dg[4] = (uint8_t)value;
+}
+
+uint32_t tmc2240_decode(const uint8_t dg[TMC2240_DATAGRAM], uint8_t *status) {
+  if (status)
+    *status = dg[0];
+  return (uint32_t)dg[1] << 24 | (uint32_t)dg[2] << 16 |
+         (uint32_t)dg[3] << 8 | dg[4];
+}
+
+void tmc2240_batch_build(uint8_t (*tx)[TMC2240_DATAGRAM], int drivers,
+                         const uint8_t *regs, int nregs) {
+  for (int r = 0; r <= nregs; r++)
+    for (int d = 0; d < drivers; d++)
+      // the last round only collects, asking for regs[0] again is harmless
+      tmc2240_encode(tx[r * drivers + d], regs[r < nregs ? r : 0], false, 0);
+}
+
+void tmc2240_batch_parse(const uint8_t (*rx)[TMC2240_DATAGRAM], int drivers,
+                         int nregs, uint32_t *values, uint8_t *status) {
+  for (int r = 1; r <= nregs; r++)
+    for (int d = 0; d < drivers; d++)
+      values[d * nregs + r - 1] =
+          tmc2240_decode(rx[r * drivers + d], &status[d]);
+}
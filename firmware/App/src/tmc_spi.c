@@ -0,0 +1,182 @@
+#include "tmc_spi.h"
+#include "dma_buf.h"
+#include "main.h"
+#include "stm32h7xx.h"
+#include "stm32h7xx_hal.h"
+#include "tcm.h"
+#include <string.h>
+
+// Hardware side: SPI3 with DMA1 stream 0 (RX) and stream 1 (TX) on
+// DMAMUX1 channels 0 and 1. The datagrams live in D2 SRAM, DMA1 can't
+// reach DTCM.
+
+#define RX_STREAM DMA1_Stream0
+#define TX_STREAM DMA1_Stream1
+#define RX_FLAGS                                                               \
+  (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 |                   \
+   DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0)
+#define TX_FLAGS                                                               \
+  (DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 |                   \
+   DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1)
+#define SPI_MBR_DIV16 3u // 62.5 MHz / 16
+
+typedef struct {
+  GPIO_TypeDef *port;
+  uint16_t pin;
+} tmc_cs_t;
+
+// nSCS_2 (PG5) has no label in the .ioc yet
+static const tmc_cs_t g_cs[TMC_SPI_DRIVERS] = {
+    {nSCS_GPIO_Port, nSCS_Pin},
+    {GPIOG, GPIO_PIN_5},
+};
+
+const uint8_t tmc_spi_regs[TMC_SPI_REGS] = {
+    TMC2240_DRV_STATUS,
+    TMC2240_SG4_RESULT,
+    TMC2240_MSCURACT,
+    TMC2240_ADC_TEMP,
+};
+
+typedef struct {
+  uint32_t reg[TMC_SPI_DRIVERS][TMC_SPI_REGS];
+  uint8_t status[TMC_SPI_DRIVERS];
+} tmc_regs_t;
+
+static DMA_BUF uint8_t g_tx[TMC_SPI_LEN][TMC2240_DATAGRAM];
+static DMA_BUF uint8_t g_rx[TMC_SPI_LEN][TMC2240_DATAGRAM];
+
+// the tick reads g_regs[g_pub], the SPI interrupt fills the other one
+TCM_BSS static tmc_regs_t g_regs[2];
+TCM_BSS static volatile uint32_t g_pub;
+TCM_BSS static volatile bool g_busy;
+TCM_BSS static bool g_ready;
+TCM_BSS static uint32_t g_div;
+TCM_BSS static uint32_t g_overruns;
+static int g_next; // datagram on the bus
+static uint32_t g_batches;
+static uint32_t g_errors;
+
+static void start_datagram(int i) {
+  const tmc_cs_t *cs = &g_cs[i % TMC_SPI_DRIVERS];
+  cs->port->BSRR = (uint32_t)cs->pin << 16;
+
+  // RX first, so nothing the SPI clocks in is missed
+  DMA1->LIFCR = RX_FLAGS | TX_FLAGS;
+  RX_STREAM->M0AR = (uint32_t)(uintptr_t)g_rx[i];
+  RX_STREAM->NDTR = TMC2240_DATAGRAM;
+  RX_STREAM->CR |= DMA_SxCR_EN;
+  SPI3->CFG1 |= SPI_CFG1_RXDMAEN;
+  TX_STREAM->M0AR = (uint32_t)(uintptr_t)g_tx[i];
+  TX_STREAM->NDTR = TMC2240_DATAGRAM;
+  TX_STREAM->CR |= DMA_SxCR_EN;
+  SPI3->CFG1 |= SPI_CFG1_TXDMAEN;
+
+  // TSIZE stays at one datagram, the SPI ends the transfer by itself
+  SPI3->CR1 |= SPI_CR1_SPE;
+  SPI3->CR1 |= SPI_CR1_CSTART;
+}
+
+// Back to idle between datagrams: TSIZE is only taken on SPE
+static void stop_datagram(int i) {
+  SPI3->IFCR = SPI_IFCR_EOTC | SPI_IFCR_TXTFC;
+  SPI3->CR1 &= ~SPI_CR1_SPE;
+  SPI3->CFG1 &= ~(SPI_CFG1_RXDMAEN | SPI_CFG1_TXDMAEN);
+  const tmc_cs_t *cs = &g_cs[i % TMC_SPI_DRIVERS];
+  cs->port->BSRR = cs->pin;
+}
+
+void tmc_spi_init(void) {
+  g_busy = false;
+  g_ready = false;
+  memset(g_regs, 0, sizeof(g_regs));
+  g_pub = 0;
+  g_div = 0;
+  g_overruns = g_batches = g_errors = 0;
+  tmc2240_batch_build(g_tx, TMC_SPI_DRIVERS, tmc_spi_regs, TMC_SPI_REGS);
+
+  // MX_GPIO_Init leaves the chip selects low
+  for (int d = 0; d < TMC_SPI_DRIVERS; d++)
+    g_cs[d].port->BSRR = g_cs[d].pin;
+
+  SPI3->CR1 = 0;
+  SPI3->CFG1 = (7u << SPI_CFG1_DSIZE_Pos) | (SPI_MBR_DIV16 << SPI_CFG1_MBR_Pos);
+  // SCK idles high between datagrams, AFCNTR keeps the pins driven with
+  // SPE off
+  SPI3->CFG2 = SPI_CFG2_MASTER | SPI_CFG2_SSM | SPI_CFG2_CPOL |
+               SPI_CFG2_CPHA | SPI_CFG2_AFCNTR;
+  SPI3->CR1 = SPI_CR1_SSI;
+  SPI3->CR2 = TMC2240_DATAGRAM;
+
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  RX_STREAM->CR = 0;
+  TX_STREAM->CR = 0;
+  DMAMUX1_Channel0->CCR = DMA_REQUEST_SPI3_RX;
+  DMAMUX1_Channel1->CCR = DMA_REQUEST_SPI3_TX;
+  RX_STREAM->PAR = (uint32_t)(uintptr_t)&SPI3->RXDR;
+  TX_STREAM->PAR = (uint32_t)(uintptr_t)&SPI3->TXDR;
+  RX_STREAM->FCR = 0; // direct mode, byte wide both sides
+  TX_STREAM->FCR = 0;
+  RX_STREAM->CR = DMA_SxCR_MINC | DMA_SxCR_PL_0 | DMA_SxCR_TCIE |
+                  DMA_SxCR_TEIE;
+  TX_STREAM->CR = DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_PL_0;
+
+  // below the servo tick and the current loop, next to USB
+  HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 2, 0);
+  NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+  g_ready = true;
+}
+
+TCM_CODE void tmc_spi_tick(void) {
+  if (!g_ready || ++g_div < TMC_SPI_PERIOD_TICKS)
+    return;
+  g_div = 0;
+  if (g_busy) {
+    g_overruns++;
+    return;
+  }
+  g_busy = true;
+  g_next = 0;
+  start_datagram(0);
+}
+
+// RX complete: every bit of the datagram is in g_rx, the chip can latch it
+void DMA1_Stream0_IRQHandler(void) {
+  uint32_t isr = DMA1->LISR;
+  int i = g_next;
+  stop_datagram(i);
+  if (isr & DMA_LISR_TEIF0) {
+    TX_STREAM->CR &= ~DMA_SxCR_EN;
+    DMA1->LIFCR = RX_FLAGS | TX_FLAGS;
+    g_errors++;
+    g_busy = false;
+    return;
+  }
+  if (++i < TMC_SPI_LEN) {
+    g_next = i;
+    start_datagram(i);
+    return;
+  }
+
+  uint32_t back = g_pub ^ 1;
+  tmc2240_batch_parse((const uint8_t(*)[TMC2240_DATAGRAM])g_rx,
+                      TMC_SPI_DRIVERS, TMC_SPI_REGS, &g_regs[back].reg[0][0],
+                      g_regs[back].status);
+  __DMB();
+  g_pub = back;
+  g_batches++;
+  g_busy = false;
+}
+
+TCM_CODE void tmc_spi_latest(int d, uint32_t out[TMC_SPI_REGS]) {
+  const tmc_regs_t *r = &g_regs[g_pub];
+  for (int k = 0; k < TMC_SPI_REGS; k++)
+    out[k] = r->reg[d][k];
+}
+
+void tmc_spi_stats(tmc_spi_stats_t *out) {
+  memcpy(out->status, g_regs[g_pub].status, sizeof(out->status));
+  out->batches = g_batches;
+  out->overruns = g_overruns;
+  out->errors = g_errors;
+}
@@ -24,6 +24,8 @@
  */
 
 #include "main.h"
+#include "cpu_prof.h"
+#include "telemetry.h"
 #include "tusb.h"
 #include "tusb_types.h"
 
@@ -60,7 +62,15 @@ static inline void board_delay(uint32_t ms) {
   while (board_millis() - start_ms < ms) {
 // take chance to run usb background
 #if CFG_TUD_ENABLED
+    uint32_t t0 = cycle_count();
     tud_task();
+    uint32_t t1 = cycle_count();
+    cpu_prof_record(SYNC_CPU_TUD_TASK, t1 - t0);
+    // below every interrupt, the servo tick only ever fills the ring
+    telemetry_task(scheduler_now_ns());
+    cpu_prof_end(SYNC_CPU_TLM_TASK, t1);
+    sync_bulk_test_task();
+    sync_task();
 #endif
 
 #if CFG_TUH_ENABLED
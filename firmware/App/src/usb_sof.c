@@ -0,0 +1,74 @@
+#include "usb_sof.h"
+#include <string.h>
+
+void usb_sof_init(usb_sof_t *s) {
+  memset(s, 0, sizeof(*s));
+  fifo_init_elem(&s->ring, s->storage, USB_SOF_RING + 1,
+                 sizeof(usb_sof_sample_t), NULL);
+  clock_est_init(&s->est);
+}
+
+static void restart(usb_sof_t *s, uint32_t fn, uint64_t node_raw_ns) {
+  s->running = true;
+  s->fn = fn;
+  s->node0_ns = node_raw_ns;
+  s->uframes = 0;
+  s->batch_start = 0;
+  s->batch_min = INT64_MAX;
+  s->epoch++;
+}
+
+void usb_sof_isr(usb_sof_t *s, uint32_t fnsof, uint64_t node_raw_ns) {
+  uint32_t fn = fnsof & USB_SOF_FN_MASK;
+  s->frames++;
+
+  if (!s->running || (int64_t)(node_raw_ns - s->last_ns) > USB_SOF_GAP_NS) {
+    if (s->running)
+      s->restarts++;
+    restart(s, fn, node_raw_ns);
+  } else {
+    uint32_t step = (fn - s->fn) & USB_SOF_FN_MASK;
+    if (step == 0)
+      return; // repeated number, nothing to learn from it
+    s->missed += step - 1;
+    s->uframes += step;
+    s->fn = fn;
+  }
+  s->last_ns = node_raw_ns;
+
+  if (s->uframes - s->batch_start >= USB_SOF_SAMPLE_UFRAMES) {
+    if (fifo_write(&s->ring, &s->cand, 1) != 1)
+      s->overflows++;
+    s->batch_start = s->uframes;
+    s->batch_min = INT64_MAX;
+  }
+
+  // Any latency only makes the node timestamp late, keep the earliest SOF of
+  // the batch relative to the bus. The last fitted drift levels the line so
+  // the pick doesn't always land on the end the drift favours.
+  int64_t bus = s->uframes * USB_SOF_UFRAME_NS;
+  int64_t node = (int64_t)(node_raw_ns - s->node0_ns);
+  int64_t k = s->uframes - s->batch_start;
+  int64_t v = node - bus + k * USB_SOF_UFRAME_NS * s->drift_ppb / 1000000000LL;
+  if (v < s->batch_min) {
+    s->batch_min = v;
+    s->cand.bus_ns = bus;
+    s->cand.node_ns = node;
+    s->cand.epoch = s->epoch;
+  }
+}
+
+bool usb_sof_poll(usb_sof_t *s) {
+  usb_sof_sample_t smp;
+  while (fifo_read(&s->ring, &smp, 1) == 1) {
+    if (smp.epoch != s->est_epoch) {
+      clock_est_init(&s->est);
+      s->est_epoch = smp.epoch;
+    }
+    // no round trip here, every sample is equally good to the fit
+    clock_est_add(&s->est, smp.node_ns, smp.bus_ns - smp.node_ns, 0);
+    if (s->est.valid)
+      s->drift_ppb = s->est.drift_ppb;
+  }
+  return s->est.valid && s->est_epoch == s->epoch;
+}
@@ -36,9 +36,19 @@
 #define VENDOR_REQUEST_CUSTOM_COMMAND 42
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #include "SEGGER_RTT.h"
+#include "cpu_prof.h"
+#include "current_sense.h"
+#include "dlog.h"
+#include "dma_buf.h"
+#include "motion.h"
+#include "motor.h"
 #include "node_time.h"
 #include "sched_servo.h"
+#include "tcm.h"
+#include "telemetry.h"
+#include "tmc_spi.h"
 #include "tusb.h"
+#include "usb_sof.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
@@ -59,16 +69,27 @@ int __io_putchar(int ch) {
 /* USER CODE BEGIN PTD */
 // void OTG_FS_IRQHandler(void) { tusb_int_handler(0, true); }
 void OTG_HS_IRQHandler(void) {
+  uint32_t t0 = cycle_count();
+  // Timestamp the SOF first thing, TinyUSB clears the flag
+  if (USB_OTG_HS->GINTSTS & USB_OTG_HS->GINTMSK & USB_OTG_GINTSTS_SOF) {
+    uint64_t now = node_time_raw_ns();
+    USB_OTG_DeviceTypeDef *dev =
+        (USB_OTG_DeviceTypeDef *)(USB_OTG_HS_PERIPH_BASE + USB_OTG_DEVICE_BASE);
+    usb_sof_isr(&g_usb_sof,
+                (dev->DSTS & USB_OTG_DSTS_FNSOF) >> USB_OTG_DSTS_FNSOF_Pos,
+                now);
+  }
   tud_int_handler(1);
   // tusb_int_handler(0, true);
   // printf("USB IRQ\n");
+  cpu_prof_end(SYNC_CPU_USB_ISR, t0);
 }
 void OTG_HS_EP1_IN_IRQHandler(void) {
-  printf("USB EP1 IN IRQ\n");
+  DLOG("USB EP1 IN IRQ\n");
   tusb_int_handler(1, true);
 };
 void OTG_HS_EP1_OUT_IRQHandler(void) {
-  printf("USB EP1 OUT IRQ\n");
+  DLOG("USB EP1 OUT IRQ\n");
   tusb_int_handler(1, true);
 };
 
@@ -303,6 +324,7 @@ int main(void) {
   /* USER CODE BEGIN Init */
   SEGGER_RTT_Init();
   SEGGER_RTT_ConfigUpBuffer(0, NULL, NULL, 0, SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+  dlog_init();
   /* USER CODE END Init */
 
   /* Configure the system clock */
@@ -339,6 +361,7 @@ int main(void) {
   MX_TIM24_Init();
   /* USER CODE BEGIN 2 */
 
+  usb_sof_init(&g_usb_sof); // before the OTG interrupt can see a SOF
   Enable_USB_IRQs();
 
   HAL_GPIO_WritePin(GPIOB, GPIO_PIN_8, GPIO_PIN_SET);
@@ -365,7 +388,17 @@ int main(void) {
   printf("tinyusb started!\n");
   sync_init();
   tim5_init();
+  cpu_prof_init(node_time_raw_ns());
+#if defined(TCM_BENCH)
+  tcm_bench_run();
+#endif
   tim_init_for_scheduler();
+  current_sense_init();
+  motor_init();
+  motion_init();
+  telemetry_init();
+  tmc_spi_init();
+  current_sense_start();
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -522,6 +555,22 @@ void MPU_Config(void) {
   MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
   MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
 
+  HAL_MPU_ConfigRegion(&MPU_InitStruct);
+
+  /* D2 SRAM, the DMA buffers (dma_buf.h): normal memory, not cacheable, so
+     the USB DMA and the core always agree on its contents */
+  MPU_InitStruct.Enable = MPU_REGION_ENABLE;
+  MPU_InitStruct.Number = MPU_REGION_NUMBER1;
+  MPU_InitStruct.BaseAddress = DMA_BUF_BASE;
+  MPU_InitStruct.Size = MPU_REGION_SIZE_32KB;
+  MPU_InitStruct.SubRegionDisable = 0x0;
+  MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL1;
+  MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
+  MPU_InitStruct.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+  MPU_InitStruct.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+  MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+  MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+
   HAL_MPU_ConfigRegion(&MPU_InitStruct);
   /* Enables the MPU */
   HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
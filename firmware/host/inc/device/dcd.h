@@ -0,0 +1,6 @@
+#pragma once
+// Host build stand-in for TinyUSB's controller driver API
+#include <stdbool.h>
+#include <stdint.h>
+
+void dcd_sof_enable(uint8_t rhport, bool en);
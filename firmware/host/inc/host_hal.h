@@ -0,0 +1,23 @@
+#pragma once
+#include "stm32h7xx.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Test side of the register shim
+
+void host_hal_reset(void);
+// Count a running timer forward by `counts` input clocks after the
+// prescaler, wrapping at ARR and setting UIF. Returns the number of updates.
+uint32_t host_tim_advance(TIM_TypeDef *tim, uint32_t counts);
+bool host_irq_enabled(IRQn_Type irq);
+
+// Bytes passed to tud_vendor_write since the last host_usb_take
+size_t host_usb_take(uint8_t *dst, size_t cap);
+// Data stage of the last control request answered with tud_control_xfer,
+// 0 if there was none since the last take
+size_t host_usb_take_control(uint8_t *dst, size_t cap);
+// Last dcd_sof_enable
+bool host_usb_sof_enabled(void);
+// Bus speed tud_speed_get reports, high speed after host_hal_reset
+void host_usb_set_high_speed(bool hs);
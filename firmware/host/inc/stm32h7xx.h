@@ -0,0 +1,85 @@
+#pragma once
+// Host build stand-in for the CMSIS device header. Peripherals are plain
+// structs in RAM; host_hal.h has helpers to move the simulated timers along.
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef struct {
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t SMCR;
+  __IO uint32_t DIER;
+  __IO uint32_t SR;
+  __IO uint32_t EGR;
+  __IO uint32_t CCMR1;
+  __IO uint32_t CCMR2;
+  __IO uint32_t CCER;
+  __IO uint32_t CNT;
+  __IO uint32_t PSC;
+  __IO uint32_t ARR;
+  __IO uint32_t RCR;
+  __IO uint32_t CCR1;
+  __IO uint32_t CCR2;
+  __IO uint32_t CCR3;
+  __IO uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct {
+  __IO uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef struct {
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+  __IO uint32_t LAR;
+} DWT_Type;
+
+typedef struct {
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef enum {
+  ADC_IRQn = 18,
+  TIM5_IRQn = 50,
+  TIM24_IRQn = 162,
+  HOST_NUM_IRQn = 163,
+} IRQn_Type;
+
+extern TIM_TypeDef host_tim[25];
+extern GPIO_TypeDef host_gpio[11];
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_core_debug;
+extern uint32_t SystemCoreClock;
+
+#define TIM1 (&host_tim[1])
+#define TIM3 (&host_tim[3])
+#define TIM4 (&host_tim[4])
+#define TIM5 (&host_tim[5])
+#define TIM8 (&host_tim[8])
+#define TIM24 (&host_tim[24])
+#define GPIOE (&host_gpio[4])
+#define GPIOG (&host_gpio[6])
+#define DWT (&host_dwt)
+#define CoreDebug (&host_core_debug)
+
+#define TIM_CR1_CEN (1UL << 0)
+#define TIM_CR1_ARPE (1UL << 7)
+#define TIM_DIER_UIE (1UL << 0)
+#define TIM_SR_UIF (1UL << 0)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+#define __HAL_RCC_TIM5_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_TIM24_CLK_ENABLE() ((void)0)
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t prio, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin);
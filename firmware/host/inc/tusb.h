@@ -0,0 +1,54 @@
+#pragma once
+// Host build stand-in for TinyUSB, vendor writes and control replies are
+// captured for the tests
+#include "stm32h7xx.h" // the real tusb.h pulls in the device header too
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  TUSB_SPEED_FULL = 0,
+  TUSB_SPEED_LOW = 1,
+  TUSB_SPEED_HIGH = 2,
+} tusb_speed_t;
+
+typedef enum {
+  TUSB_DIR_OUT = 0,
+  TUSB_DIR_IN = 1,
+} tusb_dir_t;
+
+typedef enum {
+  TUSB_REQ_TYPE_STANDARD = 0,
+  TUSB_REQ_TYPE_CLASS,
+  TUSB_REQ_TYPE_VENDOR,
+  TUSB_REQ_TYPE_INVALID
+} tusb_request_type_t;
+
+enum {
+  CONTROL_STAGE_IDLE,
+  CONTROL_STAGE_SETUP,
+  CONTROL_STAGE_DATA,
+  CONTROL_STAGE_ACK
+};
+
+typedef struct __attribute__((packed)) {
+  union {
+    struct __attribute__((packed)) {
+      uint8_t recipient : 5;
+      uint8_t type : 2;
+      uint8_t direction : 1;
+    } bmRequestType_bit;
+    uint8_t bmRequestType;
+  };
+  uint8_t bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} tusb_control_request_t;
+
+tusb_speed_t tud_speed_get(void);
+uint32_t tud_vendor_write(const void *buffer, uint32_t bufsize);
+uint32_t tud_vendor_write_flush(void);
+uint32_t tud_vendor_write_available(void);
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request,
+                      void *buffer, uint16_t len);
@@ -0,0 +1,120 @@
+#include "host_hal.h"
+#include "device/dcd.h"
+#include "tusb.h"
+#include <string.h>
+
+TIM_TypeDef host_tim[25];
+GPIO_TypeDef host_gpio[11];
+DWT_Type host_dwt;
+CoreDebug_Type host_core_debug;
+uint32_t SystemCoreClock = 550000000UL;
+
+static bool g_irq_enabled[HOST_NUM_IRQn];
+static uint8_t g_usb_buf[4096];
+static size_t g_usb_len;
+static uint8_t g_ctrl_buf[512];
+static size_t g_ctrl_len;
+static bool g_usb_sof;
+static bool g_usb_hs;
+
+void host_hal_reset(void) {
+  memset(host_tim, 0, sizeof(host_tim));
+  memset(host_gpio, 0, sizeof(host_gpio));
+  memset(&host_dwt, 0, sizeof(host_dwt));
+  memset(&host_core_debug, 0, sizeof(host_core_debug));
+  memset(g_irq_enabled, 0, sizeof(g_irq_enabled));
+  g_usb_len = 0;
+  g_ctrl_len = 0;
+  g_usb_sof = false;
+  g_usb_hs = true;
+}
+
+uint32_t host_tim_advance(TIM_TypeDef *tim, uint32_t counts) {
+  if (!(tim->CR1 & TIM_CR1_CEN))
+    return 0;
+  uint32_t updates = 0;
+  uint64_t period = (uint64_t)tim->ARR + 1;
+  uint64_t cnt = (uint64_t)tim->CNT + counts;
+  while (cnt >= period) {
+    cnt -= period;
+    updates++;
+  }
+  tim->CNT = (uint32_t)cnt;
+  if (updates)
+    tim->SR |= TIM_SR_UIF;
+  return updates;
+}
+
+bool host_irq_enabled(IRQn_Type irq) { return g_irq_enabled[irq]; }
+
+void NVIC_EnableIRQ(IRQn_Type irq) { g_irq_enabled[irq] = true; }
+void NVIC_DisableIRQ(IRQn_Type irq) { g_irq_enabled[irq] = false; }
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t prio, uint32_t sub) {
+  (void)irq;
+  (void)prio;
+  (void)sub;
+}
+void HAL_NVIC_EnableIRQ(IRQn_Type irq) { NVIC_EnableIRQ(irq); }
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+  if (state == GPIO_PIN_SET)
+    port->ODR |= pin;
+  else
+    port->ODR &= ~(uint32_t)pin;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *port, uint16_t pin) { port->ODR ^= pin; }
+
+
+uint32_t tud_vendor_write(const void *buffer, uint32_t bufsize) {
+  if (bufsize > sizeof(g_usb_buf) - g_usb_len)
+    bufsize = (uint32_t)(sizeof(g_usb_buf) - g_usb_len);
+  memcpy(g_usb_buf + g_usb_len, buffer, bufsize);
+  g_usb_len += bufsize;
+  return bufsize;
+}
+
+uint32_t tud_vendor_write_flush(void) { return (uint32_t)g_usb_len; }
+
+uint32_t tud_vendor_write_available(void) {
+  return (uint32_t)(sizeof(g_usb_buf) - g_usb_len);
+}
+
+size_t host_usb_take(uint8_t *dst, size_t cap) {
+  size_t n = g_usb_len < cap ? g_usb_len : cap;
+  memcpy(dst, g_usb_buf, n);
+  memmove(g_usb_buf, g_usb_buf + n, g_usb_len - n);
+  g_usb_len -= n;
+  return n;
+}
+
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request,
+                      void *buffer, uint16_t len) {
+  (void)rhport;
+  (void)request;
+  if (len > sizeof(g_ctrl_buf))
+    len = sizeof(g_ctrl_buf);
+  memcpy(g_ctrl_buf, buffer, len);
+  g_ctrl_len = len;
+  return true;
+}
+
+size_t host_usb_take_control(uint8_t *dst, size_t cap) {
+  size_t n = g_ctrl_len < cap ? g_ctrl_len : cap;
+  memcpy(dst, g_ctrl_buf, n);
+  g_ctrl_len = 0;
+  return n;
+}
+
+void dcd_sof_enable(uint8_t rhport, bool en) {
+  (void)rhport;
+  g_usb_sof = en;
+}
+
+bool host_usb_sof_enabled(void) { return g_usb_sof; }
+
+tusb_speed_t tud_speed_get(void) {
+  return g_usb_hs ? TUSB_SPEED_HIGH : TUSB_SPEED_FULL;
+}
+
+void host_usb_set_high_speed(bool hs) { g_usb_hs = hs; }
@@ -93,6 +93,71 @@ LoopFillZerobss:
   cmp r2, r4
   bcc FillZerobss
 
+/* Copy the ITCM code and the DTCM tables from flash, see App/inc/tcm.h */
+  ldr r0, =_sitcm
+  ldr r1, =_eitcm
+  ldr r2, =_siitcm
+  movs r3, #0
+  b LoopCopyItcm
+
+CopyItcm:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcm:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcm
+
+  ldr r0, =_sdtcm_data
+  ldr r1, =_edtcm_data
+  ldr r2, =_sidtcm_data
+  movs r3, #0
+  b LoopCopyDtcmData
+
+CopyDtcmData:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyDtcmData:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyDtcmData
+
+/* Zero fill the DTCM state */
+  ldr r2, =_sdtcm_bss
+  ldr r4, =_edtcm_bss
+  movs r3, #0
+  b LoopFillDtcmBss
+
+FillDtcmBss:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillDtcmBss:
+  cmp r2, r4
+  bcc FillDtcmBss
+
+/* Zero fill the DMA buffers in D2 SRAM */
+  ldr r2, =_sdma_buf
+  ldr r4, =_edma_buf
+  movs r3, #0
+  b LoopFillDmaBuf
+
+FillDmaBuf:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillDmaBuf:
+  cmp r2, r4
+  bcc FillDmaBuf
+
+/* The code just written to ITCM runs from here on */
+  dsb
+  isb
+
 /* Call static constructors */
     bl __libc_init_array
 /* Call the application's entry point.*/
@@ -0,0 +1,199 @@
+// fifo.h against the byte-wise critical-section version it replaced
+// (fifo_legacy.h): throughput in bytes/cycle, and how long each legacy call
+// keeps interrupts masked, which is added straight onto the latency of the
+// FOC and scheduler ISRs. The lock-free SPSC paths never mask.
+#include "cycle_counter.h"
+#include "fifo.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Legacy critical sections only time themselves while g_measure is set, so
+// the throughput runs pay a predictable branch instead of a clock read
+static volatile int g_measure = 0;
+#define MAX_SAMPLES 50000
+static uint32_t g_cs_t0, g_cs_count, g_clock_cost;
+static uint32_t g_cs[MAX_SAMPLES];
+static inline void cs_enter_(void) {
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  if (g_measure)
+    g_cs_t0 = cycle_count();
+}
+static inline void cs_exit_(void) {
+  if (g_measure) {
+    uint32_t d = cycle_count() - g_cs_t0 - g_clock_cost;
+    if ((int32_t)d < 0)
+      d = 0;
+    if (g_cs_count < MAX_SAMPLES)
+      g_cs[g_cs_count++] = d;
+  }
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+#define FIFO_LEGACY_CS_STATE int fifo_cs_unused_ __attribute__((unused))
+#define FIFO_LEGACY_CS_ENTER() cs_enter_()
+#define FIFO_LEGACY_CS_EXIT() cs_exit_()
+#include "fifo_legacy.h"
+
+#define BENCH_N 200000
+#define STORAGE 1024
+
+typedef struct {
+  float pos, vel, acc, jerk;
+} axis_t;
+typedef struct {
+  axis_t axis[2];
+} setpoint_t; // same layout as motion_setpoint_t
+
+static void report(const char *name, size_t bytes, uint32_t legacy,
+                   uint32_t now, int n) {
+  printf("%-22s legacy %7.1f cycles %6.3f B/cycle | new %7.1f cycles %6.3f "
+         "B/cycle | x%.1f\n",
+         name, (double)legacy / n, (double)bytes * n / legacy,
+         (double)now / n, (double)bytes * n / now, (double)legacy / now);
+}
+
+static void bench_bytes(size_t len) {
+  static uint8_t s_old[STORAGE], s_new[STORAGE];
+  uint8_t chunk[512] = {0};
+  fifo_legacy_t lf;
+  fifo_t f;
+  fifo_legacy_init(&lf, s_old, STORAGE, NULL);
+  fifo_init(&f, s_new, STORAGE, NULL);
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_legacy_write(&lf, chunk, len);
+    fifo_legacy_read(&lf, chunk, len);
+  }
+  uint32_t legacy = cycle_count() - t0;
+
+  t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_write(&f, chunk, len);
+    fifo_read(&f, chunk, len);
+  }
+  uint32_t now = cycle_count() - t0;
+
+  char name[32];
+  snprintf(name, sizeof(name), "write+read %zu B", len);
+  report(name, len, legacy, now, BENCH_N);
+}
+
+static void bench_push_pop(void) {
+  static uint8_t s_old[STORAGE], s_new[STORAGE];
+  fifo_legacy_t lf;
+  fifo_t f;
+  fifo_legacy_init(&lf, s_old, STORAGE, NULL);
+  fifo_init(&f, s_new, STORAGE, NULL);
+  uint8_t b;
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_legacy_push(&lf, (uint8_t)i);
+    fifo_legacy_pop(&lf, &b);
+  }
+  uint32_t legacy = cycle_count() - t0;
+
+  t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_push(&f, (uint8_t)i);
+    fifo_pop(&f, &b);
+  }
+  report("push+pop 1 B", 1, legacy, cycle_count() - t0, BENCH_N);
+}
+
+// The motion setpoint ring: a byte fifo of whole records before, typed now
+static void bench_setpoints(void) {
+  static uint8_t s_old[64 * sizeof(setpoint_t) + 1];
+  static setpoint_t s_new[65];
+  fifo_legacy_t lf;
+  fifo_t f;
+  fifo_legacy_init(&lf, s_old, sizeof(s_old), NULL);
+  fifo_init_elem(&f, s_new, 65, sizeof(setpoint_t), NULL);
+  setpoint_t sp = {{{1, 2, 3, 4}, {5, 6, 7, 8}}};
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_legacy_write(&lf, (const uint8_t *)&sp, sizeof(sp));
+    fifo_legacy_read(&lf, (uint8_t *)&sp, sizeof(sp));
+  }
+  uint32_t legacy = cycle_count() - t0;
+
+  t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    fifo_write(&f, &sp, 1);
+    fifo_read(&f, &sp, 1);
+  }
+  uint32_t now = cycle_count() - t0;
+  report("setpoint copy", sizeof(sp), legacy, now, BENCH_N);
+
+  // zero-copy: build the record in the ring, consume it in place
+  volatile float sink = 0;
+  t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    void *w;
+    const void *r;
+    if (fifo_reserve(&f, &w)) {
+      *(setpoint_t *)w = sp;
+      fifo_commit(&f, 1);
+    }
+    if (fifo_peek(&f, &r)) {
+      sink += ((const setpoint_t *)r)->axis[1].jerk;
+      fifo_consume(&f, 1);
+    }
+  }
+  now = cycle_count() - t0;
+  report("setpoint reserve/peek", sizeof(sp), legacy, now, BENCH_N);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// p99 rather than max, the host max is whatever the OS preempted us for
+static void bench_masked(size_t len) {
+  static uint8_t s_old[STORAGE];
+  uint8_t chunk[512] = {0};
+  fifo_legacy_t lf;
+  fifo_legacy_init(&lf, s_old, STORAGE, NULL);
+
+  g_cs_count = 0;
+  g_measure = 1;
+  for (int i = 0; i < BENCH_N / 10; i++) {
+    fifo_legacy_write(&lf, chunk, len);
+    fifo_legacy_read(&lf, chunk, len);
+  }
+  g_measure = 0;
+  qsort(g_cs, g_cs_count, sizeof(g_cs[0]), cmp_u32);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < g_cs_count; i++)
+    total += g_cs[i];
+  printf("irq masked per call, %3zu B: legacy avg %6.1f p99 %6u cycles | new "
+         "0 (lock-free)\n",
+         len, (double)total / g_cs_count, g_cs[g_cs_count * 99 / 100]);
+}
+
+static void calibrate_clock(void) {
+  uint32_t best = UINT32_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint32_t a = cycle_count();
+    uint32_t d = cycle_count() - a;
+    if (d < best)
+      best = d;
+  }
+  g_clock_cost = best;
+}
+
+int main(void) {
+  printf("fifo benchmarks, cycles at %lu MHz equivalent\n",
+         CYCLE_COUNTER_HZ / 1000000UL);
+  calibrate_clock();
+  bench_push_pop();
+  bench_bytes(8);
+  bench_bytes(32);
+  bench_bytes(256);
+  bench_setpoints();
+  bench_masked(32);
+  bench_masked(256);
+  return 0;
+}
@@ -0,0 +1,181 @@
+// Cycle-approximate benchmarks of the App code on the host, see
+// cycle_counter.h for how host time maps to target cycles. The fifo has its
+// own comparison in bench_fifo.c.
+#include "cycle_counter.h"
+#include <stdio.h>
+#include "cmd_decode.h"
+#include "cmd_frame.h"
+#include "foc.h"
+#include "host_hal.h"
+#include "motion.h"
+#include "pos_ctrl.h"
+#include "sched_servo.h"
+#include "telemetry.h"
+#include "usb_sof.h"
+
+#define BENCH_N 1000000
+
+static void report(const char *name, uint32_t cycles, int n) {
+  printf("%-28s %8.1f cycles/op\n", name, (double)cycles / n);
+}
+
+static void bench_foc(void) {
+  foc_params_t p = {0.5f, 200e-6f, 7.0f, 4096.0f, 24.0f, 50e-6f};
+  foc_t f;
+  foc_init(&f, &p);
+  foc_tune_bandwidth(&f, 2.0f * PI * 1000.0f);
+  foc_enable(&f, true);
+  foc_set_current(&f, 0.0f, 1.0f);
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++)
+    foc_step(&f, 0.1f, -0.05f, i);
+  report("foc_step", cycle_count() - t0, BENCH_N);
+}
+
+static void bench_pos_ctrl(void) {
+  pos_ctrl_params_t p = {150.0f, 0.05f, 2.0f, 0.0005f,
+                         2e-4f,  3e-8f, 10.0f, 0.001f};
+  pos_ctrl_t c;
+  pos_ctrl_init(&c, &p);
+  axis_setpoint_t sp = {1.0f, 10.0f, 100.0f, 1000.0f};
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++)
+    pos_ctrl_step(&c, &sp, (float)(i & 1023) * 0.001f);
+  report("pos_ctrl_step", cycle_count() - t0, BENCH_N);
+}
+
+static void bench_sched_servo(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  volatile uint32_t sink = 0;
+
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    s.freq_corr_ppb = (i & 0xff) * 1000;
+    sink += sched_servo_fixed_next_arr(&s);
+  }
+  report("sched_servo_fixed_next_arr", cycle_count() - t0, BENCH_N);
+}
+
+// 8000 of these a second in the OTG interrupt, and the poll that refits
+static void bench_usb_sof(void) {
+  static usb_sof_t s;
+  usb_sof_init(&s);
+  uint64_t node = 0;
+  uint32_t t0 = cycle_count();
+  for (int i = 0; i < BENCH_N; i++) {
+    node += USB_SOF_UFRAME_NS + (i & 7) * 100;
+    usb_sof_isr(&s, (uint32_t)i, node);
+    if ((i & 127) == 127) {
+      uint32_t t1 = cycle_count();
+      fifo_reset(&s.ring);
+      t0 += cycle_count() - t1;
+    }
+  }
+  report("usb_sof_isr", cycle_count() - t0, BENCH_N);
+
+  int n = 0;
+  t0 = cycle_count();
+  for (int i = 0; i < BENCH_N / 100; i++) {
+    for (int k = 0; k < 5 * USB_SOF_SAMPLE_UFRAMES; k++) {
+      node += USB_SOF_UFRAME_NS;
+      usb_sof_isr(&s, (uint32_t)(i * 5 * USB_SOF_SAMPLE_UFRAMES + k), node);
+    }
+    usb_sof_poll(&s);
+    n += 5;
+  }
+  report("usb_sof_poll, per sample", cycle_count() - t0, n);
+}
+
+// What telemetry adds to the servo tick: a slot and ~20 stores on a sample
+// tick, a counter otherwise. Packing runs in the main loop.
+static void fill(telemetry_sample_t *s, int i) {
+  for (int a = 0; a < TELEMETRY_AXES; a++) {
+    s->err[a] = s->id[a] = s->iq[a] = s->iq_ref[a] = (float)i;
+    s->enc[a] = i;
+    s->sp_pos[a] = s->sp_vel[a] = (float)i;
+  }
+  s->jb_depth = s->underruns = (uint16_t)i;
+}
+
+static void bench_telemetry(void) {
+  static uint8_t sink[4096];
+  host_hal_reset();
+  telemetry_init();
+
+  for (int dec = 1; dec <= 10; dec += 9) {
+    telemetry_config(SYNC_TLM_CH_ALL, (uint16_t)dec);
+    uint32_t tick = 0, task = 0;
+    int packets = 0;
+    for (int i = 0; i < BENCH_N / 32; i++) {
+      uint32_t t0 = cycle_count();
+      for (int k = 0; k < 32; k++) {
+        uint64_t t_ns = (uint64_t)(i * 32 + k) * 1000000;
+        telemetry_sample_t *s = telemetry_begin(t_ns);
+        if (s) {
+          fill(s, k);
+          telemetry_commit();
+        }
+      }
+      uint32_t t1 = cycle_count();
+      telemetry_task((uint64_t)(i * 32 + 31) * 1000000);
+      task += cycle_count() - t1;
+      tick += t1 - t0;
+      while (host_usb_take(sink, SYNC_TLM_PACKET_SIZE) > 0)
+        packets++;
+    }
+    char name[48];
+    snprintf(name, sizeof(name), "telemetry tick, dec %d", dec);
+    report(name, tick, BENCH_N / 32 * 32);
+    report("telemetry_task, per packet", task, packets ? packets : 1);
+  }
+  telemetry_stats_t st;
+  telemetry_stats(&st);
+  if (st.dropped)
+    printf("telemetry dropped %u samples\n", st.dropped);
+}
+
+// A Cmd of three moves with all four axes full, as the server sends it,
+// decoded into the jitter buffer; flushed between frames, outside the timing
+static void bench_cmd_decode(void) {
+  static motion_setpoint_t storage[MOTION_RING_DEPTH + 1];
+  jitter_buf_t jb;
+  cmd_decoder_t dec;
+  jitter_buf_init(&jb, storage, MOTION_RING_DEPTH, sizeof(motion_setpoint_t),
+                  MOTION_TICK_NS);
+  cmd_decoder_init(&dec);
+
+  static const float axis[6] = {1.25f, 20.0f, -300.0f, 4000.0f, 5e4f, 6e5f};
+  const float *axes[4] = {axis, axis, axis, axis};
+  pb_buf_t moves = {.n = 0};
+  for (uint32_t k = 0; k < 3; k++)
+    pb_move(&moves, axes, (k + 1) * MOTION_TICK_NS, k + 1);
+  uint8_t frame[512];
+  uint32_t n = pb_frame(frame, 1, &moves);
+
+  uint32_t cycles = 0;
+  for (int i = 0; i < BENCH_N; i++) {
+    jitter_buf_flush(&jb);
+    uint32_t t0 = cycle_count();
+    cmd_decode_frame(&dec, &jb, frame, n, 0);
+    cycles += cycle_count() - t0;
+  }
+  report("cmd_decode, 3 moves", cycles, BENCH_N);
+  if (dec.stats.moves != 3u * BENCH_N)
+    printf("cmd_decode queued %u of %u moves\n", dec.stats.moves,
+           3u * BENCH_N);
+}
+
+int main(void) {
+  printf("host benchmarks, cycles at %lu MHz equivalent\n",
+         CYCLE_COUNTER_HZ / 1000000UL);
+  bench_foc();
+  bench_pos_ctrl();
+  bench_sched_servo();
+  bench_usb_sof();
+  bench_telemetry();
+  bench_cmd_decode();
+  return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "sync_protocol.h"
+#include <stdint.h>
+#include <string.h>
+
+// Builds Cmd frames the way the server's encoder does (proto3: zero scalars
+// left out), for the decoder test and benchmark
+
+typedef struct {
+  uint8_t b[512];
+  uint32_t n;
+} pb_buf_t;
+
+static inline void pb_varint(pb_buf_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    p->b[p->n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  p->b[p->n++] = (uint8_t)v;
+}
+
+static inline void pb_f32(pb_buf_t *p, uint32_t field, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, 4);
+  if (!bits)
+    return;
+  pb_varint(p, field << 3 | 5);
+  memcpy(p->b + p->n, &v, 4);
+  p->n += 4;
+}
+
+static inline void pb_i32(pb_buf_t *p, uint32_t field, int32_t v) {
+  if (!v)
+    return;
+  pb_varint(p, field << 3 | 0);
+  pb_varint(p, (uint64_t)(int64_t)v);
+}
+
+static inline void pb_fixed(pb_buf_t *p, uint32_t field, uint64_t v,
+                            uint32_t size) {
+  if (!v)
+    return;
+  pb_varint(p, field << 3 | (size == 8 ? 1 : 5));
+  memcpy(p->b + p->n, &v, size);
+  p->n += size;
+}
+
+static inline void pb_sub(pb_buf_t *p, uint32_t field,
+                          const pb_buf_t *sub) {
+  pb_varint(p, field << 3 | 2);
+  pb_varint(p, sub->n);
+  memcpy(p->b + p->n, sub->b, sub->n);
+  p->n += sub->n;
+}
+
+// AxisMoveCmd: pos, vel, acc, jerk, snap, crackle
+static inline void pb_axis(pb_buf_t *p, uint32_t field, const float v[6]) {
+  pb_buf_t a = {.n = 0};
+  for (uint32_t i = 0; i < 6; i++)
+    pb_f32(&a, i + 1, v[i]);
+  pb_sub(p, field, &a);
+}
+
+// MoveCmd into Moves, axes[g] NULL for an axis left out
+static inline void pb_move(pb_buf_t *moves, const float *axes[4],
+                           uint64_t t_ns, uint32_t seq) {
+  pb_buf_t m = {.n = 0};
+  for (uint32_t g = 0; g < 4; g++)
+    if (axes[g])
+      pb_axis(&m, g + 1, axes[g]);
+  pb_fixed(&m, 5, t_ns, 8);
+  pb_fixed(&m, 6, seq, 4);
+  pb_sub(moves, 1, &m);
+}
+
+// Cmd with `payload` as oneof member `field`, delimited behind the type
+// byte; returns the frame length
+static inline uint32_t pb_frame(uint8_t *out, uint32_t field,
+                                const pb_buf_t *payload) {
+  pb_buf_t cmd = {.n = 0};
+  pb_sub(&cmd, field, payload);
+  pb_buf_t f = {.n = 0};
+  f.b[f.n++] = SYNC_MSG_TYPE_CMD;
+  pb_varint(&f, cmd.n);
+  memcpy(f.b + f.n, cmd.b, cmd.n);
+  f.n += cmd.n;
+  memcpy(out, f.b, f.n);
+  return f.n;
+}
@@ -0,0 +1,73 @@
+#include "motor_plant.h"
+#include <math.h>
+
+void motor_plant_init(motor_plant_t *m) {
+  m->r = 0.5;
+  m->l = 200e-6;
+  m->flux = 0.005;
+  m->pole_pairs = 7;
+  m->j = 2e-5;
+  m->b = 1e-5;
+  m->vbus = 24.0;
+  m->encoder_cpr = 4096;
+  m->enc_zero = 1234;
+  m->id = m->iq = 0;
+  m->omega = 0;
+  m->theta = 0;
+  m->load = 0;
+}
+
+static double theta_e(const motor_plant_t *m) {
+  return m->theta * m->pole_pairs;
+}
+
+void motor_plant_step(motor_plant_t *m, const float duty[3], double dt,
+                      int substeps) {
+  // phase to neutral voltages, the neutral floats at the mean leg voltage
+  double va = duty[0] * m->vbus, vb = duty[1] * m->vbus,
+         vc = duty[2] * m->vbus;
+  double vn = (va + vb + vc) / 3.0;
+  va -= vn;
+  vb -= vn;
+  vc -= vn;
+  double v_alpha = va;
+  double v_beta = (vb - vc) / sqrt(3.0);
+
+  double h = dt / substeps;
+  for (int i = 0; i < substeps; i++) {
+    double th = theta_e(m);
+    double s = sin(th), c = cos(th);
+    double vd = v_alpha * c + v_beta * s;
+    double vq = -v_alpha * s + v_beta * c;
+    double we = m->omega * m->pole_pairs;
+
+    double did = (vd - m->r * m->id + we * m->l * m->iq) / m->l;
+    double diq =
+        (vq - m->r * m->iq - we * m->l * m->id - we * m->flux) / m->l;
+    double dw = (motor_plant_torque(m) - m->b * m->omega - m->load) / m->j;
+
+    m->id += did * h;
+    m->iq += diq * h;
+    m->omega += dw * h;
+    m->theta += m->omega * h;
+  }
+}
+
+void motor_plant_phase_currents(const motor_plant_t *m, double *ia,
+                                double *ib) {
+  double th = theta_e(m);
+  double s = sin(th), c = cos(th);
+  double i_alpha = m->id * c - m->iq * s;
+  double i_beta = m->id * s + m->iq * c;
+  *ia = i_alpha;
+  *ib = -0.5 * i_alpha + sqrt(3.0) / 2.0 * i_beta;
+}
+
+int32_t motor_plant_encoder(const motor_plant_t *m) {
+  return (int32_t)floor(m->theta / (2.0 * M_PI) * m->encoder_cpr) +
+         m->enc_zero;
+}
+
+double motor_plant_torque(const motor_plant_t *m) {
+  return 1.5 * m->pole_pairs * m->flux * m->iq;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+// Surface PMSM in the rotor frame driven by an ideal three phase inverter.
+// Only used by the host tests, integrates with a fixed Euler sub-step.
+
+typedef struct {
+  double r;          // ohm
+  double l;          // henry
+  double flux;       // V*s/rad, permanent magnet flux linkage
+  double pole_pairs; //
+  double j;          // kg*m^2
+  double b;          // N*m*s/rad viscous friction
+  double vbus;       // volts
+  double encoder_cpr;
+  int32_t enc_zero; // encoder count when the rotor sits at electrical zero
+
+  double id, iq;    // amps
+  double omega;     // mechanical rad/s
+  double theta;     // mechanical rad
+  double load;      // N*m opposing torque
+} motor_plant_t;
+
+void motor_plant_init(motor_plant_t *m);
+// Advance by dt with the given phase duty cycles held constant
+void motor_plant_step(motor_plant_t *m, const float duty[3], double dt,
+                      int substeps);
+void motor_plant_phase_currents(const motor_plant_t *m, double *ia,
+                                double *ib);
+int32_t motor_plant_encoder(const motor_plant_t *m);
+double motor_plant_torque(const motor_plant_t *m);
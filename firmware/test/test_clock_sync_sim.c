@@ -0,0 +1,266 @@
+// Closed loop simulation of the scheduler clock sync: sched_servo and the
+// clock estimator against drifting node and host oscillators and a USB link
+// whose up and down delays differ. Mirrors node_sync.c: one exchange every
+// 20 ticks, t3 from TIM5 corrected by the servo rate, ARR preloaded so a new
+// value takes effect one period late. The /sof scenarios also emulate the
+// host controller's microframe SOFs, timestamped on TIM5 behind a variable
+// interrupt latency, and feed the usb_sof fit to the servo.
+//
+// Reports the convergence time, the residual phase jitter and bias against
+// the true host clock, and how much the estimator improves on the raw
+// per-exchange offset.
+#include "sched_servo.h"
+#include "usb_sof.h"
+#include "test_util.h"
+#include <math.h>
+#include <stdio.h>
+
+#define TIMER_HZ 10e6
+#define SYNC_EVERY 20
+
+typedef struct {
+  const char *name;
+  double node_ppm;          // node crystal error
+  double wander_ppm;        // temperature wander on top, sinusoidal
+  double wander_period_s;
+  double host_ppm;          // host clock error against true time
+  double hello_ns;          // host zeroes this long before the node does
+  double wake_mean_ns;      // host user space wakeup after the IN completes
+  double spike_p;           // chance of an extra scheduling delay per leg
+  double seconds;
+  double band_ns;           // converged once the 1 s mean phase stays inside
+  double max_jitter_ns;
+  bool sof;                 // servo gets the USB SOF drift
+  double bus_ppm;           // host controller crystal against true time
+} scenario_t;
+
+typedef struct {
+  double converged_s; // inside band_ns of the settled phase from here on
+  double locked_s;    // when the servo reported lock
+  double bias_ns;     // mean phase error after convergence
+  double jitter_ns;   // rms about the mean
+  double max_ns;
+  double raw_err_ns;  // rms error of the per-exchange offset
+  double est_err_ns;  // rms error of the estimated offset
+  double freq_std_ppm;
+} result_t;
+
+static uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+static double urand(void) {
+  g_rng ^= g_rng << 13;
+  g_rng ^= g_rng >> 7;
+  g_rng ^= g_rng << 17;
+  return (double)(g_rng >> 11) / 9007199254740992.0;
+}
+static double exprand(double mean) { return -mean * log(1.0 - urand()); }
+
+// High speed IN data waits for the host's next IN token, up to a microframe,
+// and t1 is only taken once the completion reaches user space
+static double uplink_ns(const scenario_t *sc) {
+  double d = 20e3 + urand() * 125e3 + exprand(sc->wake_mean_ns);
+  if (urand() < sc->spike_p)
+    d += exprand(400e3);
+  return d;
+}
+
+// The response goes out in the next OUT microframe
+static double downlink_ns(const scenario_t *sc) {
+  double d = 15e3 + urand() * 125e3;
+  if (urand() < sc->spike_p)
+    d += exprand(400e3);
+  return d;
+}
+
+static double node_ppm(const scenario_t *sc, double t_ns) {
+  return sc->node_ppm +
+         sc->wander_ppm * sin(2 * M_PI * t_ns * 1e-9 / sc->wander_period_s);
+}
+
+static double host_clock(const scenario_t *sc, double t_ns) {
+  return (t_ns + sc->hello_ns) * (1.0 + sc->host_ppm * 1e-6);
+}
+
+// Every SOF in [t, t_next) into the OTG interrupt. raw is TIM5 time at t.
+// The SOF interrupt sits below the scheduler tick, which sometimes holds it
+// off for a few us.
+static void emit_sofs(const scenario_t *sc, usb_sof_t *sof, int64_t *next_uf,
+                      double t, double t_next, double raw) {
+  const double bus_rate = 1.0 + sc->bus_ppm * 1e-6;
+  const double node_rate = 1.0 + node_ppm(sc, t) * 1e-6;
+  for (;;) {
+    double ts = (double)*next_uf * USB_SOF_UFRAME_NS / bus_rate;
+    if (ts >= t_next)
+      return;
+    double lat = 300 + urand() * 150;
+    if (urand() < 0.05)
+      lat += urand() * 8e3;
+    double node = raw + (ts - t) * node_rate + lat;
+    usb_sof_isr(sof, (uint32_t)*next_uf, (uint64_t)(node / 100.0) * 100);
+    (*next_uf)++;
+  }
+}
+
+static result_t run(const scenario_t *sc) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, SERVO_DEFAULT_KP_FP,
+                         SERVO_DEFAULT_KI_FP);
+  static usb_sof_t sof;
+  usb_sof_init(&sof);
+  int64_t next_uf = 1000; // host controller was running before we started
+  double raw = 0;         // TIM5, free running
+
+  int ticks = (int)(sc->seconds * 1000);
+  static double err[600000];
+  static double freq[600000];
+  double raw_sq = 0, est_sq = 0;
+  int n_est = 0;
+
+  double t = 0;              // true time, ns
+  int64_t sched_ns = 0;      // scheduler_time_ns
+  uint32_t arr = 9999;       // active period
+  uint32_t arr_shadow = 9999; // preloaded, active from the next period
+  int counter = 0;
+  bool pending = false;
+  double req_t = 0, rx_t = 0;
+  uint64_t t0 = 0, t1 = 0, t2 = 0;
+
+  for (int k = 0; k < ticks; k++) {
+    double rate = TIMER_HZ * (1.0 + node_ppm(sc, t) * 1e-6);
+    double t_next = t + (arr + 1) / rate * 1e9;
+
+    if (pending && rx_t < t_next) {
+      // TIM5 runs off the same crystal, 100 ns resolution
+      double elapsed_true = rx_t - req_t;
+      double tim5 = elapsed_true * (1.0 + node_ppm(sc, req_t) * 1e-6);
+      int64_t elapsed = (int64_t)(tim5 / 100.0) * 100;
+      uint64_t t3 = t0 + elapsed - elapsed * s.freq_corr_ppb / 1000000000LL;
+      double node_exact = t0 + tim5 * (1.0 - s.freq_corr_ppb * 1e-9);
+      double true_off = host_clock(sc, rx_t) - node_exact;
+
+      if (sc->sof)
+        sched_servo_fixed_set_bus_drift(&s, usb_sof_poll(&sof),
+                                        sof.est.drift_ppb);
+      sched_servo_fixed_on_sync(&s, t0, t1, t2, t3);
+      pending = false;
+      if (s.est.valid && k > ticks / 2) {
+        raw_sq += pow(s.last_offset_ns - true_off, 2);
+        est_sq += pow(s.est_offset_ns - true_off, 2);
+        n_est++;
+      }
+    }
+
+    if (sc->sof)
+      emit_sofs(sc, &sof, &next_uf, t, t_next, raw);
+    raw += (t_next - t) * (1.0 + node_ppm(sc, t) * 1e-6);
+
+    // update event: the preloaded ARR becomes active, the ISR runs
+    t = t_next;
+    arr = arr_shadow;
+    sched_ns += 1000000;
+    err[k] = host_clock(sc, t) - (double)sched_ns;
+    freq[k] = s.freq_corr_ppb * 1e-3;
+
+    if (++counter >= SYNC_EVERY && !pending) {
+      counter = 0;
+      pending = true;
+      req_t = t;
+      t0 = (uint64_t)sched_ns;
+      double at_host = t + uplink_ns(sc);
+      t1 = (uint64_t)host_clock(sc, at_host);
+      double turn = 5e3 + urand() * 5e3;
+      t2 = (uint64_t)host_clock(sc, at_host + turn);
+      rx_t = at_host + turn + downlink_ns(sc);
+    }
+    arr_shadow = sched_servo_fixed_next_arr(&s);
+  }
+
+  // The up/down asymmetry is invisible to any four-timestamp exchange and
+  // leaves a constant phase bias, so convergence is measured against the
+  // phase the loop settles at (mean of the second half): the first time after
+  // which the 1 s moving average stays within band_ns of it
+  result_t r = {0};
+  int from = ticks / 2;
+  double sum = 0, fsum = 0;
+  for (int k = from; k < ticks; k++) {
+    sum += err[k];
+    fsum += freq[k];
+  }
+  int n = ticks - from;
+  r.bias_ns = sum / n;
+  int conv = ticks;
+  double win = 0;
+  for (int k = ticks - 1; k >= 0; k--) {
+    win += err[k];
+    if (k + 1000 < ticks)
+      win -= err[k + 1000];
+    if (k + 1000 <= ticks && fabs(win / 1000 - r.bias_ns) >= sc->band_ns)
+      break;
+    conv = k;
+  }
+  r.converged_s = conv * 1e-3;
+  r.locked_s = s.locked_at_ns >= 0 ? s.locked_at_ns * 1e-9 : -1;
+
+  // steady state statistics over the second half
+  double sq = 0, fsq = 0;
+  for (int k = from; k < ticks; k++) {
+    double d = err[k] - r.bias_ns;
+    sq += d * d;
+    if (fabs(d) > r.max_ns)
+      r.max_ns = fabs(d);
+    fsq += pow(freq[k] - fsum / n, 2);
+  }
+  r.jitter_ns = n ? sqrt(sq / n) : 0;
+  r.freq_std_ppm = n ? sqrt(fsq / n) : 0;
+  r.raw_err_ns = n_est ? sqrt(raw_sq / n_est) : 0;
+  r.est_err_ns = n_est ? sqrt(est_sq / n_est) : 0;
+
+  printf("%-8s converged %5.2f s (servo lock %5.2f s) | phase bias %7.0f ns "
+         "jitter %6.0f ns max %6.0f ns | offset err raw %6.0f ns est %6.0f "
+         "ns | rate std %.2f ppm\n",
+         sc->name, r.converged_s, r.locked_s, r.bias_ns, r.jitter_ns, r.max_ns,
+         r.raw_err_ns, r.est_err_ns, r.freq_std_ppm);
+  return r;
+}
+
+// The bias limit is what the modelled link asymmetry allows: the fastest
+// exchanges still see (up - down) / 2 of a few us on top of the 5 us
+// difference in the fixed latencies, and the wake-up tail only hits the uplink
+static void check(const scenario_t *sc, const result_t *r) {
+  CHECK(r->converged_s < sc->seconds / 3, "%s: converged after %.2f s",
+        sc->name, r->converged_s);
+  CHECK(r->locked_s >= 0, "%s: servo never reported lock", sc->name);
+  CHECK(r->jitter_ns < sc->max_jitter_ns, "%s: phase jitter %.0f ns",
+        sc->name, r->jitter_ns);
+  CHECK(fabs(r->bias_ns) < 30000, "%s: phase bias %.0f ns", sc->name,
+        r->bias_ns);
+  CHECK(r->est_err_ns < r->raw_err_ns / 2,
+        "%s: estimator %.0f ns no better than raw %.0f ns", sc->name,
+        r->est_err_ns, r->raw_err_ns);
+}
+
+int main(void) {
+  const scenario_t scenarios[] = {
+      {"nominal", 35, 2, 30, -12, 300e3, 30e3, 0.02, 60, 20e3, 10e3},
+      {"heavy", -80, 5, 20, 25, 800e3, 80e3, 0.10, 60, 40e3, 20e3},
+      {"nom/sof", 35, 2, 30, -12, 300e3, 30e3, 0.02, 60, 20e3, 10e3, true,
+       -11.3},
+      {"heavy/sof", -80, 5, 20, 25, 800e3, 80e3, 0.10, 60, 40e3, 20e3, true,
+       27},
+  };
+  result_t r[4];
+  for (int i = 0; i < 4; i++) {
+    g_rng = 0x9e3779b97f4a7c15ULL;
+    r[i] = run(&scenarios[i]);
+    check(&scenarios[i], &r[i]);
+  }
+  // same link noise, the SOF drift has to steady both rate and phase
+  for (int i = 0; i < 2; i++) {
+    CHECK(r[i + 2].freq_std_ppm < r[i].freq_std_ppm * 0.8,
+          "%s: rate std %.2f ppm, without SOF %.2f ppm", scenarios[i + 2].name,
+          r[i + 2].freq_std_ppm, r[i].freq_std_ppm);
+    CHECK(r[i + 2].jitter_ns < r[i].jitter_ns,
+          "%s: phase jitter %.0f ns, without SOF %.0f ns",
+          scenarios[i + 2].name, r[i + 2].jitter_ns, r[i].jitter_ns);
+  }
+  return test_report("clock_sync_sim");
+}
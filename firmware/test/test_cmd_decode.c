@@ -0,0 +1,242 @@
+// cmd_decode against frames built like the server builds them: moves land in
+// the jitter buffer slots through the axis map, configuration reaches the
+// callbacks, and a broken frame never queues a half parsed move.
+#include "cmd_decode.h"
+#include "cmd_frame.h"
+#include "motion.h"
+#include "test_util.h"
+#include <math.h>
+#include <stdio.h>
+
+#define TICK_NS 1000000ULL
+#define DEPTH 8
+
+static motion_setpoint_t g_storage[DEPTH + 1];
+static jitter_buf_t g_jb;
+static cmd_decoder_t g_dec;
+
+static int g_pid_axis = -100;
+static float g_pid[4];
+static void set_pid(int axis, float p, float i, float d, float tf) {
+  g_pid_axis = axis;
+  g_pid[0] = p;
+  g_pid[1] = i;
+  g_pid[2] = d;
+  g_pid[3] = tf;
+}
+
+static int g_params_calls;
+static float g_params[5];
+static void set_params(int axis, float phase_r, float phase_l,
+                       float encoder_cpr, float counts_per_mm) {
+  g_params_calls++;
+  g_params[0] = (float)axis;
+  g_params[1] = phase_r;
+  g_params[2] = phase_l;
+  g_params[3] = encoder_cpr;
+  g_params[4] = counts_per_mm;
+}
+
+static void reset(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(motion_setpoint_t), TICK_NS);
+  cmd_decoder_init(&g_dec);
+  g_dec.set_pid = set_pid;
+  g_dec.set_params = set_params;
+  g_params_calls = 0;
+}
+
+static bool axis_is(const axis_setpoint_t *a, float pos, float vel, float acc,
+                    float jerk) {
+  return a->pos == pos && a->vel == vel && a->acc == acc && a->jerk == jerk;
+}
+
+static void test_moves(void) {
+  reset();
+  static const float x[6] = {1.5f, 2.0f, -3.0f, 4.0f, 5.0f, 6.0f};
+  static const float y[6] = {-7.0f, 0.0f, 0.0f, 8.0f, 0.0f, 0.0f};
+  pb_buf_t moves = {.n = 0};
+  for (uint32_t k = 0; k < 3; k++) {
+    const float *axes[4] = {x, k == 1 ? NULL : y, x, y};
+    pb_move(&moves, axes, (10 + k) * TICK_NS, 100 + k);
+  }
+  uint8_t frame[512];
+  uint32_t n = pb_frame(frame, 1, &moves);
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "frame rejected");
+  CHECK(g_dec.stats.frames == 1 && g_dec.stats.moves == 3 &&
+            g_dec.stats.malformed == 0,
+        "frames %u moves %u malformed %u", g_dec.stats.frames,
+        g_dec.stats.moves, g_dec.stats.malformed);
+
+  for (uint32_t k = 0; k < 3; k++) {
+    motion_setpoint_t sp;
+    CHECK(jitter_buf_release(&g_jb, (10 + k) * TICK_NS, &sp) ==
+              JITTER_RELEASED,
+          "move %u not released", k);
+    CHECK(sp.t_ns == (10 + k) * TICK_NS && sp.seq == 100 + k,
+          "move %u: t %" PRIu64 " seq %u", k, sp.t_ns, sp.seq);
+    CHECK(axis_is(&sp.axis[0], 1.5f, 2.0f, -3.0f, 4.0f), "move %u x", k);
+    // zeros left out and an absent axis both read back as zero
+    if (k == 1)
+      CHECK(axis_is(&sp.axis[1], 0, 0, 0, 0), "absent y not zeroed");
+    else
+      CHECK(axis_is(&sp.axis[1], -7.0f, 0, 0, 8.0f), "move %u y", k);
+  }
+}
+
+static void test_config(void) {
+  reset();
+  // X on another node, Y and Z on motors 0 and 1, E nowhere
+  pb_buf_t cfg = {.n = 0};
+  pb_f32(&cfg, 1, 1e-3f);
+  pb_i32(&cfg, 2, -1);
+  pb_i32(&cfg, 3, 0);
+  pb_i32(&cfg, 4, 1);
+  pb_i32(&cfg, 5, 7);
+  uint8_t frame[512];
+  uint32_t n = pb_frame(frame, 4, &cfg);
+  CHECK(n == 2 + 2 + 5 + 11 + 2 + 2, "ConfigSystem frame %u bytes", n);
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "config rejected");
+  CHECK(g_dec.motor[0] == -1 && g_dec.motor[1] == 0 && g_dec.motor[2] == 1 &&
+            g_dec.motor[3] == -1,
+        "map %d %d %d %d", g_dec.motor[0], g_dec.motor[1], g_dec.motor[2],
+        g_dec.motor[3]);
+  CHECK(g_dec.timestep == 1e-3f && g_dec.stats.config == 1, "timestep");
+
+  static const float a[6] = {1, 0, 0, 0, 0, 0};
+  static const float b[6] = {2, 0, 0, 0, 0, 0};
+  static const float c[6] = {3, 0, 0, 0, 0, 0};
+  const float *axes[4] = {a, b, c, a};
+  pb_buf_t moves = {.n = 0};
+  pb_move(&moves, axes, 5 * TICK_NS, 1);
+  n = pb_frame(frame, 1, &moves);
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "move rejected");
+  motion_setpoint_t sp;
+  jitter_buf_release(&g_jb, 5 * TICK_NS, &sp);
+  CHECK(sp.axis[0].pos == 2 && sp.axis[1].pos == 3, "remapped %g %g",
+        sp.axis[0].pos, sp.axis[1].pos);
+
+  pb_buf_t pid = {.n = 0};
+  pb_i32(&pid, 1, 1);
+  for (uint32_t f = 2; f <= 5; f++)
+    pb_f32(&pid, f, (float)f);
+  pb_i32(&pid, 15, 99); // unknown, skipped
+  n = pb_frame(frame, 3, &pid);
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "SetPID rejected");
+  CHECK(g_pid_axis == 1 && g_pid[0] == 2 && g_pid[1] == 3 && g_pid[2] == 4 &&
+            g_pid[3] == 5,
+        "SetPID axis %d", g_pid_axis);
+}
+
+static uint32_t params_frame(uint8_t *frame, const float v[4]) {
+  pb_buf_t params = {.n = 0};
+  pb_i32(&params, 1, 1);
+  for (uint32_t f = 2; f <= 5; f++)
+    pb_f32(&params, f, v[f - 2]);
+  return pb_frame(frame, 2, &params);
+}
+
+// a field left out reads 0, counts/mm of 0 would turn every position into
+// inf: the frame is refused and the callback never sees it
+static void test_params(void) {
+  reset();
+  uint8_t frame[128];
+  static const float good[4] = {0.5f, 1e-3f, 4096.0f, 102.4f};
+  uint32_t n = params_frame(frame, good);
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "SetParams rejected");
+  CHECK(g_params_calls == 1 && g_params[0] == 1 && g_params[4] == 102.4f,
+        "SetParams calls %d", g_params_calls);
+
+  const float bad[][4] = {
+      {0.5f, 1e-3f, 4096.0f, 0.0f},       // counts_per_mm omitted
+      {0.5f, 1e-3f, -4096.0f, 102.4f},    // negative
+      {0.5f, NAN, 4096.0f, 102.4f},       // not a number
+      {INFINITY, 1e-3f, 4096.0f, 102.4f}, // not finite
+      {0.5f, 1e-3f, 0.5f, 102.4f},        // cpr truncates to 0
+      {0.5f, 1e-3f, 4096.5f, 102.4f},     // fractional cpr
+      {0.5f, 1e-3f, 1e9f, 102.4f},        // cpr past a float's counts
+  };
+  for (size_t k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+    n = params_frame(frame, bad[k]);
+    CHECK(!cmd_decode_frame(&g_dec, &g_jb, frame, n, 0),
+          "SetParams %zu accepted", k);
+  }
+  CHECK(g_params_calls == 1 && g_params[4] == 102.4f &&
+            g_dec.stats.config == 1 && g_dec.stats.malformed == 7,
+        "bad SetParams applied: calls %d config %u malformed %u",
+        g_params_calls, g_dec.stats.config, g_dec.stats.malformed);
+
+  // SetPID gains may be 0, not negative
+  pb_buf_t pid = {.n = 0};
+  pb_i32(&pid, 1, 0);
+  pb_f32(&pid, 2, -1.0f);
+  n = pb_frame(frame, 3, &pid);
+  CHECK(!cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "negative P accepted");
+}
+
+static void test_broken(void) {
+  reset();
+  static const float x[6] = {1, 2, 3, 4, 0, 0};
+  const float *axes[4] = {x, x, NULL, NULL};
+  pb_buf_t moves = {.n = 0};
+  pb_move(&moves, axes, 3 * TICK_NS, 1);
+  pb_move(&moves, axes, 4 * TICK_NS, 2);
+  uint8_t frame[512];
+  uint32_t n = pb_frame(frame, 1, &moves);
+
+  // the Cmd length claims more than arrived: nothing is parsed
+  CHECK(!cmd_decode_frame(&g_dec, &g_jb, frame, n - 3, 0),
+        "truncated frame parsed");
+  CHECK(g_dec.stats.malformed == 1, "malformed %u", g_dec.stats.malformed);
+  CHECK(fifo_size(&g_jb.ring) == 0, "truncated frame queued %u",
+        (unsigned)fifo_size(&g_jb.ring));
+
+  // the lengths around it fit but the second move is cut short: the first
+  // is queued, the second is not
+  pb_buf_t bad = moves;
+  bad.n -= 3;
+  n = pb_frame(frame, 1, &bad);
+  CHECK(!cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "short move parsed");
+  CHECK(g_dec.stats.moves == 1 && g_dec.stats.malformed == 2,
+        "moves %u malformed %u", g_dec.stats.moves, g_dec.stats.malformed);
+  CHECK(fifo_size(&g_jb.ring) == 1, "queued %u",
+        (unsigned)fifo_size(&g_jb.ring));
+
+  CHECK(!cmd_decode_frame(&g_dec, &g_jb, (const uint8_t[]){0x42, 0}, 2, 0),
+        "wrong type byte parsed");
+
+  // a full buffer rejects moves, the frame itself is fine
+  reset();
+  pb_buf_t one = {.n = 0};
+  for (uint32_t k = 0; k <= DEPTH; k++) {
+    one.n = 0;
+    pb_move(&one, axes, (k + 1) * TICK_NS, k);
+    n = pb_frame(frame, 1, &one);
+    CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, n, 0), "move %u", k);
+  }
+  CHECK(g_dec.stats.moves == DEPTH && g_dec.stats.rejected == 1 &&
+            g_jb.stats.overflows == 1,
+        "moves %u rejected %u", g_dec.stats.moves, g_dec.stats.rejected);
+}
+
+// The same bytes proto.zig's "known bytes" test pins down
+static void test_known_bytes(void) {
+  reset();
+  static const uint8_t frame[] = {
+      SYNC_MSG_TYPE_CMD, 18, 0x0a, 16, 0x0a, 14, 0x0a, 5,    0x0d, 0x00,
+      0x00,              0x80, 0x3f, 0x12, 0,    0x35, 7,    0,    0,    0};
+  CHECK(cmd_decode_frame(&g_dec, &g_jb, frame, sizeof(frame), 0),
+        "known bytes rejected");
+  motion_setpoint_t sp;
+  CHECK(jitter_buf_release(&g_jb, 0, &sp) == JITTER_RELEASED, "not queued");
+  CHECK(sp.seq == 7 && sp.axis[0].pos == 1.0f && sp.axis[1].pos == 0,
+        "seq %u x %g", sp.seq, sp.axis[0].pos);
+}
+
+int main(void) {
+  test_moves();
+  test_config();
+  test_params();
+  test_broken();
+  test_known_bytes();
+  return test_report("cmd_decode");
+}
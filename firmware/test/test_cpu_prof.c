@@ -0,0 +1,88 @@
+// cpu_prof: counts, budgets and the lazy reset, with the cycles handed in
+// so the numbers are exact
+#include "cpu_prof.h"
+#include "test_util.h"
+#include <string.h>
+
+static sync_cpu_prof_t read_prof(uint64_t now_ns) {
+  sync_cpu_prof_t p;
+  memset(&p, 0xa5, sizeof(p));
+  cpu_prof_read(&p, now_ns);
+  return p;
+}
+
+int main(void) {
+  CHECK(sizeof(sync_cpu_prof_t) == 16 + SYNC_CPU_SLOTS * 32,
+        "sync_cpu_prof_t is %zu bytes", sizeof(sync_cpu_prof_t));
+
+  cpu_prof_init(1000);
+  sync_cpu_prof_t p = read_prof(1000);
+  CHECK(p.core_hz == CYCLE_COUNTER_HZ && p.slots == SYNC_CPU_SLOTS &&
+            p.window_ns == 0,
+        "core %u slots %u window %" PRIu64, p.core_hz, p.slots,
+        p.window_ns);
+  for (int i = 0; i < SYNC_CPU_SLOTS; i++)
+    CHECK(p.slot[i].count == 0 && p.slot[i].min == 0 && p.slot[i].max == 0 &&
+              p.slot[i].total == 0,
+          "slot %d not empty before any run", i);
+
+  // min, avg and max, overruns only past the budget
+  cpu_prof_set_budget(SYNC_CPU_TICK, 500);
+  cpu_prof_record(SYNC_CPU_TICK, 100);
+  cpu_prof_record(SYNC_CPU_TICK, 500);
+  cpu_prof_record(SYNC_CPU_TICK, 300);
+  cpu_prof_record(SYNC_CPU_TICK, 700);
+  cpu_prof_record(SYNC_CPU_ADC_ISR, 1234);
+  p = read_prof(1000 + 2000000);
+  const sync_cpu_slot_t *t = &p.slot[SYNC_CPU_TICK];
+  CHECK(t->count == 4 && t->min == 100 && t->max == 700 && t->avg == 400 &&
+            t->total == 1600,
+        "count %u min %u avg %u max %u total %" PRIu64, t->count, t->min,
+        t->avg, t->max, t->total);
+  CHECK(t->budget == 500 && t->overruns == 1, "budget %u overruns %u",
+        t->budget, t->overruns);
+  CHECK(p.window_ns == 2000000, "window %" PRIu64, p.window_ns);
+  const sync_cpu_slot_t *a = &p.slot[SYNC_CPU_ADC_ISR];
+  CHECK(a->count == 1 && a->min == 1234 && a->max == 1234 && a->budget == 0 &&
+            a->overruns == 0,
+        "no budget: count %u min %u overruns %u", a->count, a->min,
+        a->overruns);
+  CHECK(p.slot[SYNC_CPU_USB_ISR].count == 0, "untouched slot counted");
+
+  // reading doesn't disturb the counts
+  p = read_prof(1000 + 3000000);
+  CHECK(p.slot[SYNC_CPU_TICK].count == 4, "read changed the counts");
+
+  // a reset empties every slot at once, the budget stays
+  cpu_prof_reset(5000000);
+  p = read_prof(6000000);
+  CHECK(p.window_ns == 1000000, "window after reset %" PRIu64, p.window_ns);
+  CHECK(p.slot[SYNC_CPU_TICK].count == 0 && p.slot[SYNC_CPU_TICK].max == 0 &&
+            p.slot[SYNC_CPU_ADC_ISR].count == 0,
+        "counts survived the reset");
+  CHECK(p.slot[SYNC_CPU_TICK].budget == 500, "budget lost on reset");
+  cpu_prof_record(SYNC_CPU_TICK, 900);
+  p = read_prof(6000000);
+  t = &p.slot[SYNC_CPU_TICK];
+  CHECK(t->count == 1 && t->min == 900 && t->max == 900 && t->overruns == 1,
+        "after reset: count %u min %u max %u overruns %u", t->count, t->min,
+        t->max, t->overruns);
+
+  // out of range slots are ignored
+  cpu_prof_record(SYNC_CPU_SLOTS, 1);
+  cpu_prof_set_budget(SYNC_CPU_SLOTS, 1);
+
+  // the inline helper times a real span
+  uint32_t t0 = cycle_count();
+  volatile uint32_t sink = 0;
+  for (int i = 0; i < 10000; i++)
+    sink += i;
+  cpu_prof_end(SYNC_CPU_TLM_TASK, t0);
+  p = read_prof(6000000);
+  CHECK(p.slot[SYNC_CPU_TLM_TASK].count == 1 &&
+            p.slot[SYNC_CPU_TLM_TASK].max > 0,
+        "cpu_prof_end recorded %u runs, %u cycles",
+        p.slot[SYNC_CPU_TLM_TASK].count, p.slot[SYNC_CPU_TLM_TASK].max);
+
+  return test_report("cpu_prof");
+}
@@ -0,0 +1,187 @@
+// Extended position and the M/T velocity estimate against synthetic
+// quadrature: a shaft moving at a piecewise constant speed, the 16 bit
+// counter it drives, and the count and timestamp the timers capture on
+// every ENCx_A rising edge
+#include "encoder.h"
+#include "test_util.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TS_HZ 275000000u // APB1 timer clock
+#define LOOP_TICKS (TS_HZ / 20000) // 20 kHz current loop
+
+typedef struct {
+  double x;        // shaft position, counts
+  uint32_t t;      // timestamp clock
+  int64_t count;   // what the counter has counted, unwrapped
+  uint16_t base;   // counter value at x = 0
+  uint16_t edge_cnt;
+  uint32_t edge_t;
+  int captures;
+} shaft_t;
+
+static void shaft_init(shaft_t *q, double x, uint32_t t, uint16_t base) {
+  memset(q, 0, sizeof(*q));
+  q->x = x;
+  q->t = t;
+  q->count = (int64_t)floor(x);
+  q->base = base;
+  q->edge_cnt = 0x5555; // whatever was latched before
+  q->edge_t = t - 12345;
+}
+
+// Count step to n at time t. x4 decoding: A rises on 0 -> 1 going forward
+// and on 3 -> 2 going back.
+static void shaft_step(shaft_t *q, int64_t n, uint32_t t) {
+  bool fwd = n > q->count;
+  q->count = n;
+  if ((n & 3) == (fwd ? 1 : 2)) {
+    q->edge_cnt = (uint16_t)(q->base + n);
+    q->edge_t = t;
+    q->captures++;
+  }
+}
+
+// Move at v counts/s for the given timestamp ticks
+static void shaft_run(shaft_t *q, double v, uint32_t ticks) {
+  double x0 = q->x, x1 = x0 + v * ticks / TS_HZ;
+  if (x1 > x0) {
+    for (int64_t n = (int64_t)floor(x0) + 1; n <= (int64_t)floor(x1); n++)
+      shaft_step(q, n, q->t + (uint32_t)ceil((n - x0) / (x1 - x0) * ticks));
+  } else if (x1 < x0) {
+    for (int64_t n = (int64_t)floor(x0); n > (int64_t)floor(x1); n--)
+      shaft_step(q, n - 1, q->t + (uint32_t)ceil((x0 - n) / (x0 - x1) * ticks));
+  }
+  q->x = x1;
+  q->t += ticks;
+}
+
+static encoder_sample_t shaft_sample(const shaft_t *q) {
+  encoder_sample_t s = {
+      .cnt = (uint16_t)(q->base + q->count),
+      .edge_cnt = q->edge_cnt,
+      .edge_t = q->edge_t,
+      .now_t = q->t,
+  };
+  return s;
+}
+
+// Runs `loops` current loop periods at v, returns the worst position error
+static int64_t run(shaft_t *q, encoder_t *e, int64_t count0, double v,
+                   int loops) {
+  int64_t worst = 0;
+  for (int i = 0; i < loops; i++) {
+    shaft_run(q, v, LOOP_TICKS);
+    encoder_sample_t s = shaft_sample(q);
+    encoder_update(e, &s);
+    int64_t err = llabs(e->pos - (q->count - count0));
+    if (err > worst)
+      worst = err;
+  }
+  return worst;
+}
+
+static bool near(double got, double want, double rel) {
+  return fabs(got - want) <= rel * fabs(want);
+}
+
+int main(void) {
+  shaft_t q;
+  encoder_t e;
+
+  // fast enough to wrap the counter dozens of times, both ways, and across
+  // the timestamp wrap; position exact at every update
+  shaft_init(&q, 0.3, 0xfff00000u, 65530);
+  encoder_sample_t s = shaft_sample(&q);
+  encoder_init(&e, TS_HZ, &s);
+  CHECK(e.ts_num == TS_HZ << 3 && e.stale_ticks == TS_HZ / 10,
+        "ts_num %u shift %d stale %u", e.ts_num, e.ts_shift, e.stale_ticks);
+  int64_t worst = run(&q, &e, 0, 3.0e6, 20000); // 1 s
+  CHECK(worst == 0 && e.pos == 3000000, "pos %" PRId64 " worst %" PRId64,
+        e.pos, worst);
+  CHECK(near(encoder_velocity(&e), 3.0e6, 1e-4), "vel at 3M counts/s: %f",
+        encoder_velocity(&e));
+  worst = run(&q, &e, 0, -4.5e6, 20000);
+  CHECK(worst == 0 && e.pos == -1500000, "pos %" PRId64 " worst %" PRId64,
+        e.pos, worst);
+  CHECK(near(encoder_velocity(&e), -4.5e6, 1e-4), "vel at -4.5M counts/s: %f",
+        encoder_velocity(&e));
+
+  // past what 32 bits hold
+  e.pos += (int64_t)3 << 31;
+  int64_t from = e.pos;
+  run(&q, &e, q.count - from, 1.0e6, 2000);
+  CHECK(e.pos == from + 100000 && e.pos > INT32_MAX, "pos %" PRId64, e.pos);
+
+  // slow: an edge every 40 ms, ~800 loop periods apart. Differencing counts
+  // at the 1 kHz servo tick reads 0 or 1000 counts/s here, M/T gets the
+  // speed from the first window on.
+  shaft_init(&q, 10.5, 1000, 0);
+  s = shaft_sample(&q);
+  encoder_init(&e, TS_HZ, &s);
+  run(&q, &e, 10, 100.0, 20000);
+  CHECK(e.edges >= 20, "%u windows", e.edges);
+  CHECK(near(encoder_velocity(&e), 100.0, 1e-4), "vel at 100 counts/s: %f",
+        encoder_velocity(&e));
+  run(&q, &e, 10, -100.0, 20000);
+  CHECK(near(encoder_velocity(&e), -100.0, 1e-4), "vel at -100 counts/s: %f",
+        encoder_velocity(&e));
+
+  // mid speed, a handful of edges per period and windows that don't line up
+  // with the loop
+  run(&q, &e, 10, 12345.0, 2000);
+  CHECK(near(encoder_velocity(&e), 12345.0, 1e-4), "vel at 12345 counts/s: %f",
+        encoder_velocity(&e));
+
+  // a ramp: the estimate is the mean speed of the last window, so it lags by
+  // half a window plus the age of its last edge. From 50k counts/s up both
+  // are under 80 us (4 counts), 160 counts/s at 1M counts/s^2.
+  double v = 0;
+  double worst_lag = 0;
+  for (int i = 0; i < 20000; i++) {
+    v += 50.0; // 1 M counts/s^2
+    run(&q, &e, 10, v, 1);
+    if (i > 1000) {
+      double lag = v - encoder_velocity(&e);
+      if (fabs(lag) > worst_lag)
+        worst_lag = fabs(lag);
+    }
+  }
+  CHECK(worst_lag < 160.0, "ramp lag %f counts/s", worst_lag);
+
+  // stop: no more edges, the estimate follows the bound down and reads zero
+  // once the edges are ENCODER_STALE_DIV apart
+  run(&q, &e, 10, 2000.0, 200);
+  shaft_run(&q, 0.0, LOOP_TICKS);
+  s = shaft_sample(&q);
+  encoder_update(&e, &s);
+  float prev = encoder_velocity(&e);
+  bool falling = true;
+  for (int i = 0; i < 1000; i++) { // 50 ms
+    shaft_run(&q, 0.0, LOOP_TICKS);
+    s = shaft_sample(&q);
+    encoder_update(&e, &s);
+    falling &= encoder_velocity(&e) <= prev;
+    prev = encoder_velocity(&e);
+  }
+  CHECK(falling && prev > 0.0f && prev < 100.0f, "decay to %f", prev);
+  run(&q, &e, 10, 0.0, 1100);
+  CHECK(e.vel == 0 && !e.edge_valid, "stopped at %f", encoder_velocity(&e));
+  // moving again: one edge opens a window, the next one closes it
+  uint32_t edges = e.edges;
+  run(&q, &e, 10, 500.0, 1000);
+  CHECK(e.edges > edges && near(encoder_velocity(&e), 500.0, 1e-4),
+        "restart vel %f", encoder_velocity(&e));
+
+  // dithering across one count makes no edges and no speed
+  shaft_init(&q, 3.2, 0, 100);
+  s = shaft_sample(&q);
+  encoder_init(&e, TS_HZ, &s);
+  for (int i = 0; i < 2000; i++)
+    run(&q, &e, 3, (i & 1) ? -30000.0 : 30000.0, 1);
+  CHECK(e.vel == 0 && q.captures == 0, "dither vel %f, %d captures",
+        encoder_velocity(&e), q.captures);
+
+  return test_report("encoder");
+}
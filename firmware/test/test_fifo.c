@@ -0,0 +1,279 @@
+// Host unit tests for fifo.h, including two-thread SPSC stress runs
+#include "fifo.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+static int g_overflows = 0;
+static void overflow_cb(void) { g_overflows++; }
+
+static void test_push_pop(size_t cap) {
+  uint8_t storage[64];
+  fifo_t f;
+  fifo_init(&f, storage, cap, overflow_cb);
+  g_overflows = 0;
+
+  // one slot is always kept free
+  for (size_t i = 0; i < cap - 1; i++)
+    CHECK(fifo_push(&f, (uint8_t)i), "cap %zu push %zu", cap, i);
+  CHECK(fifo_is_full(&f), "cap %zu should be full", cap);
+  CHECK(!fifo_push(&f, 0xff), "cap %zu push when full", cap);
+  CHECK(g_overflows == 1, "cap %zu overflow callback %d", cap, g_overflows);
+  CHECK(fifo_size(&f) == cap - 1, "cap %zu size %zu", cap, fifo_size(&f));
+
+  // wrap around a few times
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < cap / 2; i++) {
+      uint8_t b = 0;
+      CHECK(fifo_pop(&f, &b), "pop");
+      CHECK(fifo_push(&f, b), "push after pop");
+    }
+  }
+  size_t n = 0;
+  uint8_t b, prev = 0;
+  while (fifo_pop(&f, &b)) {
+    if (n > 0 && b != 0)
+      CHECK((uint8_t)(prev + 1) == b || b == 0, "order %u after %u", b, prev);
+    prev = b;
+    n++;
+  }
+  CHECK(n == cap - 1, "cap %zu popped %zu", cap, n);
+  CHECK(fifo_is_empty(&f), "cap %zu should be empty", cap);
+}
+
+static void test_bulk_wrap(size_t cap) {
+  uint8_t storage[64], src[64], dst[64];
+  fifo_t f;
+  fifo_init(&f, storage, cap, overflow_cb);
+  for (int i = 0; i < 64; i++)
+    src[i] = (uint8_t)(i * 7 + 1);
+
+  // move head and tail near the end so the next write wraps
+  uint8_t junk[64];
+  CHECK(fifo_write(&f, src, cap - 3) == cap - 3, "prefill");
+  CHECK(fifo_read(&f, junk, cap - 3) == cap - 3, "drain");
+
+  size_t n = fifo_write(&f, src, cap / 2 + 1);
+  CHECK(n == cap / 2 + 1, "cap %zu wrapped write %zu", cap, n);
+  n = fifo_read(&f, dst, sizeof(dst));
+  CHECK(n == cap / 2 + 1, "cap %zu wrapped read %zu", cap, n);
+  CHECK(memcmp(src, dst, n) == 0, "cap %zu wrapped data", cap);
+
+  g_overflows = 0;
+  n = fifo_write(&f, src, cap + 10);
+  CHECK(n == cap - 1, "cap %zu write past full returned %zu", cap, n);
+  CHECK(g_overflows == 1, "write past full overflow callback %d",
+        g_overflows);
+}
+
+typedef struct {
+  uint32_t seq;
+  float pos[2];
+} rec_t; // 12 bytes, not a power of two
+
+static void test_typed(size_t cap) {
+  rec_t storage[16], out[16];
+  fifo_t f;
+  fifo_init_elem(&f, storage, cap, sizeof(rec_t), overflow_cb);
+  g_overflows = 0;
+
+  uint32_t wseq = 0, rseq = 0;
+  for (int round = 0; round < 5; round++) {
+    rec_t in[16];
+    size_t want = cap - 1 - (size_t)round % 3;
+    for (size_t i = 0; i < want; i++) {
+      in[i].seq = wseq + (uint32_t)i;
+      in[i].pos[0] = (float)in[i].seq;
+      in[i].pos[1] = -(float)in[i].seq;
+    }
+    size_t n = fifo_write(&f, in, want);
+    CHECK(n == want, "cap %zu round %d wrote %zu", cap, round, n);
+    wseq += (uint32_t)n;
+    CHECK(fifo_size(&f) == want, "cap %zu size %zu", cap, fifo_size(&f));
+
+    n = fifo_read(&f, out, 16);
+    CHECK(n == want, "cap %zu round %d read %zu", cap, round, n);
+    for (size_t i = 0; i < n; i++, rseq++)
+      CHECK(out[i].seq == rseq && out[i].pos[1] == -(float)rseq,
+            "cap %zu record %u", cap, rseq);
+  }
+  CHECK(g_overflows == 0, "unexpected overflow");
+
+  rec_t r = {0};
+  for (size_t i = 0; i < cap - 1; i++)
+    CHECK(fifo_write(&f, &r, 1) == 1, "single write %zu", i);
+  CHECK(fifo_free(&f) == 0 && fifo_is_full(&f), "cap %zu should be full", cap);
+  CHECK(fifo_write(&f, &r, 1) == 0 && g_overflows == 1, "write when full");
+
+  // the byte API would move head a byte's worth of a record: refused
+  fifo_read(&f, out, 1);
+  size_t used = fifo_size(&f), head = f.head, tail = f.tail;
+  uint8_t b = 0;
+  CHECK(!fifo_push(&f, 0x5a) && !fifo_pop(&f, &b), "byte API on a typed ring");
+  CHECK(fifo_size(&f) == used && f.head == head && f.tail == tail,
+        "byte API moved a typed ring");
+}
+
+// Every length through the short copy and past it, at every offset a ring
+// with an odd capacity comes to
+static void test_copy_lengths(void) {
+  uint8_t storage[61], src[60], dst[60];
+  fifo_t f;
+  fifo_init(&f, storage, sizeof(storage), NULL);
+  uint8_t v = 0;
+  for (size_t len = 1; len <= sizeof(src); len++) {
+    for (size_t i = 0; i < len; i++)
+      src[i] = v++;
+    memset(dst, 0, sizeof(dst));
+    CHECK(fifo_write(&f, src, len) == len, "write %zu", len);
+    CHECK(fifo_read(&f, dst, len) == len, "read %zu", len);
+    CHECK(memcmp(src, dst, len) == 0, "data of %zu at %zu", len, f.tail);
+  }
+}
+
+// Spans end at the end of storage, a wrapped ring takes two rounds
+static void test_zero_copy(void) {
+  uint8_t storage[16];
+  fifo_t f;
+  fifo_init(&f, storage, sizeof(storage), NULL);
+
+  uint8_t junk[16];
+  fifo_write(&f, junk, 10);
+  fifo_read(&f, junk, 10);
+
+  void *w;
+  size_t n = fifo_reserve(&f, &w);
+  CHECK(n == 6 && w == storage + 10, "first reserve %zu", n);
+  memset(w, 0xa5, n);
+  CHECK(fifo_is_empty(&f), "reserve must not publish");
+  fifo_commit(&f, n);
+  n = fifo_reserve(&f, &w);
+  CHECK(n == 9 && w == storage, "wrapped reserve %zu", n);
+  memset(w, 0x5a, 4);
+  fifo_commit(&f, 4);
+  CHECK(fifo_size(&f) == 10, "size after commits %zu", fifo_size(&f));
+
+  const void *r;
+  n = fifo_peek(&f, &r);
+  CHECK(n == 6 && r == storage + 10, "first peek %zu", n);
+  CHECK(((const uint8_t *)r)[5] == 0xa5, "peek data");
+  fifo_consume(&f, n);
+  n = fifo_peek(&f, &r);
+  CHECK(n == 4 && ((const uint8_t *)r)[0] == 0x5a, "wrapped peek %zu", n);
+  fifo_consume(&f, 2);
+  CHECK(fifo_size(&f) == 2, "partial consume %zu", fifo_size(&f));
+}
+
+#define STRESS_BYTES 2000000
+static fifo_t g_stress;
+static uint8_t g_stress_storage[256];
+
+static void *producer(void *arg) {
+  (void)arg;
+  uint8_t chunk[17];
+  uint32_t seq = 0;
+  while (seq < STRESS_BYTES) {
+    size_t len = sizeof(chunk);
+    if (STRESS_BYTES - seq < len)
+      len = STRESS_BYTES - seq;
+    for (size_t i = 0; i < len; i++)
+      chunk[i] = (uint8_t)(seq + i);
+    size_t done = 0;
+    while (done < len) {
+      size_t n = fifo_write(&g_stress, chunk + done, len - done);
+      if (n == 0)
+        sched_yield(); // full, let the consumer run on a single core
+      done += n;
+    }
+    seq += (uint32_t)len;
+  }
+  return NULL;
+}
+
+static void test_spsc_threads(void) {
+  fifo_init(&g_stress, g_stress_storage, sizeof(g_stress_storage),
+            overflow_cb);
+  pthread_t th;
+  pthread_create(&th, NULL, producer, NULL);
+
+  uint32_t seq = 0, errors = 0;
+  uint8_t buf[23];
+  while (seq < STRESS_BYTES) {
+    size_t n = fifo_read(&g_stress, buf, sizeof(buf));
+    if (n == 0)
+      sched_yield();
+    for (size_t i = 0; i < n; i++)
+      if (buf[i] != (uint8_t)(seq + i))
+        errors++;
+    seq += (uint32_t)n;
+  }
+  pthread_join(th, NULL);
+  CHECK(errors == 0, "%u corrupted bytes in SPSC stress", errors);
+  CHECK(fifo_is_empty(&g_stress), "stress fifo not empty at the end");
+}
+
+// Producer fills reserved spans in place, consumer reads peeked spans
+#define STRESS_RECS 300000
+static fifo_t g_typed;
+static rec_t g_typed_storage[37];
+
+static void *span_producer(void *arg) {
+  (void)arg;
+  uint32_t seq = 0;
+  while (seq < STRESS_RECS) {
+    void *span;
+    size_t n = fifo_reserve(&g_typed, &span);
+    if (n == 0) {
+      sched_yield();
+      continue;
+    }
+    if (n > STRESS_RECS - seq)
+      n = STRESS_RECS - seq;
+    rec_t *r = span;
+    for (size_t i = 0; i < n; i++) {
+      r[i].seq = seq + (uint32_t)i;
+      r[i].pos[0] = r[i].pos[1] = (float)(seq + i);
+    }
+    fifo_commit(&g_typed, n);
+    seq += (uint32_t)n;
+  }
+  return NULL;
+}
+
+static void test_spsc_spans(void) {
+  fifo_init_elem(&g_typed, g_typed_storage, 37, sizeof(rec_t), overflow_cb);
+  pthread_t th;
+  pthread_create(&th, NULL, span_producer, NULL);
+
+  uint32_t seq = 0, errors = 0;
+  while (seq < STRESS_RECS) {
+    const void *span;
+    size_t n = fifo_peek(&g_typed, &span);
+    if (n == 0) {
+      sched_yield();
+      continue;
+    }
+    const rec_t *r = span;
+    for (size_t i = 0; i < n; i++, seq++)
+      if (r[i].seq != seq || r[i].pos[1] != (float)seq)
+        errors++;
+    fifo_consume(&g_typed, n);
+  }
+  pthread_join(th, NULL);
+  CHECK(errors == 0, "%u corrupted records in span stress", errors);
+}
+
+int main(void) {
+  test_push_pop(16); // power of two, masked wrap
+  test_push_pop(13); // compare-and-subtract wrap
+  test_bulk_wrap(16);
+  test_bulk_wrap(13);
+  test_typed(16);
+  test_typed(11);
+  test_copy_lengths();
+  test_zero_copy();
+  test_spsc_threads();
+  test_spsc_spans();
+  return test_report("fifo");
+}
@@ -0,0 +1,213 @@
+// Host regression test for the FOC current loop against the PMSM plant model
+#include "foc.h"
+#include "motor_plant.h"
+#include "test_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TS (1.0 / 20000.0)
+#define SUBSTEPS 20
+#define AMPS_PER_COUNT (3.3 / 65536.0 * 10.0)
+
+typedef struct {
+  motor_plant_t plant;
+  foc_t foc;
+  float duty[3]; // applied during the current period
+} sim_t;
+
+static void sim_init(sim_t *s) {
+  motor_plant_init(&s->plant);
+  foc_params_t p = {
+      .phase_r = (float)s->plant.r,
+      .phase_l = (float)s->plant.l,
+      .pole_pairs = (float)s->plant.pole_pairs,
+      .encoder_cpr = (float)s->plant.encoder_cpr,
+      .vbus = (float)s->plant.vbus,
+      .ts = (float)TS,
+  };
+  foc_init(&s->foc, &p);
+  foc_tune_bandwidth(&s->foc, 2.0f * PI * 1000.0f);
+  s->foc.enc_offset = s->plant.enc_zero; // as if already aligned
+  s->duty[0] = s->duty[1] = s->duty[2] = 0.5f;
+}
+
+// One PWM period: sample at the start, compute, and like the hardware
+// preload the new duties only take effect in the following period
+static void sim_period(sim_t *s) {
+  double ia, ib;
+  motor_plant_phase_currents(&s->plant, &ia, &ib);
+  float ia_q = (float)(lround(ia / AMPS_PER_COUNT) * AMPS_PER_COUNT);
+  float ib_q = (float)(lround(ib / AMPS_PER_COUNT) * AMPS_PER_COUNT);
+
+  foc_step(&s->foc, ia_q, ib_q, motor_plant_encoder(&s->plant));
+  motor_plant_step(&s->plant, s->duty, TS, SUBSTEPS);
+  for (int i = 0; i < 3; i++)
+    s->duty[i] = s->foc.enabled ? s->foc.duty[i] : 0.5f;
+}
+
+static double wrap_pi(double a) {
+  while (a > M_PI)
+    a -= 2 * M_PI;
+  while (a < -M_PI)
+    a += 2 * M_PI;
+  return a;
+}
+
+static void test_align(void) {
+  sim_t s;
+  sim_init(&s);
+  s.foc.enc_offset = 0;
+  s.plant.theta = 0.3;
+  s.plant.b = 2e-3; // needs some damping to settle within the window
+  foc_enable(&s.foc, true);
+  foc_align(&s.foc, 2.0f, 10000);
+  while (foc_aligning(&s.foc))
+    sim_period(&s);
+
+  s.plant.b = 1e-5;
+  sim_period(&s);
+  double true_e = s.plant.theta * s.plant.pole_pairs;
+  double err = wrap_pi(s.foc.theta_e - true_e);
+  double count_e = 2 * M_PI * s.plant.pole_pairs / s.plant.encoder_cpr;
+  printf("align: offset %d, angle error %.4f rad\n", (int)s.foc.enc_offset,
+         err);
+  CHECK(fabs(err) < 3 * count_e, "alignment error %f rad", err);
+}
+
+static void test_step_response(void) {
+  sim_t s;
+  sim_init(&s);
+  s.plant.j = 1e9; // locked rotor
+  foc_enable(&s.foc, true);
+  foc_set_current(&s.foc, 0.0f, 2.0f);
+
+  int rise = -1;
+  double peak = 0;
+  for (int k = 0; k < 200; k++) {
+    sim_period(&s);
+    if (rise < 0 && s.plant.iq >= 0.9 * 2.0)
+      rise = k;
+    if (s.plant.iq > peak)
+      peak = s.plant.iq;
+  }
+  printf("step: 90%% rise in %d periods, peak %.3f A, final iq %.4f id %.4f\n",
+         rise, peak, s.plant.iq, s.plant.id);
+  CHECK(rise >= 0 && rise <= 10, "rise time %d periods", rise);
+  CHECK(peak < 2.0 * 1.15, "overshoot, peak %f", peak);
+  CHECK(fabs(s.plant.iq - 2.0) < 0.02, "steady state iq %f", s.plant.iq);
+  CHECK(fabs(s.plant.id) < 0.02, "steady state id %f", s.plant.id);
+}
+
+static void test_spin_and_saturate(void) {
+  sim_t s;
+  sim_init(&s);
+  foc_enable(&s.foc, true);
+  foc_set_current(&s.foc, 0.0f, 2.0f);
+
+  double id_sq = 0, iq_sq = 0;
+  int n = 0;
+  for (int k = 0; k < 500; k++) { // 25 ms, well before back EMF limits
+    sim_period(&s);
+    if (k >= 20) {
+      id_sq += s.plant.id * s.plant.id;
+      iq_sq += (s.plant.iq - 2.0) * (s.plant.iq - 2.0);
+      n++;
+    }
+  }
+  double id_rms = sqrt(id_sq / n), iq_rms = sqrt(iq_sq / n);
+  printf("spin: %.1f rad/s, id rms %.4f A, iq err rms %.4f A\n", s.plant.omega,
+         id_rms, iq_rms);
+  CHECK(id_rms < 0.05, "id rms %f while spinning", id_rms);
+  // back EMF ramps while accelerating, a PI lags a ramp by rate / Ki
+  CHECK(iq_rms < 0.1, "iq error rms %f while spinning", iq_rms);
+
+  // run into the voltage limit, the integrators must not wind up
+  for (int k = 0; k < 4000; k++)
+    sim_period(&s);
+  printf("saturated: %.1f rad/s, vq %.2f V, iq %.3f A\n", s.plant.omega,
+         s.foc.vq, s.plant.iq);
+  CHECK(s.plant.iq < 1.0, "expected back EMF to limit iq, got %f", s.plant.iq);
+  CHECK(fabs(s.foc.vq) <= s.foc.v_max + 1e-3f, "vq %f over limit", s.foc.vq);
+
+  // braking needs the q voltage to come off the limit right away
+  foc_set_current(&s.foc, 0.0f, -1.0f);
+  int settle = -1;
+  for (int k = 0; k < 100 && settle < 0; k++) {
+    sim_period(&s);
+    if (s.plant.iq < -0.9)
+      settle = k;
+  }
+  printf("unwind: iq at -0.9 A after %d periods\n", settle);
+  CHECK(settle >= 0 && settle <= 20, "windup, settle %d periods", settle);
+}
+
+// A CPR that doesn't divide 2^32, the position runs through +-2^31 and 2^32
+// and the angle must follow the true position modulo the CPR all the way
+static void test_wrap(void) {
+  sim_t s;
+  sim_init(&s);
+  foc_set_encoder_cpr(&s.foc, 4000.0f);
+  s.foc.enc_offset = 1234;
+  const double count_e = 2 * M_PI * s.plant.pole_pairs / 4000.0;
+  const int64_t starts[] = {INT32_MAX - 20000, (int64_t)INT32_MIN + 20000,
+                            UINT32_MAX - 20000, -(int64_t)UINT32_MAX + 20000};
+  const int64_t steps[] = {7, -7, 1999, 3, -1999};
+  int bad = 0;
+  for (int i = 0; i < 4; i++) {
+    int64_t pos = starts[i];
+    for (int n = 0; n < 40000; n++) {
+      pos += steps[n % 5] + (i < 2 ? 2 : -2);
+      foc_step(&s.foc, 0.0f, 0.0f, pos);
+      int64_t c = ((pos - 1234) % 4000 + 4000) % 4000;
+      double err = wrap_pi(s.foc.theta_e - (double)c * count_e);
+      if (fabs(err) > 1e-3 && bad++ < 5)
+        CHECK(0, "pos %" PRId64 ": angle %f, want %f", pos, s.foc.theta_e,
+              (double)c * count_e);
+    }
+  }
+  CHECK(bad == 0, "%d wrong angles around the 32 bit boundaries", bad);
+
+  // a jump and a CPR change reduce from scratch
+  foc_step(&s.foc, 0.0f, 0.0f, (int64_t)1 << 40);
+  CHECK(fabs(wrap_pi(s.foc.theta_e -
+                     (double)((((int64_t)1 << 40) - 1234) % 4000) * count_e)) <
+            1e-3,
+        "angle after a jump %f", s.foc.theta_e);
+  foc_set_encoder_cpr(&s.foc, 3000.0f);
+  CHECK(s.foc.enc_offset == 1234 % 3000, "offset %d", (int)s.foc.enc_offset);
+  foc_step(&s.foc, 0.0f, 0.0f, ((int64_t)1 << 40) + 1);
+  double want = (double)((((int64_t)1 << 40) + 1 - 1234) % 3000) *
+                (2 * M_PI * s.plant.pole_pairs / 3000.0);
+  CHECK(fabs(wrap_pi(s.foc.theta_e - want)) < 1e-3,
+        "angle after the CPR change %f, want %f", s.foc.theta_e, want);
+}
+
+static void bench_step(void) {
+  sim_t s;
+  sim_init(&s);
+  foc_enable(&s.foc, true);
+  foc_set_current(&s.foc, 0.0f, 1.0f);
+
+  const int n = 1000000;
+  volatile float sink = 0;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < n; i++) {
+    foc_step(&s.foc, 0.1f, -0.05f, i);
+    sink += s.foc.duty[0];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double ns =
+      ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / (double)n;
+  printf("bench: foc_step %.1f ns/call on host\n", ns);
+}
+
+int main(void) {
+  test_align();
+  test_step_response();
+  test_spin_and_saturate();
+  test_wrap();
+  bench_step();
+  return test_report("foc");
+}
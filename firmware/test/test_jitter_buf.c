@@ -0,0 +1,221 @@
+// jitter_buf against emulated USB arrivals: the host stamps one sample per
+// tick some lead ahead of the node clock, the samples come in bunched up
+// behind bus and host scheduling jitter, and the 1 ms tick has to release
+// each one on its own tick no matter when it arrived.
+#include "jitter_buf.h"
+#include "test_util.h"
+#include <stdio.h>
+
+#define TICK_NS 1000000ULL
+#define DEPTH 16
+
+typedef struct {
+  uint64_t t_ns;
+  uint32_t k; // sample number
+} sample_t;
+
+static sample_t g_storage[DEPTH + 1];
+static jitter_buf_t g_jb;
+
+static uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+static double urand(void) {
+  g_rng ^= g_rng << 13;
+  g_rng ^= g_rng >> 7;
+  g_rng ^= g_rng << 17;
+  return (double)(g_rng >> 11) / 9007199254740992.0;
+}
+
+typedef struct {
+  uint64_t t0_ns;     // target time of sample 0
+  uint64_t lead_ns;   // host sends this far ahead of the target
+  double jitter_ns;   // arrival delay on top, uniform
+  uint32_t burst;     // samples per USB transfer
+  uint32_t stall_at;  // sample where the host stalls, 0 for none
+  uint64_t stall_ns;
+
+  uint32_t next;       // next sample to send
+  uint64_t arrive_ns;  // arrival time of the pending transfer
+  uint32_t released;   // samples seen by the tick
+  uint32_t off_tick;   // released ahead of its tick
+  uint32_t out_of_order;
+  uint32_t last_k;
+} stream_t;
+
+static uint64_t target(const stream_t *st, uint32_t k) {
+  return st->t0_ns + (uint64_t)k * TICK_NS;
+}
+
+static void schedule(stream_t *st) {
+  uint64_t send = target(st, st->next) - st->lead_ns;
+  if (st->stall_at && st->next == st->stall_at)
+    send += st->stall_ns;
+  st->arrive_ns = send + (uint64_t)(urand() * st->jitter_ns);
+}
+
+// n ticks of node time, arrivals delivered in between
+static void run(stream_t *st, uint32_t n, uint64_t *now) {
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t tick = *now + TICK_NS;
+    while (st->arrive_ns < tick) {
+      for (uint32_t b = 0; b < st->burst; b++) {
+        sample_t s = {target(st, st->next), st->next};
+        jitter_buf_push(&g_jb, &s, st->arrive_ns);
+        st->next++;
+      }
+      schedule(st);
+    }
+    *now = tick;
+
+    sample_t out;
+    if (jitter_buf_release(&g_jb, *now, &out) != JITTER_RELEASED)
+      continue;
+    // behind its tick only when it came in late, jb.stats.late has those
+    if ((int64_t)(out.t_ns - *now) > (int64_t)TICK_NS / 2)
+      st->off_tick++;
+    if (st->released && out.k <= st->last_k)
+      st->out_of_order++;
+    st->last_k = out.k;
+    st->released++;
+  }
+}
+
+static void report(const char *name) {
+  const jitter_buf_stats_t *s = &g_jb.stats;
+  printf("%-9s released %5u late %3u skipped %3u waits %3u empty %3u "
+         "overflows %u misordered %u\n",
+         name, s->released, s->late, s->skipped, s->waits, s->empty,
+         s->overflows, s->misordered);
+}
+
+// 3 samples per transfer, up to 4 ms of arrival jitter under an 8 ms lead:
+// every sample goes out on exactly its tick
+static void test_on_time(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(sample_t), TICK_NS);
+  stream_t st = {.t0_ns = 100 * TICK_NS, .lead_ns = 8 * TICK_NS,
+                 .jitter_ns = 4e6, .burst = 3};
+  uint64_t now = 90 * TICK_NS;
+  schedule(&st);
+  run(&st, 9, &now); // up to the first sample
+  CHECK(g_jb.stats.released == 0, "released before its time");
+  run(&st, 5000, &now);
+  report("on time");
+  CHECK(st.released == 5000 && g_jb.stats.released == 5000,
+        "released %u of 5000", st.released);
+  CHECK(g_jb.stats.late == 0 && g_jb.stats.skipped == 0,
+        "late %u skipped %u", g_jb.stats.late, g_jb.stats.skipped);
+  CHECK(st.off_tick == 0 && st.out_of_order == 0, "off tick %u order %u",
+        st.off_tick, st.out_of_order);
+  int64_t slack = jitter_buf_take_slack(&g_jb);
+  printf("          slack min %" PRId64 " us\n", slack / 1000);
+  // the last sample of a transfer is stamped 2 ticks after the first
+  CHECK(slack >= 4 * (int64_t)TICK_NS && slack < 8 * (int64_t)TICK_NS,
+        "slack %" PRId64, slack);
+  CHECK(jitter_buf_take_slack(&g_jb) == INT64_MAX, "slack not reset");
+}
+
+// Host timeline 0.3 ms off the tick grid: the nearest tick takes each sample
+static void test_off_grid(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(sample_t), TICK_NS);
+  stream_t st = {.t0_ns = 50 * TICK_NS + 300000, .lead_ns = 5 * TICK_NS,
+                 .jitter_ns = 2e6, .burst = 1};
+  uint64_t now = 40 * TICK_NS;
+  schedule(&st);
+  run(&st, 2000, &now);
+  report("off grid");
+  // nothing due on the 9 ticks up to 50 ms, 50.3 ms goes out on that one
+  CHECK(g_jb.stats.late == 0 && st.off_tick == 0 &&
+            g_jb.stats.empty + g_jb.stats.waits == 9,
+        "late %u off tick %u idle %u", g_jb.stats.late, st.off_tick,
+        g_jb.stats.empty + g_jb.stats.waits);
+}
+
+// The host stalls 6 ms with a 2 ms lead: the samples it owed come in late,
+// the tick jumps to the newest due one and never goes backwards
+static void test_stall(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(sample_t), TICK_NS);
+  stream_t st = {.t0_ns = 10 * TICK_NS, .lead_ns = 2 * TICK_NS,
+                 .jitter_ns = 0.5e6, .burst = 1, .stall_at = 500,
+                 .stall_ns = 6 * TICK_NS};
+  uint64_t now = 5 * TICK_NS;
+  schedule(&st);
+  run(&st, 1000, &now);
+  report("stall");
+  CHECK(g_jb.stats.late >= 3 && g_jb.stats.skipped >= 3,
+        "late %u skipped %u", g_jb.stats.late, g_jb.stats.skipped);
+  // all but possibly the one released are overtaken
+  CHECK(g_jb.stats.skipped + 1 >= g_jb.stats.late,
+        "late %u, skipped %u", g_jb.stats.late, g_jb.stats.skipped);
+  CHECK(st.out_of_order == 0 && st.off_tick == 0, "order %u off tick %u",
+        st.out_of_order, st.off_tick);
+  CHECK(jitter_buf_take_slack(&g_jb) < 0, "late arrival not in the slack");
+}
+
+static void test_rejects(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(sample_t), TICK_NS);
+  sample_t s = {.t_ns = 10 * TICK_NS};
+  CHECK(jitter_buf_push(&g_jb, &s, 0), "first push");
+  CHECK(!jitter_buf_push(&g_jb, &s, 0), "same time twice");
+  s.t_ns -= TICK_NS;
+  CHECK(!jitter_buf_push(&g_jb, &s, 0), "time going back");
+  CHECK(g_jb.stats.misordered == 2, "misordered %u", g_jb.stats.misordered);
+
+  for (uint32_t k = 1; k < DEPTH + 4; k++) {
+    s.t_ns = (10 + k) * TICK_NS;
+    jitter_buf_push(&g_jb, &s, 0);
+  }
+  CHECK(g_jb.stats.overflows == 4, "overflows %u", g_jb.stats.overflows);
+
+  sample_t out;
+  CHECK(jitter_buf_release(&g_jb, 5 * TICK_NS, &out) == JITTER_WAIT,
+        "released early");
+  jitter_buf_flush(&g_jb);
+  CHECK(jitter_buf_release(&g_jb, 10 * TICK_NS, &out) == JITTER_EMPTY,
+        "not empty after flush");
+  // the restarted clock starts over from 0
+  s.t_ns = TICK_NS;
+  CHECK(jitter_buf_push(&g_jb, &s, 0), "push after flush");
+  CHECK(jitter_buf_release(&g_jb, TICK_NS, &out) == JITTER_RELEASED &&
+            out.t_ns == TICK_NS,
+        "release after flush");
+}
+
+// in place: the slot is filled where it sits and only queued on commit
+static void test_reserve(void) {
+  jitter_buf_init(&g_jb, g_storage, DEPTH, sizeof(sample_t), TICK_NS);
+  sample_t *s = jitter_buf_reserve(&g_jb);
+  CHECK(s != NULL, "no slot in an empty buffer");
+  s->t_ns = 5 * TICK_NS;
+  sample_t out;
+  CHECK(jitter_buf_release(&g_jb, 5 * TICK_NS, &out) == JITTER_EMPTY,
+        "released before the commit");
+  CHECK(jitter_buf_commit(&g_jb, 2 * TICK_NS), "commit");
+  CHECK(!jitter_buf_commit(&g_jb, 2 * TICK_NS), "committed twice");
+  CHECK(jitter_buf_take_slack(&g_jb) == 3 * TICK_NS, "slack of the commit");
+
+  // a misordered one is dropped and its slot handed out again
+  sample_t *again = jitter_buf_reserve(&g_jb);
+  again->t_ns = 4 * TICK_NS;
+  CHECK(!jitter_buf_commit(&g_jb, 0), "committed going back in time");
+  CHECK(jitter_buf_reserve(&g_jb) == again, "slot not reused");
+  CHECK(g_jb.stats.misordered == 1, "misordered %u", g_jb.stats.misordered);
+
+  for (uint32_t k = 1; k < DEPTH; k++) {
+    s = jitter_buf_reserve(&g_jb);
+    s->t_ns = (5 + k) * TICK_NS;
+    jitter_buf_commit(&g_jb, 0);
+  }
+  CHECK(jitter_buf_reserve(&g_jb) == NULL && g_jb.stats.overflows == 1,
+        "full buffer: overflows %u", g_jb.stats.overflows);
+  CHECK(jitter_buf_release(&g_jb, 5 * TICK_NS, &out) == JITTER_RELEASED &&
+            out.t_ns == 5 * TICK_NS,
+        "first committed not first out");
+}
+
+int main(void) {
+  test_on_time();
+  test_off_grid();
+  test_stall();
+  test_rejects();
+  test_reserve();
+  return test_report("jitter_buf");
+}
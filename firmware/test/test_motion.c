@@ -0,0 +1,133 @@
+// Host test of the servo tick side of motion.c: Cmd frames into the jitter
+// buffer, released on their tick into the position loop once the loops are
+// enabled and the motors aligned. The motor side is stubbed, the axes sit
+// still at their position.
+#include "../App/src/motion.c"
+#include "cmd_frame.h"
+#include "host_hal.h"
+#include "test_util.h"
+
+#define TICK_NS MOTION_TICK_NS
+
+static int64_t g_enc[MOTION_NUM_AXES];
+static float g_iq[MOTION_NUM_AXES];
+static foc_t g_foc_stub;
+static bool g_gates[MOTION_NUM_AXES];
+static int g_aligns[MOTION_NUM_AXES];
+static bool g_align_busy[MOTION_NUM_AXES]; // until the test says it's done
+
+int64_t motor_position(int m) { return g_enc[m]; }
+void motor_set_current(int m, float id, float iq) {
+  (void)id;
+  g_iq[m] = iq;
+}
+foc_t *motor_foc(int m) {
+  (void)m;
+  return &g_foc_stub;
+}
+void motor_set_params(int m, float phase_r, float phase_l, float encoder_cpr) {
+  (void)m, (void)phase_r, (void)phase_l, (void)encoder_cpr;
+}
+void motor_enable(int m, bool en) { g_gates[m] = en; }
+void motor_align(int m, float current) {
+  (void)current;
+  g_aligns[m]++;
+  g_align_busy[m] = true;
+}
+bool motor_aligning(int m) { return g_align_busy[m]; }
+void tmc_spi_latest(int d, uint32_t out[TMC_SPI_REGS]) {
+  (void)d;
+  memset(out, 0, TMC_SPI_REGS * sizeof(out[0]));
+}
+
+// one MoveCmd per tick from t0, X at pos_mm
+static uint32_t moves_frame(uint8_t *frame, uint64_t t0, uint32_t seq,
+                            float pos_mm, int count) {
+  const float x[6] = {pos_mm, 0, 0, 0, 0, 0};
+  pb_buf_t moves = {.n = 0};
+  for (int k = 0; k < count; k++) {
+    const float *axes[4] = {x, NULL, NULL, NULL};
+    pb_move(&moves, axes, t0 + (uint64_t)k * TICK_NS, seq + (uint32_t)k);
+  }
+  return pb_frame(frame, 1, &moves);
+}
+
+int main(void) {
+  uint8_t frame[512];
+  motion_stats_t st;
+
+  host_hal_reset();
+  telemetry_init();
+  motion_init();
+  g_enc[0] = 4096; // 40 mm
+
+  // the split conversion, around zero and past 32 bits
+  CHECK(counts_to_mm(0, -1) == -1.0f / 102.4f && counts_to_mm(0, 4096) == 40.0f,
+        "small: %f %f", counts_to_mm(0, -1), counts_to_mm(0, 4096));
+  CHECK(counts_to_mm(0, -((int64_t)5 << 32) - 1024) ==
+            (float)(-((int64_t)5 << 32) - 1024) / 102.4f,
+        "large: %f", counts_to_mm(0, -((int64_t)5 << 32) - 1024));
+
+  // disabled: moves queue up but the tick leaves them and the motors alone
+  uint32_t n = moves_frame(frame, 5 * TICK_NS, 1, 40.0f, 1);
+  CHECK(motion_rx_cmd(frame, n, 0), "frame rejected");
+  motion_tick(5 * TICK_NS);
+  motion_stats(&st);
+  CHECK(st.ack == 0 && st.jb.released == 0 && motion_ring_free() ==
+                                                   MOTION_RING_DEPTH - 1,
+        "released while disabled: ack %u released %u", st.ack,
+        st.jb.released);
+  motion_flush();
+
+  // enabled: gates on, aligned, the loops wait for the alignment
+  motion_enable(true);
+  CHECK(g_gates[0] && g_gates[MOTION_NUM_AXES - 1] && g_aligns[0] == 1,
+        "enable: gates %d aligns %d", g_gates[0], g_aligns[0]);
+  n = moves_frame(frame, 6 * TICK_NS, 10, 40.0f, 1);
+  CHECK(motion_rx_cmd(frame, n, 5 * TICK_NS), "frame rejected");
+  for (int k = 0; k < 3; k++)
+    motion_tick((6 + (uint64_t)k) * TICK_NS);
+  motion_stats(&st);
+  CHECK(st.jb.released == 0 && st.underruns == 0 && g_iq[0] == 0.0f,
+        "ran while aligning: released %u underruns %u", st.jb.released,
+        st.underruns);
+  motion_flush();
+  for (int a = 0; a < MOTION_NUM_AXES; a++)
+    g_align_busy[a] = false;
+
+  // then holds where the axes are and follows the moves as they come due
+  motion_tick(9 * TICK_NS);
+  motion_stats(&st);
+  CHECK(st.underruns == 1 && g_iq[0] == 0.0f,
+        "hold: underruns %u iq %f", st.underruns, g_iq[0]);
+
+  n = moves_frame(frame, 10 * TICK_NS, 100, 41.0f, 3);
+  CHECK(motion_rx_cmd(frame, n, 9 * TICK_NS), "moves rejected");
+  for (int k = 0; k < 3; k++)
+    motion_tick((10 + (uint64_t)k) * TICK_NS);
+  motion_stats(&st);
+  CHECK(st.jb.released == 3 && st.ack == 103 && st.underruns == 1,
+        "released %u ack %u underruns %u", st.jb.released, st.ack,
+        st.underruns);
+  CHECK(g_ctrl[0].err == 1.0f && g_iq[0] > 0.0f,
+        "following error %f iq %f", g_ctrl[0].err, g_iq[0]);
+
+  // enabling again (a host reattaching) leaves the loops as they are
+  float iq = g_iq[0];
+  motion_enable(true);
+  CHECK(g_ctrl[0].i_cmd == iq && g_aligns[0] == 1, "re-enable reset the loop");
+
+  motion_enable(false);
+  CHECK(g_iq[0] == 0.0f && !g_gates[0], "disable left iq %f gates %d",
+        g_iq[0], g_gates[0]);
+  motion_tick(13 * TICK_NS);
+  motion_stats(&st);
+  CHECK(st.underruns == 1 && st.jb.released == 3, "ticked while disabled");
+
+  // a new session switches the gates back on, the offsets are kept
+  motion_enable(true);
+  CHECK(g_gates[0] && g_aligns[0] == 1, "re-align: gates %d aligns %d",
+        g_gates[0], g_aligns[0]);
+
+  return test_report("motion");
+}
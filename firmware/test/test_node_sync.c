@@ -0,0 +1,278 @@
+// Host test of the sync handshake: scheduler_timer.c and node_sync.c run on
+// the register shim, the test plays the host side of the vendor channel
+#include "../App/src/scheduler_timer.c"
+#include "host_hal.h"
+#include "test_util.h"
+
+// motion.c and tmc_spi.c need the motor, current sense and SPI hardware,
+// not part of this test
+void motion_tick(uint64_t now_ns) { (void)now_ns; }
+void motion_flush(void) {}
+static bool g_motion_on;
+void motion_enable(bool en) { g_motion_on = en; }
+void tmc_spi_tick(void) {}
+static uint32_t g_cmd_frames;
+bool motion_rx_cmd(const uint8_t *buf, uint32_t len, uint64_t now_ns) {
+  (void)buf, (void)len, (void)now_ns;
+  g_cmd_frames++;
+  return true;
+}
+static int64_t g_slack_ns = INT64_MAX;
+int64_t motion_take_slack_ns(void) {
+  int64_t s = g_slack_ns;
+  g_slack_ns = INT64_MAX;
+  return s;
+}
+void motion_stats(motion_stats_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->jb.late = 3;
+  out->ack = 42;
+}
+
+static void tick(int n) {
+  for (int i = 0; i < n; i++) {
+    host_tim_advance(TIM5, 10000);
+    if (host_tim_advance(TIM24, TIM24->ARR + 1))
+      TIM24_IRQHandler();
+  }
+}
+
+static void hello_v2(uint32_t features) {
+  uint8_t buf[256];
+  sync_hello_t h = {SYNC_MSG_TYPE_HELLO, 0, 0, 2, SYNC_ENC_PB, features, 3, 0};
+  tud_vendor_rx_cb(0, (const uint8_t *)&h, sizeof(h));
+  host_usb_take(buf, sizeof(buf)); // the caps
+}
+
+// The bridges are on only while a host that drives the motors is there:
+// a clock only host, unmount, suspend and a host gone quiet all turn them off
+static void test_power_stage(void) {
+  uint8_t buf[256];
+  hello_v2(SYNC_FEAT_ACK | SYNC_FEAT_MOTION);
+  CHECK(g_motion_on, "motion host didn't enable motion");
+  hello_v2(SYNC_FEAT_ACK | SYNC_FEAT_SOF_DRIFT); // host_clock_sync
+  CHECK(!g_motion_on, "clock only host left motion on");
+
+  // answered requests keep the session going past SYNC_LOST_TICKS
+  hello_v2(SYNC_FEAT_MOTION);
+  for (int i = 0; i < 2 * SYNC_LOST_TICKS / SYNC_INTERVAL_TICKS; i++) {
+    tick(SYNC_INTERVAL_TICKS);
+    sync_req_t req;
+    CHECK(host_usb_take((uint8_t *)&req, sizeof(req)) == sizeof(req),
+          "no request %d", i);
+    sync_resp_t resp = {SYNC_MSG_TYPE_RESP, 0, req.seq, req.t0_ns + 30000,
+                        req.t0_ns + 32000};
+    tud_vendor_rx_cb(0, (const uint8_t *)&resp, sizeof(resp));
+    host_usb_take(buf, sizeof(buf)); // the stats
+  }
+  sync_task();
+  CHECK(g_motion_on, "answered session timed out");
+
+  // no answers: the tick notices, the main loop turns the motors off
+  tick(SYNC_LOST_TICKS - 1);
+  sync_task();
+  CHECK(g_motion_on, "timed out early");
+  tick(1);
+  CHECK(g_motion_on, "turned off from the tick");
+  sync_task();
+  CHECK(!g_motion_on, "quiet host left motion on");
+  host_usb_take(buf, sizeof(buf));
+  tick(2 * SYNC_INTERVAL_TICKS);
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "requests after the timeout");
+
+  hello_v2(SYNC_FEAT_MOTION);
+  tud_umount_cb();
+  CHECK(!g_motion_on, "unmount left motion on");
+  hello_v2(SYNC_FEAT_MOTION);
+  tud_suspend_cb(false);
+  CHECK(!g_motion_on, "suspend left motion on");
+}
+
+int main(void) {
+  uint8_t buf[256];
+
+  host_hal_reset();
+  TIM24->ARR = 9999; // MX_TIM24_Init
+  usb_sof_init(&g_usb_sof);
+  sync_init();
+  tim5_init();
+  tim_init_for_scheduler();
+  cpu_prof_init(node_time_raw_ns());
+  CHECK(host_irq_enabled(TIM24_IRQn), "scheduler IRQ not enabled");
+
+  tick(50);
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "sent before HELLO");
+  CHECK(!g_motion_on, "motion enabled before HELLO");
+
+  // a version 1 host sends the 8-byte HELLO and doesn't expect a reply
+  sync_hello_t hello = {SYNC_MSG_TYPE_HELLO, 0, 0, 1};
+  tud_vendor_rx_cb(0, (const uint8_t *)&hello, SYNC_HELLO_V1_SIZE);
+  CHECK(host_usb_sof_enabled(), "SOF interrupt not enabled on HELLO");
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "answered a version 1 HELLO");
+  CHECK(!g_motion_on, "a version 1 HELLO enabled motion");
+  CHECK(g_caps.encoding == SYNC_ENC_PB && g_caps.batch == 1 &&
+            g_caps.features_on == 0,
+        "version 1 defaults: encoding %#x batch %u features %#x",
+        g_caps.encoding, g_caps.batch, g_caps.features_on);
+  tick(SYNC_INTERVAL_TICKS);
+
+  size_t n = host_usb_take(buf, sizeof(buf));
+  CHECK(n == sizeof(sync_req_t), "expected one request, got %zu bytes", n);
+  sync_req_t req;
+  memcpy(&req, buf, sizeof(req));
+  CHECK(req.msg_type == SYNC_MSG_TYPE_REQ, "msg type %u", req.msg_type);
+
+  // no second request while one is outstanding
+  tick(2 * SYNC_INTERVAL_TICKS);
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "request while pending");
+
+  sync_resp_t resp = {SYNC_MSG_TYPE_RESP, 0, req.seq, req.t0_ns + 30000,
+                      req.t0_ns + 32000};
+  tud_vendor_rx_cb(0, (const uint8_t *)&resp, sizeof(resp));
+  n = host_usb_take(buf, sizeof(buf));
+  CHECK(n == sizeof(sync_stats_t), "expected stats, got %zu bytes", n);
+  sync_stats_t stats;
+  memcpy(&stats, buf, sizeof(stats));
+  CHECK(stats.msg_type == SYNC_MSG_TYPE_STATS && stats.seq == req.seq,
+        "stats type %u seq %u", stats.msg_type, stats.seq);
+  CHECK(stats.bus_drift_ppb == 0 && stats.host_bus_ppb == 0,
+        "bus drift %d host %d without any SOF", stats.bus_drift_ppb,
+        stats.host_bus_ppb);
+  CHECK(stats.sp_slack_ns == INT32_MAX && stats.sp_late == 3 &&
+            stats.sp_ack == 42,
+        "setpoint slack %d late %u ack %u", stats.sp_slack_ns, stats.sp_late,
+        stats.sp_ack);
+
+  // stale response is ignored
+  tud_vendor_rx_cb(0, (const uint8_t *)&resp, sizeof(resp));
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "answered a stale response");
+
+  uint32_t arr = TIM24->ARR;
+  CHECK(arr >= 9499 && arr <= 10499, "scheduler ARR %u out of range", arr);
+
+  // version 2 HELLO gets the node's capabilities and the picked configuration
+  sync_hello_t hello2 = {SYNC_MSG_TYPE_HELLO, 0, 0, 2,
+                         SYNC_ENC_PB | (1u << 4), SYNC_FEAT_ACK | (1u << 7),
+                         8, 0};
+  tud_vendor_rx_cb(0, (const uint8_t *)&hello2, sizeof(hello2));
+  n = host_usb_take(buf, sizeof(buf));
+  CHECK(n == sizeof(sync_caps_t), "expected caps, got %zu bytes", n);
+  sync_caps_t caps;
+  memcpy(&caps, buf, sizeof(caps));
+  CHECK(caps.msg_type == SYNC_MSG_TYPE_CAPS &&
+            caps.protocol_version == SYNC_PROTOCOL_VERSION,
+        "caps type %u version %u", caps.msg_type, caps.protocol_version);
+  CHECK(caps.encoding == SYNC_ENC_PB && caps.features_on == SYNC_FEAT_ACK &&
+            caps.batch == SYNC_MAX_BATCH,
+        "picked encoding %#x features %#x batch %u", caps.encoding,
+        caps.features_on, caps.batch);
+  CHECK(!g_motion_on, "HELLO without SYNC_FEAT_MOTION enabled motion");
+  CHECK(caps.sp_buffer == MOTION_RING_DEPTH && caps.max_rate_hz == 1000 &&
+            caps.ep_in_size == 512 && caps.ep_out_size == 512,
+        "buffer %u rate %u ep %u/%u", caps.sp_buffer, caps.max_rate_hz,
+        caps.ep_out_size, caps.ep_in_size);
+
+  // full speed enumerations have 64-byte bulk endpoints
+  host_usb_set_high_speed(false);
+  tud_vendor_rx_cb(0, (const uint8_t *)&hello2, sizeof(hello2));
+  n = host_usb_take(buf, sizeof(buf));
+  memcpy(&caps, buf, sizeof(caps));
+  CHECK(n == sizeof(caps) && caps.ep_in_size == 64 && caps.ep_out_size == 64,
+        "full speed ep %u/%u", caps.ep_out_size, caps.ep_in_size);
+
+  // Cmd frames go to the motion side and aren't answered
+  const uint8_t cmd[] = {SYNC_MSG_TYPE_CMD, 2, 0x0a, 0};
+  tud_vendor_rx_cb(0, cmd, sizeof(cmd));
+  CHECK(g_cmd_frames == 1, "%u cmd frames", g_cmd_frames);
+  CHECK(host_usb_take(buf, sizeof(buf)) == 0, "answered a cmd frame");
+
+  // the CPU profile comes over EP0, every tick so far is in it
+  tusb_control_request_t vreq = {.bRequest = SYNC_VREQ_CPU_PROF,
+                                 .wValue = SYNC_CPU_PROF_RESET,
+                                 .wLength = sizeof(sync_cpu_prof_t)};
+  vreq.bmRequestType_bit.type = TUSB_REQ_TYPE_VENDOR;
+  vreq.bmRequestType_bit.direction = TUSB_DIR_IN;
+  CHECK(tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq),
+        "profile request stalled");
+  sync_cpu_prof_t prof;
+  n = host_usb_take_control((uint8_t *)&prof, sizeof(prof));
+  CHECK(n == sizeof(prof), "profile %zu bytes", n);
+  const sync_cpu_slot_t *t = &prof.slot[SYNC_CPU_TICK];
+  CHECK(prof.slots == SYNC_CPU_SLOTS && prof.core_hz == CYCLE_COUNTER_HZ,
+        "profile slots %u core %u Hz", prof.slots, prof.core_hz);
+  CHECK(t->count == 50 + 3 * SYNC_INTERVAL_TICKS &&
+            prof.slot[SYNC_CPU_SYNC_TICK].count == t->count &&
+            prof.slot[SYNC_CPU_MOTION_TICK].count == t->count,
+        "%u ticks profiled", t->count);
+  CHECK(t->budget == CYCLE_COUNTER_HZ / 1000 && t->min <= t->avg &&
+            t->avg <= t->max,
+        "tick budget %u min %u avg %u max %u", t->budget, t->min, t->avg,
+        t->max);
+  CHECK(prof.window_ns >= (uint64_t)t->count * 1000000,
+        "window %" PRIu64 " ns", prof.window_ns);
+  CHECK(prof.slot[SYNC_CPU_ADC_ISR].count == 0, "current loop never ran");
+
+  // the read before it reset the counts, a short read gets the head
+  vreq.wValue = 0;
+  vreq.wLength = 16;
+  tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq);
+  CHECK(host_usb_take_control((uint8_t *)&prof, sizeof(prof)) == 16,
+        "short read");
+  vreq.wLength = sizeof(prof);
+  tick(3);
+  tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq);
+  host_usb_take_control((uint8_t *)&prof, sizeof(prof));
+  CHECK(prof.slot[SYNC_CPU_TICK].count == 3, "%u ticks after the reset",
+        prof.slot[SYNC_CPU_TICK].count);
+
+  // data and status stages go through, unknown and OUT requests stall
+  CHECK(tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_ACK, &vreq),
+        "status stage");
+  vreq.bRequest = 0x7f;
+  CHECK(!tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq),
+        "answered an unknown request");
+  vreq.bRequest = SYNC_VREQ_CPU_PROF;
+  vreq.bmRequestType_bit.direction = TUSB_DIR_OUT;
+  CHECK(!tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq),
+        "answered an OUT request");
+  CHECK(host_usb_take_control(buf, sizeof(buf)) == 0, "stalled with data");
+
+  // bulk throughput test: 3 IN packets, OUT filler counted, then the
+  // counters come back with the next request
+  vreq.bRequest = SYNC_VREQ_BULK_TEST;
+  vreq.bmRequestType_bit.direction = TUSB_DIR_IN;
+  vreq.wValue = 3;
+  vreq.wIndex = 0;
+  vreq.wLength = sizeof(sync_bulk_test_t);
+  CHECK(tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq),
+        "bulk test request stalled");
+  sync_bulk_test_t bt;
+  CHECK(host_usb_take_control((uint8_t *)&bt, sizeof(bt)) == sizeof(bt) &&
+            bt.in_left == 0 && bt.in_sent == 0 && bt.out_packets == 0,
+        "counters before the first test");
+  uint8_t filler[SYNC_TLM_PACKET_SIZE] = {SYNC_MSG_TYPE_BULK_TEST};
+  tud_vendor_rx_cb(0, filler, sizeof(filler));
+  tud_vendor_rx_cb(0, filler, 100);
+  sync_bulk_test_task();
+  uint8_t in[4 * SYNC_TLM_PACKET_SIZE];
+  n = host_usb_take(in, sizeof(in));
+  CHECK(n == 3 * SYNC_TLM_PACKET_SIZE, "%zu bytes of bulk test", n);
+  for (uint32_t i = 0; i < 3; i++) {
+    uint32_t seq;
+    memcpy(&seq, in + i * SYNC_TLM_PACKET_SIZE + 4, sizeof(seq));
+    CHECK(in[i * SYNC_TLM_PACKET_SIZE] == SYNC_MSG_TYPE_BULK_TEST && seq == i,
+          "packet %u type %u seq %u", i, in[i * SYNC_TLM_PACKET_SIZE], seq);
+  }
+  sync_bulk_test_task();
+  CHECK(host_usb_take(in, sizeof(in)) == 0, "sent past the count");
+  vreq.wValue = 0;
+  tud_vendor_control_xfer_cb(SYNC_RHPORT, CONTROL_STAGE_SETUP, &vreq);
+  host_usb_take_control((uint8_t *)&bt, sizeof(bt));
+  CHECK(bt.in_left == 0 && bt.in_sent == 3 && bt.out_packets == 2 &&
+            bt.out_bytes == SYNC_TLM_PACKET_SIZE + 100,
+        "bulk test in %u/%u out %u/%u", bt.in_sent, bt.in_left,
+        bt.out_packets, bt.out_bytes);
+
+  test_power_stage();
+  return test_report("node_sync");
+}
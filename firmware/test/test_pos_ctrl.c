@@ -0,0 +1,211 @@
+// Host simulation of the cascaded position loop: pos_ctrl at the 1 kHz
+// scheduler tick, foc at 20 kHz, PMSM plant driving a belt axis. Reports the
+// following error with and without feedforward.
+//
+//   test_pos_ctrl [trajectory.csv]
+//
+// The optional CSV is a recorded trajectory, one "pos,vel,acc,jerk" line per
+// tick in mm and seconds. Without it a set of synthetic moves is used.
+#include "foc.h"
+#include "motor_plant.h"
+#include "test_util.h"
+#include "pos_ctrl.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TICK_S 0.001
+#define PWM_PER_TICK 20
+#define TS_PWM (TICK_S / PWM_PER_TICK)
+#define MM_PER_REV 40.0
+#define MAX_TICKS 20000
+
+static axis_setpoint_t g_traj[MAX_TICKS];
+static int g_traj_len = 0;
+
+typedef struct {
+  motor_plant_t plant;
+  foc_t foc;
+  pos_ctrl_t ctrl;
+  float duty[3];
+  double counts_per_mm;
+} axis_sim_t;
+
+static void axis_sim_init(axis_sim_t *s) {
+  motor_plant_init(&s->plant);
+  s->plant.j = 7e-5; // rotor plus carriage
+  s->plant.b = 1e-4;
+
+  foc_params_t fp = {
+      .phase_r = (float)s->plant.r,
+      .phase_l = (float)s->plant.l,
+      .pole_pairs = (float)s->plant.pole_pairs,
+      .encoder_cpr = (float)s->plant.encoder_cpr,
+      .vbus = (float)s->plant.vbus,
+      .ts = (float)TS_PWM,
+  };
+  foc_init(&s->foc, &fp);
+  foc_tune_bandwidth(&s->foc, 2.0f * PI * 1000.0f);
+  s->foc.enc_offset = s->plant.enc_zero;
+  foc_enable(&s->foc, true);
+  s->duty[0] = s->duty[1] = s->duty[2] = 0.5f;
+  s->counts_per_mm = s->plant.encoder_cpr / MM_PER_REV;
+
+  // moving mass in current per acceleration, and the current loop lag
+  double kt = 1.5 * s->plant.pole_pairs * s->plant.flux;
+  double rad_per_mm = 2.0 * M_PI / MM_PER_REV;
+  double ka = s->plant.j * rad_per_mm / kt;
+  pos_ctrl_params_t pp = {
+      .kp_pos = 150.0f,
+      .kp_vel = 0.05f,
+      .ki_vel = 2.0f,
+      .tf_vel = 0.0005f,
+      .ka = (float)ka,
+      .kj = (float)(ka / (2.0 * M_PI * 1000.0)),
+      .i_max = 10.0f,
+      .ts = (float)TICK_S,
+  };
+  pos_ctrl_init(&s->ctrl, &pp);
+}
+
+static double axis_pos_mm(const axis_sim_t *s) {
+  return (motor_plant_encoder(&s->plant) - s->plant.enc_zero) /
+         s->counts_per_mm;
+}
+
+static void axis_sim_tick(axis_sim_t *s, const axis_setpoint_t *sp) {
+  float iq = pos_ctrl_step(&s->ctrl, sp, (float)axis_pos_mm(s));
+  foc_set_current(&s->foc, 0.0f, iq);
+  for (int k = 0; k < PWM_PER_TICK; k++) {
+    double ia, ib;
+    motor_plant_phase_currents(&s->plant, &ia, &ib);
+    foc_step(&s->foc, (float)ia, (float)ib, motor_plant_encoder(&s->plant));
+    motor_plant_step(&s->plant, s->duty, TS_PWM, 10);
+    for (int i = 0; i < 3; i++)
+      s->duty[i] = s->foc.duty[i];
+  }
+}
+
+typedef struct {
+  double rms;
+  double max;
+} follow_err_t;
+
+// Following error is measured on the true plant position, not the encoder
+static follow_err_t run(bool vel, bool acc, bool jerk) {
+  axis_sim_t s;
+  axis_sim_init(&s);
+  pos_ctrl_set_feedforward(&s.ctrl, vel, acc, jerk);
+
+  double sq = 0, max = 0;
+  for (int k = 0; k < g_traj_len; k++) {
+    // error at the instant the controller samples, the setpoint for tick k
+    // is what the axis should have reached by then
+    double pos = s.plant.theta / (2.0 * M_PI) * MM_PER_REV;
+    double e = fabs(g_traj[k].pos - pos);
+    axis_sim_tick(&s, &g_traj[k]);
+    sq += e * e;
+    if (e > max)
+      max = e;
+  }
+  follow_err_t r = {sqrt(sq / g_traj_len), max};
+  return r;
+}
+
+// Quintic point to point move, zero vel/acc at both ends
+static void add_move(double from, double to, double duration) {
+  int n = (int)(duration / TICK_S);
+  double d = to - from;
+  for (int k = 1; k <= n && g_traj_len < MAX_TICKS; k++) {
+    double tau = (double)k / n;
+    double t2 = tau * tau, t3 = t2 * tau, t4 = t3 * tau, t5 = t4 * tau;
+    axis_setpoint_t *sp = &g_traj[g_traj_len++];
+    sp->pos = (float)(from + d * (10 * t3 - 15 * t4 + 6 * t5));
+    sp->vel = (float)(d / duration * (30 * t2 - 60 * t3 + 30 * t4));
+    sp->acc =
+        (float)(d / (duration * duration) * (60 * tau - 180 * t2 + 120 * t3));
+    sp->jerk = (float)(d / (duration * duration * duration) *
+                       (60 - 360 * tau + 360 * t2));
+  }
+}
+
+static void add_dwell(double pos, double duration) {
+  int n = (int)(duration / TICK_S);
+  for (int k = 0; k < n && g_traj_len < MAX_TICKS; k++) {
+    axis_setpoint_t sp = {(float)pos, 0, 0, 0};
+    g_traj[g_traj_len++] = sp;
+  }
+}
+
+static void add_sine(double amp, double hz, double duration) {
+  int n = (int)(duration / TICK_S);
+  double w = 2 * M_PI * hz;
+  for (int k = 1; k <= n && g_traj_len < MAX_TICKS; k++) {
+    double t = k * TICK_S;
+    axis_setpoint_t *sp = &g_traj[g_traj_len++];
+    sp->pos = (float)(amp * (1 - cos(w * t)));
+    sp->vel = (float)(amp * w * sin(w * t));
+    sp->acc = (float)(amp * w * w * cos(w * t));
+    sp->jerk = (float)(-amp * w * w * w * sin(w * t));
+  }
+}
+
+static int load_csv(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  axis_setpoint_t sp;
+  while (g_traj_len < MAX_TICKS &&
+         fscanf(f, "%f,%f,%f,%f", &sp.pos, &sp.vel, &sp.acc, &sp.jerk) == 4)
+    g_traj[g_traj_len++] = sp;
+  fclose(f);
+  return 0;
+}
+
+static void report(const char *name, follow_err_t *none, follow_err_t *va,
+                   follow_err_t *vaj) {
+  printf("%-10s no ff: rms %7.4f max %7.4f mm | vel+acc: rms %7.4f max %7.4f "
+         "mm | +jerk: rms %7.4f max %7.4f mm\n",
+         name, none->rms, none->max, va->rms, va->max, vaj->rms, vaj->max);
+}
+
+int main(int argc, char **argv) {
+  follow_err_t none, va, vaj;
+
+  if (argc > 1) {
+    if (load_csv(argv[1]))
+      return 1;
+    none = run(false, false, false);
+    va = run(true, true, false);
+    vaj = run(true, true, true);
+    report(argv[1], &none, &va, &vaj);
+    return 0;
+  }
+
+  add_dwell(0, 0.05);
+  add_move(0, 50, 0.25);
+  add_dwell(50, 0.1);
+  add_move(50, 0, 0.25);
+  add_dwell(0, 0.1);
+  none = run(false, false, false);
+  va = run(true, true, false);
+  vaj = run(true, true, true);
+  report("moves", &none, &va, &vaj);
+  CHECK(va.max < none.max / 4, "feedforward gain too small, %f vs %f", va.max,
+        none.max);
+  CHECK(vaj.rms <= va.rms * 1.05, "jerk feedforward made tracking worse");
+  CHECK(fabs(g_traj[g_traj_len - 1].pos) < 1e-6, "trajectory must end at 0");
+
+  g_traj_len = 0;
+  add_sine(10, 3, 1.0);
+  none = run(false, false, false);
+  va = run(true, true, false);
+  vaj = run(true, true, true);
+  report("sine 3Hz", &none, &va, &vaj);
+  CHECK(va.max < none.max / 4, "feedforward gain too small, %f vs %f", va.max,
+        none.max);
+
+  return test_report("pos_ctrl");
+}
@@ -0,0 +1,68 @@
+// Host unit tests for the scheduler tick servo
+#include "sched_servo.h"
+#include "test_util.h"
+
+static void test_idle_period(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  CHECK(sched_servo_fixed_next_arr(&s) == 9999, "nominal ARR %u",
+        sched_servo_fixed_next_arr(&s));
+  CHECK(sched_servo_fixed_freq_ppm(&s) == 0, "nominal ppm %d",
+        sched_servo_fixed_freq_ppm(&s));
+}
+
+static void test_arr_clamped(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  s.freq_corr_ppb = 500000000; // +50%
+  CHECK(sched_servo_fixed_next_arr(&s) == 10499, "upper clamp %u",
+        sched_servo_fixed_next_arr(&s));
+  s.freq_corr_ppb = -500000000;
+  CHECK(sched_servo_fixed_next_arr(&s) == 9499, "lower clamp %u",
+        sched_servo_fixed_next_arr(&s));
+}
+
+static void test_offset_delay(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  // node is 1 ms behind the host, 20 us each way
+  uint64_t t0 = 5000000, t1 = t0 + 1000000 + 20000, t2 = t1 + 3000,
+           t3 = t0 + 20000 + 3000 + 20000;
+  sched_servo_fixed_on_sync(&s, t0, t1, t2, t3);
+  CHECK(s.last_delay_ns == 20000, "delay %" PRId64, s.last_delay_ns);
+  CHECK(s.last_offset_ns == 1000000, "offset %" PRId64, s.last_offset_ns);
+  uint32_t arr = sched_servo_fixed_next_arr(&s);
+  CHECK(arr >= 9499 && arr <= 10499, "ARR %u out of range", arr);
+}
+
+static void test_outlier_ignored(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  // 2 ms round trip is over the 500 us outlier limit
+  sched_servo_fixed_on_sync(&s, 0, 1000000, 1000000, 2000000);
+  CHECK(s.est.count == 0 && s.est.rejected == 1,
+        "outlier reached the estimator");
+  CHECK(s.freq_corr_ppb == 0, "outlier changed the frequency");
+}
+
+// A 1.5 ppm correction is 0.015 counts per tick, the ARR has to dither
+// between 9999 and 10000 so the average period carries it
+static void test_arr_dither(void) {
+  sched_servo_fixed_t s;
+  sched_servo_fixed_init(&s, 10000, 9500, 10500, 50, 1);
+  s.freq_corr_ppb = 1500;
+  uint64_t total = 0;
+  for (int i = 0; i < 100000; i++)
+    total += sched_servo_fixed_next_arr(&s) + 1;
+  CHECK(total == 1000000000ULL + 1500, "100k ticks took %" PRIu64 " counts",
+        total);
+}
+
+int main(void) {
+  test_idle_period();
+  test_arr_clamped();
+  test_offset_delay();
+  test_outlier_ignored();
+  test_arr_dither();
+  return test_report("sched_servo");
+}
@@ -0,0 +1,92 @@
+// HELLO capability negotiation against a few host and node capability sets
+#include "sync_caps.h"
+#include "test_util.h"
+#include <string.h>
+
+static sync_caps_t node(uint32_t enc, uint32_t feat, uint16_t batch) {
+  sync_caps_t c;
+  memset(&c, 0, sizeof(c));
+  c.encodings = enc;
+  c.features = feat;
+  c.max_batch = batch;
+  return c;
+}
+
+static sync_hello_t hello(uint32_t enc, uint32_t feat, uint16_t batch) {
+  sync_hello_t h = {SYNC_MSG_TYPE_HELLO, 0, 0, 2, enc, feat, batch, 0};
+  return h;
+}
+
+int main(void) {
+  const uint32_t all =
+      SYNC_FEAT_TIMESTAMPED_SP | SYNC_FEAT_ACK | SYNC_FEAT_SOF_DRIFT;
+
+  // version 1: protobuf, one setpoint per frame, no features, whatever the
+  // node can do
+  sync_caps_t c = node(SYNC_ENC_PB | (1u << 3), all, 3);
+  sync_hello_t h = {SYNC_MSG_TYPE_HELLO, 0, 0, 1};
+  sync_caps_negotiate(&h, SYNC_HELLO_V1_SIZE, &c);
+  CHECK(c.msg_type == SYNC_MSG_TYPE_CAPS &&
+            c.protocol_version == SYNC_PROTOCOL_VERSION,
+        "type %u version %u", c.msg_type, c.protocol_version);
+  CHECK(c.encoding == SYNC_ENC_PB && c.features_on == 0 && c.batch == 1,
+        "v1: encoding %#x features %#x batch %u", c.encoding, c.features_on,
+        c.batch);
+
+  // a full-size HELLO claiming version 1 is read the same way
+  h = hello(1u << 3, all, 3);
+  h.protocol_version = 1;
+  c = node(SYNC_ENC_PB | (1u << 3), all, 3);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.encoding == SYNC_ENC_PB && c.features_on == 0 && c.batch == 1,
+        "v1 full size: encoding %#x features %#x batch %u", c.encoding,
+        c.features_on, c.batch);
+
+  // both same: everything on
+  h = hello(SYNC_ENC_PB, all, 3);
+  c = node(SYNC_ENC_PB, all, 3);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.encoding == SYNC_ENC_PB && c.features_on == all && c.batch == 3,
+        "same: encoding %#x features %#x batch %u", c.encoding, c.features_on,
+        c.batch);
+
+  // higher bit is preferred when both have it
+  h = hello(SYNC_ENC_PB | (1u << 2) | (1u << 5), 0, 1);
+  c = node(SYNC_ENC_PB | (1u << 2) | (1u << 4), 0, 1);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.encoding == (1u << 2), "preferred encoding %#x", c.encoding);
+
+  // nothing in common leaves the encoding at 0, the host has to give up
+  h = hello(1u << 1, 0, 1);
+  c = node(SYNC_ENC_PB, 0, 1);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.encoding == 0, "no common encoding picked %#x", c.encoding);
+
+  // batch is the smaller of the two, and at least one
+  h = hello(SYNC_ENC_PB, 0, 16);
+  c = node(SYNC_ENC_PB, 0, 3);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.batch == 3, "host 16 node 3 batch %u", c.batch);
+  h = hello(SYNC_ENC_PB, 0, 2);
+  c = node(SYNC_ENC_PB, 0, 3);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.batch == 2, "host 2 node 3 batch %u", c.batch);
+  h = hello(SYNC_ENC_PB, 0, 0);
+  c = node(SYNC_ENC_PB, 0, 3);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.batch == 1, "host 0 batch %u", c.batch);
+
+  // features are the intersection, unknown bits on either side drop out
+  h = hello(SYNC_ENC_PB, SYNC_FEAT_ACK | SYNC_FEAT_SOF_DRIFT | (1u << 9), 1);
+  c = node(SYNC_ENC_PB, SYNC_FEAT_TIMESTAMPED_SP | SYNC_FEAT_ACK | (1u << 12),
+           1);
+  sync_caps_negotiate(&h, sizeof(h), &c);
+  CHECK(c.features_on == SYNC_FEAT_ACK, "features %#x", c.features_on);
+
+  // the node's own side comes back as it was
+  CHECK(c.encodings == SYNC_ENC_PB && c.max_batch == 1,
+        "node side changed: encodings %#x max batch %u", c.encodings,
+        c.max_batch);
+
+  return test_report("sync_caps");
+}
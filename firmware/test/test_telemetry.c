@@ -0,0 +1,196 @@
+// Telemetry packets as the host sees them: the test plays the servo tick
+// filling samples and the main loop packing and sending them
+#include "host_hal.h"
+#include "telemetry.h"
+#include "test_util.h"
+#include "tusb.h"
+#include <string.h>
+
+#define MS 1000000ULL
+// every channel the servo loop has, all but the driver registers
+#define CH_MOTION (SYNC_TLM_CH_ALL & ~SYNC_TLM_CH_DRIVER)
+
+static uint8_t g_buf[8192];
+
+// one servo tick at scheduler time t_ns, values derived from the tick
+static void tick(uint64_t t_ns) {
+  telemetry_sample_t *s = telemetry_begin(t_ns);
+  if (!s)
+    return;
+  uint32_t k = (uint32_t)(t_ns / MS);
+  for (int a = 0; a < TELEMETRY_AXES; a++) {
+    s->err[a] = 0.001f * k + a;
+    s->id[a] = -0.5f * a;
+    s->iq[a] = 0.25f * k;
+    s->iq_ref[a] = 0.5f * k;
+    s->enc[a] = (int32_t)(k * 10 + a);
+    s->sp_pos[a] = 1.0f * k;
+    s->sp_vel[a] = 100.0f + a;
+    for (int r = 0; r < TELEMETRY_DRV_REGS; r++)
+      s->drv[a][r] = k << 8 | (uint32_t)a << 4 | (uint32_t)r;
+  }
+  s->jb_depth = (uint16_t)(k & 63);
+  s->underruns = 7;
+  telemetry_commit();
+}
+
+static sync_tlm_hdr_t header(const uint8_t *p) {
+  sync_tlm_hdr_t h;
+  memcpy(&h, p, sizeof(h));
+  return h;
+}
+
+static uint32_t u32_at(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static float f32_at(const uint8_t *p) {
+  float v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+int main(void) {
+  host_hal_reset();
+  telemetry_init();
+
+  // off until the host asks
+  CHECK(telemetry_begin(0) == NULL, "sampling while off");
+  telemetry_task(100 * MS);
+  CHECK(host_usb_take(g_buf, sizeof(g_buf)) == 0, "sent while off");
+
+  // the servo loop at full rate: 64 byte samples, 7 to a packet
+  CHECK(telemetry_sample_size(CH_MOTION) == 64, "full sample %u bytes",
+        telemetry_sample_size(CH_MOTION));
+  CHECK(telemetry_sample_size(SYNC_TLM_CH_ALL) == 96,
+        "with driver registers %u bytes",
+        telemetry_sample_size(SYNC_TLM_CH_ALL));
+  telemetry_config(CH_MOTION, 1);
+  for (uint64_t k = 1; k <= 7; k++)
+    tick(k * MS);
+  telemetry_task(7 * MS);
+  size_t n = host_usb_take(g_buf, sizeof(g_buf));
+  CHECK(n == SYNC_TLM_PACKET_SIZE, "packet of %zu bytes", n);
+  sync_tlm_hdr_t h = header(g_buf);
+  CHECK(h.msg_type == SYNC_MSG_TYPE_TELEMETRY && h.count == 7 && h.seq == 0 &&
+            h.channels == CH_MOTION && h.decimation == 1 &&
+            h.axes == TELEMETRY_AXES && h.sample_size == 64 && h.dropped == 0,
+        "header type %u count %u seq %u channels %#x dec %u axes %u size %u "
+        "dropped %u",
+        h.msg_type, h.count, h.seq, h.channels, h.decimation, h.axes,
+        h.sample_size, h.dropped);
+  // third sample: tick, err x2, (id, iq) x2, iq_ref x2, enc x2, (pos, vel)
+  // x2, depth, underruns
+  const uint8_t *s = g_buf + sizeof(sync_tlm_hdr_t) + 2 * 64;
+  CHECK(u32_at(s) == 3, "tick %u", u32_at(s));
+  CHECK(f32_at(s + 8) == 0.003f + 1, "err[1] %f", f32_at(s + 8));
+  CHECK(f32_at(s + 12 + 8) == -0.5f && f32_at(s + 12 + 12) == 0.75f,
+        "id/iq[1] %f %f", f32_at(s + 20), f32_at(s + 24));
+  CHECK(f32_at(s + 28) == 1.5f, "iq_ref[0] %f", f32_at(s + 28));
+  CHECK(u32_at(s + 36) == 30 && u32_at(s + 40) == 31, "enc %u %u",
+        u32_at(s + 36), u32_at(s + 40));
+  CHECK(f32_at(s + 44) == 3.0f && f32_at(s + 56) == 101.0f,
+        "sp pos[0] %f vel[1] %f", f32_at(s + 44), f32_at(s + 56));
+  CHECK(s[60] == 3 && s[62] == 7, "depth %u underruns %u", s[60], s[62]);
+  // the rest is padding
+  int nonzero = 0;
+  for (size_t i = sizeof(sync_tlm_hdr_t) + 7 * 64; i < SYNC_TLM_PACKET_SIZE;
+       i++)
+    nonzero += g_buf[i] != 0;
+  CHECK(nonzero == 0, "%d padding bytes set", nonzero);
+
+  // a few channels, decimated: 20 byte samples, 24 to a packet
+  telemetry_config(SYNC_TLM_CH_FOLLOW_ERR | SYNC_TLM_CH_ENCODER, 4);
+  for (uint64_t k = 1; k <= 100; k++)
+    tick(k * MS);
+  telemetry_task(100 * MS);
+  n = host_usb_take(g_buf, sizeof(g_buf));
+  h = header(g_buf);
+  CHECK(n == SYNC_TLM_PACKET_SIZE && h.count == 24 && h.seq == 1 &&
+            h.decimation == 4 && h.sample_size == 20,
+        "decimated: %zu bytes, count %u seq %u dec %u size %u", n, h.count,
+        h.seq, h.decimation, h.sample_size);
+  s = g_buf + sizeof(sync_tlm_hdr_t);
+  CHECK(u32_at(s) == 4 && u32_at(s + 20) == 8 && u32_at(s + 23 * 20) == 96,
+        "ticks %u %u .. %u", u32_at(s), u32_at(s + 20), u32_at(s + 23 * 20));
+  CHECK(u32_at(s + 12) == 40, "enc[0] %u", u32_at(s + 12));
+
+  // the 25th goes out on its own once it is old enough
+  telemetry_task(100 * MS + TELEMETRY_MAX_AGE_NS - MS);
+  CHECK(host_usb_take(g_buf, sizeof(g_buf)) == 0, "sent a young packet");
+  telemetry_task(100 * MS + TELEMETRY_MAX_AGE_NS);
+  n = host_usb_take(g_buf, sizeof(g_buf));
+  h = header(g_buf);
+  CHECK(n == SYNC_TLM_PACKET_SIZE && h.count == 1 && h.seq == 2 &&
+            u32_at(g_buf + sizeof(h)) == 100,
+        "aged packet: %zu bytes, count %u seq %u", n, h.count, h.seq);
+
+  // nothing is written while the FIFO holds something else, the samples
+  // wait in the ring
+  telemetry_config(CH_MOTION, 1);
+  uint8_t other[4096 - 100] = {SYNC_MSG_TYPE_STATS};
+  tud_vendor_write(other, sizeof(other));
+  for (uint64_t k = 1; k <= 7; k++)
+    tick(k * MS);
+  telemetry_task(7 * MS);
+  n = host_usb_take(g_buf, sizeof(g_buf));
+  CHECK(n == sizeof(other), "wrote into a busy FIFO, %zu bytes", n);
+  telemetry_task(8 * MS);
+  n = host_usb_take(g_buf, sizeof(g_buf));
+  CHECK(n == SYNC_TLM_PACKET_SIZE && header(g_buf).count == 7,
+        "after the FIFO drained: %zu bytes", n);
+  CHECK(!telemetry_tx_busy(), "still busy after the write");
+
+  // the task falls behind: the tick drops instead of waiting
+  for (uint64_t k = 1; k <= TELEMETRY_RING_DEPTH + 6; k++)
+    tick(k * MS);
+  telemetry_stats_t st;
+  telemetry_stats(&st);
+  CHECK(st.dropped == 6, "dropped %u", st.dropped);
+  int packets = 0;
+  uint32_t samples = 0;
+  do {
+    telemetry_task(100 * MS);
+    n = 0;
+    while (host_usb_take(g_buf, SYNC_TLM_PACKET_SIZE) > 0) {
+      h = header(g_buf);
+      samples += h.count;
+      packets++;
+      n++;
+      CHECK(h.dropped == 6, "packet reports %u dropped", h.dropped);
+    }
+  } while (n > 0);
+  CHECK(samples == TELEMETRY_RING_DEPTH, "%u samples in %d packets", samples,
+        packets);
+
+  // TMC2240 registers go as read, per axis in tmc_spi_regs order
+  telemetry_config(SYNC_TLM_CH_DRIVER, 1);
+  tick(150 * MS);
+  telemetry_task(150 * MS + TELEMETRY_MAX_AGE_NS);
+  n = host_usb_take(g_buf, sizeof(g_buf));
+  h = header(g_buf);
+  CHECK(n == SYNC_TLM_PACKET_SIZE && h.count == 1 &&
+            h.channels == SYNC_TLM_CH_DRIVER && h.sample_size == 36,
+        "driver packet: %zu bytes, count %u channels %#x size %u", n, h.count,
+        h.channels, h.sample_size);
+  s = g_buf + sizeof(sync_tlm_hdr_t);
+  CHECK(u32_at(s) == 150 && u32_at(s + 4) == (150u << 8 | 0) &&
+            u32_at(s + 16) == (150u << 8 | 3) &&
+            u32_at(s + 20) == (150u << 8 | 0x10) &&
+            u32_at(s + 32) == (150u << 8 | 0x13),
+        "driver words %x %x .. %x", u32_at(s + 4), u32_at(s + 20),
+        u32_at(s + 32));
+
+  // a new configuration throws away what the old one queued, 0 stops it
+  tick(200 * MS);
+  telemetry_config(0, 1);
+  tick(201 * MS);
+  telemetry_task(300 * MS);
+  CHECK(host_usb_take(g_buf, sizeof(g_buf)) == 0, "sent after stop");
+  telemetry_stats(&st);
+  CHECK(st.discarded == 1, "discarded %u", st.discarded);
+
+  return test_report("telemetry");
+}
@@ -0,0 +1,111 @@
+// TMC2240 datagrams and the batch schedule, against a model of the chips'
+// pipelined replies: each answers with the register the previous datagram
+// to it asked for
+#include "test_util.h"
+#include "tmc2240.h"
+#include <string.h>
+
+#define DRIVERS 3
+#define NREGS 4
+
+static const uint8_t g_regs[NREGS] = {TMC2240_DRV_STATUS, TMC2240_SG4_RESULT,
+                                      TMC2240_MSCURACT, TMC2240_ADC_TEMP};
+
+// register contents of the model chips
+static uint32_t reg_value(int d, uint8_t addr) {
+  return (uint32_t)addr << 24 | (uint32_t)d << 16 | 0xbeef;
+}
+
+typedef struct {
+  uint8_t pending; // address the last read asked for
+  int datagrams;
+} chip_t;
+
+// one datagram on chip d's chip select, the reply into rx
+static void chip_xfer(chip_t *c, int d, const uint8_t *tx, uint8_t *rx) {
+  uint8_t st = (uint8_t)(TMC2240_ST_STANDSTILL | (d == 1 ? TMC2240_ST_SG2 : 0));
+  // the very first reply carries whatever was latched before
+  tmc2240_encode(rx, 0, false,
+                 c->datagrams ? reg_value(d, c->pending) : 0xdeadbeef);
+  rx[0] = st;
+  if (!(tx[0] & TMC2240_WRITE))
+    c->pending = tx[0] & 0x7f;
+  c->datagrams++;
+}
+
+int main(void) {
+  uint8_t dg[TMC2240_DATAGRAM];
+
+  // address byte, then the value MSB first
+  tmc2240_encode(dg, TMC2240_IHOLD_IRUN, true, 0x00071f0a);
+  CHECK(dg[0] == 0x90 && dg[1] == 0x00 && dg[2] == 0x07 && dg[3] == 0x1f &&
+            dg[4] == 0x0a,
+        "write datagram %02x %02x %02x %02x %02x", dg[0], dg[1], dg[2], dg[3],
+        dg[4]);
+  tmc2240_encode(dg, TMC2240_DRV_STATUS, false, 0xffffffff);
+  CHECK(dg[0] == 0x6f, "read address %02x", dg[0]);
+  uint8_t st = 0;
+  const uint8_t reply[TMC2240_DATAGRAM] = {0x09, 0x81, 0x1f, 0x00, 0x42};
+  CHECK(tmc2240_decode(reply, &st) == 0x811f0042 && st == 0x09,
+        "decode %08x status %02x", tmc2240_decode(reply, NULL), st);
+
+  // DRV_STATUS fields where the datasheet has them
+  uint32_t drv = 0x811f0042 | TMC2240_DRV_OT;
+  CHECK(TMC2240_DRV_SG_RESULT(drv) == 0x42 && TMC2240_DRV_CS_ACTUAL(drv) == 31,
+        "sg_result %u cs_actual %u", TMC2240_DRV_SG_RESULT(drv),
+        TMC2240_DRV_CS_ACTUAL(drv));
+  CHECK((drv & TMC2240_DRV_STST) && (drv & TMC2240_DRV_STALLGUARD) &&
+            (drv & TMC2240_DRV_FAULTS) == TMC2240_DRV_OT,
+        "flags %08x", drv);
+
+  // MSCURACT coils are 9 bit two's complement
+  uint32_t cur = (uint32_t)(-248 & 0x1ff) << 16 | 247u;
+  CHECK(TMC2240_MSCURACT_A(cur) == 247 && TMC2240_MSCURACT_B(cur) == -248,
+        "cur_a %d cur_b %d", TMC2240_MSCURACT_A(cur), TMC2240_MSCURACT_B(cur));
+  cur = 0x1ffu << 16 | 0x100u;
+  CHECK(TMC2240_MSCURACT_A(cur) == -256 && TMC2240_MSCURACT_B(cur) == -1,
+        "cur_a %d cur_b %d", TMC2240_MSCURACT_A(cur), TMC2240_MSCURACT_B(cur));
+  CHECK(TMC2240_TEMP_C(2038 + 77) > 9.99f && TMC2240_TEMP_C(2038 + 77) < 10.01f,
+        "temperature %f", TMC2240_TEMP_C(2038 + 77));
+
+  // a batch: the chips take turns, one extra round collects the last read
+  uint8_t tx[TMC2240_BATCH_LEN(DRIVERS, NREGS)][TMC2240_DATAGRAM];
+  uint8_t rx[TMC2240_BATCH_LEN(DRIVERS, NREGS)][TMC2240_DATAGRAM];
+  CHECK(TMC2240_BATCH_LEN(DRIVERS, NREGS) == 15, "batch of %d",
+        TMC2240_BATCH_LEN(DRIVERS, NREGS));
+  tmc2240_batch_build(tx, DRIVERS, g_regs, NREGS);
+  for (int i = 0; i < TMC2240_BATCH_LEN(DRIVERS, NREGS); i++) {
+    int r = i / DRIVERS;
+    uint8_t want = g_regs[r < NREGS ? r : 0];
+    CHECK(tx[i][0] == want && tx[i][1] == 0 && tx[i][4] == 0,
+          "datagram %d asks for %02x", i, tx[i][0]);
+  }
+
+  // twice over the same chips: the second batch's first replies are the
+  // first batch's dummy reads, and are thrown away again
+  chip_t chips[DRIVERS];
+  memset(chips, 0, sizeof(chips));
+  for (int pass = 0; pass < 2; pass++) {
+    memset(rx, 0, sizeof(rx));
+    for (int i = 0; i < TMC2240_BATCH_LEN(DRIVERS, NREGS); i++)
+      chip_xfer(&chips[i % DRIVERS], i % DRIVERS, tx[i], rx[i]);
+    uint32_t values[DRIVERS * NREGS];
+    uint8_t status[DRIVERS];
+    memset(values, 0, sizeof(values));
+    tmc2240_batch_parse((const uint8_t(*)[TMC2240_DATAGRAM])rx, DRIVERS,
+                        NREGS, values, status);
+    for (int d = 0; d < DRIVERS; d++) {
+      for (int r = 0; r < NREGS; r++)
+        CHECK(values[d * NREGS + r] == reg_value(d, g_regs[r]),
+              "pass %d chip %d reg %02x: %08x", pass, d, g_regs[r],
+              values[d * NREGS + r]);
+      CHECK(status[d] == (TMC2240_ST_STANDSTILL |
+                          (d == 1 ? TMC2240_ST_SG2 : 0)),
+            "chip %d status %02x", d, status[d]);
+    }
+  }
+  CHECK(chips[0].datagrams == 2 * (NREGS + 1), "chip 0 saw %d datagrams",
+        chips[0].datagrams);
+
+  return test_report("tmc2240");
+}
@@ -0,0 +1,146 @@
+// usb_sof against emulated SOF streams: a host controller counting
+// microframes off its own crystal, the node timestamping each SOF on a 100 ns
+// TIM5 behind an interrupt latency that is sometimes held off, lost SOFs,
+// wraps of the 14-bit microframe number and a bus suspend long enough to
+// lose track of it. The foreground polls every 20 ms like node_sync.c.
+#include "test_util.h"
+#include "usb_sof.h"
+#include <math.h>
+#include <stdio.h>
+
+typedef struct {
+  double node_ppm; // node crystal against the bus
+  double late_p;   // chance an interrupt is held off
+  double late_ns;  // by up to this much
+  double miss_p;   // chance a SOF is lost on the bus
+
+  uint64_t uf;    // host controller microframe counter
+  double node_ns; // node crystal time of the next SOF
+  uint32_t lost;
+} stream_t;
+
+static usb_sof_t g_sof;
+
+static uint64_t g_rng = 0x2545f4914f6cdd1dULL;
+static double urand(void) {
+  g_rng ^= g_rng << 13;
+  g_rng ^= g_rng >> 7;
+  g_rng ^= g_rng << 17;
+  return (double)(g_rng >> 11) / 9007199254740992.0;
+}
+
+static double expected_ppb(const stream_t *st) {
+  return (1.0 / (1.0 + st->node_ppm * 1e-6) - 1.0) * 1e9;
+}
+
+// n microframes of bus time, `sof` false while the bus is suspended
+static void run(stream_t *st, uint32_t n, bool sof) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (sof && urand() >= st->miss_p) {
+      double lat = 300 + urand() * 150;
+      if (urand() < st->late_p)
+        lat += urand() * st->late_ns;
+      uint64_t tim5 = (uint64_t)((st->node_ns + lat) / 100.0) * 100;
+      usb_sof_isr(&g_sof, (uint32_t)st->uf, tim5);
+    } else if (sof) {
+      st->lost++;
+    }
+    st->uf++;
+    st->node_ns += USB_SOF_UFRAME_NS * (1.0 + st->node_ppm * 1e-6);
+    if (st->uf % 160 == 0)
+      usb_sof_poll(&g_sof);
+  }
+}
+
+static void check_drift(const char *name, const stream_t *st, double tol) {
+  bool valid = usb_sof_poll(&g_sof);
+  double err = g_sof.est.drift_ppb - expected_ppb(st);
+  printf("%-10s drift %8d ppb (err %5.1f) fit jitter %4d ns | frames %u "
+         "missed %u restarts %u overflows %u\n",
+         name, g_sof.est.drift_ppb, err, g_sof.est.jitter_ns, g_sof.frames,
+         g_sof.missed, g_sof.restarts, g_sof.overflows);
+  CHECK(valid, "%s: no fit", name);
+  CHECK(fabs(err) < tol, "%s: drift off by %.1f ppb", name, err);
+}
+
+static void test_clean(void) {
+  stream_t st = {.node_ppm = 37, .uf = 5000, .node_ns = 1e9};
+  usb_sof_init(&g_sof);
+  run(&st, 8000 * 3, true);
+  check_drift("clean", &st, 10);
+  CHECK(g_sof.missed == 0 && g_sof.restarts == 0 && g_sof.overflows == 0,
+        "clean: missed %u restarts %u overflows %u", g_sof.missed,
+        g_sof.restarts, g_sof.overflows);
+  CHECK(g_sof.est.jitter_ns < 100, "clean: fit jitter %d ns",
+        g_sof.est.jitter_ns);
+}
+
+// One SOF in ten held off by up to 10 us (the scheduler tick outranks the
+// OTG interrupt), the batch minimum has to keep those out of the fit
+static void test_latency(void) {
+  stream_t st = {.node_ppm = -85, .late_p = 0.1, .late_ns = 10e3,
+                 .uf = 123, .node_ns = 5e6};
+  usb_sof_init(&g_sof);
+  run(&st, 8000 * 3, true);
+  check_drift("late irq", &st, 20);
+  CHECK(g_sof.est.jitter_ns < 200, "late irq: fit jitter %d ns",
+        g_sof.est.jitter_ns);
+}
+
+// 10 s is almost five wraps of the microframe number, with lost SOFs and
+// a short stall that the numbering still covers
+static void test_wrap_and_missed(void) {
+  stream_t st = {.node_ppm = 12, .miss_p = 0.01, .uf = 16000, .node_ns = 0};
+  usb_sof_init(&g_sof);
+  run(&st, 8000 * 5, true);
+  run(&st, 4000, false); // 0.5 s without SOFs
+  uint32_t silent = 4000;
+  run(&st, 8000 * 5, true);
+  check_drift("wraps", &st, 10);
+  CHECK(g_sof.missed == st.lost + silent, "missed %u, lost %u", g_sof.missed,
+        st.lost + silent);
+  CHECK(g_sof.restarts == 0, "restarted %u times", g_sof.restarts);
+}
+
+// A suspend over half the wrap period loses the numbering: the fit restarts
+// and comes back, and a repeated frame number is ignored
+static void test_suspend(void) {
+  stream_t st = {.node_ppm = -20, .uf = 7, .node_ns = 3e9};
+  usb_sof_init(&g_sof);
+  run(&st, 8000 * 2, true);
+  uint32_t epoch = g_sof.epoch;
+  run(&st, 8000 * 3, false);
+  run(&st, 8000 * 2, true);
+  CHECK(g_sof.restarts == 1 && g_sof.epoch == epoch + 1,
+        "restarts %u epoch %u", g_sof.restarts, g_sof.epoch);
+  check_drift("suspend", &st, 20);
+
+  int64_t uframes = g_sof.uframes;
+  usb_sof_isr(&g_sof, g_sof.fn, g_sof.last_ns + 1000);
+  CHECK(g_sof.uframes == uframes, "repeated SOF moved the count");
+}
+
+// Foreground stalled for a second: the ring drops samples, the fit carries on
+static void test_overflow(void) {
+  stream_t st = {.node_ppm = 50, .uf = 0, .node_ns = 0};
+  usb_sof_init(&g_sof);
+  run(&st, 8000, true);
+  for (uint32_t i = 0; i < 8000; i++) {
+    usb_sof_isr(&g_sof, (uint32_t)st.uf, (uint64_t)(st.node_ns + 300) / 100 *
+                                               100);
+    st.uf++;
+    st.node_ns += USB_SOF_UFRAME_NS * (1.0 + st.node_ppm * 1e-6);
+  }
+  CHECK(g_sof.overflows > 0, "ring never filled");
+  run(&st, 8000 * 2, true);
+  check_drift("overflow", &st, 10);
+}
+
+int main(void) {
+  test_clean();
+  test_latency();
+  test_wrap_and_missed();
+  test_suspend();
+  test_overflow();
+  return test_report("usb_sof");
+}
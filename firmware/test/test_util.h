@@ -0,0 +1,26 @@
+#pragma once
+#include <inttypes.h>
+#include <stdio.h>
+
+// Minimal check/report helpers shared by the host tests
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);                              \
+      printf(__VA_ARGS__);                                                     \
+      printf("\n");                                                            \
+      g_failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static inline int test_report(const char *name) {
+  if (g_failures) {
+    printf("%d check(s) failed\n", g_failures);
+    return 1;
+  }
+  printf("all %s tests passed\n", name);
+  return 0;
+}
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Check the linker map for what has to run from the TCMs (see App/inc/tcm.h).
+
+    check_tcm.py build/nucleo_driver_board.map
+
+Run after every firmware link. A handler that lost its TCM_CODE, a rename
+the list below didn't follow or a linker script that stopped collecting a
+section fails the build instead of quietly bringing back the flash fetch.
+Only global symbols show up in the map; the file state marked TCM_BSS is
+checked by the object files contributing a .dtcm_bss section.
+"""
+
+import argparse
+import re
+import sys
+
+ITCM = ("ITCM", 0x00000000, 64 * 1024)
+DTCM = ("DTCM", 0x20000000, 128 * 1024)
+
+# interrupt handlers and what they call on every run
+ITCM_SYMBOLS = [
+    "TIM24_IRQHandler",
+    "scheduler_tick_handler",
+    "sched_servo_fixed_next_arr",
+    "sync_tick",
+    "motion_tick",
+    "pos_ctrl_step",
+    "jitter_buf_release",
+    "motor_position",
+    "motor_set_current",
+    "motor_aligning",
+    "foc_aligning",
+    "ADC_IRQHandler",
+    "encoder_update",
+    "foc_step",
+    "arm_sin_f32",
+    "arm_cos_f32",
+    "node_time_raw_ns",
+    "cpu_prof_record",
+    "tmc_spi_tick",
+    "tmc_spi_latest",
+]
+
+DTCM_SYMBOLS = [
+    "g_sched_servo",
+    "scheduler_time_ns",
+    "g_usb_sof",
+    "sinTable_f32",
+]
+
+# objects with file scope TCM_BSS state; scheduler_timer.c and node_sync.c
+# build as part of main.c
+DTCM_OBJECTS = [
+    "main.o",
+    "motion.o",
+    "motor.o",
+    "current_sense.o",
+    "node_time.o",
+    "cpu_prof.o",
+    "tmc_spi.o",
+]
+
+SECTION = re.compile(r"^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)$")
+WRAPPED = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)$")
+SYMBOL = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_]\w*)$")
+OUTPUT = re.compile(r"^(\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)")
+
+
+def parse_map(path):
+    """Returns ({symbol: address}, [(input section, address, size, object)],
+    {output section: (address, size)}) from a GNU ld map."""
+    symbols, sections, outputs = {}, [], {}
+    in_map = False
+    pending = None  # input section name wrapped onto the next line
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\r\n")
+            if line.startswith("Linker script and memory map"):
+                in_map = True
+                continue
+            if not in_map:
+                continue
+            m = OUTPUT.match(line)
+            if m:
+                outputs[m.group(1)] = (int(m.group(2), 16), int(m.group(3), 16))
+                pending = None
+                continue
+            if pending:
+                m = WRAPPED.match(line)
+                if m:
+                    sections.append((pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3)))
+                    pending = None
+                    continue
+                pending = None
+            m = SECTION.match(line)
+            if m:
+                sections.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)))
+                continue
+            if re.match(r"^ \.\S+$", line):
+                pending = line.strip()
+                continue
+            m = SYMBOL.match(line)
+            if m:
+                symbols[m.group(2)] = int(m.group(1), 16)
+    return symbols, sections, outputs
+
+
+def within(region, addr, size=0):
+    _, base, length = region
+    return base <= addr and addr + size <= base + length
+
+
+def check(path):
+    symbols, sections, outputs = parse_map(path)
+    errors = []
+
+    for names, region in ((ITCM_SYMBOLS, ITCM), (DTCM_SYMBOLS, DTCM)):
+        for name in names:
+            if name not in symbols:
+                errors.append(f"{name} not in the map")
+            elif not within(region, symbols[name]):
+                errors.append(f"{name} at {symbols[name]:#010x}, not in {region[0]}")
+
+    for name, addr, size, obj in sections:
+        if name.startswith(".itcm_text"):
+            region = ITCM
+        elif name.startswith(".dtcm_bss"):
+            region = DTCM
+        else:
+            continue
+        if size and not within(region, addr, size):
+            errors.append(f"{name} of {obj} at {addr:#010x}, not in {region[0]}")
+
+    for obj in DTCM_OBJECTS:
+        if not any(n.startswith(".dtcm_bss") and size and (o == obj or o.endswith("/" + obj))
+                   for n, _, size, o in sections):
+            errors.append(f"{obj} has no .dtcm_bss state")
+
+    for out, region in ((".itcm_text", ITCM), (".dtcm_bss", DTCM)):
+        if out not in outputs:
+            errors.append(f"no {out} output section, is this the TCM linker script?")
+            continue
+        addr, size = outputs[out]
+        if not within(region, addr, size):
+            errors.append(f"{out} {addr:#010x}+{size:#x} overflows {region[0]}")
+        else:
+            print(f"{out}: {size} bytes in {region[0]}")
+
+    for e in errors:
+        print(f"check_tcm: {e}", file=sys.stderr)
+    return not errors
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("map", help="linker map, -Wl,-Map=...")
+    args = ap.parse_args()
+    sys.exit(0 if check(args.map) else 1)
+
+
+if __name__ == "__main__":
+    main()
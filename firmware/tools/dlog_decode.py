@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Decode deferred log records (see App/inc/dlog.h) back into text.
+
+    dlog_decode.py build/nucleo_driver_board.elf rtt_channel1.bin
+
+The binary is a raw dump of RTT up-buffer 1, e.g. from
+`JLinkRTTLogger -RTTChannel 1`. Format strings are read from the dlog_fmt
+section of the ELF the records came from.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<HBBI")
+SPEC = re.compile(r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(hh|h|ll|l|z|j|t|L)?([diouxXcsfFeEgGaAp%])")
+
+
+def read_dlog_section(path):
+    """Returns (section bytes, sizeof(long)) from a 32 or 64 bit ELF."""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF":
+        raise ValueError(f"{path} is not an ELF file")
+    is64 = elf[4] == 2
+    if is64:
+        shoff, = struct.unpack_from("<Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+        sh = struct.Struct("<IIQQQQIIQQ")
+    else:
+        shoff, = struct.unpack_from("<I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+        sh = struct.Struct("<IIIIIIIIII")
+    sections = [sh.unpack_from(elf, shoff + i * shentsize) for i in range(shnum)]
+    strtab = sections[shstrndx]
+    names = elf[strtab[4]:strtab[4] + strtab[5]]
+    for s in sections:
+        name = names[s[0]:names.index(b"\0", s[0])].decode()
+        if name == "dlog_fmt":
+            return elf[s[4]:s[4] + s[5]], 8 if is64 else 4
+    raise ValueError(f"{path} has no dlog_fmt section")
+
+
+def arg_size(length, conv, long_size):
+    if conv in "fFeEgGaA":
+        return 8
+    if conv in "sp":
+        return 4
+    if length in ("ll", "j"):
+        return 8
+    if length in ("l", "z", "t"):
+        return long_size
+    return 4
+
+
+def render(fmt, args, long_size):
+    out = []
+    pos = 0
+    off = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        size = arg_size(length, conv, long_size)
+        raw = args[off:off + size]
+        off += size
+        if len(raw) < size:
+            out.append("<?>")
+            continue
+        spec = "%" + flags + (width or "") + ("." + prec if prec else "")
+        if conv in "fFeEgGaA":
+            value, = struct.unpack("<d", raw)
+            py = conv if conv not in "aA" else "e"
+            out.append((spec + py) % value)
+            continue
+        value = int.from_bytes(raw, "little", signed=conv in "di")
+        if length == "hh":
+            value = (value & 0xFF) - (0x100 if conv in "di" and value & 0x80 else 0)
+        elif length == "h":
+            value = (value & 0xFFFF) - (0x10000 if conv in "di" and value & 0x8000 else 0)
+        if conv in "sp":
+            out.append((spec + "#x") % value)
+        elif conv == "c":
+            out.append(chr(value & 0xFF))
+        else:
+            out.append((spec + {"i": "d", "u": "d"}.get(conv, conv)) % value)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode(table, long_size, data, cpu_hz, show_time, out):
+    pos = 0
+    last_seq = None
+    last_cycles = None
+    epoch = 0
+    while pos + HEADER.size <= len(data):
+        fmt_off, length, seq, cycles = HEADER.unpack_from(data, pos)
+        args = data[pos + HEADER.size:pos + HEADER.size + length]
+        pos += HEADER.size + length
+        if last_seq is not None and seq != (last_seq + 1) & 0xFF:
+            out.write(f"<{(seq - last_seq - 1) & 0xFF} record(s) dropped>\n")
+        last_seq = seq
+        # 32 bit cycle counter, assumes less than one wrap between records
+        if last_cycles is not None and cycles < last_cycles:
+            epoch += 1 << 32
+        last_cycles = cycles
+        end = table.find(b"\0", fmt_off)
+        if fmt_off >= len(table) or end < 0:
+            out.write(f"<bad format offset {fmt_off}>\n")
+            continue
+        text = render(table[fmt_off:end].decode(errors="replace"), args, long_size)
+        if show_time:
+            out.write(f"[{(epoch + cycles) / cpu_hz:12.6f}] ")
+        out.write(text)
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("elf")
+    p.add_argument("dump")
+    p.add_argument("--cpu-hz", type=float, default=550e6)
+    p.add_argument("--no-time", action="store_true", help="omit timestamps")
+    a = p.parse_args()
+    table, long_size = read_dlog_section(a.elf)
+    with open(a.dump, "rb") as f:
+        data = f.read()
+    decode(table, long_size, data, a.cpu_hz, not a.no_time, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,113 @@
+// Wakeup to t1: how long after the data is there the receive path reads the
+// clock, for the three ways host_clock_sync can wait. A pipe stands in for
+// libusb's event fd, a sender thread writes its own timestamp into it once
+// per sync interval.
+//
+//   cc -O2 -o bench_rx_wakeup bench_rx_wakeup.c host_time.c -lpthread -lm
+//
+// On hardware the same comparison comes from the node's own delay estimate:
+// run host_clock_sync with and without --busy-poll and compare
+// `sync_log_csv --summary sync_log.bin`.
+#define _GNU_SOURCE
+#include "host_time.h"
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define N 2000
+#define PERIOD_NS 1000000L // faster than the 20 ms sync so it runs quickly
+
+enum { BLOCKING, EPOLL, BUSY_POLL };
+static const char *names[] = {"blocking", "epoll", "busy poll"};
+
+static int g_fd[2];
+static volatile int g_done;
+
+static void *sender(void *arg) {
+  (void)arg;
+  for (int i = 0; i < N; i++) {
+    struct timespec ts = {0, PERIOD_NS};
+    nanosleep(&ts, NULL);
+    uint64_t t0 = host_time_now_ns();
+    if (write(g_fd[1], &t0, sizeof(t0)) != sizeof(t0))
+      break;
+  }
+  g_done = 1;
+  return NULL;
+}
+
+static int cmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(int mode) {
+  if (pipe2(g_fd, mode == BUSY_POLL ? O_NONBLOCK : 0) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  int ep = epoll_create1(0);
+  struct epoll_event ev = {.events = EPOLLIN, .data.fd = g_fd[0]};
+  epoll_ctl(ep, EPOLL_CTL_ADD, g_fd[0], &ev);
+
+  static double lat[N];
+  int n = 0;
+  g_done = 0;
+  pthread_t th;
+  pthread_create(&th, NULL, sender, NULL);
+  while (n < N && !g_done) {
+    uint64_t t0, t1;
+    if (mode == BLOCKING) {
+      // the old path: a blocking wait with a 100 ms timeout, t1 read after
+      // the call has returned
+      struct pollfd p = {.fd = g_fd[0], .events = POLLIN};
+      if (poll(&p, 1, 100) <= 0)
+        continue;
+      if (read(g_fd[0], &t0, sizeof(t0)) != sizeof(t0))
+        continue;
+      t1 = host_time_now_ns();
+    } else if (mode == EPOLL) {
+      struct epoll_event e;
+      if (epoll_wait(ep, &e, 1, 100) <= 0)
+        continue;
+      t1 = host_time_now_ns();
+      if (read(g_fd[0], &t0, sizeof(t0)) != sizeof(t0))
+        continue;
+    } else {
+      if (read(g_fd[0], &t0, sizeof(t0)) != sizeof(t0))
+        continue;
+      t1 = host_time_now_ns();
+    }
+    lat[n++] = (double)(t1 - t0);
+  }
+  pthread_join(th, NULL);
+  close(ep);
+  close(g_fd[0]);
+  close(g_fd[1]);
+
+  double sum = 0, sq = 0;
+  for (int i = 0; i < n; i++)
+    sum += lat[i];
+  double mean = sum / n;
+  for (int i = 0; i < n; i++)
+    sq += (lat[i] - mean) * (lat[i] - mean);
+  qsort(lat, n, sizeof(double), cmp);
+  printf("%-10s n %5d  min %6.0f  p50 %6.0f  p99 %7.0f  max %7.0f  "
+         "std %6.0f ns\n",
+         names[mode], n, lat[0], lat[n / 2], lat[n * 99 / 100], lat[n - 1],
+         sqrt(sq / n));
+}
+
+int main(void) {
+  run(BLOCKING);
+  run(EPOLL);
+  run(BUSY_POLL);
+  return 0;
+}
@@ -0,0 +1,212 @@
+// Bulk throughput of the node's vendor interface, both ways, and what the
+// USB interrupt costs the node while it runs. The node sends and counts
+// SYNC_MSG_TYPE_BULK_TEST filler (SYNC_VREQ_BULK_TEST in sync_protocol.h),
+// the load comes from the SYNC_CPU_USB_ISR slot of the CPU profile.
+//
+//   bench_usb_throughput [--mb 64] [serial]
+//
+// Claims the vendor interface, stop the server first. Run it on firmware
+// before and after a USB driver or memory layout change and compare.
+//
+//   cc -O2 -o bench_usb_throughput bench_usb_throughput.c host_time.c -lusb-1.0
+#include "host_time.h"
+#include "sync_protocol.h"
+#include <libusb-1.0/libusb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_VID 0xcafe
+#define NODE_PID 0x4011
+#define NODE_IFACE 2
+#define CTRL_TIMEOUT_MS 500
+#define BULK_TIMEOUT_MS 2000
+#define CHUNK (256 * SYNC_TLM_PACKET_SIZE) // bytes per libusb call
+
+static libusb_device_handle *open_node(libusb_context *ctx,
+                                       const char *serial) {
+  libusb_device **list = NULL;
+  ssize_t cnt = libusb_get_device_list(ctx, &list);
+  libusb_device_handle *found = NULL;
+  for (ssize_t i = 0; i < cnt && !found; i++) {
+    struct libusb_device_descriptor dd;
+    libusb_device_handle *h = NULL;
+    if (libusb_get_device_descriptor(list[i], &dd) < 0 ||
+        dd.idVendor != NODE_VID || dd.idProduct != NODE_PID ||
+        libusb_open(list[i], &h) < 0)
+      continue;
+    unsigned char sn[64];
+    int n = serial && dd.iSerialNumber
+                ? libusb_get_string_descriptor_ascii(h, dd.iSerialNumber, sn,
+                                                     sizeof(sn) - 1)
+                : 0;
+    if (n > 0)
+      sn[n] = 0;
+    if (!serial || (n > 0 && strcmp((const char *)sn, serial) == 0))
+      found = h;
+    else
+      libusb_close(h);
+  }
+  if (cnt > 0)
+    libusb_free_device_list(list, 1);
+  return found;
+}
+
+// Bulk endpoints of the vendor interface
+static int find_eps(libusb_device_handle *h, uint8_t *in, uint8_t *out) {
+  struct libusb_config_descriptor *cfg = NULL;
+  if (libusb_get_active_config_descriptor(libusb_get_device(h), &cfg) < 0)
+    return -1;
+  *in = *out = 0;
+  for (int i = 0; i < cfg->bNumInterfaces; i++) {
+    const struct libusb_interface_descriptor *id = cfg->interface[i].altsetting;
+    if (cfg->interface[i].num_altsetting < 1 ||
+        id->bInterfaceNumber != NODE_IFACE)
+      continue;
+    for (int e = 0; e < id->bNumEndpoints; e++) {
+      const struct libusb_endpoint_descriptor *ep = &id->endpoint[e];
+      if ((ep->bmAttributes & 3) != LIBUSB_TRANSFER_TYPE_BULK)
+        continue;
+      if (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN)
+        *in = ep->bEndpointAddress;
+      else
+        *out = ep->bEndpointAddress;
+    }
+  }
+  libusb_free_config_descriptor(cfg);
+  return *in && *out ? 0 : -1;
+}
+
+static int vreq(libusb_device_handle *h, uint8_t req, uint32_t arg, void *dst,
+                uint16_t len) {
+  int r = libusb_control_transfer(
+      h, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR |
+             LIBUSB_RECIPIENT_DEVICE,
+      req, (uint16_t)arg, (uint16_t)(arg >> 16), dst, len, CTRL_TIMEOUT_MS);
+  if (r < 0)
+    fprintf(stderr, "control transfer %#x: %s\n", req, libusb_error_name(r));
+  return r == len ? 0 : -1;
+}
+
+// Prints the USB interrupt's share of the node since the last read and
+// starts a new window
+static void print_isr(libusb_device_handle *h, uint32_t packets) {
+  sync_cpu_prof_t p;
+  if (vreq(h, SYNC_VREQ_CPU_PROF, SYNC_CPU_PROF_RESET, &p, sizeof(p)) < 0)
+    return;
+  const sync_cpu_slot_t *s = &p.slot[SYNC_CPU_USB_ISR];
+  double window = (double)p.window_ns * 1e-9 * p.core_hz;
+  printf("  usb isr: %u runs, avg %u max %u cycles, %.1f%% load, %.0f "
+         "cycles/packet\n",
+         s->count, s->avg, s->max, window > 0 ? 100.0 * s->total / window : 0,
+         packets ? (double)s->total / packets : 0.0);
+}
+
+int main(int argc, char **argv) {
+  uint32_t mb = 64;
+  const char *serial = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mb") == 0 && i + 1 < argc)
+      mb = (uint32_t)atoi(argv[++i]);
+    else if (argv[i][0] != '-' && !serial)
+      serial = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--mb megabytes] [serial]\n", argv[0]);
+      return 2;
+    }
+  }
+  uint32_t packets = mb * 1024 * 1024 / SYNC_TLM_PACKET_SIZE;
+  packets -= packets % (CHUNK / SYNC_TLM_PACKET_SIZE);
+  if (!packets) {
+    fprintf(stderr, "--mb too small\n");
+    return 2;
+  }
+
+  libusb_context *ctx = NULL;
+  int r = libusb_init(&ctx);
+  if (r < 0) {
+    fprintf(stderr, "libusb_init: %s\n", libusb_error_name(r));
+    return 1;
+  }
+  libusb_device_handle *h = open_node(ctx, serial);
+  if (!h) {
+    fprintf(stderr, "No node %04x:%04x%s%s found\n", NODE_VID, NODE_PID,
+            serial ? " serial " : "", serial ? serial : "");
+    libusb_exit(ctx);
+    return 1;
+  }
+  uint8_t ep_in, ep_out;
+  libusb_set_auto_detach_kernel_driver(h, 1);
+  if (find_eps(h, &ep_in, &ep_out) < 0 ||
+      (r = libusb_claim_interface(h, NODE_IFACE)) < 0) {
+    fprintf(stderr, "can't claim interface %d, server running?\n",
+            NODE_IFACE);
+    libusb_close(h);
+    libusb_exit(ctx);
+    return 1;
+  }
+
+  static uint8_t buf[CHUNK];
+  sync_bulk_test_t bt;
+  int ok = 0;
+  for (uint32_t i = 0; i < CHUNK; i += SYNC_TLM_PACKET_SIZE)
+    buf[i] = SYNC_MSG_TYPE_BULK_TEST;
+
+  // OUT, counters zeroed by the request, nothing queued
+  if (vreq(h, SYNC_VREQ_BULK_TEST, 0, &bt, sizeof(bt)) < 0)
+    goto out;
+  vreq(h, SYNC_VREQ_CPU_PROF, SYNC_CPU_PROF_RESET, NULL, 0);
+  uint64_t t0 = host_time_now_ns();
+  for (uint32_t sent = 0; sent < packets;
+       sent += CHUNK / SYNC_TLM_PACKET_SIZE) {
+    int n = 0;
+    r = libusb_bulk_transfer(h, ep_out, buf, CHUNK, &n, BULK_TIMEOUT_MS);
+    if (r < 0) {
+      fprintf(stderr, "OUT: %s\n", libusb_error_name(r));
+      goto out;
+    }
+  }
+  double s = (host_time_now_ns() - t0) * 1e-9;
+  printf("OUT %u packets in %.3f s: %.1f MB/s\n", packets, s,
+         packets * (double)SYNC_TLM_PACKET_SIZE / s / 1e6);
+  print_isr(h, packets);
+
+  // IN, the reply has the OUT counts
+  if (vreq(h, SYNC_VREQ_BULK_TEST, packets, &bt, sizeof(bt)) < 0)
+    goto out;
+  if (bt.out_packets != packets)
+    printf("  node counted %u packets, %u bytes\n", bt.out_packets,
+           bt.out_bytes);
+  t0 = host_time_now_ns();
+  uint32_t got = 0, lost = 0, expect = 0;
+  while (got < packets) {
+    int n = 0;
+    r = libusb_bulk_transfer(h, ep_in, buf, CHUNK, &n, BULK_TIMEOUT_MS);
+    if (r < 0 && !(r == LIBUSB_ERROR_TIMEOUT && n > 0)) {
+      fprintf(stderr, "IN after %u packets: %s\n", got, libusb_error_name(r));
+      goto out;
+    }
+    for (int i = 0; i + SYNC_TLM_PACKET_SIZE <= n;
+         i += SYNC_TLM_PACKET_SIZE) {
+      uint32_t seq;
+      memcpy(&seq, buf + i + 4, sizeof(seq));
+      if (buf[i] != SYNC_MSG_TYPE_BULK_TEST)
+        continue; // a stray telemetry or sync packet
+      lost += seq - expect;
+      expect = seq + 1;
+      got++;
+    }
+  }
+  s = (host_time_now_ns() - t0) * 1e-9;
+  printf("IN  %u packets in %.3f s: %.1f MB/s%s\n", got, s,
+         got * (double)SYNC_TLM_PACKET_SIZE / s / 1e6,
+         lost ? ", sequence gaps" : "");
+  print_isr(h, got);
+  ok = vreq(h, SYNC_VREQ_BULK_TEST, 0, &bt, sizeof(bt)) == 0;
+
+out:
+  libusb_release_interface(h, NODE_IFACE);
+  libusb_close(h);
+  libusb_exit(ctx);
+  return ok ? 0 : 1;
+}
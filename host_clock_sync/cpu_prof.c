@@ -0,0 +1,155 @@
+// Where the node's cycles go: reads the DWT profile of its interrupt handlers
+// and main loop tasks over a vendor control request (see cpu_prof.h in the
+// firmware) and prints one line per slot.
+//
+//   cpu_prof [serial]                 since the last reset
+//   cpu_prof --reset [serial]         and start a new window
+//   cpu_prof --watch 2 [serial]       a fresh 2 s window, over and over
+//
+// Control requests don't need the vendor interface, this runs next to the
+// server without disturbing it.
+//
+//   cc -O2 -o cpu_prof cpu_prof.c -lusb-1.0
+#include "sync_protocol.h"
+#include <libusb-1.0/libusb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NODE_VID 0xcafe
+#define NODE_PID 0x4011
+#define CTRL_TIMEOUT_MS 500
+
+static const char *const g_names[SYNC_CPU_SLOTS] = {
+    [SYNC_CPU_TICK] = "tick",
+    [SYNC_CPU_SYNC_TICK] = " sync_tick",
+    [SYNC_CPU_MOTION_TICK] = " motion_tick",
+    [SYNC_CPU_USB_ISR] = "usb isr",
+    [SYNC_CPU_ADC_ISR] = "current loop",
+    [SYNC_CPU_TUD_TASK] = "tud_task",
+    [SYNC_CPU_TLM_TASK] = "telemetry",
+};
+
+static libusb_device_handle *open_node(libusb_context *ctx,
+                                       const char *serial) {
+  libusb_device **list = NULL;
+  ssize_t cnt = libusb_get_device_list(ctx, &list);
+  libusb_device_handle *found = NULL;
+  for (ssize_t i = 0; i < cnt && !found; i++) {
+    struct libusb_device_descriptor dd;
+    libusb_device_handle *h = NULL;
+    if (libusb_get_device_descriptor(list[i], &dd) < 0 ||
+        dd.idVendor != NODE_VID || dd.idProduct != NODE_PID ||
+        libusb_open(list[i], &h) < 0)
+      continue;
+    unsigned char sn[64];
+    int n = serial && dd.iSerialNumber
+                ? libusb_get_string_descriptor_ascii(h, dd.iSerialNumber, sn,
+                                                     sizeof(sn) - 1)
+                : 0;
+    if (n > 0)
+      sn[n] = 0;
+    if (!serial || (n > 0 && strcmp((const char *)sn, serial) == 0))
+      found = h;
+    else
+      libusb_close(h);
+  }
+  if (cnt > 0)
+    libusb_free_device_list(list, 1);
+  return found;
+}
+
+static int read_prof(libusb_device_handle *h, int reset, sync_cpu_prof_t *p) {
+  memset(p, 0, sizeof(*p));
+  int r = libusb_control_transfer(
+      h, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR |
+             LIBUSB_RECIPIENT_DEVICE,
+      SYNC_VREQ_CPU_PROF, reset ? SYNC_CPU_PROF_RESET : 0, 0,
+      (unsigned char *)p, sizeof(*p), CTRL_TIMEOUT_MS);
+  if (r < 0) {
+    fprintf(stderr, "control transfer: %s\n", libusb_error_name(r));
+    return r;
+  }
+  if (r != (int)sizeof(*p) || p->slots != SYNC_CPU_SLOTS) {
+    fprintf(stderr, "unexpected profile, %d bytes, %u slots\n", r, p->slots);
+    return -1;
+  }
+  return 0;
+}
+
+// Load is the share of the window's cycles the slot took; nested slots
+// (sync_tick, motion_tick) are part of their parent's
+static void print_prof(const sync_cpu_prof_t *p) {
+  double us = 1e6 / p->core_hz;
+  double window = (double)p->window_ns * 1e-9 * p->core_hz;
+  printf("window %.3f s, core %u MHz\n", p->window_ns * 1e-9,
+         p->core_hz / 1000000);
+  printf("%-13s %9s %8s %8s %8s %8s %8s %8s %6s\n", "", "runs", "min",
+         "avg", "max", "max us", "budget", "over", "load");
+  for (int i = 0; i < SYNC_CPU_SLOTS; i++) {
+    const sync_cpu_slot_t *s = &p->slot[i];
+    printf("%-13s %9u %8u %8u %8u %8.2f ", g_names[i], s->count, s->min,
+           s->avg, s->max, s->max * us);
+    if (s->budget)
+      printf("%8u %8u", s->budget, s->overruns);
+    else
+      printf("%8s %8s", "-", "-");
+    printf(" %5.1f%%\n", window > 0 ? 100.0 * s->total / window : 0.0);
+  }
+}
+
+int main(int argc, char **argv) {
+  int reset = 0;
+  int watch_s = 0;
+  const char *serial = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--reset") == 0)
+      reset = 1;
+    else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+      watch_s = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && !serial)
+      serial = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--reset] [--watch seconds] [serial]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  libusb_context *ctx = NULL;
+  int r = libusb_init(&ctx);
+  if (r < 0) {
+    fprintf(stderr, "libusb_init: %s\n", libusb_error_name(r));
+    return 1;
+  }
+  libusb_device_handle *h = open_node(ctx, serial);
+  if (!h) {
+    fprintf(stderr, "No node %04x:%04x%s%s found\n", NODE_VID, NODE_PID,
+            serial ? " serial " : "", serial ? serial : "");
+    libusb_exit(ctx);
+    return 1;
+  }
+
+  sync_cpu_prof_t p;
+  if (watch_s > 0) {
+    // throw away what came before, then one window per line block
+    r = read_prof(h, 1, &p);
+    while (r == 0) {
+      sleep(watch_s);
+      r = read_prof(h, 1, &p);
+      if (r == 0) {
+        print_prof(&p);
+        printf("\n");
+        fflush(stdout);
+      }
+    }
+  } else {
+    r = read_prof(h, reset, &p);
+    if (r == 0)
+      print_prof(&p);
+  }
+  libusb_close(h);
+  libusb_exit(ctx);
+  return r == 0 ? 0 : 1;
+}
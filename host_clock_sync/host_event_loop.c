@@ -0,0 +1,182 @@
+#include "host_event_loop.h"
+#include "host_time.h"
+#include <libusb-1.0/libusb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define TRANSPORT_GONE -2
+#define MAX_IN 16
+#define NUM_OUT 8
+#define OUT_SIZE 64
+
+// transport_*.c
+void transport_usb(libusb_context **ctx, libusb_device_handle **dev,
+                   uint8_t *ep_in, uint8_t *ep_out);
+
+static libusb_context *g_ctx;
+static libusb_device_handle *g_dev;
+static uint8_t g_ep_in, g_ep_out;
+static int g_epfd = -1;
+static event_loop_cfg_t g_cfg;
+static event_loop_rx_t g_on_rx;
+static void *g_user;
+static int g_gone;
+
+static struct libusb_transfer *g_in[MAX_IN];
+static int g_in_posted;
+static struct libusb_transfer *g_out[NUM_OUT];
+static uint8_t g_out_buf[NUM_OUT][OUT_SIZE];
+static int g_out_busy[NUM_OUT];
+
+static void in_cb(struct libusb_transfer *xfer) {
+  // before anything else, this is t1
+  uint64_t t1 = host_time_now_ns();
+  if (xfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    if (xfer->actual_length > 0)
+      g_on_rx(xfer->buffer, xfer->actual_length, t1, g_user);
+  } else if (xfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+    g_gone = 1;
+  }
+  if (g_gone || xfer->status == LIBUSB_TRANSFER_CANCELLED ||
+      libusb_submit_transfer(xfer) != 0)
+    g_in_posted--;
+}
+
+static void out_cb(struct libusb_transfer *xfer) {
+  if (xfer->status == LIBUSB_TRANSFER_NO_DEVICE)
+    g_gone = 1;
+  else if (xfer->status != LIBUSB_TRANSFER_COMPLETED)
+    fprintf(stderr, "bulk OUT status %d\n", xfer->status);
+  g_out_busy[(intptr_t)xfer->user_data] = 0;
+}
+
+static void fd_added(int fd, short events, void *user) {
+  (void)user;
+  struct epoll_event ev = {.data.fd = fd};
+  if (events & POLLIN)
+    ev.events |= EPOLLIN;
+  if (events & POLLOUT)
+    ev.events |= EPOLLOUT;
+  epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void fd_removed(int fd, void *user) {
+  (void)user;
+  epoll_ctl(g_epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int event_loop_init(const event_loop_cfg_t *cfg, event_loop_rx_t on_rx,
+                    void *user) {
+  transport_usb(&g_ctx, &g_dev, &g_ep_in, &g_ep_out);
+  g_cfg = *cfg;
+  if (g_cfg.in_flight < 1)
+    g_cfg.in_flight = 1;
+  if (g_cfg.in_flight > MAX_IN)
+    g_cfg.in_flight = MAX_IN;
+  g_on_rx = on_rx;
+  g_user = user;
+  g_gone = 0;
+
+  g_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (g_epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  const struct libusb_pollfd **fds = libusb_get_pollfds(g_ctx);
+  if (!fds) {
+    fprintf(stderr, "libusb_get_pollfds not supported here\n");
+    return -1;
+  }
+  for (int i = 0; fds[i]; i++)
+    fd_added(fds[i]->fd, fds[i]->events, NULL);
+  libusb_free_pollfds(fds);
+  libusb_set_pollfd_notifiers(g_ctx, fd_added, fd_removed, NULL);
+
+  for (int i = 0; i < NUM_OUT; i++) {
+    g_out[i] = libusb_alloc_transfer(0);
+    g_out_busy[i] = 0;
+  }
+  g_in_posted = 0;
+  for (int i = 0; i < g_cfg.in_flight; i++) {
+    g_in[i] = libusb_alloc_transfer(0);
+    uint8_t *buf = malloc(g_cfg.in_size);
+    libusb_fill_bulk_transfer(g_in[i], g_dev, g_ep_in, buf, g_cfg.in_size,
+                              in_cb, NULL, 0);
+    g_in[i]->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    int r = libusb_submit_transfer(g_in[i]);
+    if (r != 0) {
+      fprintf(stderr, "submit IN: %s\n", libusb_error_name(r));
+      return r;
+    }
+    g_in_posted++;
+  }
+  return 0;
+}
+
+int event_loop_send(const void *buf, int len) {
+  if (len > OUT_SIZE)
+    return -1;
+  for (int i = 0; i < NUM_OUT; i++) {
+    if (g_out_busy[i])
+      continue;
+    memcpy(g_out_buf[i], buf, len);
+    libusb_fill_bulk_transfer(g_out[i], g_dev, g_ep_out, g_out_buf[i], len,
+                              out_cb, (void *)(intptr_t)i, 1000);
+    if (libusb_submit_transfer(g_out[i]) != 0)
+      return -1;
+    g_out_busy[i] = 1;
+    return len;
+  }
+  return -1;
+}
+
+int event_loop_run_once(int timeout_ms) {
+  struct timeval zero = {0, 0};
+  if (!g_cfg.busy_poll) {
+    // sleep until libusb has something, or its own next timeout
+    struct timeval tv;
+    if (libusb_get_next_timeout(g_ctx, &tv) == 1) {
+      int ms = (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+      if (ms < timeout_ms)
+        timeout_ms = ms;
+    }
+    struct epoll_event evs[8];
+    if (epoll_wait(g_epfd, evs, 8, timeout_ms) < 0)
+      return 0; // EINTR, SIGINT on the way
+  }
+  int r = libusb_handle_events_timeout_completed(g_ctx, &zero, NULL);
+  if (r != 0 && r != LIBUSB_ERROR_INTERRUPTED)
+    return r;
+  return g_gone ? TRANSPORT_GONE : 0;
+}
+
+void event_loop_close(void) {
+  for (int i = 0; i < g_cfg.in_flight; i++)
+    if (g_in[i])
+      libusb_cancel_transfer(g_in[i]);
+  struct timeval tv = {0, 10000};
+  for (int tries = 0; tries < 100; tries++) {
+    int out_busy = 0;
+    for (int i = 0; i < NUM_OUT; i++)
+      out_busy |= g_out_busy[i];
+    if (g_in_posted <= 0 && !out_busy)
+      break;
+    libusb_handle_events_timeout_completed(g_ctx, &tv, NULL);
+  }
+  libusb_set_pollfd_notifiers(g_ctx, NULL, NULL, NULL);
+  for (int i = 0; i < g_cfg.in_flight; i++) {
+    libusb_free_transfer(g_in[i]);
+    g_in[i] = NULL;
+  }
+  for (int i = 0; i < NUM_OUT; i++) {
+    libusb_free_transfer(g_out[i]);
+    g_out[i] = NULL;
+  }
+  if (g_epfd >= 0)
+    close(g_epfd);
+  g_epfd = -1;
+}
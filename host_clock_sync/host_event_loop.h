@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+// Async libusb for the sync daemon. Several bulk IN transfers stay posted so
+// the node's request never waits for us to resubmit, libusb's fds sit in an
+// epoll set, and the receive time is read first thing in the completion
+// callback instead of after a blocking libusb_bulk_transfer has unwound.
+// Busy polling trades a core for the wakeup jitter of epoll_wait.
+
+typedef void (*event_loop_rx_t)(const uint8_t *buf, int len, uint64_t t1_ns,
+                                void *user);
+
+typedef struct {
+  int in_flight; // bulk IN transfers kept posted
+  int in_size;   // bytes per IN transfer
+  int busy_poll; // spin on libusb instead of sleeping in epoll_wait
+} event_loop_cfg_t;
+
+// On the device transport_init opened. on_rx runs from event_loop_run_once.
+int event_loop_init(const event_loop_cfg_t *cfg, event_loop_rx_t on_rx,
+                    void *user);
+
+// Queues an OUT transfer, buf is copied. -1 if every OUT slot is busy.
+int event_loop_send(const void *buf, int len);
+
+// Handles whatever completes within timeout_ms (busy poll: returns as soon as
+// nothing is pending). 0, TRANSPORT_GONE once the device went away, or a
+// libusb error.
+int event_loop_run_once(int timeout_ms);
+
+// Cancels the posted transfers and waits for them
+void event_loop_close(void);
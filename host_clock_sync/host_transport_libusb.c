@@ -2,6 +2,10 @@
 
 #include <libusb-1.0/libusb.h>
 #include <stdio.h>
+#include <string.h>
+
+#define TRANSPORT_GONE -2
+#define TRANSPORT_NO_DEVICE -3
 
 static libusb_context *g_ctx = NULL;
 static libusb_device_handle *g_dev = NULL;
@@ -30,7 +34,31 @@ static void debug_print_config(const struct libusb_config_descriptor *cfg) {
   }
 }
 
-int transport_init(uint16_t vid, uint16_t pid) {
+// Serial number string of dev against serial, any device matches NULL
+static int serial_matches(libusb_device *dev,
+                          const struct libusb_device_descriptor *dd,
+                          const char *serial) {
+  if (!serial)
+    return 1;
+  if (!dd->iSerialNumber)
+    return 0;
+  libusb_device_handle *h = NULL;
+  if (libusb_open(dev, &h) < 0)
+    return 0;
+  unsigned char sn[64];
+  int n = libusb_get_string_descriptor_ascii(h, dd->iSerialNumber, sn,
+                                             sizeof(sn) - 1);
+  libusb_close(h);
+  if (n <= 0)
+    return 0;
+  sn[n] = 0;
+  return strcmp((const char *)sn, serial) == 0;
+}
+
+// serial picks the board by its serial number string, NULL takes the first.
+// TRANSPORT_NO_DEVICE, without a word, while there's no such board: callers
+// poll for it. Every failure leaves nothing open.
+int transport_init(uint16_t vid, uint16_t pid, const char *serial) {
   int r = libusb_init(&g_ctx);
   if (r < 0) {
     fprintf(stderr, "libusb_init failed: %s\n", libusb_error_name(r));
@@ -42,7 +70,8 @@ int transport_init(uint16_t vid, uint16_t pid) {
   if (cnt < 0) {
     fprintf(stderr, "libusb_get_device_list: %s\n",
             libusb_error_name((int)cnt));
-    return (int)cnt;
+    r = (int)cnt;
+    goto fail;
   }
 
   libusb_device *found_dev = NULL;
@@ -54,23 +83,24 @@ int transport_init(uint16_t vid, uint16_t pid) {
     if (r < 0)
       continue;
 
-    if (dd.idVendor == vid && dd.idProduct == pid) {
+    if (dd.idVendor == vid && dd.idProduct == pid &&
+        serial_matches(dev, &dd, serial)) {
       found_dev = dev;
       break;
     }
   }
 
   if (!found_dev) {
-    fprintf(stderr, "No device %04x:%04x found\n", vid, pid);
     libusb_free_device_list(list, 1);
-    return -1;
+    r = TRANSPORT_NO_DEVICE;
+    goto fail;
   }
 
   r = libusb_open(found_dev, &g_dev);
   if (r < 0) {
     fprintf(stderr, "libusb_open failed: %s\n", libusb_error_name(r));
     libusb_free_device_list(list, 1);
-    return r;
+    goto fail;
   }
 
   libusb_free_device_list(list, 1);
@@ -133,7 +163,8 @@ int transport_init(uint16_t vid, uint16_t pid) {
   if (!found_iface) {
     fprintf(stderr,
             "Could not find vendor-specific interface with bulk IN/OUT\n");
-    return -1;
+    r = -1;
+    goto fail;
   }
 
   printf("Using config %u, interface %u, EP_IN=0x%02x, EP_OUT=0x%02x\n",
@@ -163,15 +194,23 @@ int transport_init(uint16_t vid, uint16_t pid) {
   if (r < 0) {
     fprintf(stderr, "claim_interface(%u) failed: %s\n", g_iface_number,
             libusb_error_name(r));
-    return r;
+    goto fail;
   }
 
   printf("transport_init OK\n");
   return 0;
+
+fail:
+  if (g_dev) {
+    libusb_close(g_dev);
+    g_dev = NULL;
+  }
+  libusb_exit(g_ctx);
+  g_ctx = NULL;
+  return r;
 }
 
 int transport_send(const void *buf, int len) {
-  printf("sending %d bytes\n", len);
   int xfer = 0;
   int r = libusb_bulk_transfer(g_dev, g_ep_out, (unsigned char *)buf, len,
                                &xfer, 1000);
@@ -192,6 +231,8 @@ int transport_recv(void *buf, int len, int timeout_ms) {
                                timeout_ms);
   if (r == LIBUSB_ERROR_TIMEOUT)
     return 0;
+  if (r == LIBUSB_ERROR_NO_DEVICE)
+    return TRANSPORT_GONE;
   if (r != 0) {
     fprintf(stderr, "bulk IN error: %s (%d)\n", libusb_error_name(r), r);
     return -1;
@@ -210,3 +251,12 @@ void transport_close(void) {
     g_ctx = NULL;
   }
 }
+
+// For the async event loop
+void transport_usb(libusb_context **ctx, libusb_device_handle **dev,
+                   uint8_t *ep_in, uint8_t *ep_out) {
+  *ctx = g_ctx;
+  *dev = g_dev;
+  *ep_in = g_ep_in;
+  *ep_out = g_ep_out;
+}
@@ -4,6 +4,10 @@
 #include "sync_protocol.h"
 #include <libusb-1.0/libusb.h>
 #include <stdio.h>
+#include <string.h>
+
+#define TRANSPORT_GONE -2
+#define TRANSPORT_NO_DEVICE -3
 
 static libusb_context *g_ctx = NULL;
 static libusb_device_handle *g_dev = NULL;
@@ -12,7 +16,28 @@ static uint8_t g_iface_number = 2; // adjust if your vendor IF is not 0
 static uint8_t g_ep_in = 0x87;
 static uint8_t g_ep_out = 0x07;
 
-int transport_init(uint16_t vid, uint16_t pid) {
+// Serial number string of dev against serial, any device matches NULL
+static int serial_matches(libusb_device *dev,
+                          const struct libusb_device_descriptor *desc,
+                          const char *serial) {
+  if (!serial)
+    return 1;
+  libusb_device_handle *h = NULL;
+  if (!desc->iSerialNumber || libusb_open(dev, &h) < 0)
+    return 0;
+  unsigned char sn[64];
+  int n = libusb_get_string_descriptor_ascii(h, desc->iSerialNumber, sn,
+                                             sizeof(sn) - 1);
+  libusb_close(h);
+  if (n <= 0)
+    return 0;
+  sn[n] = 0;
+  return strcmp((const char *)sn, serial) == 0;
+}
+
+// TRANSPORT_NO_DEVICE, without a word, while there's no such board. Every
+// failure leaves nothing open.
+int transport_init(uint16_t vid, uint16_t pid, const char *serial) {
   int r = libusb_init(&g_ctx);
   if (r < 0) {
     fprintf(stderr, "libusb_init failed: %d\n", r);
@@ -23,7 +48,8 @@ int transport_init(uint16_t vid, uint16_t pid) {
   ssize_t cnt = libusb_get_device_list(g_ctx, &list);
   if (cnt < 0) {
     fprintf(stderr, "libusb_get_device_list: %zd\n", cnt);
-    return (int)cnt;
+    r = (int)cnt;
+    goto fail;
   }
 
   libusb_device *found = NULL;
@@ -35,7 +61,8 @@ int transport_init(uint16_t vid, uint16_t pid) {
       continue;
     }
 
-    if (desc.idVendor == vid && desc.idProduct == pid) {
+    if (desc.idVendor == vid && desc.idProduct == pid &&
+        serial_matches(dev, &desc, serial)) {
       printf("Found candidate device: bus %u, address %u\n",
              libusb_get_bus_number(dev), libusb_get_device_address(dev));
       printf("  bNumConfigurations = %u\n", desc.bNumConfigurations);
@@ -45,9 +72,9 @@ int transport_init(uint16_t vid, uint16_t pid) {
   }
 
   if (!found) {
-    fprintf(stderr, "No device with VID:PID %04x:%04x found\n", vid, pid);
     libusb_free_device_list(list, 1);
-    return -1;
+    r = TRANSPORT_NO_DEVICE;
+    goto fail;
   }
 
   // Open with detailed error reporting
@@ -57,7 +84,7 @@ int transport_init(uint16_t vid, uint16_t pid) {
     fprintf(stderr, "Hint: if this is LIBUSB_ERROR_ACCESS, try running as root "
                     "or add a udev rule.\n");
     libusb_free_device_list(list, 1);
-    return r;
+    goto fail;
   }
 
   libusb_free_device_list(list, 1);
@@ -88,13 +115,22 @@ int transport_init(uint16_t vid, uint16_t pid) {
             g_iface_number, libusb_error_name(r), r);
     fprintf(stderr, "Hint: LIBUSB_ERROR_BUSY => kernel driver still bound, or "
                     "wrong interface.\n");
-    return r;
+    goto fail;
   }
 
   printf("Successfully opened and claimed interface %u on %04x:%04x\n",
          g_iface_number, vid, pid);
 
   return 0;
+
+fail:
+  if (g_dev) {
+    libusb_close(g_dev);
+    g_dev = NULL;
+  }
+  libusb_exit(g_ctx);
+  g_ctx = NULL;
+  return r;
 }
 
 void transport_close(void) {
@@ -127,9 +163,20 @@ int transport_recv(void *buf, int len, int timeout_ms) {
                                &transferred, timeout_ms);
   if (r == LIBUSB_ERROR_TIMEOUT)
     return 0;
+  if (r == LIBUSB_ERROR_NO_DEVICE)
+    return TRANSPORT_GONE;
   if (r != 0) {
     fprintf(stderr, "bulk IN error r=%s (%d)\n", libusb_error_name(r), r);
     return -1;
   }
   return transferred;
 }
+
+// For the async event loop
+void transport_usb(libusb_context **ctx, libusb_device_handle **dev,
+                   uint8_t *ep_in, uint8_t *ep_out) {
+  *ctx = g_ctx;
+  *dev = g_dev;
+  *ep_in = g_ep_in;
+  *ep_out = g_ep_out;
+}
@@ -1,12 +1,17 @@
+#include "host_event_loop.h"
 #include "host_time.h"
+#include "sync_log.h"
 #include "sync_protocol.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // transport_*.c
-int transport_init(uint16_t vid, uint16_t pid);
+#define TRANSPORT_GONE -2 // transport_recv: the device went away
+#define TRANSPORT_NO_DEVICE -3 // transport_init: no such board plugged in
+int transport_init(uint16_t vid, uint16_t pid, const char *serial);
 void transport_close(void);
 int transport_send(const void *buf, int len);
 int transport_recv(void *buf, int len, int timeout_ms);
@@ -18,85 +23,167 @@ static void sigint_handler(int sig) {
   g_running = 0;
 }
 
+// Open the board and start a sync session, the node zeroes its clock on the
+// HELLO and we zero ours right behind it
+static int attach(uint16_t vid, uint16_t pid, const char *serial) {
+  int r = transport_init(vid, pid, serial);
+  if (r != 0)
+    return r;
+
+  sync_hello_t hello;
+  hello.msg_type = SYNC_MSG_TYPE_HELLO;
+  hello.reserved = 0;
+  hello.reserved2 = 0;
+  hello.protocol_version = SYNC_PROTOCOL_VERSION;
+  // sync only, no setpoints go out from here
+  hello.encodings = SYNC_ENC_PB;
+  hello.features = SYNC_FEAT_ACK | SYNC_FEAT_SOF_DRIFT;
+  hello.max_batch = 1;
+  hello.reserved3 = 0;
+
+  transport_send(&hello, sizeof(hello));
+  zero_clock();
+  return 0;
+}
+
+// CAPS reply to the HELLO, printed from the main loop
+static sync_caps_t g_caps;
+static volatile int g_caps_new = 0;
+
+static void print_caps(const sync_caps_t *c) {
+  printf("Node caps: encodings %#x features %#x batch %u buffer %u rate %u Hz "
+         "ep %u/%u, using encoding %#x features %#x batch %u\n",
+         c->encodings, c->features, c->max_batch, c->sp_buffer,
+         c->max_rate_hz, c->ep_out_size, c->ep_in_size, c->encoding,
+         c->features_on, c->batch);
+}
+
+static void log_attach(void) {
+  sync_log_rec_t rec = {.host_ns = host_time_now_ns(),
+                        .kind = SYNC_LOG_ATTACH};
+  sync_log_push(&rec);
+}
+
+// Completion callback of the event loop, t1 was read as the transfer
+// completed. Nothing in here blocks: the response is an async OUT transfer,
+// the log a copy into the ring.
+static void on_rx(const uint8_t *buf, int n, uint64_t t_rx, void *user) {
+  (void)user;
+  uint8_t msg_type = buf[0];
+  if (msg_type == SYNC_MSG_TYPE_REQ && n == sizeof(sync_req_t)) {
+    // Device -> host sync request
+    sync_req_t req;
+    memcpy(&req, buf, sizeof(req));
+
+    sync_resp_t resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.msg_type = SYNC_MSG_TYPE_RESP;
+    resp.reserved = 0;
+    resp.seq = req.seq;
+    resp.t1_ns = t_rx;
+    resp.t2_ns = host_time_now_ns(); // just before send
+
+    event_loop_send(&resp, sizeof(resp));
+
+    sync_log_rec_t rec = {.host_ns = t_rx,
+                          .kind = SYNC_LOG_RESP,
+                          .seq = req.seq,
+                          .resp_ns = (uint32_t)(resp.t2_ns - resp.t1_ns)};
+    sync_log_push(&rec);
+  } else if (msg_type == SYNC_MSG_TYPE_STATS && n == sizeof(sync_stats_t)) {
+
+    sync_stats_t stats;
+    memcpy(&stats, buf, sizeof(stats));
+
+    sync_log_rec_t rec = {.host_ns = t_rx,
+                          .kind = SYNC_LOG_STATS,
+                          .seq = stats.seq,
+                          .offset_ns = stats.offset_ns,
+                          .delay_ns = stats.delay_ns,
+                          .freq_corr_ppm = stats.freq_corr_ppm,
+                          .bus_drift_ppb = stats.bus_drift_ppb,
+                          .host_bus_ppb = stats.host_bus_ppb,
+                          .sp_slack_ns = stats.sp_slack_ns,
+                          .sp_late = stats.sp_late,
+                          .sp_ack = stats.sp_ack};
+    sync_log_push(&rec);
+  } else if (msg_type == SYNC_MSG_TYPE_CAPS && n == sizeof(sync_caps_t)) {
+    memcpy(&g_caps, buf, sizeof(g_caps));
+    g_caps_new = 1;
+  } else {
+    // ignore unknown message
+  }
+}
+
+// usage: host_clock_sync [--busy-poll] [--in N] [serial]
+// Writes sync_log.bin, sync_log_csv turns it into CSV and --summary gives
+// the delay spread to compare the modes by.
 int main(int argc, char **argv) {
   uint16_t vid = 0xCafe; // adjust to match your descriptor
   uint16_t pid = 0x4011;
+  const char *serial = NULL;
+  event_loop_cfg_t cfg = {.in_flight = 4, .in_size = 512, .busy_poll = 0};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--busy-poll") == 0)
+      cfg.busy_poll = 1;
+    else if (strcmp(argv[i], "--in") == 0 && i + 1 < argc)
+      cfg.in_flight = atoi(argv[++i]);
+    else
+      serial = argv[i];
+  }
 
-  if (transport_init(vid, pid) != 0) {
+  int r = attach(vid, pid, serial);
+  if (r != 0) {
+    if (r == TRANSPORT_NO_DEVICE)
+      fprintf(stderr, "No device %04x:%04x%s%s found\n", vid, pid,
+              serial ? " serial " : "", serial ? serial : "");
     return 1;
   }
 
   signal(SIGINT, sigint_handler);
 
-  {
-    sync_hello_t hello;
-    hello.msg_type = SYNC_MSG_TYPE_HELLO;
-    hello.reserved = 0;
-    hello.reserved2 = 0;
-    hello.protocol_version = 1;
-
-    transport_send(&hello, sizeof(hello));
-    zero_clock();
+  // records are 64 bytes, 4096 of them cover minutes of a stalled disk
+  if (sync_log_open("sync_log.bin", 4096) != 0) {
+    transport_close();
+    return 1;
   }
-
-  FILE *log = fopen("sync_log.csv", "w");
-  if (!log) {
-    perror("fopen");
+  log_attach();
+  if (event_loop_init(&cfg, on_rx, NULL) != 0) {
+    sync_log_close();
     transport_close();
     return 1;
   }
 
-  fprintf(log, "host_time_ns,seq,offset_ns,delay_ns,freq_corr_ppm\n");
-  fflush(log);
-
-  uint8_t buf[64];
-
   while (g_running) {
-    int n = transport_recv(buf, sizeof(buf), 100); // 100 ms timeout
-    if (n < 0) {
-      break; // error
-    }
-    if (n == 0) {
-      printf("No data\n");
-      // no data
+    int r = event_loop_run_once(100);
+    if (r == TRANSPORT_GONE) {
+      // unplugged or reset: wait for it to come back and start a new
+      // session, host_time_ns restarts from 0 in the log. Polled quietly,
+      // every try that finds nothing has closed its libusb context again.
+      fprintf(stderr, "Device gone, waiting for it\n");
+      event_loop_close();
+      transport_close();
+      while (g_running && attach(vid, pid, serial) != 0)
+        usleep(50000);
+      if (!g_running)
+        break;
+      log_attach();
+      if (event_loop_init(&cfg, on_rx, NULL) != 0)
+        break;
       continue;
     }
-    printf("Got Data!\n");
-
-    uint8_t msg_type = buf[0];
-    if (msg_type == SYNC_MSG_TYPE_REQ && n == sizeof(sync_req_t)) {
-      // Device -> host sync request
-      sync_req_t req;
-      memcpy(&req, buf, sizeof(req));
-
-      uint64_t t1 = host_time_now_ns();
-
-      sync_resp_t resp;
-      memset(&resp, 0, sizeof(resp));
-      resp.msg_type = SYNC_MSG_TYPE_RESP;
-      resp.reserved = 0;
-      resp.seq = req.seq;
-      resp.t1_ns = t1;
-      resp.t2_ns = host_time_now_ns(); // just before send
-
-      transport_send(&resp, sizeof(resp));
-    } else if (msg_type == SYNC_MSG_TYPE_STATS && n == sizeof(sync_stats_t)) {
-
-      sync_stats_t stats;
-      memcpy(&stats, buf, sizeof(stats));
-
-      uint64_t host_now = host_time_now_ns();
-
-      fprintf(log, "%llu,%u,%lld,%lld,%d\n", (unsigned long long)host_now,
-              (unsigned)stats.seq, (long long)stats.offset_ns,
-              (long long)stats.delay_ns, (int)stats.freq_corr_ppm);
-      fflush(log);
-    } else {
-      // ignore unknown message
+    if (r < 0) {
+      fprintf(stderr, "event loop: %d\n", r);
+      break;
+    }
+    if (g_caps_new) {
+      g_caps_new = 0;
+      print_caps(&g_caps);
     }
   }
 
-  fclose(log);
+  event_loop_close();
+  sync_log_close();
   transport_close();
   return 0;
 }
@@ -0,0 +1,128 @@
+#include "sync_log.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Single producer (receive thread), single consumer (writer). Each side only
+// stores its own index, the other one's is read with acquire.
+static sync_log_rec_t *g_ring;
+static uint32_t g_mask;
+static _Atomic uint32_t g_head; // producer
+static _Atomic uint32_t g_tail; // writer
+static uint32_t g_dropped;      // producer only
+
+static FILE *g_file;
+static pthread_t g_writer;
+static atomic_bool g_run;
+
+#define WRITE_BATCH 64
+#define FLUSH_NS 200000000ull // at most this much of the log waits in stdio
+#define IDLE_SLEEP_NS 10000000L
+
+static uint64_t mono_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool sync_log_push(const sync_log_rec_t *rec) {
+  uint32_t head = atomic_load_explicit(&g_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&g_tail, memory_order_acquire);
+  if (head - tail > g_mask) {
+    g_dropped++;
+    return false;
+  }
+  sync_log_rec_t *slot = &g_ring[head & g_mask];
+  *slot = *rec;
+  slot->dropped = g_dropped;
+  atomic_store_explicit(&g_head, head + 1, memory_order_release);
+  return true;
+}
+
+// Writes up to WRITE_BATCH records, the count written
+static uint32_t drain(void) {
+  uint32_t tail = atomic_load_explicit(&g_tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&g_head, memory_order_acquire);
+  uint32_t n = head - tail;
+  if (n > WRITE_BATCH)
+    n = WRITE_BATCH;
+  // contiguous part first, the wrapped rest on the next call
+  uint32_t idx = tail & g_mask;
+  if (n > g_mask + 1 - idx)
+    n = g_mask + 1 - idx;
+  if (n == 0)
+    return 0;
+  if (fwrite(&g_ring[idx], sizeof(sync_log_rec_t), n, g_file) != n)
+    perror("sync log write");
+  atomic_store_explicit(&g_tail, tail + n, memory_order_release);
+  return n;
+}
+
+static void *writer(void *arg) {
+  (void)arg;
+  uint64_t last_flush = mono_ns();
+  while (atomic_load(&g_run)) {
+    uint32_t n = drain();
+    uint64_t now = mono_ns();
+    if (now - last_flush > FLUSH_NS) {
+      fflush(g_file);
+      last_flush = now;
+    }
+    if (n == 0) {
+      struct timespec ts = {0, IDLE_SLEEP_NS};
+      nanosleep(&ts, NULL);
+    }
+  }
+  while (drain())
+    ;
+  fflush(g_file);
+  return NULL;
+}
+
+int sync_log_open(const char *path, uint32_t records) {
+  uint32_t n = 1;
+  while (n < records)
+    n <<= 1;
+  g_ring = calloc(n, sizeof(sync_log_rec_t));
+  if (!g_ring)
+    return -1;
+  g_mask = n - 1;
+  atomic_store(&g_head, 0);
+  atomic_store(&g_tail, 0);
+  g_dropped = 0;
+
+  g_file = fopen(path, "wb");
+  if (!g_file) {
+    perror("fopen");
+    free(g_ring);
+    return -1;
+  }
+  sync_log_header_t hdr = {.version = SYNC_LOG_VERSION,
+                           .rec_size = sizeof(sync_log_rec_t)};
+  strncpy(hdr.magic, SYNC_LOG_MAGIC, sizeof(hdr.magic));
+  fwrite(&hdr, sizeof(hdr), 1, g_file);
+
+  atomic_store(&g_run, true);
+  if (pthread_create(&g_writer, NULL, writer, NULL) != 0) {
+    fclose(g_file);
+    free(g_ring);
+    return -1;
+  }
+  return 0;
+}
+
+void sync_log_close(void) {
+  if (!g_file)
+    return;
+  atomic_store(&g_run, false);
+  pthread_join(g_writer, NULL);
+  if (g_dropped)
+    fprintf(stderr, "sync log: %u records dropped\n", g_dropped);
+  fclose(g_file);
+  g_file = NULL;
+  free(g_ring);
+  g_ring = NULL;
+}
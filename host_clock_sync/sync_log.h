@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sync log off the receive thread. The thread answering sync requests only
+// copies a fixed record into a lock-free ring, a background writer drains it
+// into a binary file of the same records, so a disk stall can't hold up a
+// response and show up in the delay measurement. sync_log_csv turns the file
+// into CSV.
+
+#define SYNC_LOG_MAGIC "SYNCLOG"
+#define SYNC_LOG_VERSION 1
+
+enum {
+  SYNC_LOG_STATS = 1,  // stats message from the node
+  SYNC_LOG_RESP = 2,   // sync request answered
+  SYNC_LOG_ATTACH = 3, // new session after HELLO, host_ns restarts
+};
+
+#pragma pack(push, 1)
+
+typedef struct {
+  char magic[8]; // SYNC_LOG_MAGIC, NUL padded
+  uint32_t version;
+  uint32_t rec_size; // sizeof(sync_log_rec_t)
+} sync_log_header_t;
+
+typedef struct {
+  uint64_t host_ns; // host time the message came in
+  uint8_t kind;     // SYNC_LOG_*
+  uint8_t reserved;
+  uint16_t seq;
+  uint32_t dropped; // records lost to a full ring before this one, total
+  // SYNC_LOG_STATS, as sent in sync_stats_t
+  int64_t offset_ns;
+  int64_t delay_ns;
+  int32_t freq_corr_ppm;
+  int32_t bus_drift_ppb;
+  int32_t host_bus_ppb;
+  int32_t sp_slack_ns;
+  uint32_t sp_late;
+  uint32_t sp_ack;
+  // SYNC_LOG_RESP: t2 - t1, how long we held the request
+  uint32_t resp_ns;
+  uint32_t reserved2;
+} sync_log_rec_t;
+
+#pragma pack(pop)
+
+// Creates the file and starts the writer thread. records is the ring size,
+// rounded up to a power of two.
+int sync_log_open(const char *path, uint32_t records);
+
+// Receive thread: never blocks, false if the ring was full and the record was
+// dropped.
+bool sync_log_push(const sync_log_rec_t *rec);
+
+// Writes out what is still queued and stops the writer
+void sync_log_close(void);
@@ -0,0 +1,126 @@
+// CSV export of the binary sync log
+//
+//   sync_log_csv sync_log.bin > sync_log.csv         stats, old CSV layout
+//   sync_log_csv --resp sync_log.bin > resp.csv      request turnaround
+//   sync_log_csv --summary sync_log.bin              delay and turnaround
+//                                                    spread
+//
+// Session restarts come out as comment lines, host_time_ns starts over from
+// 0 after each one.
+#include "sync_log.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  double *v;
+  size_t n, cap;
+} series_t;
+
+static void add(series_t *s, double x) {
+  if (s->n == s->cap) {
+    s->cap = s->cap ? 2 * s->cap : 1024;
+    s->v = realloc(s->v, s->cap * sizeof(double));
+  }
+  s->v[s->n++] = x;
+}
+
+static int cmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// The spread is what matters: the servo fits the minimum delay, everything
+// above it is noise in the offset
+static void summary(const char *name, series_t *s) {
+  if (!s->n) {
+    printf("%-9s no samples\n", name);
+    return;
+  }
+  double sum = 0, sq = 0;
+  for (size_t i = 0; i < s->n; i++)
+    sum += s->v[i];
+  double mean = sum / s->n;
+  for (size_t i = 0; i < s->n; i++)
+    sq += (s->v[i] - mean) * (s->v[i] - mean);
+  qsort(s->v, s->n, sizeof(double), cmp);
+  printf("%-9s n %6zu  min %8.0f  p50 %8.0f  p99 %8.0f  max %8.0f  "
+         "mean %8.0f  std %7.0f ns\n",
+         name, s->n, s->v[0], s->v[s->n / 2], s->v[s->n * 99 / 100],
+         s->v[s->n - 1], mean, sqrt(sq / s->n));
+}
+
+int main(int argc, char **argv) {
+  int resp = argc > 2 && strcmp(argv[1], "--resp") == 0;
+  int sum = argc > 2 && strcmp(argv[1], "--summary") == 0;
+  if (argc != 2 + resp + sum) {
+    fprintf(stderr, "usage: %s [--resp|--summary] sync_log.bin\n", argv[0]);
+    return 2;
+  }
+  int opt = resp || sum;
+  FILE *f = fopen(argv[1 + opt], "rb");
+  if (!f) {
+    perror("fopen");
+    return 1;
+  }
+
+  sync_log_header_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      strncmp(hdr.magic, SYNC_LOG_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.version != SYNC_LOG_VERSION ||
+      hdr.rec_size != sizeof(sync_log_rec_t)) {
+    fprintf(stderr, "%s: not a version %d sync log\n", argv[1 + opt],
+            SYNC_LOG_VERSION);
+    fclose(f);
+    return 1;
+  }
+
+  series_t delay = {0}, turnaround = {0};
+  if (sum)
+    ;
+  else if (resp)
+    printf("host_time_ns,seq,resp_ns\n");
+  else
+    printf("host_time_ns,seq,offset_ns,delay_ns,freq_corr_ppm,"
+           "bus_drift_ppb,host_bus_ppb,sp_slack_ns,sp_late,sp_ack\n");
+
+  sync_log_rec_t r;
+  uint32_t dropped = 0;
+  while (fread(&r, sizeof(r), 1, f) == 1) {
+    if (sum) {
+      dropped = r.dropped;
+      if (r.kind == SYNC_LOG_STATS)
+        add(&delay, (double)r.delay_ns);
+      else if (r.kind == SYNC_LOG_RESP)
+        add(&turnaround, (double)r.resp_ns);
+      continue;
+    }
+    if (r.dropped != dropped) {
+      printf("# %u records dropped\n", r.dropped - dropped);
+      dropped = r.dropped;
+    }
+    if (r.kind == SYNC_LOG_ATTACH) {
+      printf("# new session\n");
+    } else if (resp && r.kind == SYNC_LOG_RESP) {
+      printf("%llu,%u,%u\n", (unsigned long long)r.host_ns, (unsigned)r.seq,
+             (unsigned)r.resp_ns);
+    } else if (!resp && r.kind == SYNC_LOG_STATS) {
+      printf("%llu,%u,%lld,%lld,%d,%d,%d,%d,%u,%u\n",
+             (unsigned long long)r.host_ns, (unsigned)r.seq,
+             (long long)r.offset_ns, (long long)r.delay_ns,
+             (int)r.freq_corr_ppm, (int)r.bus_drift_ppb, (int)r.host_bus_ppb,
+             (int)r.sp_slack_ns, (unsigned)r.sp_late, (unsigned)r.sp_ack);
+    }
+  }
+  fclose(f);
+  if (sum) {
+    summary("delay", &delay);
+    summary("t2 - t1", &turnaround);
+    if (dropped)
+      printf("%u records dropped\n", dropped);
+  }
+  free(delay.v);
+  free(turnaround.v);
+  return 0;
+}
@@ -94,8 +94,8 @@ pub fn build(b: *std.Build) void {
         .flags = &.{},
     });
     nanopb.addIncludePath(b.path("src/proto/"));
-
-    lib.root_module.addImport("nanopb", nanopb);
+    // The library encodes with the comptime codec in src/proto.zig, nanopb
+    // stays as the reference it is tested and benchmarked against
 
     // This declares intent for the library to be installed into the standard
     // location when the user invokes the "install" step (the default step when
@@ -137,6 +137,74 @@ pub fn build(b: *std.Build) void {
 
     const run_usb_tests = b.addRunArtifact(usb_tests);
 
+    // sync wire format and estimate, no device needed
+    const clock_sync_tests = b.addTest(.{
+        .root_source_file = b.path("src/clock_sync.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_clock_sync_tests = b.addRunArtifact(clock_sync_tests);
+
+    // per-node move queues
+    const spsc_tests = b.addTest(.{
+        .root_source_file = b.path("src/spsc.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_spsc_tests = b.addRunArtifact(spsc_tests);
+
+    // pipeline latency histograms
+    const latency_tests = b.addTest(.{
+        .root_source_file = b.path("src/latency.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_latency_tests = b.addRunArtifact(latency_tests);
+
+    // telemetry packet decode and the CSV recorder
+    const telemetry_tests = b.addTest(.{
+        .root_source_file = b.path("src/telemetry.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_telemetry_tests = b.addRunArtifact(telemetry_tests);
+
+    // TMC2240 register layouts
+    const tmc2240_tests = b.addTest(.{
+        .root_source_file = b.path("src/tmc2240.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_tmc2240_tests = b.addRunArtifact(tmc2240_tests);
+
+    // comptime protobuf codec, and the same bytes as nanopb
+    const proto_tests = b.addTest(.{
+        .root_source_file = b.path("src/proto.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    const run_proto_tests = b.addRunArtifact(proto_tests);
+    const proto_nanopb_tests = b.addTest(.{
+        .root_source_file = b.path("src/test_proto.zig"),
+        .target = target,
+        .optimize = optimize,
+    });
+    proto_nanopb_tests.root_module.addImport("nanopb", nanopb);
+    proto_nanopb_tests.linkLibC();
+    const run_proto_nanopb_tests = b.addRunArtifact(proto_nanopb_tests);
+
+    const bench_proto = b.addExecutable(.{
+        .name = "bench_proto",
+        .root_source_file = b.path("src/bench_proto.zig"),
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+    bench_proto.root_module.addImport("nanopb", nanopb);
+    bench_proto.linkLibC();
+    const run_bench_proto = b.addRunArtifact(bench_proto);
+    const bench_proto_step = b.step("bench-proto", "Encode/decode ns per Cmd, comptime codec against nanopb");
+    bench_proto_step.dependOn(&run_bench_proto.step);
+
     // Similar to creating the run step earlier, this exposes a `test` step to
     // the `zig build --help` menu, providing a way for the user to request
     // running the unit tests.
@@ -144,4 +212,11 @@ pub fn build(b: *std.Build) void {
     test_step.dependOn(&run_lib_unit_tests.step);
     // _ = run_lib_unit_tests;
     test_step.dependOn(&run_usb_tests.step);
+    test_step.dependOn(&run_clock_sync_tests.step);
+    test_step.dependOn(&run_spsc_tests.step);
+    test_step.dependOn(&run_latency_tests.step);
+    test_step.dependOn(&run_telemetry_tests.step);
+    test_step.dependOn(&run_tmc2240_tests.step);
+    test_step.dependOn(&run_proto_tests.step);
+    test_step.dependOn(&run_proto_nanopb_tests.step);
 }
@@ -0,0 +1,69 @@
+const std = @import("std");
+const nanopb = @import("nanopb");
+const proto = @import("proto.zig");
+const test_proto = @import("test_proto.zig");
+
+// ns per Cmd frame, three full moves as the server sends them: the
+// comptime codec against nanopb's table driven pb_encode_ex/pb_decode_ex.
+// zig build bench-proto (ReleaseFast).
+
+const iterations = 1_000_000;
+const batches = 64; // distinct frames, cycled so the values aren't constant
+
+pub fn main() !void {
+    var prng = std.Random.DefaultPrng.init(42);
+    const r = prng.random();
+    var cmds: [batches]proto.Cmd = undefined;
+    var pbs: [batches]nanopb.Cmd = undefined;
+    for (&cmds, &pbs) |*c, *p| {
+        var m: proto.Moves = .{};
+        for (0..3) |_| {
+            var mv = test_proto.randomMove(r);
+            // every axis present, like a node driving all four
+            inline for (.{ "x", "y", "z", "e" }) |a| {
+                if (@field(mv, a) == null) @field(mv, a) = .{ .pos = 1, .vel = 2 };
+            }
+            m.move.appendAssumeCapacity(mv);
+        }
+        c.* = .{ .payload = .{ .moves = m } };
+        p.* = test_proto.toPb(c.*);
+    }
+
+    var buf: [proto.maxSize(proto.Cmd) + 2]u8 = undefined;
+    var bytes: usize = 0;
+
+    var timer = try std.time.Timer.start();
+    for (0..iterations) |i| {
+        bytes += try proto.encodeDelimited(proto.Cmd, &cmds[i % batches], &buf);
+        std.mem.doNotOptimizeAway(&buf);
+    }
+    const zig_enc = timer.lap();
+    for (0..iterations) |i| {
+        bytes += try test_proto.pbEncode(&pbs[i % batches], &buf);
+        std.mem.doNotOptimizeAway(&buf);
+    }
+    const pb_enc = timer.lap();
+
+    const n = try proto.encodeDelimited(proto.Cmd, &cmds[0], &buf);
+    _ = timer.lap();
+    for (0..iterations) |_| {
+        var used: usize = 0;
+        const c = try proto.decodeDelimited(proto.Cmd, buf[0..n], &used);
+        std.mem.doNotOptimizeAway(&c);
+    }
+    const zig_dec = timer.lap();
+    for (0..iterations) |_| {
+        const c = try test_proto.pbDecode(buf[0..n]);
+        std.mem.doNotOptimizeAway(&c);
+    }
+    const pb_dec = timer.lap();
+
+    const per = struct {
+        fn ns(t: u64) f64 {
+            return @as(f64, @floatFromInt(t)) / iterations;
+        }
+    }.ns;
+    std.debug.print("Cmd of 3 moves, {} bytes average\n", .{bytes / (2 * iterations)});
+    std.debug.print("encode  comptime {d:7.1} ns | nanopb {d:7.1} ns | x{d:.1}\n", .{ per(zig_enc), per(pb_enc), per(pb_enc) / per(zig_enc) });
+    std.debug.print("decode  comptime {d:7.1} ns | nanopb {d:7.1} ns | x{d:.1}\n", .{ per(zig_dec), per(pb_dec), per(pb_dec) / per(zig_dec) });
+}
@@ -0,0 +1,366 @@
+const std = @import("std");
+
+// Host side of the node clock sync, the same exchange host_clock_sync/main.c
+// runs but inside the server so it can share the vendor interface with the
+// motion frames. The node sends a request every 20 ms, we answer with our
+// receive and transmit times, and it answers with the stats of its servo.
+// The wire format is sync_protocol.h: packed, little endian.
+//
+// Only one process can claim the interface, so host_clock_sync can't run next
+// to the server anymore, it stays around as a standalone logger.
+
+pub const MsgType = enum(u8) {
+    req = 1, // device -> host
+    resp = 2, // host -> device
+    stats = 3, // device -> host
+    hello = 4, // host -> device
+    cmd = 5, // host -> device, a length delimited Cmd follows
+    caps = 6, // device -> host, answer to a version 2 HELLO
+    telemetry = 7, // device -> host, see telemetry.zig
+    tlm_cfg = 8, // host -> device
+    _,
+};
+
+pub const protocol_version: u32 = 2;
+
+/// Setpoint encodings, SYNC_ENC_*. A higher bit is preferred.
+pub const enc_pb: u32 = 1 << 0;
+
+/// Optional features, SYNC_FEAT_*
+pub const feat_timestamped_sp: u32 = 1 << 0;
+pub const feat_ack: u32 = 1 << 1;
+pub const feat_sof_drift: u32 = 1 << 2;
+pub const feat_telemetry: u32 = 1 << 3;
+/// We drive the motors, the node powers the bridges for the session
+pub const feat_motion: u32 = 1 << 4;
+
+/// Node sync period, see SYNC_INTERVAL_TICKS in node_sync.c
+pub const sync_interval_ns: u64 = 20 * std.time.ns_per_ms;
+/// Stats older than this and the estimate is no longer trusted
+pub const stale_ns: u64 = 10 * sync_interval_ns;
+
+pub const Req = struct {
+    seq: u16,
+    t0_ns: u64,
+
+    pub const size = 12;
+
+    pub fn decode(buf: []const u8) ?Req {
+        if (buf.len != size or buf[0] != @intFromEnum(MsgType.req)) return null;
+        return .{
+            .seq = std.mem.readInt(u16, buf[2..4], .little),
+            .t0_ns = std.mem.readInt(u64, buf[4..12], .little),
+        };
+    }
+
+    pub fn encode(self: Req, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(MsgType.req);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], self.seq, .little);
+        std.mem.writeInt(u64, buf[4..12], self.t0_ns, .little);
+    }
+};
+
+pub const Resp = struct {
+    seq: u16,
+    t1_ns: u64,
+    t2_ns: u64,
+
+    pub const size = 20;
+
+    pub fn decode(buf: []const u8) ?Resp {
+        if (buf.len != size or buf[0] != @intFromEnum(MsgType.resp)) return null;
+        return .{
+            .seq = std.mem.readInt(u16, buf[2..4], .little),
+            .t1_ns = std.mem.readInt(u64, buf[4..12], .little),
+            .t2_ns = std.mem.readInt(u64, buf[12..20], .little),
+        };
+    }
+
+    pub fn encode(self: Resp, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(MsgType.resp);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], self.seq, .little);
+        std.mem.writeInt(u64, buf[4..12], self.t1_ns, .little);
+        std.mem.writeInt(u64, buf[12..20], self.t2_ns, .little);
+    }
+};
+
+/// What we can do, the node picks from both and answers with Caps
+pub const Hello = struct {
+    version: u32 = protocol_version,
+    encodings: u32 = enc_pb,
+    features: u32 = 0,
+    max_batch: u16 = 1,
+
+    pub const size = 20;
+    /// version 1 HELLO, the node answers it with the version 1 defaults
+    pub const v1_size = 8;
+
+    pub fn encode(self: Hello, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(MsgType.hello);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], 0, .little);
+        std.mem.writeInt(u32, buf[4..8], self.version, .little);
+        std.mem.writeInt(u32, buf[8..12], self.encodings, .little);
+        std.mem.writeInt(u32, buf[12..16], self.features, .little);
+        std.mem.writeInt(u16, buf[16..18], self.max_batch, .little);
+        std.mem.writeInt(u16, buf[18..20], 0, .little);
+    }
+};
+
+/// The node's capabilities and the configuration it picked, sent with
+/// encoding and batch from here on
+pub const Caps = struct {
+    version: u32,
+    encodings: u32,
+    features: u32,
+    max_batch: u16,
+    sp_buffer: u16, // setpoints the jitter buffer holds
+    max_rate_hz: u32, // one setpoint per scheduler tick
+    ep_out_size: u16,
+    ep_in_size: u16,
+    encoding: u32, // one enc_* bit, 0 if there is none in common
+    features_on: u32,
+    batch: u16,
+
+    pub const size = 40;
+
+    pub fn decode(buf: []const u8) ?Caps {
+        if (buf.len != size or buf[0] != @intFromEnum(MsgType.caps)) return null;
+        return .{
+            .version = std.mem.readInt(u32, buf[4..8], .little),
+            .encodings = std.mem.readInt(u32, buf[8..12], .little),
+            .features = std.mem.readInt(u32, buf[12..16], .little),
+            .max_batch = std.mem.readInt(u16, buf[16..18], .little),
+            .sp_buffer = std.mem.readInt(u16, buf[18..20], .little),
+            .max_rate_hz = std.mem.readInt(u32, buf[20..24], .little),
+            .ep_out_size = std.mem.readInt(u16, buf[24..26], .little),
+            .ep_in_size = std.mem.readInt(u16, buf[26..28], .little),
+            .encoding = std.mem.readInt(u32, buf[28..32], .little),
+            .features_on = std.mem.readInt(u32, buf[32..36], .little),
+            .batch = std.mem.readInt(u16, buf[36..38], .little),
+        };
+    }
+
+    pub fn encode(self: Caps, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(MsgType.caps);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], 0, .little);
+        std.mem.writeInt(u32, buf[4..8], self.version, .little);
+        std.mem.writeInt(u32, buf[8..12], self.encodings, .little);
+        std.mem.writeInt(u32, buf[12..16], self.features, .little);
+        std.mem.writeInt(u16, buf[16..18], self.max_batch, .little);
+        std.mem.writeInt(u16, buf[18..20], self.sp_buffer, .little);
+        std.mem.writeInt(u32, buf[20..24], self.max_rate_hz, .little);
+        std.mem.writeInt(u16, buf[24..26], self.ep_out_size, .little);
+        std.mem.writeInt(u16, buf[26..28], self.ep_in_size, .little);
+        std.mem.writeInt(u32, buf[28..32], self.encoding, .little);
+        std.mem.writeInt(u32, buf[32..36], self.features_on, .little);
+        std.mem.writeInt(u16, buf[36..38], self.batch, .little);
+        std.mem.writeInt(u16, buf[38..40], 0, .little);
+    }
+};
+
+pub const Stats = struct {
+    seq: u16,
+    offset_ns: i64, // host - node, from the node's fit
+    delay_ns: i64,
+    freq_corr_ppm: i32,
+    bus_drift_ppb: i32,
+    host_bus_ppb: i32,
+    sp_slack_ns: i32, // least setpoint slack since the last stats
+    sp_late: u32, // setpoints that missed their tick, total
+    sp_ack: u32, // seq + 1 of the last setpoint the node ran, 0 for none
+
+    pub const size = 44;
+
+    pub fn decode(buf: []const u8) ?Stats {
+        if (buf.len != size or buf[0] != @intFromEnum(MsgType.stats)) return null;
+        return .{
+            .seq = std.mem.readInt(u16, buf[2..4], .little),
+            .offset_ns = std.mem.readInt(i64, buf[4..12], .little),
+            .delay_ns = std.mem.readInt(i64, buf[12..20], .little),
+            .freq_corr_ppm = std.mem.readInt(i32, buf[20..24], .little),
+            .bus_drift_ppb = std.mem.readInt(i32, buf[24..28], .little),
+            .host_bus_ppb = std.mem.readInt(i32, buf[28..32], .little),
+            .sp_slack_ns = std.mem.readInt(i32, buf[32..36], .little),
+            .sp_late = std.mem.readInt(u32, buf[36..40], .little),
+            .sp_ack = std.mem.readInt(u32, buf[40..44], .little),
+        };
+    }
+
+    pub fn encode(self: Stats, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(MsgType.stats);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], self.seq, .little);
+        std.mem.writeInt(i64, buf[4..12], self.offset_ns, .little);
+        std.mem.writeInt(i64, buf[12..20], self.delay_ns, .little);
+        std.mem.writeInt(i32, buf[20..24], self.freq_corr_ppm, .little);
+        std.mem.writeInt(i32, buf[24..28], self.bus_drift_ppb, .little);
+        std.mem.writeInt(i32, buf[28..32], self.host_bus_ppb, .little);
+        std.mem.writeInt(i32, buf[32..36], self.sp_slack_ns, .little);
+        std.mem.writeInt(u32, buf[36..40], self.sp_late, .little);
+        std.mem.writeInt(u32, buf[40..44], self.sp_ack, .little);
+    }
+};
+
+/// CLOCK_MONOTONIC_RAW from the last HELLO, the node zeroes its clock on the
+/// same message so both start near 0. Same clock as host_time.c.
+pub const HostClock = struct {
+    origin_ns: u64 = 0,
+
+    pub fn raw() u64 {
+        const ts = std.posix.clock_gettime(std.posix.CLOCK.MONOTONIC_RAW) catch unreachable;
+        return @as(u64, @intCast(ts.sec)) * std.time.ns_per_s + @as(u64, @intCast(ts.nsec));
+    }
+
+    pub fn zero(self: *HostClock) void {
+        self.origin_ns = raw();
+    }
+
+    pub fn now(self: *const HostClock) u64 {
+        return raw() -% self.origin_ns;
+    }
+};
+
+/// The node's view of the link as of its last stats message.
+pub const Estimate = struct {
+    seq: u16 = 0,
+    host_ns: u64 = 0, // when the stats arrived
+    offset_ns: i64 = 0,
+    delay_ns: i64 = 0,
+    freq_corr_ppm: i32 = 0,
+    bus_drift_ppb: i32 = 0,
+    host_bus_ppb: i32 = 0,
+    sp_slack_ns: i32 = std.math.maxInt(i32),
+    sp_late: u32 = 0,
+    sp_ack: u32 = 0,
+
+    /// Node time at host time `host_ns`. The node servo steers its clock onto
+    /// ours, so the remaining offset is all there is to take out.
+    pub fn hostToNode(self: Estimate, host_ns: u64) i64 {
+        return @as(i64, @intCast(host_ns)) - self.offset_ns;
+    }
+};
+
+/// Shared between the receive thread, which answers requests and takes the
+/// stats, and the motion sender, which reads the estimate.
+pub const ClockSync = struct {
+    clock: HostClock = .{},
+    running: std.atomic.Value(bool) = std.atomic.Value(bool).init(false),
+
+    mutex: std.Thread.Mutex = .{},
+    est: Estimate = .{},
+    valid: bool = false,
+    caps: ?Caps = null, // null until the node answers the HELLO
+
+    // receive thread only
+    requests: usize = 0,
+    stats: usize = 0,
+    unknown: usize = 0,
+    send_errors: usize = 0,
+    recv_errors: usize = 0,
+
+    /// HELLO went out: restart our clock and forget the old estimate, the
+    /// node has zeroed its side too.
+    pub fn onHello(self: *ClockSync) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.clock.zero();
+        self.est = .{};
+        self.valid = false;
+        self.caps = null;
+    }
+
+    pub fn onCaps(self: *ClockSync, c: Caps) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.caps = c;
+    }
+
+    /// The configuration the node picked, null if it hasn't answered (yet)
+    pub fn getCaps(self: *ClockSync) ?Caps {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        return self.caps;
+    }
+
+    pub fn onStats(self: *ClockSync, s: Stats, host_ns: u64) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.est = .{
+            .seq = s.seq,
+            .host_ns = host_ns,
+            .offset_ns = s.offset_ns,
+            .delay_ns = s.delay_ns,
+            .freq_corr_ppm = s.freq_corr_ppm,
+            .bus_drift_ppb = s.bus_drift_ppb,
+            .host_bus_ppb = s.host_bus_ppb,
+            .sp_slack_ns = s.sp_slack_ns,
+            .sp_late = s.sp_late,
+            .sp_ack = s.sp_ack,
+        };
+        self.valid = true;
+        self.stats += 1;
+    }
+
+    /// The estimate, or null if the node hasn't reported within stale_ns of
+    /// `now_ns`.
+    pub fn estimate(self: *ClockSync, now_ns: u64) ?Estimate {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        if (!self.valid or now_ns -% self.est.host_ns > stale_ns) return null;
+        return self.est;
+    }
+};
+
+test "wire layout matches sync_protocol.h" {
+    var req_buf: [Req.size]u8 = undefined;
+    (Req{ .seq = 0x0102, .t0_ns = 0x1122334455667788 }).encode(&req_buf);
+    try std.testing.expectEqualSlices(u8, &.{ 1, 0, 0x02, 0x01, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11 }, &req_buf);
+    const req = Req.decode(&req_buf).?;
+    try std.testing.expectEqual(@as(u16, 0x0102), req.seq);
+    try std.testing.expectEqual(@as(u64, 0x1122334455667788), req.t0_ns);
+
+    var resp_buf: [Resp.size]u8 = undefined;
+    const resp: Resp = .{ .seq = 7, .t1_ns = 1000, .t2_ns = 1250 };
+    resp.encode(&resp_buf);
+    try std.testing.expectEqual(resp, Resp.decode(&resp_buf).?);
+
+    var hello_buf: [Hello.size]u8 = undefined;
+    (Hello{ .features = feat_ack | feat_sof_drift, .max_batch = 3 }).encode(&hello_buf);
+    try std.testing.expectEqualSlices(u8, &.{ 4, 0, 0, 0, 2, 0, 0, 0, 1, 0, 0, 0, 6, 0, 0, 0, 3, 0, 0, 0 }, &hello_buf);
+
+    var caps_buf: [Caps.size]u8 = undefined;
+    const caps: Caps = .{ .version = 2, .encodings = enc_pb, .features = 7, .max_batch = 3, .sp_buffer = 64, .max_rate_hz = 1000, .ep_out_size = 512, .ep_in_size = 512, .encoding = enc_pb, .features_on = feat_ack, .batch = 3 };
+    caps.encode(&caps_buf);
+    try std.testing.expectEqualSlices(u8, &.{ 6, 0, 0, 0, 2, 0, 0, 0 }, caps_buf[0..8]);
+    try std.testing.expectEqualSlices(u8, &.{ 0xe8, 0x03, 0, 0, 0, 2, 0, 2 }, caps_buf[20..28]);
+    try std.testing.expectEqualSlices(u8, &.{ 3, 0, 0, 0 }, caps_buf[36..40]);
+    try std.testing.expectEqual(caps, Caps.decode(&caps_buf).?);
+
+    var stats_buf: [Stats.size]u8 = undefined;
+    const stats: Stats = .{ .seq = 9, .offset_ns = -12345, .delay_ns = 80000, .freq_corr_ppm = -3, .bus_drift_ppb = 1500, .host_bus_ppb = -42, .sp_slack_ns = -250000, .sp_late = 17, .sp_ack = 123456 };
+    stats.encode(&stats_buf);
+    try std.testing.expectEqual(stats, Stats.decode(&stats_buf).?);
+
+    // wrong length or type is not a sync message
+    try std.testing.expectEqual(@as(?Req, null), Req.decode(req_buf[0 .. Req.size - 1]));
+    var bad = stats_buf;
+    bad[0] = @intFromEnum(MsgType.resp);
+    try std.testing.expectEqual(@as(?Stats, null), Stats.decode(&bad));
+}
+
+test "estimate goes stale" {
+    var sync: ClockSync = .{};
+    try std.testing.expectEqual(@as(?Estimate, null), sync.estimate(0));
+
+    sync.onStats(.{ .seq = 1, .offset_ns = 2500, .delay_ns = 60000, .freq_corr_ppm = 0, .bus_drift_ppb = 0, .host_bus_ppb = 0, .sp_slack_ns = 0, .sp_late = 0, .sp_ack = 0 }, 1_000_000_000);
+    const est = sync.estimate(1_000_000_000 + stale_ns).?;
+    try std.testing.expectEqual(@as(i64, 1_000_000_000 - 2500), est.hostToNode(1_000_000_000));
+    try std.testing.expectEqual(@as(?Estimate, null), sync.estimate(1_000_000_000 + stale_ns + 1));
+
+    sync.onHello();
+    try std.testing.expectEqual(@as(?Estimate, null), sync.estimate(sync.clock.now()));
+}
@@ -0,0 +1,259 @@
+const std = @import("std");
+
+// Latency of each stage of the send pipeline, from Prunt calling
+// enqueue_command() to the OUT transfer carrying the move completing, in
+// HDR-style histograms: every power of two is split into 32 buckets, so a
+// value reads back within 1/32 of what was recorded (exact below 64 ns) from
+// 1 ns to 68 s in 1024 buckets. Recording is two relaxed atomic adds and a
+// max, no lock, so the Ada thread, the node send threads and libusb's
+// completion callbacks record into the same histograms as they go.
+
+const Counter = std.atomic.Value(u64);
+
+const sub_bits = 5;
+const sub_count = 1 << sub_bits;
+// values are clamped below 2^max_bits ns
+const max_bits = 36;
+const max_value: u64 = (1 << max_bits) - 1;
+pub const bucket_count = (max_bits - sub_bits + 1) * sub_count;
+
+fn bucketOf(ns: u64) usize {
+    const v = @min(ns, max_value);
+    const msb: u6 = @intCast(63 - @clz(v | 1));
+    const shift: u6 = if (msb > sub_bits) msb - sub_bits else 0;
+    return (@as(usize, shift) << sub_bits) + @as(usize, @intCast(v >> shift));
+}
+
+/// Smallest value that lands in bucket `i`
+fn bucketLow(i: usize) u64 {
+    if (i < 2 * sub_count) return i;
+    const shift: u6 = @intCast((i >> sub_bits) - 1);
+    return @as(u64, i - (@as(usize, shift) << sub_bits)) << shift;
+}
+
+/// Largest value that lands in bucket `i`, what percentiles report
+fn bucketHigh(i: usize) u64 {
+    return if (i + 1 == bucket_count) max_value else bucketLow(i + 1) - 1;
+}
+
+/// Raw host time, CLOCK_MONOTONIC_RAW like clock_sync.HostClock so stamps
+/// taken anywhere in the pipeline compare
+pub fn now() u64 {
+    const ts = std.posix.clock_gettime(std.posix.CLOCK.MONOTONIC_RAW) catch unreachable;
+    return @as(u64, @intCast(ts.sec)) * std.time.ns_per_s + @as(u64, @intCast(ts.nsec));
+}
+
+pub const Histogram = struct {
+    counts: [bucket_count]Counter = [_]Counter{Counter.init(0)} ** bucket_count,
+    sum_ns: Counter = Counter.init(0),
+    max_ns: Counter = Counter.init(0),
+
+    pub fn record(self: *Histogram, ns: u64) void {
+        _ = self.counts[bucketOf(ns)].fetchAdd(1, .monotonic);
+        _ = self.sum_ns.fetchAdd(ns, .monotonic);
+        // the max only moves early on, most records get away with the load
+        if (ns > self.max_ns.load(.monotonic)) _ = self.max_ns.fetchMax(ns, .monotonic);
+    }
+
+    /// A snapshot. Records that land while it is taken may or may not be in
+    /// it, the counts stay consistent with each other either way.
+    pub fn stats(self: *const Histogram) StageStats {
+        var counts: [bucket_count]u64 = undefined;
+        var total: u64 = 0;
+        for (&counts, &self.counts) |*c, *src| {
+            c.* = src.load(.monotonic);
+            total += c.*;
+        }
+        var out: StageStats = .{ .count = total };
+        if (total == 0) return out;
+        const max_ns = self.max_ns.load(.monotonic);
+        out.max_ns = max_ns;
+        out.mean_ns = self.sum_ns.load(.monotonic) / total;
+
+        const pcts = [_]struct { num: u64, den: u64, field: *u64 }{
+            .{ .num = 50, .den = 100, .field = &out.p50_ns },
+            .{ .num = 90, .den = 100, .field = &out.p90_ns },
+            .{ .num = 99, .den = 100, .field = &out.p99_ns },
+            .{ .num = 999, .den = 1000, .field = &out.p999_ns },
+        };
+        var next: usize = 0;
+        var seen: u64 = 0;
+        var min_set = false;
+        for (counts, 0..) |c, i| {
+            if (c == 0) continue;
+            if (!min_set) {
+                out.min_ns = bucketLow(i);
+                min_set = true;
+            }
+            seen += c;
+            // the first value at or past the rank, rounded up like HdrHistogram
+            while (next < pcts.len and seen * pcts[next].den >= total * pcts[next].num) : (next += 1)
+                pcts[next].field.* = @min(bucketHigh(i), max_ns);
+        }
+        return out;
+    }
+
+    pub fn reset(self: *Histogram) void {
+        for (&self.counts) |*c| c.store(0, .monotonic);
+        self.sum_ns.store(0, .monotonic);
+        self.max_ns.store(0, .monotonic);
+    }
+};
+
+pub const Stage = enum(u8) {
+    queue, // enqueue_command() to a node's send thread taking the move
+    derive, // the four derivators in enqueue_command()
+    encode, // Cmd frame into its transfer buffer
+    transfer, // OUT transfer submitted to completed
+    end_to_end, // enqueue_command() to the completion of the frame carrying
+    // the oldest move in it
+};
+pub const stage_count = @typeInfo(Stage).@"enum".fields.len;
+
+/// One stage as get_pipeline_stats() hands it out, in ns
+pub const StageStats = extern struct {
+    count: u64 = 0,
+    min_ns: u64 = 0,
+    mean_ns: u64 = 0,
+    p50_ns: u64 = 0,
+    p90_ns: u64 = 0,
+    p99_ns: u64 = 0,
+    p999_ns: u64 = 0,
+    max_ns: u64 = 0,
+};
+
+/// get_pipeline_stats(), all u64 so the Ada record is a plain array of
+/// Unsigned_64. Stages in Stage order.
+pub const PipelineStats = extern struct {
+    stage: [stage_count]StageStats = .{StageStats{}} ** stage_count,
+    queue_hwm: u64 = 0, // most moves any node's queue has held
+    queue_capacity: u64 = 0,
+    in_flight_hwm: u64 = 0, // most OUT transfers any node had in flight
+    in_flight_capacity: u64 = 0,
+    queue_full: u64 = 0, // enqueues that found a queue full and waited
+    dropped: u64 = 0, // moves dropped on the host, never sent
+    send_errors: u64 = 0, // frames that failed to go out
+    transfer_errors: u64 = 0, // OUT transfers that completed with an error
+    timeline_restarts: u64 = 0, // moves too late for their time, see node.Timeline
+};
+
+/// The server's, shared by every thread of the pipeline
+pub const Pipeline = struct {
+    hist: [stage_count]Histogram = .{Histogram{}} ** stage_count,
+    queue_hwm: Counter = Counter.init(0),
+    in_flight_hwm: Counter = Counter.init(0),
+    queue_full: Counter = Counter.init(0),
+    dropped: Counter = Counter.init(0),
+    send_errors: Counter = Counter.init(0),
+    transfer_errors: Counter = Counter.init(0),
+
+    pub fn record(self: *Pipeline, stage: Stage, ns: u64) void {
+        self.hist[@intFromEnum(stage)].record(ns);
+    }
+
+    /// From a stamp taken with now() until now
+    pub fn since(self: *Pipeline, stage: Stage, t0: u64) void {
+        self.record(stage, now() -| t0);
+    }
+
+    pub fn count(_: *Pipeline, counter: *Counter, n: u64) void {
+        _ = counter.fetchAdd(n, .monotonic);
+    }
+
+    pub fn highWater(_: *Pipeline, mark: *Counter, v: u64) void {
+        if (v > mark.load(.monotonic)) _ = mark.fetchMax(v, .monotonic);
+    }
+
+    /// Everything but the capacities and timeline_restarts, which the
+    /// server knows
+    pub fn snapshot(self: *const Pipeline) PipelineStats {
+        var out: PipelineStats = .{};
+        for (&out.stage, &self.hist) |*s, *h| s.* = h.stats();
+        out.queue_hwm = self.queue_hwm.load(.monotonic);
+        out.in_flight_hwm = self.in_flight_hwm.load(.monotonic);
+        out.queue_full = self.queue_full.load(.monotonic);
+        out.dropped = self.dropped.load(.monotonic);
+        out.send_errors = self.send_errors.load(.monotonic);
+        out.transfer_errors = self.transfer_errors.load(.monotonic);
+        return out;
+    }
+
+    pub fn log(self: *const Pipeline) void {
+        const s = self.snapshot();
+        inline for (@typeInfo(Stage).@"enum".fields, 0..) |f, i| {
+            const st = s.stage[i];
+            if (st.count > 0)
+                std.log.info("{s:>10}: {} samples, p50 {} p99 {} p99.9 {} max {} ns", .{ f.name, st.count, st.p50_ns, st.p99_ns, st.p999_ns, st.max_ns });
+        }
+        std.log.info("queue high water {}, {} full, {} dropped, {} send errors, {} transfer errors", .{ s.queue_hwm, s.queue_full, s.dropped, s.send_errors, s.transfer_errors });
+    }
+};
+
+test "buckets cover the range in order" {
+    var last: usize = 0;
+    var v: u64 = 0;
+    while (v < max_value) : (v = v + 1 + v / 7) {
+        const i = bucketOf(v);
+        try std.testing.expect(i >= last and i < bucket_count);
+        try std.testing.expect(bucketLow(i) <= v and v <= bucketHigh(i));
+        // within 1/32 of the value
+        try std.testing.expect(bucketHigh(i) - bucketLow(i) <= v / sub_count);
+        last = i;
+    }
+    try std.testing.expectEqual(bucket_count - 1, bucketOf(std.math.maxInt(u64)));
+    for (1..bucket_count) |i| try std.testing.expectEqual(bucketHigh(i - 1) + 1, bucketLow(i));
+}
+
+test "percentiles of a known distribution" {
+    var h: Histogram = .{};
+    // 1..10000 us, uniform
+    for (1..10001) |k| h.record(k * std.time.ns_per_us);
+    const s = h.stats();
+    try std.testing.expectEqual(@as(u64, 10000), s.count);
+    try std.testing.expectEqual(@as(u64, 10000 * std.time.ns_per_us), s.max_ns);
+    try std.testing.expectEqual(@as(u64, 5000500), s.mean_ns);
+    const within = struct {
+        fn f(got: u64, want: u64) !void {
+            try std.testing.expect(got >= want and got - want <= want / sub_count);
+        }
+    }.f;
+    try std.testing.expect(s.min_ns <= std.time.ns_per_us and std.time.ns_per_us - s.min_ns <= std.time.ns_per_us / sub_count);
+    try within(s.p50_ns, 5000 * std.time.ns_per_us);
+    try within(s.p90_ns, 9000 * std.time.ns_per_us);
+    try within(s.p99_ns, 9900 * std.time.ns_per_us);
+    try within(s.p999_ns, 9990 * std.time.ns_per_us);
+
+    h.reset();
+    try std.testing.expectEqual(@as(u64, 0), h.stats().count);
+}
+
+test "one outlier shows in p99.9 and max only" {
+    var h: Histogram = .{};
+    // exact below 64 ns
+    for (0..999) |_| h.record(40);
+    h.record(50 * std.time.ns_per_ms);
+    const s = h.stats();
+    try std.testing.expectEqual(@as(u64, 40), s.p50_ns);
+    try std.testing.expectEqual(@as(u64, 40), s.p99_ns);
+    try std.testing.expectEqual(@as(u64, 40), s.p999_ns);
+    try std.testing.expectEqual(@as(u64, 50 * std.time.ns_per_ms), s.max_ns);
+    h.record(50 * std.time.ns_per_ms);
+    try std.testing.expectEqual(@as(u64, 50 * std.time.ns_per_ms), h.stats().p999_ns);
+}
+
+test "records from several threads all count" {
+    var p: Pipeline = .{};
+    const worker = struct {
+        fn run(pl: *Pipeline) void {
+            for (0..100_000) |k| pl.record(.encode, k % 5000);
+            pl.highWater(&pl.queue_hwm, 17);
+        }
+    };
+    var threads: [4]std.Thread = undefined;
+    for (&threads) |*t| t.* = try std.Thread.spawn(.{}, worker.run, .{&p});
+    for (threads) |t| t.join();
+    const s = p.snapshot();
+    try std.testing.expectEqual(@as(u64, 400_000), s.stage[@intFromEnum(Stage.encode)].count);
+    try std.testing.expectEqual(@as(u64, 4999), s.stage[@intFromEnum(Stage.encode)].max_ns);
+    try std.testing.expectEqual(@as(u64, 17), s.queue_hwm);
+}
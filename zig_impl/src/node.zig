@@ -0,0 +1,486 @@
+const std = @import("std");
+const types = @import("types.zig");
+const Transport = @import("transport.zig");
+const clock_sync = @import("clock_sync.zig");
+const spsc = @import("spsc.zig");
+const usb = @import("usb.zig");
+const telemetry = @import("telemetry.zig");
+const latency = @import("latency.zig");
+
+// One board on the bus. Each node drives a subset of the axes, has its own
+// transport, sync session and send thread, and gets every move through its
+// own SPSC ring, so a slow or busy board only ever holds up its own axes.
+// What keeps the axes on different boards together is the shared Timeline:
+// every node stamps sample n for the same host instant, converted into its
+// own clock through its own sync estimate.
+
+/// How far ahead of the node clock moves are stamped, the node's jitter
+/// buffer has to cover the USB and host scheduling jitter with this much
+pub const setpoint_lead_ns: u64 = 5 * std.time.ns_per_ms;
+/// A move that can't get at least this much lead starts a new timeline
+pub const setpoint_min_lead_ns: u64 = 1 * std.time.ns_per_ms;
+
+/// Boards have two bridges, see MOTOR_COUNT
+pub const axes_per_node = 2;
+
+pub const Sample = struct {
+    seq: u64, // same number on every node
+    move: types.MoveCmd,
+    enq_ns: u64 = 0, // latency.now() when enqueue_command() got it
+};
+
+pub const MoveRing = spsc.SpscRing(Sample);
+
+/// Raw host time (CLOCK_MONOTONIC_RAW, not zeroed) of every sample, one per
+/// Ts from sample seq0 at t0. Shared by all nodes.
+pub const Timeline = struct {
+    mutex: std.Thread.Mutex = .{},
+    started: bool = false,
+    seq0: u64 = 0,
+    t0_raw_ns: u64 = 0,
+    ts_ns: u64,
+    restarts: usize = 0,
+
+    /// Synchronized start: sample `seq` runs at `t0_raw_ns` on every node.
+    pub fn start(self: *Timeline, seq: u64, t0_raw_ns: u64) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.seq0 = seq;
+        self.t0_raw_ns = t0_raw_ns;
+        self.started = true;
+    }
+
+    fn targetLocked(self: *const Timeline, seq: u64) u64 {
+        if (seq >= self.seq0) return self.t0_raw_ns + (seq - self.seq0) * self.ts_ns;
+        return self.t0_raw_ns -| (self.seq0 - seq) * self.ts_ns;
+    }
+
+    /// Raw host time of sample `seq`, null until started. If it can no
+    /// longer go out with setpoint_min_lead_ns to spare, the timeline starts
+    /// over one lead out from `now_raw_ns` at this sample, for every node. A
+    /// node still behind that sample sends its older ones late.
+    pub fn target(self: *Timeline, seq: u64, now_raw_ns: u64) ?u64 {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        if (!self.started) return null;
+        const t = self.targetLocked(seq);
+        if (seq >= self.seq0 and t < now_raw_ns + setpoint_min_lead_ns) {
+            self.seq0 = seq;
+            self.t0_raw_ns = now_raw_ns + setpoint_lead_ns;
+            self.restarts += 1;
+            return self.t0_raw_ns;
+        }
+        return t;
+    }
+};
+
+/// Samples kept after sending for a reattaching node to resume from, well
+/// over the lead plus one stats interval at the smallest Ts
+pub const replay_len = 1024;
+/// Telemetry samples a node's ring holds for the server, 4 s at full rate
+pub const telemetry_ring_len = 4096;
+/// How often a detached node looks for its board without a hotplug event
+const attach_poll_ns: u64 = 250 * std.time.ns_per_ms;
+
+const vid = 0xcafe;
+const pid = 0x4011;
+
+pub const Node = struct {
+    index: usize,
+    axes: types.DeviceConfig,
+    axis_idx: [4]i32, // motor index on this board of X, Y, Z, E, -1 if not here
+    timestep: f32,
+    // board this node drives, empty until the first board to show up is
+    // adopted when no serial was given
+    serial_buf: [usb.max_serial_len]u8 = undefined,
+    serial_len: usize = 0,
+    queue: MoveRing,
+    thread: ?std.Thread = null,
+    sent: usize = 0,
+    frames: usize = 0,
+    reattaches: usize = 0,
+    batch: usize = 1, // moves per frame, from the node's Caps
+    lat: ?*latency.Pipeline = null, // the server's, set before the thread starts
+
+    // send thread only: the link comes and goes under it
+    transport: Transport.USBTransport = undefined,
+    attached: bool = false,
+    sync: clock_sync.ClockSync = .{},
+    sync_thread: ?std.Thread = null,
+    last_attach_ns: u64 = 0,
+    resume_pending: bool = false, // replay from the ack in the first stats
+    // the node can't take our setpoints: it stays detached, its moves hold,
+    // until a board is plugged in again
+    failed: bool = false,
+
+    // sent samples, seq n at n % replay_len, [hist_lo, hist_hi) valid
+    history: []Sample,
+    hist_lo: u64 = 0,
+    hist_hi: u64 = 0,
+    resend: u64 = 0, // next to send again, hist_hi when not replaying
+
+    // filled by the receive thread, drained by the server
+    telemetry: telemetry.Stream,
+    // channels << 16 | decimation, set from any thread; the send thread
+    // sends it when it changes and after every HELLO, which turns it off
+    tlm_cfg: std.atomic.Value(u64) = std.atomic.Value(u64).init(0),
+    tlm_cfg_sent: ?u64 = null,
+
+    // set from the hotplug thread
+    location: std.atomic.Value(u16) = std.atomic.Value(u16).init(0),
+    gone: std.atomic.Value(bool) = std.atomic.Value(bool).init(false),
+    arrived: std.atomic.Value(bool) = std.atomic.Value(bool).init(false),
+
+    /// The board is opened by the send thread, so a node whose board isn't
+    /// plugged in yet still starts and picks it up when it appears.
+    pub fn init(self: *Node, gpa: std.mem.Allocator, index: usize, serial: []const u8, axis_idx: [4]i32, timestep: f32, queue_len: usize) !void {
+        var axes: types.DeviceConfig = .{};
+        for (axis_idx, 0..) |idx, a| {
+            if (idx >= 0) axes.set(@enumFromInt(a));
+        }
+        self.* = .{
+            .index = index,
+            .axes = axes,
+            .axis_idx = axis_idx,
+            .timestep = timestep,
+            .queue = try MoveRing.init(gpa, queue_len),
+            .history = undefined,
+            .telemetry = undefined,
+        };
+        errdefer self.queue.deinit(gpa);
+        self.history = try gpa.alloc(Sample, replay_len);
+        errdefer gpa.free(self.history);
+        self.telemetry = try telemetry.Stream.init(gpa, @intCast(index), telemetry_ring_len);
+        self.serial_len = @min(serial.len, self.serial_buf.len);
+        @memcpy(self.serial_buf[0..self.serial_len], serial[0..self.serial_len]);
+    }
+
+    pub fn serial(self: *const Node) []const u8 {
+        return self.serial_buf[0..self.serial_len];
+    }
+
+    /// Open the board, configure it and start its sync session. HELLO flushes
+    /// the node's jitter buffer, what it held is sent again from the ack.
+    fn attach(self: *Node) !void {
+        if (self.serial_len == 0) {
+            var t = try Transport.USBTransport.initIndex(pid, vid, 0);
+            errdefer t.deinit();
+            const desc = try t.dev.getDeviceDescriptor();
+            const sn = try t.dev.getStringDescriptorAscii(desc.serial_number_str_index, &self.serial_buf);
+            self.serial_len = sn.len;
+            self.transport = t;
+            std.log.info("node {}: adopted board {s}", .{ self.index, self.serial() });
+        } else {
+            self.transport = try Transport.USBTransport.initSerial(pid, vid, self.serial());
+        }
+        errdefer self.transport.deinit();
+        self.transport.lat = self.lat;
+        try self.transport.start_pool();
+        const loc = self.transport.location();
+        self.location.store(@as(u16, loc.bus) << 8 | loc.address, .release);
+        self.gone.store(false, .release);
+
+        try self.transport.send_config_system(self.timestep, self.axis_idx);
+        try self.transport.send_hello(&self.sync);
+        self.telemetry.restart();
+        self.tlm_cfg_sent = null;
+        self.sync.running.store(true, .release);
+        self.sync_thread = std.Thread.spawn(.{}, Transport.USBTransport.recv_loop, .{ &self.transport, &self.sync, &self.telemetry }) catch |err| {
+            self.sync.running.store(false, .release);
+            return err;
+        };
+        self.attached = true;
+        self.resume_pending = self.hist_hi > 0;
+    }
+
+    fn detach(self: *Node) void {
+        if (!self.attached) return;
+        self.sync.running.store(false, .release);
+        if (self.sync_thread) |t| t.join();
+        self.sync_thread = null;
+        self.transport.deinit();
+        self.location.store(0, .release);
+        self.attached = false;
+    }
+
+    /// Hotplug thread: the board at `loc` went away.
+    pub fn onLeft(self: *Node, loc: usb.DeviceLocation) void {
+        if (self.location.load(.acquire) == @as(u16, loc.bus) << 8 | loc.address)
+            self.gone.store(true, .release);
+    }
+
+    /// Hotplug thread: some board arrived, look for ours now.
+    pub fn onArrived(self: *Node) void {
+        self.arrived.store(true, .release);
+    }
+
+    /// The node's first stats after a reattach: resend what it hadn't run
+    /// yet. `ack` is seq + 1 of the last sample it ran, in 32 bits.
+    fn resumeFrom(self: *Node, ack: u32) void {
+        self.resume_pending = false;
+        const behind: u64 = @as(u32, @truncate(self.hist_hi)) -% ack;
+        if (ack == 0 or behind > self.hist_hi - self.hist_lo) {
+            // rebooted, or ran something we no longer have: nothing to resume
+            std.log.warn("node {}: ack {} outside the last {} samples, not resending", .{ self.index, ack, self.hist_hi - self.hist_lo });
+            return;
+        }
+        self.resend = self.hist_hi - behind;
+        std.log.info("node {}: resuming from sample {}, {} to resend", .{ self.index, self.resend, behind });
+    }
+
+    /// Next sample to send: the replay first, then the queue. Null if there
+    /// is none.
+    fn next(self: *Node) ?Sample {
+        if (self.resend < self.hist_hi) return self.history[self.resend % replay_len];
+        const s = self.queue.peek() orelse return null;
+        return s.*;
+    }
+
+    fn consume(self: *Node, sample: Sample) void {
+        if (self.resend < self.hist_hi) {
+            self.resend += 1;
+            return;
+        }
+        _ = self.queue.pop();
+        if (self.lat) |lat| {
+            if (sample.enq_ns != 0) lat.since(.queue, sample.enq_ns);
+        }
+        if (self.hist_hi == 0) self.hist_lo = sample.seq;
+        self.history[sample.seq % replay_len] = sample;
+        self.hist_hi = sample.seq + 1;
+        self.resend = self.hist_hi;
+        if (self.hist_hi - self.hist_lo > replay_len) self.hist_lo = self.hist_hi - replay_len;
+    }
+
+    /// Node time of raw host time `raw_ns` through estimate `est`
+    fn nodeTime(self: *const Node, est: clock_sync.Estimate, raw_ns: u64) u64 {
+        return @intCast(@max(est.hostToNode(raw_ns -% self.sync.clock.origin_ns), 0));
+    }
+
+    pub fn live(self: *Node) bool {
+        return self.sync.estimate(self.sync.clock.now()) != null;
+    }
+
+    /// Any thread: the telemetry channels to ask the node for, 0 for none.
+    /// Samples come `decimation` servo ticks apart.
+    pub fn setTelemetry(self: *Node, channels: u32, decimation: u16) void {
+        self.tlm_cfg.store(@as(u64, channels) << 16 | decimation, .release);
+    }
+
+    fn sendTelemetryConfig(self: *Node) void {
+        const cfg = self.tlm_cfg.load(.acquire);
+        if (self.tlm_cfg_sent) |sent| {
+            if (sent == cfg) return;
+        } else if (cfg >> 16 == 0) {
+            // after a HELLO the node has it off already
+            self.tlm_cfg_sent = cfg;
+            return;
+        }
+        self.transport.send_telemetry_config(.{ .channels = @truncate(cfg >> 16), .decimation = @truncate(cfg) }) catch return;
+        self.tlm_cfg_sent = cfg;
+    }
+
+    /// Takes the configuration the node picked from our HELLO. A node that
+    /// didn't answer is version 1: one move per frame. False if it can't
+    /// decode our setpoints, nothing may go out to it.
+    fn checkCaps(self: *Node, ts_ns: u64) bool {
+        const caps = self.sync.getCaps() orelse {
+            std.log.info("node {}: no caps, version 1 firmware", .{self.index});
+            self.batch = 1;
+            return true;
+        };
+        if (caps.encoding != clock_sync.enc_pb) {
+            std.log.warn("node {}: no setpoint encoding in common (node has {x})", .{ self.index, caps.encodings });
+            return false;
+        }
+        self.batch = std.math.clamp(caps.batch, 1, Transport.max_batch);
+        if (caps.max_rate_hz != 0 and std.time.ns_per_s / ts_ns > caps.max_rate_hz)
+            std.log.warn("node {}: {} setpoints/s is over the node's {} Hz", .{ self.index, std.time.ns_per_s / ts_ns, caps.max_rate_hz });
+        if (caps.sp_buffer != 0 and setpoint_lead_ns / ts_ns + @as(u64, self.batch) > caps.sp_buffer)
+            std.log.warn("node {}: lead of {} setpoints overruns its {} slot buffer", .{ self.index, setpoint_lead_ns / ts_ns + @as(u64, self.batch), caps.sp_buffer });
+        return true;
+    }
+
+    /// Keeps the board attached, reattaching on hotplug or a dead link.
+    /// True while it is.
+    fn keepAttached(self: *Node) bool {
+        if (self.attached and (self.gone.load(.acquire) or !self.sync.running.load(.acquire))) {
+            std.log.warn("node {}: board {s} gone, holding moves", .{ self.index, self.serial() });
+            self.detach();
+        }
+        if (self.attached) return true;
+
+        const now = clock_sync.HostClock.raw();
+        // a failed node isn't polled, only a new board gets another try
+        const arrived = self.arrived.swap(false, .acq_rel);
+        if (!arrived and (self.failed or now - self.last_attach_ns < attach_poll_ns)) return false;
+        self.failed = false;
+        self.last_attach_ns = now;
+        self.attach() catch return false;
+        if (self.hist_hi > 0) self.reattaches += 1;
+        std.log.info("node {}: board {s} attached", .{ self.index, self.serial() });
+        return true;
+    }
+
+    /// Send thread: keeps the board attached, stamps each move with its node
+    /// time from the shared timeline and sends it once it is within
+    /// setpoint_lead_ns. While the board is away moves back up in the queue
+    /// and hold the planner.
+    pub fn run(self: *Node, timeline: *Timeline, running: *const std.atomic.Value(bool)) void {
+        var sync_live = false;
+        var last_late: u32 = 0;
+        while (running.load(.acquire)) {
+            if (!self.keepAttached()) {
+                sync_live = false;
+                std.Thread.sleep(std.time.ns_per_ms);
+                continue;
+            }
+            self.sendTelemetryConfig();
+            // moves only go out while the node's clock is tracking ours,
+            // they stay queued until the estimate is fresh again
+            const est = self.sync.estimate(self.sync.clock.now()) orelse {
+                if (sync_live) std.log.warn("node {}: clock sync lost, holding moves", .{self.index});
+                sync_live = false;
+                std.Thread.sleep(std.time.ns_per_ms);
+                continue;
+            };
+            if (!sync_live) {
+                std.log.info("node {}: clock sync live, offset {} ns", .{ self.index, est.offset_ns });
+                last_late = est.sp_late;
+                if (!self.checkCaps(timeline.ts_ns)) {
+                    std.log.err("node {}: board {s} can't take our moves, holding them until a board is plugged in", .{ self.index, self.serial() });
+                    self.failed = true;
+                    self.detach();
+                    continue;
+                }
+            }
+            sync_live = true;
+            if (self.resume_pending) self.resumeFrom(est.sp_ack);
+            if (est.sp_late != last_late) {
+                std.log.warn("node {}: {} setpoints missed their tick, slack {} ns", .{ self.index, est.sp_late -% last_late, est.sp_slack_ns });
+                last_late = est.sp_late;
+            }
+
+            const sample = self.next() orelse {
+                std.Thread.sleep(100 * std.time.ns_per_us);
+                continue;
+            };
+            const now_raw = clock_sync.HostClock.raw();
+            const t_raw = timeline.target(sample.seq, now_raw) orelse {
+                std.Thread.sleep(100 * std.time.ns_per_us);
+                continue;
+            };
+            if (t_raw > now_raw + setpoint_lead_ns) {
+                std.Thread.sleep(@min(t_raw - now_raw - setpoint_lead_ns, 100 * std.time.ns_per_us));
+                continue;
+            }
+
+            // the ones right behind it go in the same frame, up to the batch
+            // the node agreed to, each at most one Ts earlier than the last
+            var moves: [Transport.max_batch]types.MoveCmd = undefined;
+            var n: usize = 0;
+            // replayed moves were timed when they first went out
+            const origin_ns = if (self.resend < self.hist_hi) 0 else sample.enq_ns;
+            var s = sample;
+            var due = t_raw;
+            while (true) {
+                moves[n] = s.move;
+                moves[n].t_ns = self.nodeTime(est, due);
+                moves[n].seq = @truncate(s.seq);
+                self.consume(s);
+                n += 1;
+                if (n == self.batch) break;
+                s = self.next() orelse break;
+                due = timeline.target(s.seq, now_raw) orelse break;
+                if (due > now_raw + setpoint_lead_ns + @as(u64, n) * timeline.ts_ns) break;
+            }
+            self.transport.send_moves(moves[0..n], self.axes, origin_ns) catch |err| {
+                std.log.err("node {}: failed to send move command: {}", .{ self.index, err });
+                if (self.lat) |lat| lat.count(&lat.send_errors, 1);
+                // the ack puts it back in line after the reattach, anything
+                // else is lost
+                if (err == usb.UsbError.NoDevice) {
+                    self.gone.store(true, .release);
+                } else if (self.lat) |lat| lat.count(&lat.dropped, n);
+                continue;
+            };
+            self.sent += n;
+            self.frames += 1;
+        }
+        self.detach();
+    }
+
+    pub fn deinit(self: *Node, gpa: std.mem.Allocator) void {
+        self.detach();
+        gpa.free(self.history);
+        self.telemetry.deinit(gpa);
+        self.queue.deinit(gpa);
+    }
+};
+
+test "timeline restarts for every node at once" {
+    const ms = std.time.ns_per_ms;
+    var tl: Timeline = .{ .ts_ns = ms };
+    try std.testing.expectEqual(@as(?u64, null), tl.target(0, 0));
+
+    tl.start(0, 100 * ms);
+    try std.testing.expectEqual(@as(?u64, 100 * ms), tl.target(0, 90 * ms));
+    try std.testing.expectEqual(@as(?u64, 110 * ms), tl.target(10, 90 * ms));
+
+    // node A comes to sample 20 with only 0.5 ms left: everyone moves on
+    const t20 = tl.target(20, 119 * ms + ms / 2).?;
+    try std.testing.expectEqual(119 * ms + ms / 2 + setpoint_lead_ns, t20);
+    try std.testing.expectEqual(@as(usize, 1), tl.restarts);
+    // node B gets to 20 and 21 on the new timeline
+    try std.testing.expectEqual(@as(?u64, t20), tl.target(20, 120 * ms));
+    try std.testing.expectEqual(@as(?u64, t20 + ms), tl.target(21, 120 * ms));
+    // node C still at 19 sends it late instead of restarting again
+    try std.testing.expectEqual(@as(?u64, t20 - ms), tl.target(19, 120 * ms));
+    try std.testing.expectEqual(@as(usize, 1), tl.restarts);
+}
+
+test "reattached node resends from its ack" {
+    const gpa = std.testing.allocator;
+    var n: Node = undefined;
+    try n.init(gpa, 0, "ABC", .{ 0, 1, -1, -1 }, 1e-3, 16);
+    defer n.deinit(gpa);
+    const move = std.mem.zeroes(types.MoveCmd);
+
+    for (0..10) |k| {
+        try std.testing.expect(n.queue.push(.{ .seq = k, .move = move }));
+        n.consume(n.next().?);
+    }
+    try std.testing.expect(n.queue.push(.{ .seq = 10, .move = move }));
+
+    // the node ran up to sample 6 before the drop
+    n.resume_pending = true;
+    n.resumeFrom(7);
+    try std.testing.expectEqual(@as(u64, 7), n.resend);
+    for (7..11) |k| {
+        const s = n.next().?;
+        try std.testing.expectEqual(@as(u64, k), s.seq);
+        n.consume(s);
+    }
+    try std.testing.expectEqual(@as(?Sample, null), n.next());
+
+    // a rebooted board acks nothing, nothing is resent
+    n.resumeFrom(0);
+    try std.testing.expectEqual(@as(?Sample, null), n.next());
+}
+
+test "node without a common encoding gets no moves" {
+    const gpa = std.testing.allocator;
+    var n: Node = undefined;
+    try n.init(gpa, 0, "ABC", .{ 0, 1, -1, -1 }, 1e-3, 16);
+    defer n.deinit(gpa);
+
+    var caps: clock_sync.Caps = .{ .version = 2, .encodings = 1 << 4, .features = 0, .max_batch = 3, .sp_buffer = 64, .max_rate_hz = 1000, .ep_out_size = 512, .ep_in_size = 512, .encoding = 0, .features_on = 0, .batch = 3 };
+    n.sync.caps = caps;
+    try std.testing.expect(!n.checkCaps(std.time.ns_per_ms));
+    try std.testing.expectEqual(@as(usize, 1), n.batch);
+
+    caps.encoding = clock_sync.enc_pb;
+    n.sync.caps = caps;
+    try std.testing.expect(n.checkCaps(std.time.ns_per_ms));
+    try std.testing.expectEqual(@as(usize, 3), n.batch);
+}
@@ -9,6 +9,7 @@ const minMax = zzplot.minMax;
 
 const root = @import("root.zig");
 const types = @import("types.zig");
+const telemetry = @import("telemetry.zig");
 
 const AxisMoveCmd = types.AxisMoveCmd;
 const MoveCmd = types.MoveCmd;
@@ -247,6 +248,92 @@ fn run_plot(move_data: []MoveCmd, Ts: f32, _allocator: std.mem.Allocator) void {
     c.glfwTerminate();
 }
 
+/// Following error, q current against its command and the jitter buffer
+/// depth of one node's samples, against node time
+pub fn PlotTelemetry(samples: []const telemetry.Sample, allocator: std.mem.Allocator) !void {
+    if (samples.len <= 10) return;
+    const local = try allocator.dupe(telemetry.Sample, samples);
+    errdefer allocator.free(local);
+
+    var thread_config = std.Thread.SpawnConfig{};
+    thread_config.allocator = allocator;
+    const thread = try std.Thread.spawn(thread_config, run_plot_telemetry, .{ local, allocator });
+    thread.detach();
+}
+
+fn run_plot_telemetry(samples: []telemetry.Sample, _allocator: std.mem.Allocator) void {
+    defer _allocator.free(samples);
+    var arena = std.heap.ArenaAllocator.init(_allocator);
+    defer arena.deinit();
+    const allocator = arena.allocator();
+
+    const n_pts = samples.len;
+    var series: [8][]f32 = undefined;
+    for (&series) |*s| s.* = allocator.alloc(f32, n_pts) catch return;
+    const t, const e0, const e1, const iq0, const iq1, const ref0, const ref1, const depth = series;
+    const t0 = samples[0].nodeNs();
+    for (samples, 0..) |s, i| {
+        t[i] = @as(f32, @floatFromInt(s.nodeNs() - t0)) / std.time.ns_per_s;
+        e0[i] = s.err[0];
+        e1[i] = s.err[1];
+        iq0[i] = s.iq[0];
+        iq1[i] = s.iq[1];
+        ref0[i] = s.iq_ref[0];
+        ref1[i] = s.iq_ref[1];
+        depth[i] = @floatFromInt(s.jb_depth);
+    }
+    std.log.info("Plotting {} telemetry samples", .{n_pts});
+
+    const shared = zzplot.createShared() catch return;
+    const vg = nvg.gl.init(allocator, .{ .debug = true }) catch return;
+    zzplot.Font.init(vg);
+
+    var fig = Figure.init(allocator, shared, vg, .{
+        .title_str = "Node telemetry",
+        .xpos = 120,
+        .ypos = 120,
+        .wid = 960,
+        .ht = 700,
+        .disp_fps = true,
+    }) catch return;
+
+    var ax1 = Axes.init(fig, .{ .ypos = 0.66, .ht = 0.33, .title_str = "Following error", .xlabel_str = "time (s)", .ylabel_str = "mm", .draw_grid = true }) catch return;
+    var ax2 = Axes.init(fig, .{ .ypos = 0.33, .ht = 0.33, .title_str = "Iq and command", .xlabel_str = "time (s)", .ylabel_str = "A", .draw_grid = true }) catch return;
+    var ax3 = Axes.init(fig, .{ .ypos = 0.0, .ht = 0.33, .title_str = "Setpoint buffer", .xlabel_str = "time (s)", .ylabel_str = "setpoints", .draw_grid = true }) catch return;
+
+    var plt_e0 = Plot.init(ax1, .{ .line_col = Color.opacity(Color.blue, 0.7), .line_width = 4 }) catch return;
+    var plt_e1 = Plot.init(ax1, .{ .line_col = Color.opacity(Color.orange, 0.7), .line_width = 4 }) catch return;
+    var plt_iq0 = Plot.init(ax2, .{ .line_col = Color.opacity(Color.blue, 0.7), .line_width = 4 }) catch return;
+    var plt_iq1 = Plot.init(ax2, .{ .line_col = Color.opacity(Color.orange, 0.7), .line_width = 4 }) catch return;
+    var plt_ref0 = Plot.init(ax2, .{ .line_col = Color.opacity(Color.green, 0.5), .line_width = 2 }) catch return;
+    var plt_ref1 = Plot.init(ax2, .{ .line_col = Color.opacity(Color.purple, 0.5), .line_width = 2 }) catch return;
+    var plt_depth = Plot.init(ax3, .{ .line_col = Color.opacity(Color.green, 0.7), .line_width = 4 }) catch return;
+
+    ax1.set_limits(minMax(f32, .{t}), minMax(f32, .{ e0, e1 }), .{});
+    ax2.set_limits(minMax(f32, .{t}), minMax(f32, .{ iq0, iq1, ref0, ref1 }), .{});
+    ax3.set_limits(minMax(f32, .{t}), minMax(f32, .{depth}), .{});
+
+    while (fig.live and 0 == c.glfwWindowShouldClose(@ptrCast(fig.window))) {
+        fig.begin();
+
+        ax1.draw();
+        plt_e0.plot(t, e0);
+        plt_e1.plot(t, e1);
+
+        ax2.draw();
+        plt_iq0.plot(t, iq0);
+        plt_iq1.plot(t, iq1);
+        plt_ref0.plot(t, ref0);
+        plt_ref1.plot(t, ref1);
+
+        ax3.draw();
+        plt_depth.plot(t, depth);
+
+        fig.end();
+    }
+    c.glfwTerminate();
+}
+
 const math = std.math;
 
 pub fn genTestSignals(t: []f32, u: []f32, v: []f32, x: []f32, y: []f32) !void {
@@ -0,0 +1,487 @@
+const std = @import("std");
+
+// messages.proto as Zig types, with an encoder and decoder generated for
+// each type at comptime: every field write is unrolled and nothing walks a
+// descriptor table at run time. The bytes are nanopb's: proto3, scalars at
+// their default left out, submessages written when present, a oneof member
+// always. test_proto.zig holds it against the generated C.
+//
+// Field numbers are in each type's `pb` declaration. The wire type follows
+// from the Zig type: f32 is float, i32 int32, u32 fixed32, u64 fixed64 (the
+// only unsigned types messages.proto has), a struct with `pb` a message,
+// ?struct an optional message, BoundedArray a repeated message and
+// ?union(enum) a oneof.
+
+pub const AxisMoveCmd = struct {
+    pos: f32 = 0,
+    vel: f32 = 0,
+    acc: f32 = 0,
+    jerk: f32 = 0,
+    snap: f32 = 0,
+    crackle: f32 = 0,
+
+    pub const pb = .{ .pos = 1, .vel = 2, .acc = 3, .jerk = 4, .snap = 5, .crackle = 6 };
+};
+
+pub const MoveCmd = struct {
+    x: ?AxisMoveCmd = null,
+    y: ?AxisMoveCmd = null,
+    z: ?AxisMoveCmd = null,
+    e: ?AxisMoveCmd = null,
+    t_ns: u64 = 0,
+    seq: u32 = 0,
+
+    pub const pb = .{ .x = 1, .y = 2, .z = 3, .e = 4, .t_ns = 5, .seq = 6 };
+};
+
+pub const Moves = struct {
+    move: std.BoundedArray(MoveCmd, 3) = .{}, // max_count = 3
+
+    pub const pb = .{ .move = 1 };
+};
+
+pub const ConfigSystem = struct {
+    timestep: f32 = 0,
+    x_axis_idx: i32 = 0,
+    y_axis_idx: i32 = 0,
+    z_axis_idx: i32 = 0,
+    e_axis_idx: i32 = 0,
+
+    pub const pb = .{ .timestep = 1, .x_axis_idx = 2, .y_axis_idx = 3, .z_axis_idx = 4, .e_axis_idx = 5 };
+};
+
+pub const SetPID = struct {
+    axis: i32 = 0,
+    p: f32 = 0,
+    i: f32 = 0,
+    d: f32 = 0,
+    tf: f32 = 0,
+
+    pub const pb = .{ .axis = 1, .p = 2, .i = 3, .d = 4, .tf = 5 };
+};
+
+pub const SetParams = struct {
+    axis: i32 = 0,
+    phase_r: f32 = 0,
+    phase_l: f32 = 0,
+    enoder_cpr: f32 = 0,
+    counts_per_mm: f32 = 0,
+
+    pub const pb = .{ .axis = 1, .phase_r = 2, .phase_l = 3, .enoder_cpr = 4, .counts_per_mm = 5 };
+};
+
+pub const Cmd = struct {
+    payload: ?Payload = null,
+
+    pub const Payload = union(enum) {
+        moves: Moves,
+        axis_params: SetParams,
+        setpid: SetPID,
+        config_system: ConfigSystem,
+
+        pub const pb = .{ .moves = 1, .axis_params = 2, .setpid = 3, .config_system = 4 };
+    };
+    // a oneof has its numbers on the union
+    pub const pb = .{ .payload = 0 };
+};
+
+const wire_varint = 0;
+const wire_i64 = 1;
+const wire_len = 2;
+const wire_i32 = 5;
+
+fn key(comptime num: u32, comptime wire: u3) u32 {
+    return num << 3 | wire;
+}
+
+fn varintSize(v: u64) usize {
+    return (@as(usize, 64 - @clz(v | 1)) + 6) / 7;
+}
+
+fn isRepeated(comptime F: type) bool {
+    return @typeInfo(F) == .@"struct" and !@hasDecl(F, "pb") and @hasField(F, "buffer") and @hasField(F, "len");
+}
+
+fn isOneof(comptime F: type) bool {
+    return switch (@typeInfo(F)) {
+        .optional => |o| @typeInfo(o.child) == .@"union",
+        else => false,
+    };
+}
+
+fn RepeatedElem(comptime F: type) type {
+    return @typeInfo(@FieldType(F, "buffer")).array.child;
+}
+
+// ------------------------------------------------------------
+// Sizes
+// ------------------------------------------------------------
+
+/// Bytes `encode` writes for `msg`
+pub fn encodedSize(comptime T: type, msg: *const T) usize {
+    var n: usize = 0;
+    inline for (std.meta.fields(T)) |f| {
+        const v = &@field(msg, f.name);
+        if (comptime isOneof(f.type)) {
+            if (v.*) |*u| switch (u.*) {
+                inline else => |*m, tag| n += lenFieldSize(@field(@TypeOf(u.*).pb, @tagName(tag)), encodedSize(@TypeOf(m.*), m)),
+            };
+        } else {
+            n += fieldSize(f.type, @field(T.pb, f.name), v);
+        }
+    }
+    return n;
+}
+
+fn lenFieldSize(comptime num: u32, len: usize) usize {
+    const tag = comptime varintSize(key(num, wire_len));
+    return tag + varintSize(len) + len;
+}
+
+fn fieldSize(comptime F: type, comptime num: u32, v: *const F) usize {
+    const tag = comptime varintSize(key(num, 0));
+    switch (F) {
+        f32 => return if (@as(u32, @bitCast(v.*)) == 0) 0 else tag + 4,
+        i32 => return if (v.* == 0) 0 else tag + varintSize(@bitCast(@as(i64, v.*))),
+        u32 => return if (v.* == 0) 0 else tag + 4,
+        u64 => return if (v.* == 0) 0 else tag + 8,
+        else => {},
+    }
+    if (comptime isRepeated(F)) {
+        var n: usize = 0;
+        for (v.constSlice()) |*m| n += lenFieldSize(num, encodedSize(RepeatedElem(F), m));
+        return n;
+    }
+    switch (@typeInfo(F)) {
+        .optional => |o| return if (v.*) |*m| lenFieldSize(num, encodedSize(o.child, m)) else 0,
+        .@"struct" => return lenFieldSize(num, encodedSize(F, v)),
+        else => @compileError("no protobuf type for " ++ @typeName(F)),
+    }
+}
+
+/// The most any T encodes to, nanopb's <Message>_size
+pub fn maxSize(comptime T: type) usize {
+    comptime {
+        var n: usize = 0;
+        for (std.meta.fields(T)) |f| {
+            if (isOneof(f.type)) {
+                const U = @typeInfo(f.type).optional.child;
+                var most: usize = 0;
+                for (std.meta.fields(U)) |uf| most = @max(most, maxLenField(@field(U.pb, uf.name), uf.type));
+                n += most;
+            } else {
+                n += maxFieldSize(f.type, @field(T.pb, f.name));
+            }
+        }
+        return n;
+    }
+}
+
+fn maxLenField(comptime num: u32, comptime M: type) usize {
+    const m = maxSize(M);
+    return varintSize(key(num, wire_len)) + varintSize(m) + m;
+}
+
+fn maxFieldSize(comptime F: type, comptime num: u32) usize {
+    const tag = varintSize(key(num, 0));
+    return switch (F) {
+        f32, u32 => tag + 4,
+        i32 => tag + 10,
+        u64 => tag + 8,
+        else => if (isRepeated(F))
+            @typeInfo(@FieldType(F, "buffer")).array.len * maxLenField(num, RepeatedElem(F))
+        else switch (@typeInfo(F)) {
+            .optional => |o| maxLenField(num, o.child),
+            else => maxLenField(num, F),
+        },
+    };
+}
+
+// ------------------------------------------------------------
+// Encode
+// ------------------------------------------------------------
+
+const Writer = struct {
+    buf: []u8,
+    pos: usize = 0,
+
+    inline fn byte(w: *Writer, b: u8) void {
+        w.buf[w.pos] = b;
+        w.pos += 1;
+    }
+
+    inline fn varint(w: *Writer, v: u64) void {
+        var x = v;
+        while (x >= 0x80) : (x >>= 7) w.byte(@as(u8, @truncate(x)) | 0x80);
+        w.byte(@truncate(x));
+    }
+
+    inline fn fixed(w: *Writer, comptime I: type, v: I) void {
+        std.mem.writeInt(I, w.buf[w.pos..][0..@sizeOf(I)], v, .little);
+        w.pos += @sizeOf(I);
+    }
+};
+
+/// Encodes `msg` into `buf`, returns the bytes written
+pub fn encode(comptime T: type, msg: *const T, buf: []u8) error{Overflow}!usize {
+    const n = encodedSize(T, msg);
+    if (n > buf.len) return error.Overflow;
+    var w: Writer = .{ .buf = buf };
+    writeMessage(T, msg, &w);
+    return w.pos;
+}
+
+/// Varint length and `msg`, as PB_ENCODE_DELIMITED
+pub fn encodeDelimited(comptime T: type, msg: *const T, buf: []u8) error{Overflow}!usize {
+    const n = encodedSize(T, msg);
+    if (varintSize(n) + n > buf.len) return error.Overflow;
+    var w: Writer = .{ .buf = buf };
+    w.varint(n);
+    writeMessage(T, msg, &w);
+    return w.pos;
+}
+
+fn writeMessage(comptime T: type, msg: *const T, w: *Writer) void {
+    inline for (std.meta.fields(T)) |f| {
+        const v = &@field(msg, f.name);
+        if (comptime isOneof(f.type)) {
+            if (v.*) |*u| switch (u.*) {
+                inline else => |*m, tag| writeSub(@TypeOf(m.*), @field(@TypeOf(u.*).pb, @tagName(tag)), m, w),
+            };
+        } else {
+            writeField(f.type, @field(T.pb, f.name), v, w);
+        }
+    }
+}
+
+fn writeSub(comptime M: type, comptime num: u32, m: *const M, w: *Writer) void {
+    w.varint(comptime key(num, wire_len));
+    w.varint(encodedSize(M, m));
+    writeMessage(M, m, w);
+}
+
+fn writeField(comptime F: type, comptime num: u32, v: *const F, w: *Writer) void {
+    switch (F) {
+        f32 => if (@as(u32, @bitCast(v.*)) != 0) {
+            w.varint(comptime key(num, wire_i32));
+            w.fixed(u32, @bitCast(v.*));
+        },
+        i32 => if (v.* != 0) {
+            w.varint(comptime key(num, wire_varint));
+            w.varint(@bitCast(@as(i64, v.*)));
+        },
+        u32 => if (v.* != 0) {
+            w.varint(comptime key(num, wire_i32));
+            w.fixed(u32, v.*);
+        },
+        u64 => if (v.* != 0) {
+            w.varint(comptime key(num, wire_i64));
+            w.fixed(u64, v.*);
+        },
+        else => if (comptime isRepeated(F)) {
+            for (v.constSlice()) |*m| writeSub(RepeatedElem(F), num, m, w);
+        } else switch (@typeInfo(F)) {
+            .optional => |o| if (v.*) |*m| writeSub(o.child, num, m, w),
+            else => writeSub(F, num, v, w),
+        },
+    }
+}
+
+// ------------------------------------------------------------
+// Decode
+// ------------------------------------------------------------
+
+pub const DecodeError = error{
+    Truncated,
+    WireType,
+    Overflow, // varint over 64 bits, int32 out of range
+    TooMany, // more repeated elements than max_count
+};
+
+const Reader = struct {
+    buf: []const u8,
+    pos: usize = 0,
+
+    fn varint(r: *Reader) DecodeError!u64 {
+        var v: u64 = 0;
+        var shift: u7 = 0;
+        while (true) : (shift += 7) {
+            if (r.pos == r.buf.len) return error.Truncated;
+            if (shift >= 64) return error.Overflow;
+            const b = r.buf[r.pos];
+            r.pos += 1;
+            v |= @as(u64, b & 0x7f) << @intCast(shift);
+            if (b & 0x80 == 0) return v;
+        }
+    }
+
+    fn fixed(r: *Reader, comptime I: type) DecodeError!I {
+        if (r.buf.len - r.pos < @sizeOf(I)) return error.Truncated;
+        const v = std.mem.readInt(I, r.buf[r.pos..][0..@sizeOf(I)], .little);
+        r.pos += @sizeOf(I);
+        return v;
+    }
+
+    fn bytes(r: *Reader) DecodeError![]const u8 {
+        const n = try r.varint();
+        if (n > r.buf.len - r.pos) return error.Truncated;
+        const s = r.buf[r.pos..][0..@intCast(n)];
+        r.pos += s.len;
+        return s;
+    }
+
+    fn skip(r: *Reader, wire: u3) DecodeError!void {
+        switch (wire) {
+            wire_varint => _ = try r.varint(),
+            wire_i64 => _ = try r.fixed(u64),
+            wire_len => _ = try r.bytes(),
+            wire_i32 => _ = try r.fixed(u32),
+            else => return error.WireType,
+        }
+    }
+};
+
+pub fn decode(comptime T: type, buf: []const u8) DecodeError!T {
+    var msg: T = .{};
+    try decodeInto(T, &msg, buf);
+    return msg;
+}
+
+/// A PB_ENCODE_DELIMITED message at the front of `buf`, the bytes it took
+/// in `used`
+pub fn decodeDelimited(comptime T: type, buf: []const u8, used: *usize) DecodeError!T {
+    var r: Reader = .{ .buf = buf };
+    const body = try r.bytes();
+    used.* = r.pos;
+    return decode(T, body);
+}
+
+/// Merges `buf` into `msg` the way nanopb does: later scalars win, a
+/// submessage seen twice is merged, repeated fields append
+pub fn decodeInto(comptime T: type, msg: *T, buf: []const u8) DecodeError!void {
+    var r: Reader = .{ .buf = buf };
+    while (r.pos < buf.len) {
+        const k = try r.varint();
+        const wire: u3 = @truncate(k);
+        if (!try decodeField(T, msg, &r, k >> 3, wire)) try r.skip(wire);
+    }
+}
+
+fn decodeField(comptime T: type, msg: *T, r: *Reader, num: u64, wire: u3) DecodeError!bool {
+    inline for (std.meta.fields(T)) |f| {
+        const v = &@field(msg, f.name);
+        if (comptime isOneof(f.type)) {
+            const U = @typeInfo(f.type).optional.child;
+            inline for (std.meta.fields(U)) |uf| {
+                if (num == @field(U.pb, uf.name)) {
+                    // another member replaces the one there, the same one merges
+                    const tag = @field(std.meta.Tag(U), uf.name);
+                    if (v.* == null or std.meta.activeTag(v.*.?) != tag) v.* = @unionInit(U, uf.name, .{});
+                    try decodeValue(uf.type, &@field(v.*.?, uf.name), r, wire);
+                    return true;
+                }
+            }
+        } else if (num == @field(T.pb, f.name)) {
+            try decodeValue(f.type, v, r, wire);
+            return true;
+        }
+    }
+    return false;
+}
+
+fn expectWire(wire: u3, comptime want: u3) DecodeError!void {
+    if (wire != want) return error.WireType;
+}
+
+fn decodeValue(comptime F: type, v: *F, r: *Reader, wire: u3) DecodeError!void {
+    switch (F) {
+        f32 => {
+            try expectWire(wire, wire_i32);
+            v.* = @bitCast(try r.fixed(u32));
+        },
+        i32 => {
+            try expectWire(wire, wire_varint);
+            const x: i64 = @bitCast(try r.varint());
+            v.* = std.math.cast(i32, x) orelse return error.Overflow;
+        },
+        u32 => {
+            try expectWire(wire, wire_i32);
+            v.* = try r.fixed(u32);
+        },
+        u64 => {
+            try expectWire(wire, wire_i64);
+            v.* = try r.fixed(u64);
+        },
+        else => {
+            try expectWire(wire, wire_len);
+            const body = try r.bytes();
+            if (comptime isRepeated(F)) {
+                const m = v.addOne() catch return error.TooMany;
+                m.* = .{};
+                try decodeInto(RepeatedElem(F), m, body);
+            } else switch (@typeInfo(F)) {
+                .optional => |o| {
+                    if (v.* == null) v.* = .{};
+                    try decodeInto(o.child, &v.*.?, body);
+                },
+                else => try decodeInto(F, v, body),
+            }
+        },
+    }
+}
+
+test "sizes match the nanopb header" {
+    // messages.pb.h
+    try std.testing.expectEqual(30, maxSize(AxisMoveCmd));
+    try std.testing.expectEqual(142, maxSize(MoveCmd));
+    try std.testing.expectEqual(438, maxSize(Cmd));
+}
+
+test "known bytes" {
+    // x present with pos 1.0 only, seq 7, and an empty y
+    var moves: Moves = .{};
+    try moves.move.append(.{ .x = .{ .pos = 1.0 }, .y = .{}, .seq = 7 });
+    const cmd: Cmd = .{ .payload = .{ .moves = moves } };
+    var buf: [64]u8 = undefined;
+    const n = try encodeDelimited(Cmd, &cmd, &buf);
+    const want = [_]u8{
+        18, // delimiter
+        0x0a, 16, // Cmd.moves
+        0x0a, 14, // Moves.move
+        0x0a, 5, 0x0d, 0x00, 0x00, 0x80, 0x3f, // x { pos: 1.0 }
+        0x12, 0, // y {}
+        0x35, 7, 0, 0, 0, // seq
+    };
+    try std.testing.expectEqualSlices(u8, &want, buf[0..n]);
+
+    var used: usize = 0;
+    const back = try decodeDelimited(Cmd, buf[0..n], &used);
+    try std.testing.expectEqual(n, used);
+    const m = back.payload.?.moves.move.constSlice();
+    try std.testing.expectEqual(1, m.len);
+    try std.testing.expectEqualDeep(moves.move.get(0), m[0]);
+}
+
+test "negative int32 takes ten bytes and comes back" {
+    const cfg: Cmd = .{ .payload = .{ .config_system = .{ .timestep = 1e-4, .x_axis_idx = -1, .y_axis_idx = 1 } } };
+    var buf: [maxSize(Cmd)]u8 = undefined;
+    const n = try encode(Cmd, &cfg, &buf);
+    // oneof tag and length, float, -1, 1
+    try std.testing.expectEqual(2 + 5 + 11 + 2, n);
+    try std.testing.expectEqualDeep(cfg, try decode(Cmd, buf[0..n]));
+}
+
+test "decode rejects what nanopb rejects" {
+    // truncated float
+    try std.testing.expectError(error.Truncated, decode(AxisMoveCmd, &.{ 0x0d, 0, 0 }));
+    // pos as a varint
+    try std.testing.expectError(error.WireType, decode(AxisMoveCmd, &.{ 0x08, 1 }));
+    // a fourth move
+    var buf: [16]u8 = undefined;
+    var i: usize = 0;
+    while (i < 8) : (i += 2) buf[i..][0..2].* = .{ 0x0a, 0 };
+    try std.testing.expectError(error.TooMany, decode(Moves, buf[0..8]));
+    // unknown fields are skipped
+    const m = try decode(AxisMoveCmd, &.{ 0x78, 5, 0x0d, 0, 0, 0x80, 0x3f });
+    try std.testing.expectEqual(@as(f32, 1.0), m.pos);
+}
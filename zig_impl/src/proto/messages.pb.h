@@ -28,6 +28,8 @@ typedef struct _MoveCmd {
     AxisMoveCmd z;
     bool has_e;
     AxisMoveCmd e;
+    uint64_t t_ns;
+    uint32_t seq;
 } MoveCmd;
 
 typedef struct _Moves {
@@ -76,14 +78,14 @@ extern "C" {
 
 /* Initializer values for message structs */
 #define AxisMoveCmd_init_default                 {0, 0, 0, 0, 0, 0}
-#define MoveCmd_init_default                     {false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default}
+#define MoveCmd_init_default                     {false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default, false, AxisMoveCmd_init_default, 0, 0}
 #define Moves_init_default                       {0, {MoveCmd_init_default, MoveCmd_init_default, MoveCmd_init_default}}
 #define ConfigSystem_init_default                {0, 0, 0, 0, 0}
 #define SetPID_init_default                      {0, 0, 0, 0, 0}
 #define SetParams_init_default                   {0, 0, 0, 0, 0}
 #define Cmd_init_default                         {0, {Moves_init_default}}
 #define AxisMoveCmd_init_zero                    {0, 0, 0, 0, 0, 0}
-#define MoveCmd_init_zero                        {false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero}
+#define MoveCmd_init_zero                        {false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero, false, AxisMoveCmd_init_zero, 0, 0}
 #define Moves_init_zero                          {0, {MoveCmd_init_zero, MoveCmd_init_zero, MoveCmd_init_zero}}
 #define ConfigSystem_init_zero                   {0, 0, 0, 0, 0}
 #define SetPID_init_zero                         {0, 0, 0, 0, 0}
@@ -101,6 +103,8 @@ extern "C" {
 #define MoveCmd_y_tag                            2
 #define MoveCmd_z_tag                            3
 #define MoveCmd_e_tag                            4
+#define MoveCmd_t_ns_tag                         5
+#define MoveCmd_seq_tag                          6
 #define Moves_move_tag                           1
 #define ConfigSystem_timestep_tag                1
 #define ConfigSystem_x_axis_idx_tag              2
@@ -137,7 +141,9 @@ X(a, STATIC,   SINGULAR, FLOAT,    crackle,           6)
 X(a, STATIC,   OPTIONAL, MESSAGE,  x,                 1) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  y,                 2) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  z,                 3) \
-X(a, STATIC,   OPTIONAL, MESSAGE,  e,                 4)
+X(a, STATIC,   OPTIONAL, MESSAGE,  e,                 4) \
+X(a, STATIC,   SINGULAR, FIXED64,  t_ns,              5) \
+X(a, STATIC,   SINGULAR, FIXED32,  seq,               6)
 #define MoveCmd_CALLBACK NULL
 #define MoveCmd_DEFAULT NULL
 #define MoveCmd_x_MSGTYPE AxisMoveCmd
@@ -209,11 +215,11 @@ extern const pb_msgdesc_t Cmd_msg;
 
 /* Maximum encoded size of messages (where known) */
 #define AxisMoveCmd_size                         30
-#define Cmd_size                                 396
+#define Cmd_size                                 438
 #define ConfigSystem_size                        49
 #define MESSAGES_PB_H_MAX_SIZE                   Cmd_size
-#define MoveCmd_size                             128
-#define Moves_size                               393
+#define MoveCmd_size                             142
+#define Moves_size                               435
 #define SetPID_size                              31
 #define SetParams_size                           31
 
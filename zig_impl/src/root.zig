@@ -8,6 +8,11 @@ const plt = @import("plot.zig");
 const diff = @import("diff.zig");
 const Transport = @import("transport.zig");
 const dequeue = @import("dequeue.zig");
+const clock_sync = @import("clock_sync.zig");
+const node = @import("node.zig");
+const usb = @import("usb.zig");
+const telemetry = @import("telemetry.zig");
+const latency = @import("latency.zig");
 
 const AxisMoveCmd = types.AxisMoveCmd;
 const MoveCmd = types.MoveCmd;
@@ -19,91 +24,309 @@ const MoveCmd = types.MoveCmd;
 
 const Diff = diff.BinomialDerivator(6);
 
-const DeviceConfig = struct {
-    x: bool,
-    y: bool,
-    z: bool,
-    e: bool,
-};
+const MoveHistory = dequeue.Deque(MoveCmd);
+// moves kept for Plot()
+const history_len = 5000;
+// per node, 100 ms of moves at the default 0.1 ms Ts
+const node_queue_len = 1000;
+
+const TelemetryHistory = dequeue.Deque(telemetry.Sample);
+// samples kept for telemetry_plot(), 10 s of one node at full rate
+const tlm_history_len = 10000;
+// how often the drain thread empties the per node rings
+const tlm_drain_ns = 5 * std.time.ns_per_ms;
+
+// Boards to drive, by serial number, from add_node() before configure()
+var node_serials: std.ArrayListUnmanaged([]const u8) = .{};
 
-const MoveQueue = dequeue.Deque(MoveCmd);
+// Axis -> node map set through map_axis() before configure(), -1 for the
+// default: two axes per board in X, Y, Z, E order, everything on the first
+// board if there is only one
+var axis_node: [4]i32 = .{ -1, -1, -1, -1 };
 
 const Server = struct {
-    move_queue: MoveQueue,
-    // move_queue: std.fifo.LinearFifo(MoveCmd, .{ .Static = 5000 }) = undefined,
+    history: MoveHistory,
     alloc: std.mem.Allocator = undefined,
     differ: [4]Diff = undefined,
     Ts: f32 = 0.0001,
     run_thread: bool = false,
-    transport: Transport.USBTransport,
+    running: std.atomic.Value(bool) = std.atomic.Value(bool).init(false),
+    nodes: []node.Node = &.{},
+    timeline: node.Timeline = undefined,
+    next_seq: u64 = 0,
+    // node telemetry, filled by the drain thread
+    tlm_lock: std.Thread.Mutex = .{},
+    tlm_history: TelemetryHistory,
+    recorder: ?telemetry.Recorder = null,
+    // per stage latency, high water marks and drops, get_pipeline_stats()
+    pipeline: latency.Pipeline = .{},
     pub fn init(allocator: std.mem.Allocator, Ts: f32) !*@This() {
         var ret = try allocator.create(@This());
-        ret.move_queue = try MoveQueue.initCapacity(allocator, 5000);
+        errdefer allocator.destroy(ret);
+        ret.* = .{
+            .history = try MoveHistory.initCapacity(allocator, history_len),
+            .tlm_history = try TelemetryHistory.initCapacity(allocator, tlm_history_len),
+        };
         ret.Ts = Ts;
 
         for (&ret.differ) |*d| {
             d.* = Diff.init(Ts);
         }
-        ret.run_thread = true;
-
         ret.alloc = allocator;
-        ret.transport = try Transport.USBTransport.init(0x4011, 0xcafe);
+        ret.timeline = .{ .ts_ns = @intFromFloat(@round(@as(f64, Ts) * std.time.ns_per_s)) };
+        try ret.openNodes();
+        ret.running.store(true, .release);
+        ret.run_thread = true;
         return ret;
     }
+
+    // One node per board, by serial number: the ones given to add_node(), or
+    // else every board on the bus in serial order so the axis map doesn't
+    // depend on ports or enumeration order. With neither, one node takes the
+    // first board to show up.
+    fn openNodes(self: *@This()) !void {
+        var found: [][]const u8 = &.{};
+        defer usb.Context.freeSerials(self.alloc, found);
+        if (node_serials.items.len == 0) {
+            var ctx = try usb.Context.init();
+            defer ctx.deinit();
+            found = try ctx.listSerials(self.alloc, 0xcafe, 0x4011);
+            std.mem.sort([]const u8, found, {}, struct {
+                fn lt(_: void, a: []const u8, b: []const u8) bool {
+                    return std.mem.order(u8, a, b) == .lt;
+                }
+            }.lt);
+        }
+        const serials: []const []const u8 = if (node_serials.items.len > 0) node_serials.items else found;
+        const count = @max(serials.len, 1);
+        std.log.info("{} node(s), {} board(s) on the bus", .{ count, found.len });
+
+        const axis_idx: [][4]i32 = try self.alloc.alloc([4]i32, count);
+        defer self.alloc.free(axis_idx);
+        @memset(axis_idx, .{ -1, -1, -1, -1 });
+        const motors = try self.alloc.alloc(i32, count);
+        defer self.alloc.free(motors);
+        @memset(motors, 0);
+        for (0..4) |a| {
+            const n: usize = if (axis_node[a] >= 0)
+                @intCast(axis_node[a])
+            else if (count == 1) 0 else a / node.axes_per_node;
+            if (n >= count) {
+                std.log.err("axis {} mapped to node {}, only {} configured", .{ a, n, count });
+                return error.NoSuchNode;
+            }
+            axis_idx[n][a] = motors[n];
+            motors[n] += 1;
+        }
+
+        self.nodes = try self.alloc.alloc(node.Node, count);
+        var opened: usize = 0;
+        errdefer {
+            for (self.nodes[0..opened]) |*n| n.deinit(self.alloc);
+            self.alloc.free(self.nodes);
+        }
+        for (self.nodes, 0..) |*n, i| {
+            const sn: []const u8 = if (i < serials.len) serials[i] else "";
+            try n.init(self.alloc, i, sn, axis_idx[i], self.Ts, node_queue_len);
+            n.lat = &self.pipeline;
+            opened += 1;
+            std.log.info("node {}: board {s}, axes {}", .{ i, sn, n.axes });
+        }
+    }
+
+    // Hotplug thread, only flags the nodes: each node's send thread opens
+    // and closes its own board
+    fn onHotplug(self: *@This(), event: usb.HotplugEvent, loc: usb.DeviceLocation) void {
+        for (self.nodes) |*n| switch (event) {
+            .left => n.onLeft(loc),
+            .arrived => n.onArrived(),
+        };
+    }
+
+    fn hotplugLoop(self: *@This(), ctx: *usb.Context) void {
+        while (self.running.load(.acquire)) {
+            ctx.handleEventsTimeout(100 * std.time.us_per_ms) catch |err| {
+                std.log.err("hotplug events: {}", .{err});
+                std.Thread.sleep(100 * std.time.ns_per_ms);
+            };
+        }
+    }
+
+    // Moves every node's samples out of its ring before it fills, into the
+    // plot history and the recorder
+    fn drainTelemetry(self: *@This()) void {
+        while (self.running.load(.acquire)) {
+            self.drainOnce();
+            std.Thread.sleep(tlm_drain_ns);
+        }
+        self.drainOnce();
+    }
+
+    fn drainOnce(self: *@This()) void {
+        self.tlm_lock.lock();
+        defer self.tlm_lock.unlock();
+        for (self.nodes) |*n| {
+            while (n.telemetry.ring.pop()) |s| {
+                if (self.tlm_history.len == tlm_history_len) _ = self.tlm_history.popFront();
+                self.tlm_history.pushBackAssumeCapacity(s);
+                if (self.recorder) |*rec| rec.write(s) catch |err| {
+                    std.log.err("telemetry recorder: {}, stopped", .{err});
+                    rec.close();
+                    self.recorder = null;
+                };
+            }
+        }
+    }
+
+    pub fn setTelemetry(self: *@This(), channels: u32, decimation: u16) void {
+        for (self.nodes) |*n| n.setTelemetry(channels, decimation);
+    }
+
+    pub fn startRecording(self: *@This(), path: []const u8) !void {
+        const rec = try telemetry.Recorder.create(path);
+        self.tlm_lock.lock();
+        defer self.tlm_lock.unlock();
+        if (self.recorder) |*old| old.close();
+        self.recorder = rec;
+    }
+
+    pub fn stopRecording(self: *@This()) void {
+        self.tlm_lock.lock();
+        defer self.tlm_lock.unlock();
+        if (self.recorder) |*rec| {
+            std.log.info("telemetry recorder: {} samples", .{rec.rows});
+            rec.close();
+        }
+        self.recorder = null;
+    }
+
+    /// Plots the first node's samples in the history
+    pub fn PlotTelemetry(self: *@This()) void {
+        self.tlm_lock.lock();
+        defer self.tlm_lock.unlock();
+        var samples: std.ArrayListUnmanaged(telemetry.Sample) = .{};
+        defer samples.deinit(self.alloc);
+        var it = self.tlm_history.iterator();
+        while (it.next()) |s| {
+            if (s.node == 0) samples.append(self.alloc, s) catch break;
+        }
+        plt.PlotTelemetry(samples.items, self.alloc) catch {
+            std.log.err("Failed to plot telemetry", .{});
+        };
+    }
+
     pub fn run(self: *@This()) void {
         std.log.info("Starting server", .{});
         std.debug.print("Server thread run\n", .{});
-        // var i: usize = 0;
-        // var msg: [512]u8 = undefined;
-        // for (msg[0..]) |*b| {
-        //     b.* = @addWithOverflow(@as(u8, 45), @as(u8, @intCast(i % 255)))[0];
-        // }
-        // i += 1;
-        // for (0..3334) |_| {
-        //     const maybe_sent = self.transport.bulk_transfer_send(&msg);
-        //     if (maybe_sent) |s| {
-        //         std.log.info("Sent {} bytes via bulk transfer\n", .{s});
-        //     } else |err| {
-        //         std.log.info("Error in bulk transfer: {any}\n", .{err});
-        //     }
-        // }
-        var msgs_sent: usize = 0;
         var timer = std.time.Timer.start() catch unreachable;
-        while (self.run_thread) {
-            // std.log.info("Running main server thread", .{});
-            while (self.move_queue.len > 0) {
-                std.log.info("something in queue", .{});
-
-                const maybe_cmd = self.move_queue.popFront();
-
-                if (maybe_cmd) |cmd| {
-                    std.log.info("Processing move command: {}", .{cmd});
-                    self.transport.send_move(cmd) catch |err| {
-                        std.log.err("Failed to send move command: {}", .{err});
-                        continue;
-                    };
-                    msgs_sent += 1;
-                    std.log.info("Messages sent: {}", .{msgs_sent});
-                }
+
+        // without hotplug support detached nodes still poll for their board
+        var hotplug_ctx: ?usb.Context = null;
+        var hotplug_handle: usb.HotplugHandle = undefined;
+        var hotplug_thread: ?std.Thread = null;
+        if (usb.Context.hasHotplug()) hotplug: {
+            var ctx = usb.Context.init() catch break :hotplug;
+            hotplug_handle = ctx.registerHotplug(0xcafe, 0x4011, @This(), self, onHotplug) catch {
+                ctx.deinit();
+                break :hotplug;
+            };
+            hotplug_ctx = ctx;
+            hotplug_thread = std.Thread.spawn(.{}, hotplugLoop, .{ self, &hotplug_ctx.? }) catch null;
+        }
+
+        const drain_thread: ?std.Thread = std.Thread.spawn(.{}, drainTelemetry, .{self}) catch |err| blk: {
+            std.log.err("telemetry drain thread failed to start: {}", .{err});
+            break :blk null;
+        };
+
+        var spawned: usize = 0;
+        for (self.nodes) |*n| {
+            n.thread = std.Thread.spawn(.{}, node.Node.run, .{ n, &self.timeline, &self.running }) catch |err| {
+                std.log.err("node {}: send thread failed to start: {}", .{ n.index, err });
+                break;
+            };
+            spawned += 1;
+        }
+
+        // synchronized start: sample 0 runs one lead after every node has
+        // its clock locked, the same host instant on all of them
+        if (spawned == self.nodes.len) {
+            while (self.run_thread) {
+                var live = true;
+                for (self.nodes) |*n| live = live and n.live();
+                if (live) break;
+                std.Thread.sleep(std.time.ns_per_ms);
             }
+            self.timeline.start(0, clock_sync.HostClock.raw() + node.setpoint_lead_ns);
+            std.log.info("all {} node(s) synced, motion started", .{self.nodes.len});
         }
+        while (self.run_thread) std.Thread.sleep(std.time.ns_per_ms);
+
+        self.running.store(false, .release);
+        if (hotplug_thread) |t| t.join();
+        if (hotplug_ctx) |*ctx| {
+            ctx.deregisterHotplug(hotplug_handle);
+            ctx.deinit();
+        }
+        for (self.nodes) |*n| {
+            if (n.thread) |t| t.join();
+            n.thread = null;
+        }
+        // the node threads are gone, what they received is in the rings
+        if (drain_thread) |t| t.join();
+        self.stopRecording();
+        var msgs_sent: usize = 0;
+        var reattaches: usize = 0;
+        for (self.nodes) |*n| {
+            msgs_sent += n.sent;
+            reattaches += n.reattaches;
+            n.deinit(self.alloc);
+        }
+        self.pipeline.log();
         const time = timer.read();
         std.debug.print("Server Thread Time taken for 10k messages: {} ms\n", .{time / 1000000});
-        std.debug.print("Server thread sent: {} messages\n", .{msgs_sent});
+        std.debug.print("Server thread sent: {} messages, {} timeline restarts, {} reattaches\n", .{ msgs_sent, self.timeline.restarts, reattaches });
         std.log.info("We're done: run", .{});
     }
 
-    pub fn EnqueueMove(self: *@This(), cmd: MoveCmd) void {
-        self.move_queue.pushBack(self.alloc, cmd) catch {
-            std.log.err("failed to enqueue move\n", .{});
-        };
+    // Every node gets every sample under the same sequence number and only
+    // sends its own axes. A full queue holds the planner back. `enq_ns` is
+    // when enqueue_command() was called, latency.now() time.
+    pub fn EnqueueMove(self: *@This(), cmd: MoveCmd, enq_ns: u64) void {
+        const sample: node.Sample = .{ .seq = self.next_seq, .move = cmd, .enq_ns = enq_ns };
+        self.next_seq += 1;
+        const p = &self.pipeline;
+        for (self.nodes) |*n| {
+            if (std.meta.eql(n.axes, types.DeviceConfig{})) continue;
+            if (!n.queue.push(sample)) {
+                p.count(&p.queue_full, 1);
+                while (!n.queue.push(sample)) {
+                    if (!self.running.load(.acquire)) {
+                        p.count(&p.dropped, 1);
+                        return;
+                    }
+                    std.Thread.sleep(100 * std.time.ns_per_us);
+                }
+            }
+            p.highWater(&p.queue_hwm, n.queue.len());
+        }
+        if (self.history.len == history_len) _ = self.history.popFront();
+        self.history.pushBackAssumeCapacity(cmd);
     }
     pub fn Plot(self: *@This()) void {
         // kick off a thread that runs the plot window
-        plt.PlotMove(self.move_queue.readableSlice(0), self.Ts, self.alloc) catch {
+        const moves = self.alloc.alloc(MoveCmd, self.history.len) catch {
             std.log.err("Failed to plot move data", .{});
+            return;
         };
-        self.move_queue.discard(self.move_queue.count);
+        defer self.alloc.free(moves);
+        var it = self.history.iterator();
+        var i: usize = 0;
+        while (it.next()) |m| : (i += 1) moves[i] = m;
+        plt.PlotMove(moves, self.Ts, self.alloc) catch {
+            std.log.err("Failed to plot move data", .{});
+        };
+        while (self.history.popFront()) |_| {}
     }
     pub fn GetDerivative(self: *@This(), val: f64, axis: u4) AxisMoveCmd {
         const xdiff = self.differ[axis].calc(val);
@@ -133,21 +356,41 @@ pub export fn disable_stepper(axis: i32) callconv(.C) void {
     std.log.info("Disabling axis: {}", .{axis});
 }
 
+/// Drive the board with this serial number as the next node, before
+/// configure(). Without any, every board on the bus is used.
+pub export fn add_node(serial: [*:0]const u8) callconv(.C) void {
+    const sn = std.heap.c_allocator.dupe(u8, std.mem.span(serial)) catch return;
+    node_serials.append(std.heap.c_allocator, sn) catch std.heap.c_allocator.free(sn);
+}
+
+/// Put `axis` (0..3 for X, Y, Z, E) on node `node_index`, in add_node()
+/// order or serial number order, before configure(). -1 restores the
+/// default.
+pub export fn map_axis(axis: i32, node_index: i32) callconv(.C) void {
+    if (axis < 0 or axis >= 4) {
+        std.log.err("map_axis: no axis {}", .{axis});
+        return;
+    }
+    axis_node[@intCast(axis)] = node_index;
+}
+
 pub export fn enqueue_command(x: f64, y: f64, z: f64, e: f64, index: i32, safe_stop: i32) callconv(.C) void {
     _ = index;
     // std.log.warn("Move cmd: X={} Y={} Z={}, E={}", .{ x, y, z, e });
     if (server) |s| {
+        const t0 = latency.now();
         const X = s.GetDerivative(x, 0);
         const Y = s.GetDerivative(y, 1);
         const Z = s.GetDerivative(z, 2);
         const E = s.GetDerivative(e, 3);
+        s.pipeline.since(.derive, t0);
 
         s.EnqueueMove(.{
             .X = X,
             .Y = Y,
             .Z = Z,
             .E = E,
-        });
+        }, t0);
         if (safe_stop != 0) {
             std.log.warn("Safe Stop here", .{});
             // s.Plot();
@@ -184,10 +427,53 @@ pub export fn configure(interp_time: f32) callconv(.C) void {
     std.log.info("Finished Configuring Server", .{});
 }
 
+/// Ask every node for these SYNC_TLM_CH_* channels on every `decimation`-th
+/// servo tick, 0 channels to stop
+pub export fn telemetry_config(channels: u32, decimation: u16) callconv(.C) void {
+    if (server) |s| s.setTelemetry(channels, decimation);
+}
+
+/// Write every telemetry sample from now on to a CSV file at `path`
+pub export fn telemetry_record(path: [*:0]const u8) callconv(.C) i32 {
+    const s = server orelse return -1;
+    s.startRecording(std.mem.span(path)) catch |err| {
+        std.log.err("telemetry_record {s}: {}", .{ path, err });
+        return -1;
+    };
+    return 0;
+}
+
+pub export fn telemetry_stop_record() callconv(.C) void {
+    if (server) |s| s.stopRecording();
+}
+
+pub export fn telemetry_plot() callconv(.C) void {
+    if (server) |s| s.PlotTelemetry();
+}
+
+/// Latency of each pipeline stage since configure(), queue and transfer
+/// high water marks and drop counts, see latency.PipelineStats for the
+/// layout. -1 before configure().
+pub export fn get_pipeline_stats(out: *latency.PipelineStats) callconv(.C) i32 {
+    const s = server orelse return -1;
+    out.* = s.pipeline.snapshot();
+    for (s.nodes) |*n| out.queue_capacity = @max(out.queue_capacity, n.queue.capacity());
+    out.in_flight_capacity = usb.TransferPool.len;
+    s.timeline.mutex.lock();
+    defer s.timeline.mutex.unlock();
+    out.timeline_restarts = s.timeline.restarts;
+    return 0;
+}
+
 pub export fn shutdown() callconv(.C) void {
     std.log.info("Turning off Motors", .{});
 }
 
+test {
+    // node.zig needs libusb, so its tests run with the library's
+    _ = node;
+}
+
 test "startup shutdown" {
     // std.testing.log_level = .debug;
     const expect = std.testing.expect;
@@ -201,6 +487,9 @@ test "startup shutdown" {
             enqueue_command(i * 1.0, i * 2.0, i * 3.0, i * 4.0, 0, 0);
         }
         const time = timer.read();
+        var stats: latency.PipelineStats = undefined;
+        try expect(get_pipeline_stats(&stats) == 0);
+        try expect(stats.stage[@intFromEnum(latency.Stage.derive)].count == 10000);
         // while (s.move_queue.len > 0) {}
         shutdown();
         s.run_thread = false;
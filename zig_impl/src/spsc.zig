@@ -0,0 +1,111 @@
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+
+/// Lock-free single producer, single consumer ring, the Zig side of
+/// firmware/App/inc/fifo.h: only the producer moves head, only the consumer
+/// moves tail, one slot is kept free to tell full from empty. Capacity is
+/// rounded up to a power of two.
+pub fn SpscRing(comptime T: type) type {
+    return struct {
+        const Self = @This();
+
+        buffer: []T,
+        mask: usize,
+        // on their own cache lines so the two threads don't share one
+        head: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+        tail: std.atomic.Value(usize) align(std.atomic.cache_line) = std.atomic.Value(usize).init(0),
+
+        pub fn init(gpa: Allocator, capacity: usize) !Self {
+            const n = try std.math.ceilPowerOfTwo(usize, capacity + 1);
+            return .{ .buffer = try gpa.alloc(T, n), .mask = n - 1 };
+        }
+
+        pub fn deinit(self: *Self, gpa: Allocator) void {
+            gpa.free(self.buffer);
+            self.* = undefined;
+        }
+
+        /// Producer. False if full.
+        pub fn push(self: *Self, item: T) bool {
+            const head = self.head.load(.monotonic);
+            const next = (head + 1) & self.mask;
+            if (next == self.tail.load(.acquire)) return false;
+            self.buffer[head] = item;
+            self.head.store(next, .release);
+            return true;
+        }
+
+        /// Consumer. Null if empty.
+        pub fn pop(self: *Self) ?T {
+            const tail = self.tail.load(.monotonic);
+            if (tail == self.head.load(.acquire)) return null;
+            const item = self.buffer[tail];
+            self.tail.store((tail + 1) & self.mask, .release);
+            return item;
+        }
+
+        /// Consumer. The next item without taking it.
+        pub fn peek(self: *Self) ?*const T {
+            const tail = self.tail.load(.monotonic);
+            if (tail == self.head.load(.acquire)) return null;
+            return &self.buffer[tail];
+        }
+
+        /// Either side, a snapshot.
+        pub fn len(self: *const Self) usize {
+            return (self.head.load(.acquire) -% self.tail.load(.acquire)) & self.mask;
+        }
+
+        pub fn capacity(self: *const Self) usize {
+            return self.mask;
+        }
+    };
+}
+
+test "spsc ring fills, wraps and empties" {
+    const gpa = std.testing.allocator;
+    var ring = try SpscRing(u32).init(gpa, 5);
+    defer ring.deinit(gpa);
+    try std.testing.expectEqual(@as(usize, 7), ring.capacity());
+
+    var k: u32 = 0;
+    while (ring.push(k)) k += 1;
+    try std.testing.expectEqual(@as(u32, 7), k);
+    try std.testing.expectEqual(@as(usize, 7), ring.len());
+
+    for (0..3) |i| try std.testing.expectEqual(@as(?u32, @intCast(i)), ring.pop());
+    for (0..3) |_| {
+        try std.testing.expect(ring.push(k));
+        k += 1;
+    }
+    try std.testing.expect(!ring.push(k));
+    try std.testing.expectEqual(@as(u32, 3), ring.peek().?.*);
+    for (3..10) |i| try std.testing.expectEqual(@as(?u32, @intCast(i)), ring.pop());
+    try std.testing.expectEqual(@as(?u32, null), ring.pop());
+}
+
+test "spsc ring across threads" {
+    const gpa = std.testing.allocator;
+    const Ring = SpscRing(u64);
+    var ring = try Ring.init(gpa, 64);
+    defer ring.deinit(gpa);
+    const n: u64 = 200_000;
+
+    const producer = struct {
+        fn run(r: *Ring) void {
+            var i: u64 = 0;
+            while (i < n) {
+                if (r.push(i)) i += 1 else std.atomic.spinLoopHint();
+            }
+        }
+    };
+    const t = try std.Thread.spawn(.{}, producer.run, .{&ring});
+    var expect: u64 = 0;
+    while (expect < n) {
+        if (ring.pop()) |v| {
+            try std.testing.expectEqual(expect, v);
+            expect += 1;
+        } else std.atomic.spinLoopHint();
+    }
+    t.join();
+}
@@ -0,0 +1,349 @@
+const std = @import("std");
+const clock_sync = @import("clock_sync.zig");
+const spsc = @import("spsc.zig");
+const tmc2240 = @import("tmc2240.zig");
+
+// Device -> host telemetry, sync_tlm_hdr_t and sync_tlm_cfg_t in
+// sync_protocol.h. Every packet is a full 512 byte bulk packet: a 16 byte
+// header and `count` samples of the enabled channels. The receive thread
+// unpacks them into a per node SPSC ring; the server drains the rings into
+// its plot history and the recorder.
+
+pub const packet_size = 512;
+pub const header_size = 16;
+/// Motor bridges per board, TELEMETRY_AXES
+pub const axes = 2;
+/// TMC2240 words per axis, tmc2240.streamed
+pub const drv_regs = tmc2240.streamed.len;
+
+// SYNC_TLM_CH_*
+pub const ch_follow_err: u32 = 1 << 0;
+pub const ch_current: u32 = 1 << 1;
+pub const ch_iq_ref: u32 = 1 << 2;
+pub const ch_encoder: u32 = 1 << 3;
+pub const ch_setpoint: u32 = 1 << 4;
+pub const ch_buffer: u32 = 1 << 5;
+pub const ch_driver: u32 = 1 << 6;
+pub const ch_all: u32 = 0x7f;
+
+/// Servo tick on the node, a sample's tick counts these since the HELLO
+pub const tick_ns: u64 = std.time.ns_per_ms;
+
+/// One sample off the wire. Channels that weren't enabled read 0, `channels`
+/// says which are real.
+pub const Sample = struct {
+    node: u8 = 0,
+    channels: u32 = 0,
+    tick: u32 = 0,
+    err: [axes]f32 = .{ 0, 0 }, // mm
+    id: [axes]f32 = .{ 0, 0 }, // A
+    iq: [axes]f32 = .{ 0, 0 },
+    iq_ref: [axes]f32 = .{ 0, 0 },
+    enc: [axes]i32 = .{ 0, 0 },
+    sp_pos: [axes]f32 = .{ 0, 0 }, // mm
+    sp_vel: [axes]f32 = .{ 0, 0 }, // mm/s
+    jb_depth: u16 = 0,
+    underruns: u16 = 0,
+    drv: [axes][drv_regs]u32 = .{ .{0} ** drv_regs, .{0} ** drv_regs },
+
+    /// Node time of the sample, same clock as MoveCmd.t_ns
+    pub fn nodeNs(self: Sample) u64 {
+        return @as(u64, self.tick) * tick_ns;
+    }
+
+    /// Axis a's TMC2240 registers, zero before the node's first SPI batch
+    pub fn driver(self: Sample, a: usize) tmc2240.Regs {
+        return tmc2240.Regs.decode(self.drv[a]);
+    }
+};
+
+pub fn sampleSize(channels: u32) usize {
+    var n: usize = 4;
+    if (channels & ch_follow_err != 0) n += 4 * axes;
+    if (channels & ch_current != 0) n += 8 * axes;
+    if (channels & ch_iq_ref != 0) n += 4 * axes;
+    if (channels & ch_encoder != 0) n += 4 * axes;
+    if (channels & ch_setpoint != 0) n += 8 * axes;
+    if (channels & ch_buffer != 0) n += 4;
+    if (channels & ch_driver != 0) n += 4 * drv_regs * axes;
+    return n;
+}
+
+pub const Header = struct {
+    count: u8,
+    seq: u16,
+    channels: u32,
+    decimation: u16,
+    axes: u8,
+    sample_size: u8,
+    dropped: u32,
+
+    /// Null unless this is a whole telemetry packet whose samples fit
+    pub fn decode(buf: []const u8) ?Header {
+        if (buf.len != packet_size or buf[0] != @intFromEnum(clock_sync.MsgType.telemetry)) return null;
+        const h: Header = .{
+            .count = buf[1],
+            .seq = std.mem.readInt(u16, buf[2..4], .little),
+            .channels = std.mem.readInt(u32, buf[4..8], .little),
+            .decimation = std.mem.readInt(u16, buf[8..10], .little),
+            .axes = buf[10],
+            .sample_size = buf[11],
+            .dropped = std.mem.readInt(u32, buf[12..16], .little),
+        };
+        if (h.axes != axes or h.sample_size != sampleSize(h.channels)) return null;
+        if (header_size + @as(usize, h.count) * h.sample_size > packet_size) return null;
+        return h;
+    }
+};
+
+const Reader = struct {
+    buf: []const u8,
+    pos: usize = 0,
+
+    fn f32le(self: *Reader) f32 {
+        return @bitCast(self.int(u32));
+    }
+
+    fn int(self: *Reader, comptime T: type) T {
+        const v = std.mem.readInt(T, self.buf[self.pos..][0..@sizeOf(T)], .little);
+        self.pos += @sizeOf(T);
+        return v;
+    }
+};
+
+/// Sample `i` of a packet with header `h`
+pub fn decodeSample(buf: []const u8, h: Header, i: usize) Sample {
+    var r: Reader = .{ .buf = buf, .pos = header_size + i * h.sample_size };
+    var s: Sample = .{ .channels = h.channels };
+    s.tick = r.int(u32);
+    if (h.channels & ch_follow_err != 0) {
+        for (&s.err) |*v| v.* = r.f32le();
+    }
+    if (h.channels & ch_current != 0) {
+        for (0..axes) |a| {
+            s.id[a] = r.f32le();
+            s.iq[a] = r.f32le();
+        }
+    }
+    if (h.channels & ch_iq_ref != 0) {
+        for (&s.iq_ref) |*v| v.* = r.f32le();
+    }
+    if (h.channels & ch_encoder != 0) {
+        for (&s.enc) |*v| v.* = r.int(i32);
+    }
+    if (h.channels & ch_setpoint != 0) {
+        for (0..axes) |a| {
+            s.sp_pos[a] = r.f32le();
+            s.sp_vel[a] = r.f32le();
+        }
+    }
+    if (h.channels & ch_buffer != 0) {
+        s.jb_depth = r.int(u16);
+        s.underruns = r.int(u16);
+    }
+    if (h.channels & ch_driver != 0) {
+        for (&s.drv) |*d| {
+            for (d) |*v| v.* = r.int(u32);
+        }
+    }
+    return s;
+}
+
+pub const Config = struct {
+    channels: u32,
+    decimation: u16,
+
+    pub const size = 8;
+
+    pub fn encode(self: Config, buf: *[size]u8) void {
+        buf[0] = @intFromEnum(clock_sync.MsgType.tlm_cfg);
+        buf[1] = 0;
+        std.mem.writeInt(u16, buf[2..4], self.decimation, .little);
+        std.mem.writeInt(u32, buf[4..8], self.channels, .little);
+    }
+};
+
+pub const Ring = spsc.SpscRing(Sample);
+
+/// One node's stream: the receive thread produces, the server drains
+pub const Stream = struct {
+    ring: Ring,
+    node: u8,
+
+    // receive thread only
+    packets: usize = 0,
+    samples: usize = 0,
+    lost_packets: usize = 0, // seq gaps, USB side
+    overflows: usize = 0, // ring full, the server is behind
+    node_dropped: u32 = 0, // the node's count, its tick found no room
+    next_seq: ?u16 = null,
+
+    pub fn init(gpa: std.mem.Allocator, node: u8, capacity: usize) !Stream {
+        return .{ .ring = try Ring.init(gpa, capacity), .node = node };
+    }
+
+    pub fn deinit(self: *Stream, gpa: std.mem.Allocator) void {
+        self.ring.deinit(gpa);
+    }
+
+    /// A new sync session restarts the node's packet numbers
+    pub fn restart(self: *Stream) void {
+        self.next_seq = null;
+    }
+
+    /// Receive thread: unpack one packet into the ring. False if it isn't a
+    /// telemetry packet.
+    pub fn onPacket(self: *Stream, buf: []const u8) bool {
+        const h = Header.decode(buf) orelse return false;
+        if (self.next_seq) |seq| self.lost_packets += h.seq -% seq;
+        self.next_seq = h.seq +% 1;
+        self.node_dropped = h.dropped;
+        self.packets += 1;
+        for (0..h.count) |i| {
+            var s = decodeSample(buf, h, i);
+            s.node = self.node;
+            if (self.ring.push(s)) self.samples += 1 else self.overflows += 1;
+        }
+        return true;
+    }
+};
+
+/// CSV of every sample the server drains, one row per sample
+pub const Recorder = struct {
+    file: std.fs.File,
+    bw: std.io.BufferedWriter(1 << 16, std.fs.File.Writer),
+    rows: usize = 0,
+
+    const columns = "node,tick,node_ns,channels,err0,err1,id0,iq0,id1,iq1,iq_ref0,iq_ref1,enc0,enc1,sp_pos0,sp_vel0,sp_pos1,sp_vel1,jb_depth,underruns,drv_status0,sg4_result0,mscuract0,adc_temp0,drv_status1,sg4_result1,mscuract1,adc_temp1\n";
+
+    pub fn create(path: []const u8) !Recorder {
+        const file = try std.fs.cwd().createFile(path, .{});
+        errdefer file.close();
+        var r: Recorder = .{ .file = file, .bw = .{ .unbuffered_writer = file.writer() } };
+        try r.bw.writer().writeAll(columns);
+        return r;
+    }
+
+    pub fn write(self: *Recorder, s: Sample) !void {
+        try self.bw.writer().print("{},{},{},{x},{d},{d},{d},{d},{d},{d},{d},{d},{},{},{d},{d},{d},{d},{},{},{x},{x},{x},{x},{x},{x},{x},{x}\n", .{
+            s.node,      s.tick,      s.nodeNs(),  s.channels,
+            s.err[0],    s.err[1],    s.id[0],     s.iq[0],
+            s.id[1],     s.iq[1],     s.iq_ref[0], s.iq_ref[1],
+            s.enc[0],    s.enc[1],    s.sp_pos[0], s.sp_vel[0],
+            s.sp_pos[1], s.sp_vel[1], s.jb_depth,  s.underruns,
+            s.drv[0][0], s.drv[0][1], s.drv[0][2], s.drv[0][3],
+            s.drv[1][0], s.drv[1][1], s.drv[1][2], s.drv[1][3],
+        });
+        self.rows += 1;
+    }
+
+    pub fn close(self: *Recorder) void {
+        self.bw.flush() catch |err| std.log.err("telemetry recorder: {}", .{err});
+        self.file.close();
+    }
+};
+
+fn testPacket(buf: *[packet_size]u8, seq: u16, channels: u32, ticks: []const u32) void {
+    @memset(buf, 0);
+    const size = sampleSize(channels);
+    buf[0] = @intFromEnum(clock_sync.MsgType.telemetry);
+    buf[1] = @intCast(ticks.len);
+    std.mem.writeInt(u16, buf[2..4], seq, .little);
+    std.mem.writeInt(u32, buf[4..8], channels, .little);
+    std.mem.writeInt(u16, buf[8..10], 1, .little);
+    buf[10] = axes;
+    buf[11] = @intCast(size);
+    std.mem.writeInt(u32, buf[12..16], 3, .little);
+    for (ticks, 0..) |t, i| {
+        const p = buf[header_size + i * size ..];
+        std.mem.writeInt(u32, p[0..4], t, .little);
+        if (channels & ch_follow_err != 0) {
+            std.mem.writeInt(u32, p[4..8], @bitCast(@as(f32, 0.5)), .little);
+            std.mem.writeInt(u32, p[8..12], @bitCast(@as(f32, -0.25)), .little);
+        }
+        if (channels == ch_follow_err | ch_encoder) {
+            std.mem.writeInt(i32, p[12..16], -7, .little);
+            std.mem.writeInt(i32, p[16..20], @intCast(t), .little);
+        }
+        if (channels == ch_driver) {
+            for (0..axes * drv_regs) |k| {
+                std.mem.writeInt(u32, p[4 + 4 * k ..][0..4], @intCast(t << 8 | k), .little);
+            }
+        }
+    }
+}
+
+test "telemetry packet layout matches sync_tlm_hdr_t" {
+    try std.testing.expectEqual(@as(usize, 96), sampleSize(ch_all));
+    try std.testing.expectEqual(@as(usize, 20), sampleSize(ch_follow_err | ch_encoder));
+
+    var buf: [packet_size]u8 = undefined;
+    testPacket(&buf, 9, ch_follow_err | ch_encoder, &.{ 10, 11, 12 });
+    const h = Header.decode(&buf).?;
+    try std.testing.expectEqual(@as(u8, 3), h.count);
+    try std.testing.expectEqual(@as(u16, 9), h.seq);
+    try std.testing.expectEqual(@as(u32, 3), h.dropped);
+    const s = decodeSample(&buf, h, 2);
+    try std.testing.expectEqual(@as(u32, 12), s.tick);
+    try std.testing.expectEqual([axes]f32{ 0.5, -0.25 }, s.err);
+    try std.testing.expectEqual([axes]i32{ -7, 12 }, s.enc);
+    try std.testing.expectEqual([axes]f32{ 0, 0 }, s.iq);
+    try std.testing.expectEqual(@as(u64, 12 * std.time.ns_per_ms), s.nodeNs());
+
+    // driver words, axis by axis in tmc_spi_regs[] order
+    testPacket(&buf, 10, ch_driver, &.{ 0, 0x811f00 });
+    const hd = Header.decode(&buf).?;
+    try std.testing.expectEqual(@as(u8, 36), hd.sample_size);
+    const sd = decodeSample(&buf, hd, 1);
+    try std.testing.expectEqual([drv_regs]u32{ 0x811f0004, 0x811f0005, 0x811f0006, 0x811f0007 }, sd.drv[1]);
+    try std.testing.expectEqual(@as(u5, 31), sd.driver(0).drv_status.cs_actual);
+    try std.testing.expect(sd.driver(0).drv_status.stst);
+
+    // short, wrong type, or samples that don't match the channels
+    try std.testing.expectEqual(@as(?Header, null), Header.decode(buf[0 .. packet_size - 1]));
+    var bad = buf;
+    bad[11] = 64;
+    try std.testing.expectEqual(@as(?Header, null), Header.decode(&bad));
+
+    var cfg_buf: [Config.size]u8 = undefined;
+    (Config{ .channels = ch_all, .decimation = 10 }).encode(&cfg_buf);
+    try std.testing.expectEqualSlices(u8, &.{ 8, 0, 10, 0, 0x7f, 0, 0, 0 }, &cfg_buf);
+}
+
+test "stream counts lost packets and a full ring" {
+    const gpa = std.testing.allocator;
+    var stream = try Stream.init(gpa, 1, 4);
+    defer stream.deinit(gpa);
+    var buf: [packet_size]u8 = undefined;
+
+    testPacket(&buf, 65535, ch_follow_err, &.{ 1, 2 });
+    try std.testing.expect(stream.onPacket(&buf));
+    // 0 is lost across the wrap
+    testPacket(&buf, 1, ch_follow_err, &.{ 5, 6, 7, 8, 9, 10 });
+    try std.testing.expect(stream.onPacket(&buf));
+    try std.testing.expectEqual(@as(usize, 1), stream.lost_packets);
+    try std.testing.expectEqual(@as(usize, 7), stream.samples);
+    try std.testing.expectEqual(@as(usize, 1), stream.overflows);
+    try std.testing.expectEqual(@as(u8, 1), stream.ring.pop().?.node);
+
+    try std.testing.expect(!stream.onPacket(buf[0..64]));
+}
+
+test "recorder writes a row per sample" {
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    var path_buf: [std.fs.max_path_bytes]u8 = undefined;
+    const dir = try tmp.dir.realpath(".", &path_buf);
+    const path = try std.fs.path.join(std.testing.allocator, &.{ dir, "tlm.csv" });
+    defer std.testing.allocator.free(path);
+
+    var rec = try Recorder.create(path);
+    try rec.write(.{ .node = 1, .tick = 5, .channels = ch_encoder, .enc = .{ 10, -3 } });
+    rec.close();
+
+    const csv = try tmp.dir.readFileAlloc(std.testing.allocator, "tlm.csv", 4096);
+    defer std.testing.allocator.free(csv);
+    var lines = std.mem.splitScalar(u8, csv, '\n');
+    try std.testing.expect(std.mem.startsWith(u8, lines.next().?, "node,tick,node_ns"));
+    try std.testing.expect(std.mem.startsWith(u8, lines.next().?, "1,5,5000000,8,0,0,"));
+}
@@ -0,0 +1,189 @@
+const std = @import("std");
+const nanopb = @import("nanopb");
+const proto = @import("proto.zig");
+
+// proto.zig against the nanopb generated C: the same bytes for the same
+// message, and each decodes what the other wrote
+
+fn toPbAxis(a: proto.AxisMoveCmd) nanopb.AxisMoveCmd {
+    return .{ .pos = a.pos, .vel = a.vel, .acc = a.acc, .jerk = a.jerk, .snap = a.snap, .crackle = a.crackle };
+}
+
+fn fromPbAxis(a: nanopb.AxisMoveCmd) proto.AxisMoveCmd {
+    return .{ .pos = a.pos, .vel = a.vel, .acc = a.acc, .jerk = a.jerk, .snap = a.snap, .crackle = a.crackle };
+}
+
+pub fn toPb(cmd: proto.Cmd) nanopb.Cmd {
+    var c = std.mem.zeroes(nanopb.Cmd);
+    const p = cmd.payload orelse return c;
+    switch (p) {
+        .moves => |m| {
+            c.which_payload = nanopb.Cmd_moves_tag;
+            c.payload.moves.move_count = @intCast(m.move.len);
+            for (m.move.constSlice(), 0..) |mv, i| {
+                const out = &c.payload.moves.move[i];
+                out.has_x = mv.x != null;
+                out.has_y = mv.y != null;
+                out.has_z = mv.z != null;
+                out.has_e = mv.e != null;
+                out.x = toPbAxis(mv.x orelse .{});
+                out.y = toPbAxis(mv.y orelse .{});
+                out.z = toPbAxis(mv.z orelse .{});
+                out.e = toPbAxis(mv.e orelse .{});
+                out.t_ns = mv.t_ns;
+                out.seq = mv.seq;
+            }
+        },
+        .config_system => |s| {
+            c.which_payload = nanopb.Cmd_config_system_tag;
+            c.payload.config_system = .{ .timestep = s.timestep, .x_axis_idx = s.x_axis_idx, .y_axis_idx = s.y_axis_idx, .z_axis_idx = s.z_axis_idx, .e_axis_idx = s.e_axis_idx };
+        },
+        .setpid => |s| {
+            c.which_payload = nanopb.Cmd_setpid_tag;
+            c.payload.setpid = .{ .axis = s.axis, .p = s.p, .i = s.i, .d = s.d, .tf = s.tf };
+        },
+        .axis_params => |s| {
+            c.which_payload = nanopb.Cmd_axis_params_tag;
+            c.payload.axis_params = .{ .axis = s.axis, .phase_r = s.phase_r, .phase_l = s.phase_l, .enoder_cpr = s.enoder_cpr, .counts_per_mm = s.counts_per_mm };
+        },
+    }
+    return c;
+}
+
+fn fromPb(c: nanopb.Cmd) proto.Cmd {
+    switch (c.which_payload) {
+        nanopb.Cmd_moves_tag => {
+            var m: proto.Moves = .{};
+            for (c.payload.moves.move[0..c.payload.moves.move_count]) |mv| {
+                m.move.appendAssumeCapacity(.{
+                    .x = if (mv.has_x) fromPbAxis(mv.x) else null,
+                    .y = if (mv.has_y) fromPbAxis(mv.y) else null,
+                    .z = if (mv.has_z) fromPbAxis(mv.z) else null,
+                    .e = if (mv.has_e) fromPbAxis(mv.e) else null,
+                    .t_ns = mv.t_ns,
+                    .seq = mv.seq,
+                });
+            }
+            return .{ .payload = .{ .moves = m } };
+        },
+        nanopb.Cmd_config_system_tag => {
+            const s = c.payload.config_system;
+            return .{ .payload = .{ .config_system = .{ .timestep = s.timestep, .x_axis_idx = s.x_axis_idx, .y_axis_idx = s.y_axis_idx, .z_axis_idx = s.z_axis_idx, .e_axis_idx = s.e_axis_idx } } };
+        },
+        nanopb.Cmd_setpid_tag => {
+            const s = c.payload.setpid;
+            return .{ .payload = .{ .setpid = .{ .axis = s.axis, .p = s.p, .i = s.i, .d = s.d, .tf = s.tf } } };
+        },
+        nanopb.Cmd_axis_params_tag => {
+            const s = c.payload.axis_params;
+            return .{ .payload = .{ .axis_params = .{ .axis = s.axis, .phase_r = s.phase_r, .phase_l = s.phase_l, .enoder_cpr = s.enoder_cpr, .counts_per_mm = s.counts_per_mm } } };
+        },
+        else => return .{},
+    }
+}
+
+pub fn pbEncode(c: *const nanopb.Cmd, buf: []u8) !usize {
+    var stream = nanopb.pb_ostream_from_buffer(buf.ptr, buf.len);
+    if (!nanopb.pb_encode_ex(&stream, nanopb.Cmd_fields, c, nanopb.PB_ENCODE_DELIMITED)) return error.Encode;
+    return stream.bytes_written;
+}
+
+pub fn pbDecode(buf: []const u8) !nanopb.Cmd {
+    var c = std.mem.zeroes(nanopb.Cmd);
+    var stream = nanopb.pb_istream_from_buffer(buf.ptr, buf.len);
+    if (!nanopb.pb_decode_ex(&stream, nanopb.Cmd_fields, &c, nanopb.PB_DECODE_DELIMITED)) return error.Decode;
+    return c;
+}
+
+// bit for bit, so -0.0 and 0.0 differ like they do on the wire
+fn expectSameCmd(want: proto.Cmd, got: proto.Cmd) !void {
+    var a: [proto.maxSize(proto.Cmd) + 2]u8 = undefined;
+    var b: [proto.maxSize(proto.Cmd) + 2]u8 = undefined;
+    const na = try proto.encode(proto.Cmd, &want, &a);
+    const nb = try proto.encode(proto.Cmd, &got, &b);
+    try std.testing.expectEqualSlices(u8, a[0..na], b[0..nb]);
+    try std.testing.expectEqual(want.payload == null, got.payload == null);
+    if (want.payload) |p| try std.testing.expectEqual(std.meta.activeTag(p), std.meta.activeTag(got.payload.?));
+}
+
+fn randomFloat(r: std.Random) f32 {
+    return switch (r.uintLessThan(u8, 8)) {
+        0, 1 => 0,
+        2 => -0.0,
+        3 => std.math.floatMax(f32),
+        else => (r.float(f32) - 0.5) * 2000,
+    };
+}
+
+fn randomInt(r: std.Random) i32 {
+    return switch (r.uintLessThan(u8, 4)) {
+        0 => 0,
+        1 => -1 - r.intRangeAtMost(i32, 0, 1000),
+        2 => std.math.minInt(i32),
+        else => r.int(i32),
+    };
+}
+
+fn randomAxis(r: std.Random) ?proto.AxisMoveCmd {
+    if (r.uintLessThan(u8, 4) == 0) return null;
+    return .{ .pos = randomFloat(r), .vel = randomFloat(r), .acc = randomFloat(r), .jerk = randomFloat(r), .snap = randomFloat(r), .crackle = randomFloat(r) };
+}
+
+pub fn randomMove(r: std.Random) proto.MoveCmd {
+    return .{
+        .x = randomAxis(r),
+        .y = randomAxis(r),
+        .z = randomAxis(r),
+        .e = randomAxis(r),
+        .t_ns = if (r.boolean()) r.int(u64) else 0,
+        .seq = if (r.boolean()) r.int(u32) else 0,
+    };
+}
+
+fn randomCmd(r: std.Random) proto.Cmd {
+    switch (r.uintLessThan(u8, 8)) {
+        0 => return .{ .payload = .{ .config_system = .{ .timestep = randomFloat(r), .x_axis_idx = randomInt(r), .y_axis_idx = randomInt(r), .z_axis_idx = randomInt(r), .e_axis_idx = randomInt(r) } } },
+        1 => return .{ .payload = .{ .setpid = .{ .axis = randomInt(r), .p = randomFloat(r), .i = randomFloat(r), .d = randomFloat(r), .tf = randomFloat(r) } } },
+        2 => return .{ .payload = .{ .axis_params = .{ .axis = randomInt(r), .phase_r = randomFloat(r), .phase_l = randomFloat(r), .enoder_cpr = randomFloat(r), .counts_per_mm = randomFloat(r) } } },
+        else => {
+            var m: proto.Moves = .{};
+            for (0..r.uintAtMost(usize, 3)) |_| m.move.appendAssumeCapacity(randomMove(r));
+            return .{ .payload = .{ .moves = m } };
+        },
+    }
+}
+
+test "nanopb bytes for random commands, both ways" {
+    var prng = std.Random.DefaultPrng.init(0x6e616e6f);
+    const r = prng.random();
+    var ours: [proto.maxSize(proto.Cmd) + 2]u8 = undefined;
+    var theirs: [nanopb.Cmd_size + 2]u8 = undefined;
+    for (0..20000) |_| {
+        const cmd = randomCmd(r);
+        const pb = toPb(cmd);
+
+        const n = try proto.encodeDelimited(proto.Cmd, &cmd, &ours);
+        const m = try pbEncode(&pb, &theirs);
+        try std.testing.expectEqualSlices(u8, theirs[0..m], ours[0..n]);
+
+        var used: usize = 0;
+        try expectSameCmd(cmd, try proto.decodeDelimited(proto.Cmd, theirs[0..m], &used));
+        try std.testing.expectEqual(m, used);
+        try expectSameCmd(cmd, fromPb(try pbDecode(ours[0..n])));
+    }
+}
+
+test "largest command" {
+    const axis: proto.AxisMoveCmd = .{ .pos = 1, .vel = 2, .acc = 3, .jerk = 4, .snap = 5, .crackle = 6 };
+    var m: proto.Moves = .{};
+    for (0..3) |i| m.move.appendAssumeCapacity(.{ .x = axis, .y = axis, .z = axis, .e = axis, .t_ns = 1 << 63, .seq = @intCast(i + 1) });
+    const cmd: proto.Cmd = .{ .payload = .{ .moves = m } };
+    try std.testing.expectEqual(@as(usize, nanopb.Cmd_size), proto.encodedSize(proto.Cmd, &cmd));
+
+    var ours: [proto.maxSize(proto.Cmd) + 2]u8 = undefined;
+    var theirs: [nanopb.Cmd_size + 2]u8 = undefined;
+    const n = try proto.encodeDelimited(proto.Cmd, &cmd, &ours);
+    const pb = toPb(cmd);
+    try std.testing.expectEqualSlices(u8, theirs[0..try pbEncode(&pb, &theirs)], ours[0..n]);
+    try std.testing.expectError(error.Overflow, proto.encodeDelimited(proto.Cmd, &cmd, ours[0 .. n - 1]));
+}
@@ -0,0 +1,120 @@
+const std = @import("std");
+
+// TMC2240 registers as the node streams them, SYNC_TLM_CH_DRIVER in
+// sync_protocol.h and firmware/App/inc/tmc2240.h. The words are sent as read
+// off the chip, so these are the datasheet layouts, field for field the
+// Prunt.TMC_Types.TMC2240 records: a word can go straight into an
+// Unchecked_Conversion on the Ada side or a @bitCast here.
+
+pub const gconf = 0x00;
+pub const gstat = 0x01;
+pub const ifcnt = 0x02;
+pub const ioin = 0x04;
+pub const drv_conf = 0x0a;
+pub const ihold_irun = 0x10;
+pub const adc_vsupply_ain = 0x50;
+pub const adc_temp = 0x51;
+pub const mscuract = 0x6b;
+pub const chopconf = 0x6c;
+pub const drv_status = 0x6f;
+pub const sg4_result = 0x75;
+
+/// tmc_spi_regs[], the order of a driver's words in a telemetry sample
+pub const streamed = [_]u8{ drv_status, sg4_result, mscuract, adc_temp };
+
+pub const DrvStatus = packed struct(u32) {
+    sg_result: u10,
+    _r0: u2 = 0,
+    s2vsa: bool,
+    s2vsb: bool,
+    stealth: bool,
+    fsactive: bool,
+    cs_actual: u5,
+    _r1: u3 = 0,
+    stallguard: bool,
+    ot: bool,
+    otpw: bool,
+    s2ga: bool,
+    s2gb: bool,
+    ola: bool,
+    olb: bool,
+    stst: bool,
+
+    /// Any of these and the bridge stays off until GSTAT is cleared
+    pub fn fault(self: DrvStatus) bool {
+        return self.s2vsa or self.s2vsb or self.ot or self.s2ga or self.s2gb;
+    }
+};
+
+pub const Sg4Result = packed struct(u32) {
+    sg4_result: u10,
+    _r0: u22 = 0,
+};
+
+/// Microstep table currents of the two coils
+pub const Mscuract = packed struct(u32) {
+    cur_a: i9,
+    _r0: u7 = 0,
+    cur_b: i9,
+    _r1: u7 = 0,
+};
+
+pub const AdcTemp = packed struct(u32) {
+    adc_temp: u13,
+    _r0: u19 = 0,
+
+    pub fn celsius(self: AdcTemp) f32 {
+        return (@as(f32, @floatFromInt(self.adc_temp)) - 2038.0) / 7.7;
+    }
+};
+
+/// One driver's words from a telemetry sample
+pub const Regs = struct {
+    drv_status: DrvStatus,
+    sg4_result: Sg4Result,
+    mscuract: Mscuract,
+    adc_temp: AdcTemp,
+
+    pub fn decode(words: [streamed.len]u32) Regs {
+        return .{
+            .drv_status = @bitCast(words[0]),
+            .sg4_result = @bitCast(words[1]),
+            .mscuract = @bitCast(words[2]),
+            .adc_temp = @bitCast(words[3]),
+        };
+    }
+
+    pub fn encode(self: Regs) [streamed.len]u32 {
+        return .{
+            @bitCast(self.drv_status),
+            @bitCast(self.sg4_result),
+            @bitCast(self.mscuract),
+            @bitCast(self.adc_temp),
+        };
+    }
+};
+
+test "register layouts match the datasheet" {
+    // the same words test_tmc2240.c checks the C field macros with
+    const st: DrvStatus = @bitCast(@as(u32, 0x811f0042 | 1 << 25));
+    try std.testing.expectEqual(@as(u10, 0x42), st.sg_result);
+    try std.testing.expectEqual(@as(u5, 31), st.cs_actual);
+    try std.testing.expect(st.stst and st.stallguard and st.ot and !st.otpw);
+    try std.testing.expect(st.fault());
+
+    const cur: Mscuract = @bitCast(@as(u32, 0x1ff << 16 | 0x100));
+    try std.testing.expectEqual(@as(i9, -256), cur.cur_a);
+    try std.testing.expectEqual(@as(i9, -1), cur.cur_b);
+
+    const temp: AdcTemp = .{ .adc_temp = 2038 + 77 };
+    try std.testing.expectApproxEqAbs(@as(f32, 10), temp.celsius(), 0.01);
+}
+
+test "regs round trip" {
+    const words = [_]u32{ 0x80140123, 0x3ff, @as(u32, 0x108) << 16 | 0xf7, 0x7f6 };
+    const r = Regs.decode(words);
+    try std.testing.expectEqual(@as(u5, 20), r.drv_status.cs_actual);
+    try std.testing.expectEqual(@as(i9, 247), r.mscuract.cur_a);
+    try std.testing.expectEqual(@as(i9, -248), r.mscuract.cur_b);
+    try std.testing.expectEqual(words, r.encode());
+}
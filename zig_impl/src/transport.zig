@@ -1,10 +1,23 @@
 const std = @import("std");
 const types = @import("types.zig");
 const usb = @import("usb.zig");
-const nanopb = @import("nanopb");
+const proto = @import("proto.zig");
+const clock_sync = @import("clock_sync.zig");
+const telemetry = @import("telemetry.zig");
+const latency = @import("latency.zig");
 
 const Cmd = types.Cmd;
 
+/// Moves per Cmd frame, max_count of Moves.move in messages.proto
+pub const max_batch = 3;
+
+/// Type byte, varint length and the largest Cmd
+pub const cmd_frame_size = 1 + 5 + proto.maxSize(proto.Cmd);
+// an OUT frame that hasn't gone out by then has failed
+const out_timeout_ms = 100;
+// longest wait between receive tries while the IN endpoint keeps failing
+const max_recv_backoff_ms = 100;
+
 pub const Transport = struct {
     ptr: *anyopaque,
     sendFn: *const fn (ptr: *anyopaque, msg: Cmd) anyerror!void,
@@ -29,24 +42,58 @@ pub const USBTransport = struct {
     vendor_if_num: u8 = 2,
     vendor_ep_out: usb.EndpointAddress = .{ .number = 0x6, .direction = .out },
     vendor_ep_in: usb.EndpointAddress = .{ .number = 0x6, .direction = .in },
+    // the receive thread answers sync requests while moves go out, one OUT
+    // transfer at a time so t2 is taken when ours is next on the wire
+    send_lock: std.Thread.Mutex = .{},
+    // Cmd frames are encoded into these and submitted without waiting
+    out_pool: usb.TransferPool = .{},
+    // the server's latency stats, encode times go here and the pool's
+    // transfer and end to end times
+    lat: ?*latency.Pipeline = null,
 
     pub fn init(pid: u16, vid: u16) !USBTransport {
-        std.log.info("Initializiing USB Transport", .{});
+        return initIndex(pid, vid, 0);
+    }
+
+    /// Open the `index`-th board with this VID:PID, each node of a multi
+    /// board setup gets its own transport and libusb context.
+    pub fn initIndex(pid: u16, vid: u16, index: usize) !USBTransport {
+        std.log.info("Initializiing USB Transport {}", .{index});
 
         _ = usb.Context.setLogLevel(0);
 
         var ctx = try usb.Context.init();
         errdefer ctx.deinit();
 
-        const maybe_handle = try ctx.openDeviceByVidPid(vid, pid);
+        const maybe_handle = try ctx.openDeviceByVidPidIndex(vid, pid, index);
         if (maybe_handle == null) {
             std.log.err(
-                "skipping: device {x:0>4}:{x:0>4} not present\n",
-                .{ vid, pid },
+                "skipping: device {x:0>4}:{x:0>4} #{} not present\n",
+                .{ vid, pid, index },
             );
             return USBError.InitializationError;
         }
-        var handle = maybe_handle.?;
+        return claim(ctx, maybe_handle.?);
+    }
+
+    /// Open the board with this serial number string, the same board whatever
+    /// port it is on or the order it enumerated in.
+    pub fn initSerial(pid: u16, vid: u16, serial: []const u8) !USBTransport {
+        _ = usb.Context.setLogLevel(0);
+
+        var ctx = try usb.Context.init();
+        errdefer ctx.deinit();
+
+        const maybe_handle = try ctx.openDeviceBySerial(vid, pid, serial);
+        if (maybe_handle == null) {
+            std.log.debug("device {x:0>4}:{x:0>4} {s} not present", .{ vid, pid, serial });
+            return USBError.InitializationError;
+        }
+        return claim(ctx, maybe_handle.?);
+    }
+
+    fn claim(ctx: usb.Context, handle_: usb.DeviceHandle) !USBTransport {
+        var handle = handle_;
         errdefer handle.close();
 
         handle.setAutoDetachKernelDriver(true) catch |e| {
@@ -66,9 +113,22 @@ pub const USBTransport = struct {
         };
         return ret;
     }
+    /// Buffers for Cmd frames. The pool points back at the transport, so
+    /// this goes once it is where it stays.
+    pub fn start_pool(self: *@This()) !void {
+        self.out_pool.lat = self.lat;
+        try self.out_pool.start(&self.dev, self.vendor_ep_out, cmd_frame_size, out_timeout_ms);
+    }
+
+    /// Bus position of the open board, to match hotplug events against.
+    pub fn location(self: *@This()) usb.DeviceLocation {
+        const loc = self.dev.getBusAndAddress();
+        return .{ .bus = loc.bus, .address = loc.address };
+    }
+
     pub fn send(self: *@This(), msg: Cmd) !void {
         switch (msg) {
-            .MoveCmd => |c| try self.send_move(c),
+            .MoveCmd => |c| try self.send_move(c, types.DeviceConfig.all),
         }
     }
     pub fn transport(self: *@This()) Transport {
@@ -93,8 +153,15 @@ pub const USBTransport = struct {
         };
     }
     pub fn bulk_transfer_send(self: *@This(), data: []const u8) !usize {
+        self.send_lock.lock();
+        defer self.send_lock.unlock();
+        return self.bulk_transfer_send_locked(data);
+    }
+    fn bulk_transfer_send_locked(self: *@This(), data: []const u8) !usize {
         const actual_xfer_len = self.dev.bulkOut(self.vendor_ep_out, data, 100) catch |e| {
             std.log.err("bulk transfer error: {}\n", .{e});
+            // the caller reattaches on this one
+            if (e == usb.UsbError.NoDevice) return e;
             return USBError.Error;
         };
         if (actual_xfer_len != data.len) {
@@ -102,97 +169,185 @@ pub const USBTransport = struct {
         }
         return actual_xfer_len;
     }
-    pub fn bulk_transfer_recv(self: *@This(), data: *[]u8) !usize {
+    pub fn bulk_transfer_recv(self: *@This(), data: []u8) !usize {
         const recv_len = self.dev.bulkIn(self.vendor_ep_in, data, 100) catch |e| {
-            std.log.err("bulk transfer error: {}\n", .{e});
-            return USBError.Error;
+            if (e == usb.UsbError.Timeout) return 0;
+            return e;
         };
         return recv_len;
     }
 
-    fn zig_axis_move_to_pb(axis: types.AxisMoveCmd) nanopb.AxisMoveCmd {
-        var pb_move: nanopb.AxisMoveCmd = undefined;
-        pb_move.pos = axis.pos;
-        pb_move.vel = axis.vel;
-        pb_move.acc = axis.acc;
-        pb_move.jerk = axis.jerk;
-        pb_move.snap = axis.snap;
-        // pb_move.has_crackle = true;
-        pb_move.crackle = axis.crackle;
-        return pb_move;
-    }
-
-    fn zig_move_to_pb(move: types.MoveCmd) nanopb.MoveCmd {
-        var pb_move: nanopb.MoveCmd = undefined;
-        pb_move.has_x = true;
-        pb_move.has_y = true;
-        pb_move.has_z = true;
-        pb_move.has_e = true;
-        pb_move.x = zig_axis_move_to_pb(move.X);
-        pb_move.y = zig_axis_move_to_pb(move.Y);
-        pb_move.z = zig_axis_move_to_pb(move.Z);
-        pb_move.e = zig_axis_move_to_pb(move.E);
-        return pb_move;
-    }
-
-    fn pb_move_to_zig(move: nanopb.MoveCmd) types.MoveCmd {
-        var zig_move: types.MoveCmd = undefined;
-        zig_move.X = pb_axis_move_to_zig(move.x);
-        zig_move.Y = pb_axis_move_to_zig(move.y);
-        zig_move.Z = pb_axis_move_to_zig(move.z);
-        zig_move.E = pb_axis_move_to_zig(move.e);
-        return zig_move;
-    }
-    fn pb_axis_move_to_zig(axis: nanopb.AxisMoveCmd) types.AxisMoveCmd {
-        var zig_axis: types.AxisMoveCmd = undefined;
-        zig_axis.pos = axis.pos;
-        zig_axis.vel = axis.vel;
-        zig_axis.acc = axis.acc;
-        zig_axis.jerk = axis.jerk;
-        zig_axis.snap = axis.snap;
-        zig_axis.crackle = axis.crackle;
-        return zig_axis;
-    }
-
-    pub fn send_move(self: *@This(), msg: types.MoveCmd) !void {
-        // _ = self;
-        // std.debug.print("***************************************\n", .{});
-
-        var cmd: nanopb.Cmd = undefined;
-        cmd.which_payload = nanopb.Cmd_moves_tag;
-        cmd.payload.moves.move_count = 1;
-        cmd.payload.moves.move[0] = zig_move_to_pb(msg);
-        var buf: [nanopb.Cmd_size]u8 = undefined;
-        const len: usize = buf.len;
-        var stream = nanopb.pb_ostream_from_buffer(@ptrCast(@constCast(buf[0..].ptr)), len);
-        const status = nanopb.pb_encode_ex(@constCast(&stream), nanopb.Cmd_fields, &cmd, nanopb.PB_ENCODE_DELIMITED);
-        if (!status) {
-            std.log.err("Failed to encode pb: {s}", .{stream.errmsg});
-            return USBError.Error;
+    /// Starts a sync session: the node zeroes its clock on the HELLO and
+    /// starts sending requests, we zero ours right behind it. The HELLO
+    /// carries what we can do, the node answers with Caps.
+    pub fn send_hello(self: *@This(), sync: *clock_sync.ClockSync) !void {
+        var buf: [clock_sync.Hello.size]u8 = undefined;
+        const hello: clock_sync.Hello = .{
+            .encodings = clock_sync.enc_pb,
+            .features = clock_sync.feat_timestamped_sp | clock_sync.feat_ack | clock_sync.feat_sof_drift | clock_sync.feat_telemetry | clock_sync.feat_motion,
+            .max_batch = max_batch,
+        };
+        hello.encode(&buf);
+        _ = try self.bulk_transfer_send(&buf);
+        sync.onHello();
+    }
+
+    fn send_sync_resp(self: *@This(), sync: *clock_sync.ClockSync, req: clock_sync.Req, t1_ns: u64) !void {
+        self.send_lock.lock();
+        defer self.send_lock.unlock();
+        // t2 below is only right with nothing of ours queued ahead of it
+        self.out_pool.waitIdle(out_timeout_ms * std.time.us_per_ms) catch {};
+        var buf: [clock_sync.Resp.size]u8 = undefined;
+        const resp: clock_sync.Resp = .{ .seq = req.seq, .t1_ns = t1_ns, .t2_ns = sync.clock.now() };
+        resp.encode(&buf);
+        _ = try self.bulk_transfer_send_locked(&buf);
+    }
+
+    /// Pick the telemetry channels, 0 stops the stream
+    pub fn send_telemetry_config(self: *@This(), cfg: telemetry.Config) !void {
+        var buf: [telemetry.Config.size]u8 = undefined;
+        cfg.encode(&buf);
+        _ = try self.bulk_transfer_send(&buf);
+    }
+
+    /// Receive thread for the vendor IN endpoint. Sync requests are answered
+    /// straight from here with t1 read as soon as the transfer returns, stats
+    /// update the estimate the motion sender checks, telemetry packets go
+    /// into `tlm`. Runs until `sync.running` is cleared or the device goes
+    /// away.
+    pub fn recv_loop(self: *@This(), sync: *clock_sync.ClockSync, tlm: *telemetry.Stream) void {
+        var buf: [512]u8 = undefined; // one high speed bulk packet
+        // an error comes straight back, not after the transfer timeout: wait
+        // before the next try, longer while they keep coming
+        var backoff_ms: u64 = 0;
+        while (sync.running.load(.acquire)) {
+            const n = self.bulk_transfer_recv(&buf) catch |e| {
+                if (e == usb.UsbError.NoDevice) break;
+                sync.recv_errors += 1;
+                if (backoff_ms == 0) std.log.err("bulk transfer error: {}", .{e});
+                // a stalled endpoint stays stalled until told otherwise
+                if (e == usb.UsbError.Pipe) self.dev.clearHalt(self.vendor_ep_in) catch {};
+                backoff_ms = @min(@max(backoff_ms * 2, 1), max_recv_backoff_ms);
+                std.Thread.sleep(backoff_ms * std.time.ns_per_ms);
+                continue;
+            };
+            backoff_ms = 0;
+            const t1_ns = sync.clock.now();
+            if (n == 0) continue;
+
+            const msg = buf[0..n];
+            switch (@as(clock_sync.MsgType, @enumFromInt(msg[0]))) {
+                .req => if (clock_sync.Req.decode(msg)) |req| {
+                    sync.requests += 1;
+                    self.send_sync_resp(sync, req, t1_ns) catch {
+                        sync.send_errors += 1;
+                    };
+                } else {
+                    sync.unknown += 1;
+                },
+                .stats => if (clock_sync.Stats.decode(msg)) |stats| {
+                    sync.onStats(stats, t1_ns);
+                    std.log.debug("sync {}: offset {} ns delay {} ns corr {} ppm", .{ stats.seq, stats.offset_ns, stats.delay_ns, stats.freq_corr_ppm });
+                } else {
+                    sync.unknown += 1;
+                },
+                .telemetry => if (!tlm.onPacket(msg)) {
+                    sync.unknown += 1;
+                },
+                .caps => if (clock_sync.Caps.decode(msg)) |caps| {
+                    sync.onCaps(caps);
+                    std.log.info("node caps: encodings {x} features {x} batch {} buffer {} rate {} Hz ep {}/{}, using encoding {x} features {x} batch {}", .{ caps.encodings, caps.features, caps.max_batch, caps.sp_buffer, caps.max_rate_hz, caps.ep_out_size, caps.ep_in_size, caps.encoding, caps.features_on, caps.batch });
+                } else {
+                    sync.unknown += 1;
+                },
+                else => sync.unknown += 1,
+            }
         }
-        // @memset(buf[0..len], 43);
-        std.log.info("msg size: {}, bytes encoded: {}\n", .{ @bitSizeOf(types.MoveCmd) / 8, stream.bytes_written });
-        _ = self.bulk_transfer_send(buf[0..stream.bytes_written]) catch |e| {
+        sync.running.store(false, .release);
+        std.log.info("sync receive loop done: {} requests, {} stats, {} unknown, {} send errors, {} receive errors", .{ sync.requests, sync.stats, sync.unknown, sync.send_errors, sync.recv_errors });
+    }
+
+    fn zig_axis_move_to_pb(axis: types.AxisMoveCmd) proto.AxisMoveCmd {
+        return .{
+            .pos = axis.pos,
+            .vel = axis.vel,
+            .acc = axis.acc,
+            .jerk = axis.jerk,
+            .snap = axis.snap,
+            .crackle = axis.crackle,
+        };
+    }
+
+    fn zig_move_to_pb(move: types.MoveCmd, axes: types.DeviceConfig) proto.MoveCmd {
+        // axes another node drives are left out of the frame
+        return .{
+            .x = if (axes.x) zig_axis_move_to_pb(move.X) else null,
+            .y = if (axes.y) zig_axis_move_to_pb(move.Y) else null,
+            .z = if (axes.z) zig_axis_move_to_pb(move.Z) else null,
+            .e = if (axes.e) zig_axis_move_to_pb(move.E) else null,
+            .t_ns = move.t_ns,
+            .seq = move.seq,
+        };
+    }
+
+    pub fn send_move(self: *@This(), msg: types.MoveCmd, axes: types.DeviceConfig) !void {
+        return self.send_moves(&.{msg}, axes, 0);
+    }
+
+    /// Up to max_batch moves in one Cmd frame, as many as the node's Caps
+    /// batch allows. `origin_ns` is when the oldest of them was enqueued,
+    /// latency.now() time, 0 to leave the frame out of the end to end stats.
+    pub fn send_moves(self: *@This(), msgs: []const types.MoveCmd, axes: types.DeviceConfig, origin_ns: u64) !void {
+        std.debug.assert(msgs.len >= 1 and msgs.len <= max_batch);
+        var cmd: proto.Cmd = .{ .payload = .{ .moves = .{} } };
+        for (msgs) |m| cmd.payload.?.moves.move.appendAssumeCapacity(zig_move_to_pb(m, axes));
+        self.send_cmd(&cmd, origin_ns) catch |e| {
             std.log.err("Failed to send move: {}\n", .{e});
+            if (e == usb.UsbError.NoDevice) return e;
             return USBError.Error;
         };
-        // read the message back for debugging
-        // var istream = nanopb.pb_istream_from_buffer(@ptrCast(@constCast(buf[0..].ptr)), stream.bytes_written);
-        // var recv_cmd: nanopb.Cmd = undefined;
-        // const status2 = nanopb.pb_decode_ex(@constCast(&istream), nanopb.Cmd_fields, &recv_cmd, nanopb.PB_DECODE_DELIMITED);
-
-        // // const tcmd = pb_move_to_zig(cmd.payload.moves.move[0]);
-        // // const rcmd = pb_move_to_zig(recv_cmd.payload.moves.move[0]);
+    }
 
-        // if (!status2) {
-        //     std.log.err("Failed to decode pb: {}\n", .{status2});
-        // }
+    /// Tell a node which of the global axes it drives: the motor index for
+    /// each of X, Y, Z, E, or -1 for axes on another node.
+    pub fn send_config_system(self: *@This(), timestep: f32, axis_idx: [4]i32) !void {
+        const cmd: proto.Cmd = .{ .payload = .{ .config_system = .{
+            .timestep = timestep,
+            .x_axis_idx = axis_idx[0],
+            .y_axis_idx = axis_idx[1],
+            .z_axis_idx = axis_idx[2],
+            .e_axis_idx = axis_idx[3],
+        } } };
+        self.send_cmd(&cmd, 0) catch |e| {
+            std.log.err("Failed to send config: {}\n", .{e});
+            return USBError.Error;
+        };
+    }
 
-        // std.debug.print("trans_cmd: {any}\n", .{tcmd});
-        // std.debug.print("recv_cmd: {any}\n", .{rcmd});
+    /// Encodes straight into a pooled transfer buffer and submits it as it
+    /// is, the bytes aren't copied on the way. Returns once it is queued, an
+    /// error of the transfer comes back from a later send.
+    fn send_cmd(self: *@This(), cmd: *const proto.Cmd, origin_ns: u64) !void {
+        const out = try self.out_pool.acquire();
+        // the sync messages share the endpoint, a type byte in front tells
+        // the node this one is a Cmd (varint length and message follow)
+        const buf = out.data;
+        buf[0] = @intFromEnum(clock_sync.MsgType.cmd);
+        const t0 = if (self.lat != null) latency.now() else 0;
+        const n = proto.encodeDelimited(proto.Cmd, cmd, buf[1..cmd_frame_size]) catch |e| {
+            self.out_pool.release(out);
+            std.log.err("Failed to encode pb: {}", .{e});
+            return USBError.Error;
+        };
+        if (self.lat) |lat| lat.since(.encode, t0);
+        std.log.debug("msg size: {}, bytes encoded: {}\n", .{ @bitSizeOf(types.MoveCmd) / 8, n });
+        self.send_lock.lock();
+        defer self.send_lock.unlock();
+        try self.out_pool.submit(out, 1 + n, origin_ns);
     }
 
     pub fn deinit(self: *@This()) void {
+        self.out_pool.deinit();
         self.dev.releaseInterface(self.vendor_if_num);
         self.dev.close();
         self.ctx.deinit();
@@ -6,6 +6,34 @@ const Cmd = union(enum) {
 
 pub const Axis = enum { X, Y, Z, E };
 
+/// Which of the axes a node drives
+pub const DeviceConfig = struct {
+    x: bool = false,
+    y: bool = false,
+    z: bool = false,
+    e: bool = false,
+
+    pub const all: DeviceConfig = .{ .x = true, .y = true, .z = true, .e = true };
+
+    pub fn has(self: DeviceConfig, axis: Axis) bool {
+        return switch (axis) {
+            .X => self.x,
+            .Y => self.y,
+            .Z => self.z,
+            .E => self.e,
+        };
+    }
+
+    pub fn set(self: *DeviceConfig, axis: Axis) void {
+        switch (axis) {
+            .X => self.x = true,
+            .Y => self.y = true,
+            .Z => self.z = true,
+            .E => self.e = true,
+        }
+    }
+};
+
 pub const AxisMoveCmd = struct {
     pos: f32,
     vel: f32,
@@ -19,4 +47,6 @@ pub const MoveCmd = struct {
     Y: AxisMoveCmd,
     Z: AxisMoveCmd,
     E: AxisMoveCmd,
+    t_ns: u64 = 0, // node scheduler time to run at, stamped by the server
+    seq: u32 = 0, // sample number, the node acks the last one it ran
 };
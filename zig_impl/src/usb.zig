@@ -1,5 +1,6 @@
 const std = @import("std");
 pub const libusb = @import("libusb");
+const latency = @import("latency.zig");
 
 pub const Allocator = std.mem.Allocator;
 
@@ -164,6 +165,25 @@ pub const EndpointAddress = struct {
     }
 };
 
+/// Longest serial number string read, the boards send 24 hex digits.
+pub const max_serial_len = 64;
+
+pub const HotplugEvent = enum { arrived, left };
+
+/// Where a device sits on the bus, stable while it stays attached.
+pub const DeviceLocation = struct {
+    bus: u8,
+    address: u8,
+
+    pub fn eql(a: DeviceLocation, b: DeviceLocation) bool {
+        return a.bus == b.bus and a.address == b.address;
+    }
+};
+
+pub const HotplugHandle = struct {
+    raw: libusb.libusb_hotplug_callback_handle,
+};
+
 /// A libusb context. Create this once per process (or once per library user).
 pub const Context = struct {
     raw: *libusb.libusb_context,
@@ -210,6 +230,187 @@ pub const Context = struct {
             .raw = handle.?,
         };
     }
+
+    /// Number of attached devices with this vendor/product ID.
+    pub fn countDevices(self: *Context, vendor_id: u16, product_id: u16) UsbError!usize {
+        var list: [*c]?*libusb.libusb_device = undefined;
+        const cnt = libusb.libusb_get_device_list(self.raw, &list);
+        if (cnt < 0) return mapLibusbError(@intCast(cnt));
+        defer libusb.libusb_free_device_list(list, 1);
+
+        var n: usize = 0;
+        for (0..@intCast(cnt)) |i| {
+            if (matchVidPid(list[i].?, vendor_id, product_id)) n += 1;
+        }
+        return n;
+    }
+
+    /// Open the `index`-th device with this vendor/product ID, in bus
+    /// enumeration order. Returns `null` if there are not that many.
+    pub fn openDeviceByVidPidIndex(
+        self: *Context,
+        vendor_id: u16,
+        product_id: u16,
+        index: usize,
+    ) UsbError!?DeviceHandle {
+        var list: [*c]?*libusb.libusb_device = undefined;
+        const cnt = libusb.libusb_get_device_list(self.raw, &list);
+        if (cnt < 0) return mapLibusbError(@intCast(cnt));
+        defer libusb.libusb_free_device_list(list, 1);
+
+        var n: usize = 0;
+        for (0..@intCast(cnt)) |i| {
+            const dev = list[i].?;
+            if (!matchVidPid(dev, vendor_id, product_id)) continue;
+            if (n == index) {
+                var handle: ?*libusb.libusb_device_handle = null;
+                try checkResult(libusb.libusb_open(dev, &handle));
+                return DeviceHandle{ .ctx = self, .raw = handle.? };
+            }
+            n += 1;
+        }
+        return null;
+    }
+
+    /// Serial number strings of the attached devices with this vendor/product
+    /// ID, in bus enumeration order. Devices that can't be opened (claimed by
+    /// another process, no permission) are left out. Free with `freeSerials`.
+    pub fn listSerials(
+        self: *Context,
+        gpa: Allocator,
+        vendor_id: u16,
+        product_id: u16,
+    ) (UsbError || Allocator.Error)![][]const u8 {
+        var list: [*c]?*libusb.libusb_device = undefined;
+        const cnt = libusb.libusb_get_device_list(self.raw, &list);
+        if (cnt < 0) return mapLibusbError(@intCast(cnt));
+        defer libusb.libusb_free_device_list(list, 1);
+
+        var serials = std.ArrayList([]const u8).init(gpa);
+        errdefer {
+            for (serials.items) |sn| gpa.free(sn);
+            serials.deinit();
+        }
+        for (0..@intCast(cnt)) |i| {
+            const dev = list[i].?;
+            if (!matchVidPid(dev, vendor_id, product_id)) continue;
+            var buf: [max_serial_len]u8 = undefined;
+            const sn = readSerial(dev, &buf) orelse continue;
+            try serials.append(try gpa.dupe(u8, sn));
+        }
+        return serials.toOwnedSlice();
+    }
+
+    pub fn freeSerials(gpa: Allocator, serials: [][]const u8) void {
+        for (serials) |sn| gpa.free(sn);
+        gpa.free(serials);
+    }
+
+    /// Open the device with this vendor/product ID and serial number string.
+    /// Returns `null` if it isn't attached.
+    pub fn openDeviceBySerial(
+        self: *Context,
+        vendor_id: u16,
+        product_id: u16,
+        serial: []const u8,
+    ) UsbError!?DeviceHandle {
+        var list: [*c]?*libusb.libusb_device = undefined;
+        const cnt = libusb.libusb_get_device_list(self.raw, &list);
+        if (cnt < 0) return mapLibusbError(@intCast(cnt));
+        defer libusb.libusb_free_device_list(list, 1);
+
+        for (0..@intCast(cnt)) |i| {
+            const dev = list[i].?;
+            if (!matchVidPid(dev, vendor_id, product_id)) continue;
+            var buf: [max_serial_len]u8 = undefined;
+            const sn = readSerial(dev, &buf) orelse continue;
+            if (!std.mem.eql(u8, sn, serial)) continue;
+            var handle: ?*libusb.libusb_device_handle = null;
+            try checkResult(libusb.libusb_open(dev, &handle));
+            return DeviceHandle{ .ctx = self, .raw = handle.? };
+        }
+        return null;
+    }
+
+    /// Serial number string of `dev`, null if it has none or can't be opened.
+    fn readSerial(dev: *libusb.libusb_device, buf: []u8) ?[]u8 {
+        var desc: libusb.libusb_device_descriptor = undefined;
+        if (libusb.libusb_get_device_descriptor(dev, &desc) < 0) return null;
+        if (desc.iSerialNumber == 0) return null;
+        var handle: ?*libusb.libusb_device_handle = null;
+        if (libusb.libusb_open(dev, &handle) < 0) return null;
+        defer libusb.libusb_close(handle);
+        const rc = libusb.libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, buf.ptr, @intCast(buf.len));
+        if (rc <= 0) return null;
+        return buf[0..@intCast(rc)];
+    }
+
+    /// True if this platform's libusb delivers hotplug events.
+    pub fn hasHotplug() bool {
+        return libusb.libusb_has_capability(libusb.LIBUSB_CAP_HAS_HOTPLUG) != 0;
+    }
+
+    /// Call `callback(user, event, location)` for every device with this
+    /// vendor/product ID that arrives or leaves. Callbacks run from
+    /// `handleEventsTimeout` on the thread calling it and must not do
+    /// synchronous I/O, libusb holds its event lock around them.
+    pub fn registerHotplug(
+        self: *Context,
+        vendor_id: u16,
+        product_id: u16,
+        comptime User: type,
+        user: *User,
+        comptime callback: fn (*User, HotplugEvent, DeviceLocation) void,
+    ) UsbError!HotplugHandle {
+        const Wrapper = struct {
+            fn cb(
+                _: ?*libusb.libusb_context,
+                dev: ?*libusb.libusb_device,
+                event: libusb.libusb_hotplug_event,
+                user_data: ?*anyopaque,
+            ) callconv(.C) c_int {
+                const ev: HotplugEvent = if (event == libusb.LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) .arrived else .left;
+                callback(@ptrCast(@alignCast(user_data)), ev, .{
+                    .bus = libusb.libusb_get_bus_number(dev),
+                    .address = libusb.libusb_get_device_address(dev),
+                });
+                return 0; // stay registered
+            }
+        };
+        var handle: libusb.libusb_hotplug_callback_handle = 0;
+        try checkResult(libusb.libusb_hotplug_register_callback(
+            self.raw,
+            @intCast(libusb.LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | libusb.LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+            0,
+            vendor_id,
+            product_id,
+            libusb.LIBUSB_HOTPLUG_MATCH_ANY,
+            Wrapper.cb,
+            user,
+            &handle,
+        ));
+        return .{ .raw = handle };
+    }
+
+    pub fn deregisterHotplug(self: *Context, handle: HotplugHandle) void {
+        libusb.libusb_hotplug_deregister_callback(self.raw, handle.raw);
+    }
+
+    /// Run pending libusb events (hotplug callbacks, async transfers), waiting
+    /// at most `timeout_us` for one.
+    pub fn handleEventsTimeout(self: *Context, timeout_us: u32) UsbError!void {
+        var tv: libusb.struct_timeval = .{
+            .tv_sec = @intCast(timeout_us / std.time.us_per_s),
+            .tv_usec = @intCast(timeout_us % std.time.us_per_s),
+        };
+        try checkResult(libusb.libusb_handle_events_timeout_completed(self.raw, &tv, null));
+    }
+
+    fn matchVidPid(dev: *libusb.libusb_device, vendor_id: u16, product_id: u16) bool {
+        var desc: libusb.libusb_device_descriptor = undefined;
+        if (libusb.libusb_get_device_descriptor(dev, &desc) < 0) return false;
+        return desc.idVendor == vendor_id and desc.idProduct == product_id;
+    }
 };
 
 /// An open handle to a USB device, associated with a Context.
@@ -271,6 +472,12 @@ pub const DeviceHandle = struct {
         try checkResult(rc);
     }
 
+    /// Clear a halt (stall) on an endpoint, resets its data toggle too.
+    pub fn clearHalt(self: *DeviceHandle, endpoint: EndpointAddress) UsbError!void {
+        const rc = libusb.libusb_clear_halt(self.raw, endpoint.toRaw());
+        try checkResult(rc);
+    }
+
     /// Get the low-level bus number and device address.
     pub fn getBusAndAddress(self: *DeviceHandle) struct { bus: u8, address: u8 } {
         const dev = libusb.libusb_get_device(self.raw);
@@ -503,6 +710,244 @@ pub const DeviceHandle = struct {
     }
 };
 
+// ------------------------------------------------------------
+// Pooled asynchronous bulk OUT
+// ------------------------------------------------------------
+
+/// A fixed set of bulk OUT transfers, each with a buffer of whole max size
+/// packets. A sender takes a buffer, encodes straight into it and submits
+/// it as it is; the completion puts it back. Where the platform can
+/// (usbfs) the buffers are libusb_dev_mem_alloc'd, mapped by the kernel, so
+/// the bytes aren't copied again on their way to the controller either.
+///
+/// Completions run on whichever thread handles the context's events: a
+/// synchronous transfer on another thread, or acquire() and waitIdle()
+/// when they wait. The pool must stay where start() was called on it until
+/// deinit().
+pub const TransferPool = struct {
+    pub const len = 8;
+    // how long acquire() waits for a completion, a transfer times out
+    // before that
+    const acquire_wait_us = 200 * std.time.us_per_ms;
+    const wait_step_us = std.time.us_per_ms;
+
+    pub const Buffer = struct {
+        index: u8,
+        data: []u8,
+    };
+
+    ctx: ?*libusb.libusb_context = null,
+    handle: ?*libusb.libusb_device_handle = null,
+    xfers: [len]?*libusb.libusb_transfer = .{null} ** len,
+    bufs: [len][]u8 = .{&.{}} ** len,
+    dev_mem: bool = false,
+
+    lock: std.Thread.Mutex = .{},
+    free: [len]u8 = undefined,
+    free_len: usize = 0,
+    in_flight: std.atomic.Value(u32) = std.atomic.Value(u32).init(0),
+    // the first error a completion reported, for the next acquire()
+    failed: ?UsbError = null,
+
+    submitted: usize = 0,
+    completed: usize = 0,
+    waits: usize = 0, // acquire() found every buffer in flight
+    errors: usize = 0,
+
+    // transfer and end to end latency, and the in flight high water mark,
+    // when set; stamped per buffer at submit
+    lat: ?*latency.Pipeline = null,
+    submit_ns: [len]u64 = .{0} ** len,
+    origin_ns: [len]u64 = .{0} ** len,
+
+    /// Buffers of at least `min_size` bytes, rounded up to the endpoint's
+    /// max packet size.
+    pub fn start(self: *TransferPool, dev: *DeviceHandle, endpoint: EndpointAddress, min_size: usize, timeout_ms: u32) UsbError!void {
+        errdefer self.deinit();
+        self.ctx = dev.ctx.raw;
+        self.handle = dev.raw;
+        const mps = libusb.libusb_get_max_packet_size(libusb.libusb_get_device(dev.raw), endpoint.toRaw());
+        try checkResult(mps);
+        const packet: usize = @intCast(@max(mps, 1));
+        const size = (min_size + packet - 1) / packet * packet;
+        try ensureLenFitsCInt(size);
+
+        // all from the kernel or none, deinit frees them one way
+        self.dev_mem = true;
+        for (&self.bufs) |*b| {
+            const p = libusb.libusb_dev_mem_alloc(dev.raw, size);
+            if (p == null) break;
+            b.* = p[0..size];
+        }
+        if (self.bufs[len - 1].len == 0) {
+            self.freeBuffers();
+            self.dev_mem = false;
+            for (&self.bufs) |*b| b.* = std.heap.page_allocator.alloc(u8, size) catch return UsbError.NoMem;
+        }
+
+        for (&self.xfers, 0..) |*x, i| {
+            const xfer = libusb.libusb_alloc_transfer(0) orelse return UsbError.NoMem;
+            x.* = xfer;
+            xfer.*.dev_handle = dev.raw;
+            xfer.*.endpoint = endpoint.toRaw();
+            xfer.*.type = libusb.LIBUSB_TRANSFER_TYPE_BULK;
+            xfer.*.timeout = timeout_ms;
+            xfer.*.buffer = self.bufs[i].ptr;
+            xfer.*.length = 0;
+            xfer.*.callback = onComplete;
+            xfer.*.user_data = self;
+            self.free[i] = @intCast(i);
+        }
+        self.free_len = len;
+    }
+
+    /// A buffer to encode into, waiting for a completion if all of them are
+    /// in flight. Fails with the error of an earlier transfer once.
+    pub fn acquire(self: *TransferPool) UsbError!Buffer {
+        var waited: u32 = 0;
+        while (true) {
+            {
+                self.lock.lock();
+                defer self.lock.unlock();
+                if (self.failed) |err| {
+                    self.failed = null;
+                    return err;
+                }
+                if (self.free_len > 0) {
+                    self.free_len -= 1;
+                    const i = self.free[self.free_len];
+                    if (waited > 0) self.waits += 1;
+                    return .{ .index = i, .data = self.bufs[i] };
+                }
+            }
+            if (waited >= acquire_wait_us) return UsbError.Timeout;
+            try self.handleEvents(wait_step_us);
+            waited += wait_step_us;
+        }
+    }
+
+    /// Send the first `n` bytes of an acquired buffer. `origin_ns` is when
+    /// what it carries entered the pipeline, latency.now() time, 0 if it
+    /// isn't timed end to end.
+    pub fn submit(self: *TransferPool, b: Buffer, n: usize, origin_ns: u64) UsbError!void {
+        std.debug.assert(n <= b.data.len);
+        const xfer = self.xfers[b.index].?;
+        xfer.*.length = @intCast(n);
+        if (self.lat) |lat| {
+            self.origin_ns[b.index] = origin_ns;
+            self.submit_ns[b.index] = latency.now();
+            lat.highWater(&lat.in_flight_hwm, self.in_flight.load(.monotonic) + 1);
+        }
+        _ = self.in_flight.fetchAdd(1, .acq_rel);
+        const rc = libusb.libusb_submit_transfer(xfer);
+        if (rc < 0) {
+            _ = self.in_flight.fetchSub(1, .acq_rel);
+            self.release(b);
+            return mapLibusbError(rc);
+        }
+        self.lock.lock();
+        defer self.lock.unlock();
+        self.submitted += 1;
+    }
+
+    /// Give back a buffer that won't be submitted
+    pub fn release(self: *TransferPool, b: Buffer) void {
+        self.lock.lock();
+        defer self.lock.unlock();
+        self.free[self.free_len] = b.index;
+        self.free_len += 1;
+    }
+
+    /// Until nothing submitted is outstanding, or `timeout_us`
+    pub fn waitIdle(self: *TransferPool, timeout_us: u32) UsbError!void {
+        var waited: u32 = 0;
+        while (self.in_flight.load(.acquire) > 0) {
+            if (waited >= timeout_us) return UsbError.Timeout;
+            try self.handleEvents(wait_step_us);
+            waited += wait_step_us;
+        }
+    }
+
+    fn handleEvents(self: *TransferPool, timeout_us: u32) UsbError!void {
+        var tv: libusb.struct_timeval = .{ .tv_sec = 0, .tv_usec = @intCast(timeout_us) };
+        try checkResult(libusb.libusb_handle_events_timeout_completed(self.ctx, &tv, null));
+    }
+
+    fn onComplete(xfer: [*c]libusb.libusb_transfer) callconv(.C) void {
+        const self: *TransferPool = @ptrCast(@alignCast(xfer.*.user_data));
+        const err: ?UsbError = switch (xfer.*.status) {
+            libusb.LIBUSB_TRANSFER_COMPLETED => if (xfer.*.actual_length == xfer.*.length) null else UsbError.Io,
+            libusb.LIBUSB_TRANSFER_CANCELLED => null,
+            libusb.LIBUSB_TRANSFER_NO_DEVICE => UsbError.NoDevice,
+            libusb.LIBUSB_TRANSFER_TIMED_OUT => UsbError.Timeout,
+            libusb.LIBUSB_TRANSFER_STALL => UsbError.Pipe,
+            libusb.LIBUSB_TRANSFER_OVERFLOW => UsbError.Overflow,
+            else => UsbError.Io,
+        };
+        const done: ?*libusb.libusb_transfer = xfer;
+        self.lock.lock();
+        defer self.lock.unlock();
+        for (self.xfers, 0..) |x, i| {
+            if (x != done) continue;
+            self.free[self.free_len] = @intCast(i);
+            self.free_len += 1;
+            if (self.lat) |lat| {
+                if (err != null) {
+                    lat.count(&lat.transfer_errors, 1);
+                } else if (xfer.*.status == libusb.LIBUSB_TRANSFER_COMPLETED) {
+                    const t = latency.now();
+                    lat.record(.transfer, t -| self.submit_ns[i]);
+                    if (self.origin_ns[i] != 0) lat.record(.end_to_end, t -| self.origin_ns[i]);
+                }
+            }
+            break;
+        }
+        self.completed += 1;
+        if (err) |e| {
+            self.errors += 1;
+            if (self.failed == null) self.failed = e;
+        }
+        _ = self.in_flight.fetchSub(1, .acq_rel);
+    }
+
+    /// Cancels what is still in flight and waits for it before freeing
+    pub fn deinit(self: *TransferPool) void {
+        if (self.in_flight.load(.acquire) > 0) {
+            for (self.xfers) |x| {
+                if (x) |xfer| _ = libusb.libusb_cancel_transfer(xfer);
+            }
+            self.waitIdle(acquire_wait_us) catch {
+                std.log.err("OUT transfers still in flight, leaking them", .{});
+                return;
+            };
+        }
+        for (&self.xfers) |*x| {
+            if (x.*) |xfer| libusb.libusb_free_transfer(xfer);
+            x.* = null;
+        }
+        self.freeBuffers();
+        if (self.submitted > 0)
+            std.log.info("OUT pool: {} submitted, {} waits, {} errors", .{ self.submitted, self.waits, self.errors });
+        self.free_len = 0;
+        self.submitted = 0;
+        self.completed = 0;
+        self.waits = 0;
+        self.errors = 0;
+        self.failed = null;
+    }
+
+    fn freeBuffers(self: *TransferPool) void {
+        for (&self.bufs) |*b| {
+            if (b.len == 0) continue;
+            if (self.dev_mem)
+                _ = libusb.libusb_dev_mem_free(self.handle, b.ptr, b.len)
+            else
+                std.heap.page_allocator.free(b.*);
+            b.* = &.{};
+        }
+    }
+};
+
 fn ensureLenFitsCInt(len: usize) UsbError!void {
     if (len > @as(usize, std.math.maxInt(c_int))) {
         return UsbError.InvalidParam;